@@ -0,0 +1,446 @@
+﻿#pragma once
+#include "Metrics.h"
+#include "Telemetry.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// AdmissionControl - decides when a generation may be sent to the daemon, per model and priority class
+// Each class has a token bucket (requests per second with a burst) and a concurrency limit per model. A request
+// that does not fit waits in its class's queue; one that finds the queue full is rejected rather than piling
+// up. Interactive requests are dispatched before any queued batch request of the same model, and batch requests
+// only get the slots the batch limit allows, so a flood of batch work cannot keep a person waiting.
+class AdmissionControl {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef uint64_t Ticket;
+
+    // Priority - class of a request: a person waiting on it, or work that can wait (model comparisons)
+    enum Priority { Interactive, Batch, PriorityCount };
+
+    // Limits - of one class, 0 = unlimited
+    struct Limits {
+        int maxConcurrent;    // running per model; the interactive one caps the model, batch requests count against it too
+        double ratePerSecond; // requests started per model
+        int burst;            // started at once after a quiet period, at least 1
+        int maxQueued;        // waiting per model, more are rejected
+    };
+
+    // Row - one model of the admission table
+    struct Row {
+        std::string model;
+        int running[PriorityCount] = {};
+        int queued[PriorityCount] = {};
+        double tokens[PriorityCount] = {}; // left in the bucket, the burst when the class has no rate limit
+    };
+
+    // Counts - per class, for the admission window
+    struct Counts {
+        uint64_t admitted = 0;
+        uint64_t rejected = 0;
+        uint64_t queued = 0;            // had to wait
+        double queueP50Seconds = 0.0;   // of the requests that waited
+        double queueP99Seconds = 0.0;
+    };
+
+    static const char* name(Priority priority) { return priority == Interactive ? "interactive" : "batch"; }
+
+    static Limits limits(Priority priority) {
+        AdmissionControl& control = instance();
+        std::lock_guard<std::mutex> lock(control.mutex);
+        return control.classes[priority].limits;
+    }
+
+    // setLimits() - applies at once, queued requests that fit now start
+    static void setLimits(Priority priority, const Limits& value) {
+        AdmissionControl& control = instance();
+        std::vector<std::pair<Ticket, std::function<void(Ticket)>>> starts;
+        {
+            std::lock_guard<std::mutex> lock(control.mutex);
+            control.classes[priority].limits = sanitize(value);
+            control.dispatch(Clock::now(), starts);
+        }
+        run(starts);
+    }
+
+    // admit() - starts the request at once if its model and class have room, queues it otherwise;
+    // reject gets the limit that held it back when the queue is full, start is called with the returned
+    // ticket (maybe before admit() returns), hand that to release() once the request ended
+    static Ticket admit(const std::string& model, Priority priority, const std::function<void(Ticket)>& start,
+                        const std::function<void(const std::string&)>& reject) {
+        AdmissionControl& control = instance();
+        Class& type = control.classes[priority];
+        const char* blocked;
+        Ticket ticket;
+        {
+            std::lock_guard<std::mutex> lock(control.mutex);
+            ticket = ++control.lastTicket;
+            Model& state = control.models[model];
+            Clock::time_point now = Clock::now();
+            blocked = control.blocker(state, priority, now);
+            if (blocked == nullptr && !state.queues[priority].empty()) {
+                blocked = "queue"; // the dispatcher has not caught up yet, keep the order
+            }
+            if (blocked == nullptr) {
+                control.take(state, priority);
+                control.running[ticket] = std::make_pair(model, priority);
+            }
+            else if (type.limits.maxQueued == 0 || (int)state.queues[priority].size() < type.limits.maxQueued) {
+                Waiting waiting;
+                waiting.ticket = ticket;
+                waiting.since = now;
+                waiting.start = start;
+                waiting.reject = reject;
+                state.queues[priority].push_back(std::move(waiting));
+                type.queuedGauge.add(1);
+                control.startDispatcher();
+                control.wakeup.notify_one();
+                return ticket;
+            }
+        }
+        if (blocked != nullptr) {
+            type.rejected.add();
+            MetricsRegistry::counter("model_app_admission_rejected_total", "Requests rejected because their class's queue was full, by the limit that held them back.",
+                MetricsRegistry::label("model", model) + "," + MetricsRegistry::label("priority", name(priority)) + "," + MetricsRegistry::label("limit", blocked)).add();
+            Trace::instant("admission rejected", model + " (" + name(priority) + ", " + blocked + ")");
+            reject(std::string(name(priority)) + " queue full, " + blocked + " limit");
+            return 0;
+        }
+        type.admitted.add();
+        type.queueTime.record(0);
+        start(ticket);
+        return ticket;
+    }
+
+    // withdraw() - drops a queued request without calling start or reject, false if it is not waiting (started, ended)
+    // its callbacks are destroyed on the admission thread, whatever that releases must not run under the caller's locks
+    static bool withdraw(Ticket ticket) {
+        AdmissionControl& control = instance();
+        std::lock_guard<std::mutex> lock(control.mutex);
+        for (auto& entry : control.models) {
+            for (int priority = 0; priority < PriorityCount; ++priority) {
+                std::deque<Waiting>& queue = entry.second.queues[priority];
+                for (auto waiting = queue.begin(); waiting != queue.end(); ++waiting) {
+                    if (waiting->ticket == ticket) {
+                        control.dropped.push_back(std::move(*waiting));
+                        queue.erase(waiting);
+                        control.classes[priority].queuedGauge.add(-1);
+                        control.wakeup.notify_one();
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    // promote() - an interactive request joined a queued batch one, it moves to the back of the interactive queue
+    static void promote(Ticket ticket) {
+        AdmissionControl& control = instance();
+        std::vector<std::pair<Ticket, std::function<void(Ticket)>>> starts;
+        {
+            std::lock_guard<std::mutex> lock(control.mutex);
+            bool moved = false;
+            for (auto entry = control.models.begin(); entry != control.models.end() && !moved; ++entry) {
+                std::deque<Waiting>& batch = entry->second.queues[Batch];
+                for (auto waiting = batch.begin(); waiting != batch.end(); ++waiting) {
+                    if (waiting->ticket == ticket) {
+                        entry->second.queues[Interactive].push_back(std::move(*waiting));
+                        batch.erase(waiting);
+                        control.classes[Batch].queuedGauge.add(-1);
+                        control.classes[Interactive].queuedGauge.add(1);
+                        moved = true;
+                        break;
+                    }
+                }
+            }
+            if (!moved) {
+                return;
+            }
+            control.dispatch(Clock::now(), starts);
+        }
+        run(starts);
+    }
+
+    // release() - a started request ended, its slot goes to the next queued one; unknown tickets are ignored
+    static void release(Ticket ticket) {
+        AdmissionControl& control = instance();
+        std::vector<std::pair<Ticket, std::function<void(Ticket)>>> starts;
+        {
+            std::lock_guard<std::mutex> lock(control.mutex);
+            auto found = control.running.find(ticket);
+            if (found == control.running.end()) {
+                return;
+            }
+            control.models[found->second.first].running[found->second.second]--;
+            control.classes[found->second.second].runningGauge.add(-1);
+            control.running.erase(found);
+            control.dispatch(Clock::now(), starts);
+        }
+        run(starts);
+    }
+
+    // shutdown() - ends the admission thread and waits for it, requests still queued are never started;
+    // see App::Shutdown()
+    static void shutdown() {
+        AdmissionControl& control = instance();
+        {
+            std::lock_guard<std::mutex> lock(control.mutex);
+            control.stopping = true;
+            control.dispatching = true; // not started again
+        }
+        control.wakeup.notify_all();
+        if (control.dispatcher.joinable()) {
+            control.dispatcher.join();
+        }
+    }
+
+    // snapshot() - every model that was sent a request
+    static std::vector<Row> snapshot() {
+        AdmissionControl& control = instance();
+        std::lock_guard<std::mutex> lock(control.mutex);
+        Clock::time_point now = Clock::now();
+        std::vector<Row> rows;
+        for (auto& entry : control.models) {
+            Row row;
+            row.model = entry.first;
+            for (int priority = 0; priority < PriorityCount; ++priority) {
+                control.refill(entry.second, (Priority)priority, now);
+                row.running[priority] = entry.second.running[priority];
+                row.queued[priority] = (int)entry.second.queues[priority].size();
+                row.tokens[priority] = entry.second.tokens[priority];
+            }
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+    static Counts counts(Priority priority) {
+        Class& type = instance().classes[priority];
+        Counts counts;
+        counts.admitted = type.admitted.get();
+        counts.rejected = type.rejected.get();
+        counts.queued = type.waited.get();
+        counts.queueP50Seconds = type.queueTime.percentile(0.5) / 1e6;
+        counts.queueP99Seconds = type.queueTime.percentile(0.99) / 1e6;
+        return counts;
+    }
+
+private:
+    // Waiting - a queued request
+    struct Waiting {
+        Ticket ticket = 0;
+        Clock::time_point since;
+        std::function<void(Ticket)> start;
+        std::function<void(const std::string&)> reject;
+    };
+
+    // Model - admission state of one model, guarded by the mutex
+    struct Model {
+        int running[PriorityCount] = {};
+        double tokens[PriorityCount] = { -1.0, -1.0 }; // -1 = full, set on first use
+        Clock::time_point refilled[PriorityCount];
+        std::deque<Waiting> queues[PriorityCount];
+    };
+
+    // Class - limits and metrics of a priority class
+    struct Class {
+        Limits limits;
+        Counter& admitted;
+        Counter rejected; // exported per model and limit, see admit()
+        Counter& waited;
+        Gauge& queuedGauge;
+        Gauge& runningGauge;
+        Histogram queueTime; // microseconds from admit() to start, 0 for requests that did not wait
+
+        Class(Priority priority, const Limits& defaults)
+            : limits(defaults),
+              admitted(MetricsRegistry::counter("model_app_admission_admitted_total", "Requests admitted to the daemon.", MetricsRegistry::label("priority", name(priority)))),
+              waited(MetricsRegistry::counter("model_app_admission_queued_total", "Requests that had to wait for a rate or concurrency limit.", MetricsRegistry::label("priority", name(priority)))),
+              queuedGauge(MetricsRegistry::gauge("model_app_admission_queue_depth", "Requests waiting for admission.", MetricsRegistry::label("priority", name(priority)))),
+              runningGauge(MetricsRegistry::gauge("model_app_admission_running", "Admitted requests still running.", MetricsRegistry::label("priority", name(priority)))) {}
+    };
+
+    std::mutex mutex;
+    std::condition_variable wakeup; // a request was queued or the limits changed
+    Class classes[PriorityCount];
+    std::map<std::string, Model> models;
+    std::map<Ticket, std::pair<std::string, Priority>> running;
+    std::vector<Waiting> dropped; // withdrawn, destroyed by the admission thread
+    Ticket lastTicket = 0;
+    bool dispatching = false;
+    bool stopping = false;  // shutdown() was called
+    std::thread dispatcher; // the admission thread, see startDispatcher()
+
+    AdmissionControl()
+        : classes{ { Interactive, environmentLimits("MODEL_APP_INTERACTIVE_LIMITS", 4, 0.0, 1, 32) },
+                   { Batch, environmentLimits("MODEL_APP_BATCH_LIMITS", 2, 1.0, 2, 256) } } {
+        MetricsRegistry::collector([this](std::string& out) {
+            MetricsRegistry::writeFamily(out, "model_app_admission_queue_seconds", "Time from submission to admission.", "histogram");
+            for (int priority = 0; priority < PriorityCount; ++priority) {
+                MetricsRegistry::writeHistogram(out, "model_app_admission_queue_seconds", MetricsRegistry::label("priority", name((Priority)priority)), classes[priority].queueTime);
+            }
+        });
+    }
+
+    // instance() - never destroyed, requests release their slots from the HTTP loop and pool threads
+    static AdmissionControl& instance() {
+        static AdmissionControl* control = new AdmissionControl();
+        return *control;
+    }
+
+    // environmentLimits() - "concurrency,rate,burst,queue" from name, the defaults for missing fields
+    static Limits environmentLimits(const char* variable, int concurrent, double rate, int burst, int queued) {
+        Limits limits = { concurrent, rate, burst, queued };
+        std::string text = MetricsExporter::environment(variable);
+        std::vector<std::string> fields;
+        for (size_t start = 0; !text.empty() && start <= text.length(); ) {
+            size_t comma = std::min(text.find(',', start), text.length());
+            fields.push_back(text.substr(start, comma - start));
+            start = comma + 1;
+        }
+        if (fields.size() > 0 && !fields[0].empty()) limits.maxConcurrent = std::atoi(fields[0].c_str());
+        if (fields.size() > 1 && !fields[1].empty()) limits.ratePerSecond = std::atof(fields[1].c_str());
+        if (fields.size() > 2 && !fields[2].empty()) limits.burst = std::atoi(fields[2].c_str());
+        if (fields.size() > 3 && !fields[3].empty()) limits.maxQueued = std::atoi(fields[3].c_str());
+        return sanitize(limits);
+    }
+
+    static Limits sanitize(Limits limits) {
+        limits.maxConcurrent = std::max(0, limits.maxConcurrent);
+        limits.ratePerSecond = std::max(0.0, limits.ratePerSecond);
+        limits.burst = std::max(1, limits.burst);
+        limits.maxQueued = std::max(0, limits.maxQueued);
+        return limits;
+    }
+
+    // refill() - adds the tokens earned since the last refill, mutex held
+    void refill(Model& state, Priority priority, Clock::time_point now) {
+        const Limits& limits = classes[priority].limits;
+        if (state.tokens[priority] < 0.0 || limits.ratePerSecond <= 0.0) {
+            state.tokens[priority] = limits.burst;
+        }
+        else {
+            double earned = std::chrono::duration<double>(now - state.refilled[priority]).count() * limits.ratePerSecond;
+            state.tokens[priority] = std::min<double>(limits.burst, state.tokens[priority] + earned);
+        }
+        state.refilled[priority] = now;
+    }
+
+    // blocker() - the limit keeping a request of priority from starting now ("concurrency", "rate", "interactive first"),
+    // nullptr if it may start; mutex held
+    const char* blocker(Model& state, Priority priority, Clock::time_point now) {
+        const Limits& model = classes[Interactive].limits;
+        const Limits& own = classes[priority].limits;
+        if (model.maxConcurrent > 0 && state.running[Interactive] + state.running[Batch] >= model.maxConcurrent) {
+            return "concurrency";
+        }
+        if (priority == Batch) {
+            if (own.maxConcurrent > 0 && state.running[Batch] >= own.maxConcurrent) {
+                return "concurrency";
+            }
+            if (!state.queues[Interactive].empty()) {
+                return "interactive first";
+            }
+        }
+        refill(state, priority, now);
+        if (own.ratePerSecond > 0.0 && state.tokens[priority] < 1.0) {
+            return "rate";
+        }
+        return nullptr;
+    }
+
+    // take() - counts a request of priority as running and spends its token, mutex held
+    void take(Model& state, Priority priority) {
+        state.running[priority]++;
+        if (classes[priority].limits.ratePerSecond > 0.0) {
+            state.tokens[priority] -= 1.0;
+        }
+        classes[priority].runningGauge.add(1);
+    }
+
+    // dispatch() - starts every queued request that fits now, interactive ones first; collects the starts
+    // for run() and returns when the next rate-limited one may go (max if none waits for tokens), waking the
+    // admission thread to sleep until then; mutex held
+    Clock::time_point dispatch(Clock::time_point now, std::vector<std::pair<Ticket, std::function<void(Ticket)>>>& starts) {
+        Clock::time_point next = Clock::time_point::max();
+        for (auto& entry : models) {
+            Model& state = entry.second;
+            for (int priority = 0; priority < PriorityCount; ++priority) {
+                std::deque<Waiting>& queue = state.queues[priority];
+                Class& type = classes[priority];
+                const char* blocked = nullptr;
+                while (!queue.empty() && (blocked = blocker(state, (Priority)priority, now)) == nullptr) {
+                    Waiting& waiting = queue.front();
+                    take(state, (Priority)priority);
+                    running[waiting.ticket] = std::make_pair(entry.first, (Priority)priority);
+                    type.admitted.add();
+                    type.waited.add();
+                    type.queuedGauge.add(-1);
+                    type.queueTime.record(Telemetry::toMicros(std::chrono::duration<double>(now - waiting.since).count()));
+                    starts.push_back(std::make_pair(waiting.ticket, std::move(waiting.start)));
+                    queue.pop_front();
+                }
+                if (blocked != nullptr && std::string(blocked) == "rate") {
+                    double seconds = (1.0 - state.tokens[priority]) / type.limits.ratePerSecond;
+                    next = std::min(next, now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)));
+                }
+            }
+        }
+        if (next != Clock::time_point::max()) {
+            wakeup.notify_one();
+        }
+        return next;
+    }
+
+    // run() - calls the starts dispatch() collected, outside the mutex
+    static void run(std::vector<std::pair<Ticket, std::function<void(Ticket)>>>& starts) {
+        for (auto& start : starts) {
+            start.second(start.first);
+        }
+    }
+
+    // startDispatcher() - starts the thread that admits rate-limited requests as their tokens come in and drops
+    // withdrawn ones, mutex held
+    void startDispatcher() {
+        if (dispatching) {
+            return;
+        }
+        dispatching = true;
+        dispatcher = std::thread([this]() {
+            Trace::setThreadName("Admission");
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                std::vector<std::pair<Ticket, std::function<void(Ticket)>>> starts;
+                std::vector<Waiting> withdrawn;
+                withdrawn.swap(dropped);
+                Clock::time_point next = dispatch(Clock::now(), starts);
+                if (!starts.empty() || !withdrawn.empty()) {
+                    lock.unlock();
+                    run(starts);
+                    withdrawn.clear();
+                    lock.lock();
+                    continue;
+                }
+                if (next == Clock::time_point::max()) {
+                    wakeup.wait(lock);
+                }
+                else {
+                    wakeup.wait_until(lock, next);
+                }
+            }
+        });
+    }
+};
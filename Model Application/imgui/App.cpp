@@ -1,55 +1,62 @@
 ﻿#include "imgui.h"
 #include "App.h"
 #include "ModelClient.cpp"
-
-std::vector<std::string> get_ollama_model_names() {
-    std::vector<std::string> model_names;
-
-    // Temporary file to store ollama list output
-    const char* temp_file = "ollama_list_output.txt";
-
-    // Run ollama list and redirect output to a file
-    std::string command = "ollama list > " + std::string(temp_file);
-    int result = std::system(command.c_str());
-    if (result != 0) {
-        std::cerr << "Error: Failed to run ollama list command" << std::endl;
-        return model_names;
-    }
-
-    // Read the output from the temporary file
-    std::ifstream file(temp_file);
-    if (!file.is_open()) {
-        std::cerr << "Error: Failed to open temporary file" << std::endl;
-        return model_names;
+#include "ChatHistory.h"
+#include "GgufReader.h"
+#include "ModelStore.h"
+#include "MemoryEstimator.h"
+#include "StoreInspector.h"
+#include "ModelCatalog.h"
+#include "PullManager.h"
+
+// Reads the 'Model' section straight from the GGUF header of the model's blob, empty if the blob is not local
+// Only the header pages are touched through the mapping, so this is quick even for multi-gigabyte models.
+std::string get_gguf_model_info(const std::string& model_name) {
+    TRACE_SCOPE_DETAIL("get_gguf_model_info", model_name);
+    std::string blob = ModelStore::ModelBlobPath(model_name);
+    GgufInfo info;
+    std::string error;
+    if (blob.empty() || !GgufReader::parseFile(blob, info, error)) {
+        if (!blob.empty()) {
+            std::cerr << "Error: Failed to read GGUF header of " << model_name << ": " << error << std::endl;
+        }
+        return "";
     }
 
-    // Parse the file line by line
-    std::string line;
-    bool first_line = true; // Skip the header line
-    while (std::getline(file, line)) { // Use std::ifstream with std::getline
-        if (first_line) {
-            first_line = false; // Skip the table header
-            continue;
-        }
-        // Extract the first column (model name)
-        std::istringstream ss(line); // Use std::istringstream for parsing the line
-        std::string model_name;
-        ss >> model_name; // Read the first word (model name)
-        if (!model_name.empty()) {
-            model_names.push_back(model_name);
+    // Same layout as the 'Model' section of ollama show
+    std::string result;
+    auto add_line = [&result](const std::string& name, const std::string& value) {
+        if (value.empty() || value == "0") {
+            return;
         }
+        char line[128];
+        snprintf(line, sizeof(line), "%-20s%s", name.c_str(), value.c_str());
+        result += result.empty() ? line : "\n" + std::string(line);
+    };
+    add_line("architecture", info.architecture());
+    add_line("parameters", GgufReader::formatParameters(info.parameterCount));
+    add_line("context length", std::to_string(info.archNumber("context_length")));
+    add_line("embedding length", std::to_string(info.archNumber("embedding_length")));
+    add_line("layers", std::to_string(info.archNumber("block_count")));
+    add_line("attention heads", std::to_string(info.archNumber("attention.head_count")));
+    add_line("kv heads", std::to_string(info.archNumber("attention.head_count_kv")));
+    if (info.find("general.file_type") != nullptr) {
+        add_line("quantization", GgufReader::fileTypeName(info.number("general.file_type")));
     }
-
-    file.close();
-
-    // Clean up the temporary file
-    std::remove(temp_file);
-
-    return model_names;
+    const GgufValue* tokens = info.find("tokenizer.ggml.tokens");
+    std::string tokenizer = info.text("tokenizer.ggml.model");
+    if (!tokenizer.empty() && tokens != nullptr) {
+        tokenizer += " (" + std::to_string(tokens->arrayCount) + " tokens)";
+    }
+    add_line("tokenizer", tokenizer);
+    return result;
 }
 
 std::string get_ollama_model_info(const std::string& model_name) {
-    std::string result;
+    std::string result = get_gguf_model_info(model_name);
+    if (!result.empty()) {
+        return result;
+    }
 
     // Temporary file to store ollama show output
     const char* temp_file = "ollama_show_output.txt";
@@ -123,14 +130,151 @@ std::string get_ollama_model_info(const std::string& model_name) {
 // App Namespace for imgui implementation
 namespace App {
 
+    // HistoryLoad - a saved chat read on the "history" pool group, applied to its tab once done
+    struct HistoryLoad {
+        std::atomic<bool> done{ false };
+        Conversation conversation;
+    };
+
+    // CatalogLoad - `ollama list` read on the "catalog" pool group at startup and after a pull
+    struct CatalogLoad {
+        std::atomic<bool> done{ false };
+        std::vector<ModelCatalog::Entry> entries;
+    };
+
+    // ModelInfoLoad - the 'Model' section of one model, read on the "catalog" pool group
+    struct ModelInfoLoad {
+        std::atomic<bool> done{ false };
+        std::string model;
+        std::string text;
+    };
+
+    // ChatTab - one conversation, owns its client, messages and generation worker
+    struct ChatTab {
+        int id;                                 // unique id, keeps ImGui tab labels stable
+        int selected = 0;                       // selected model index
+        ModelClient client;                     // client of this conversation
+        Conversation conversation;              // prompts and responses, in order
+        bool synced = true;                     // has the last response seen the client's final output?
+        std::shared_ptr<HistoryLoad> pendingLoad; // saved chat being read in the background
+
+        ChatTab(int id, int selected, const std::string& modelName) : id(id), selected(selected), client(modelName) {}
+    };
+
     // Declarations
-    static std::vector<std::string> model_names = get_ollama_model_names(); // added model names
-    static int selected = 0;                                                // selected model index
-    ModelClient client(model_names[selected]);                              // inital client
-    std::vector<std::string> outputVector;                                  // holds outputs
-    std::vector<std::string> inputVector;                                   // holds inputs
-    std::string model_info = get_ollama_model_info(model_names[selected]);  // holds current model info
+    static std::vector<ModelCatalog::Entry> catalog;                        // installed models, filled by UpdateCatalog()
+    static std::vector<std::string> model_names;                            // added model names
+    ModelCatalog::View catalogView;                                         // filtered/sorted rows of the model table
+    static char catalogFilter[64] = "";                                     // model table search text
+    std::vector<std::unique_ptr<ChatTab>> tabs;                             // open conversations
+    size_t activeTab = 0;                                                   // tab shown in the output window
+    int nextTabId = 1;                                                      // id for the next opened tab
+    std::string model_info;                                                 // holds current model info
+    std::string model_info_model;                                           // model whose info should be shown
+    std::string model_info_shown;                                           // model that model_info describes
+    std::shared_ptr<ModelInfoLoad> pendingInfo;                             // model info being read in the background
     bool showConsole = false;                                               // show console with output?
+    bool showStatsWindow = false;                                           // show generation stats window?
+    bool showMetricsWindow = false;                                         // show metrics export window?
+    bool showCacheWindow = false;                                           // show response cache window?
+    bool showResidencyWindow = false;                                       // show model residency window?
+    bool showEndpointsWindow = false;                                       // show endpoints window?
+    bool showAdmissionWindow = false;                                       // show admission window?
+    bool showContextWindow = false;                                         // show context planner window?
+    bool showStoreWindow = false;                                           // show model store window?
+    bool showPullsWindow = false;                                           // show model pulls window?
+    int catalogPulls = -1;                                                  // PullManager::completedPulls() the catalog reflects, -1 = not loaded
+    std::shared_ptr<CatalogLoad> pendingCatalog;                            // catalog refresh running in the background
+    std::mutex historyMutex;                                                // guards historyFiles
+    std::vector<int> historyFiles;                                          // saved chat numbers, listed on the pool
+    int plannedContext = 8192;                                              // num_ctx checked before sending
+    int plannedBatch = 512;                                                 // num_batch of the runner
+    int plannedParallel = 1;                                                // OLLAMA_NUM_PARALLEL slots
+    int plannedCacheType = MemoryEstimator::F16;                            // OLLAMA_KV_CACHE_TYPE
+    float plannedBudgetGigabytes = 0.0f;                                    // memory for one model, 0 = available RAM
+    static bool metricsStarted = MetricsExporter::startFromEnvironment();   // MODEL_APP_METRICS_* export, see Metrics.h
+    static bool traceStarted = []() {                                       // MODEL_APP_TRACE records from startup, see Trace.h
+        Trace::setEnabled(!MetricsExporter::environment("MODEL_APP_TRACE").empty());
+        return true;
+    }();
+    static bool cacheStarted = []() {                                       // MODEL_APP_CACHE turns the response cache on
+        ResponseCache::setEnabled(!MetricsExporter::environment("MODEL_APP_CACHE").empty());
+        return true;
+    }();
+    static bool pullsStarted = []() {                                       // resumes pulls left unfinished last time
+        PullManager::resumePending();
+        return true;
+    }();
+    static bool historyListed = []() {                                      // saved chats are listed off the UI thread
+        ThreadPool::group("history").submit(RefreshHistoryList);
+        return true;
+    }();
+    bool compareMode = false;                                               // send prompts to several models at once?
+    std::vector<bool> compareSelected(model_names.size(), false);          // models picked for compare mode
+    std::vector<std::unique_ptr<ModelClient>> compareClients;              // one client per compared model
+    std::string comparePrompt;                                              // prompt of the current comparison
+
+    // OpenTab() - opens a new conversation using the given model index
+    void OpenTab(int selected) {
+        tabs.push_back(std::unique_ptr<ChatTab>(new ChatTab(nextTabId++, selected, model_names.empty() ? "" : model_names[selected])));
+        activeTab = tabs.size() - 1;
+    }
+
+    // ActiveTab() - conversation shown in the output window
+    ChatTab& ActiveTab() {
+        if (tabs.empty()) {
+            OpenTab(0);
+        }
+        return *tabs[activeTab];
+    }
+
+    // SyncTab() - appends newly streamed output to the tab's last message
+    // only the active tab syncs every frame, background tabs catch up when shown; a frame without new text copies nothing,
+    // and the arena never moves what it already holds
+    void SyncTab(ChatTab& tab) {
+        if (tab.pendingLoad && tab.pendingLoad->done) {
+            tab.conversation = std::move(tab.pendingLoad->conversation);
+            tab.pendingLoad.reset();
+            tab.synced = true;
+        }
+        if (tab.synced || tab.conversation.empty()) {
+            return;
+        }
+        bool finished = !tab.client.running; // read before the copy so the last chunk is not missed
+        size_t last = tab.conversation.size() - 1;
+        tab.conversation.append(last, tab.client.getOutputFrom(tab.conversation[last].length));
+        if (finished) {
+            GenerationStats stats = tab.client.getStats();
+            tab.conversation.setTokens(last, stats.evalCount);
+            tab.conversation.setDuration(last, stats.wallTime);
+            if (last > 0 && tab.conversation[last - 1].role == Conversation::User) {
+                tab.conversation.setTokens(last - 1, stats.promptEvalCount);
+            }
+        }
+        tab.synced = finished;
+    }
+
+    // FormatMicros() - microseconds as a short human readable duration
+    std::string FormatMicros(uint64_t micros) {
+        char text[32];
+        if (micros >= 1000000) {
+            snprintf(text, sizeof(text), "%.2f s", micros / 1e6);
+        }
+        else {
+            snprintf(text, sizeof(text), "%.1f ms", micros / 1e3);
+        }
+        return text;
+    }
+
+    // IsCompareRunning() - is any compared model still generating?
+    bool IsCompareRunning() {
+        for (const auto& compareClient : compareClients) {
+            if (compareClient->running) {
+                return true;
+            }
+        }
+        return false;
+    }
 
     // Renders Main Header - called by RenderApplicationWindow()
     void RenderApplicationHeader() {
@@ -147,6 +291,54 @@ namespace App {
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 2);
         ImGui::Text("  Model Application");
 
+        // tools menu, opens the tool windows
+        ImGui::SameLine(ImGui::GetWindowWidth() - 125);
+        ImGui::SetCursorPosY(ImGui::GetCursorPosY() - 3);
+        if (ImGui::Button("Tools")) {
+            ImGui::OpenPopup("ToolsPopup");
+        }
+        if (ImGui::BeginPopup("ToolsPopup")) {
+            ImGui::MenuItem("Generation Stats", nullptr, &showStatsWindow);
+            ImGui::MenuItem("Metrics Export", nullptr, &showMetricsWindow);
+            ImGui::MenuItem("Response Cache", nullptr, &showCacheWindow);
+            ImGui::MenuItem("Model Residency", nullptr, &showResidencyWindow);
+            ImGui::MenuItem("Endpoints", nullptr, &showEndpointsWindow);
+            ImGui::MenuItem("Admission", nullptr, &showAdmissionWindow);
+            ImGui::MenuItem("Context Planner", nullptr, &showContextWindow);
+            ImGui::MenuItem("Model Pulls", nullptr, &showPullsWindow);
+            if (ImGui::MenuItem("Model Store", nullptr, &showStoreWindow) && showStoreWindow) {
+                StoreInspector::startScan();
+            }
+            ImGui::Separator();
+            bool http = ModelClient::transport() == ModelClient::Http;
+            if (ImGui::MenuItem("Stream over HTTP API", nullptr, &http)) {
+                ModelClient::setTransport(http ? ModelClient::Http : ModelClient::Cli); // applies to the next prompt
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Generations go to the ollama daemon over HTTP on one I/O thread (%d open)\ninstead of an `ollama run` process and a thread each", (int)HttpLoop::active());
+            }
+            int publishInterval = ModelClient::publishInterval();
+            ImGui::SetNextItemWidth(100);
+            if (ImGui::InputInt("Output interval (ms)", &publishInterval, 8, 50)) {
+                ModelClient::setPublishInterval(publishInterval);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Streamed text is handed to the UI at most this often, tokens in between are batched\nand go out when the interval runs out; 0 = every chunk");
+            }
+            ImGui::Separator();
+            bool tracing = Trace::enabled();
+            if (ImGui::MenuItem("Record Trace", nullptr, &tracing)) {
+                Trace::setEnabled(tracing);
+            }
+            if (ImGui::MenuItem("Save Trace (trace.json)", nullptr, false, Trace::eventCount() > 0)) {
+                Trace::dump("trace.json"); // open in chrome://tracing or ui.perfetto.dev
+            }
+            if (ImGui::MenuItem("Clear Trace", nullptr, false, Trace::eventCount() > 0)) {
+                Trace::clear();
+            }
+            ImGui::EndPopup();
+        }
+
         // minimize and close buttons, aligned to the right
         ImGui::SameLine(ImGui::GetWindowWidth() - 65);
         ImGui::SetCursorPosY(ImGui::GetCursorPosY() - 3);
@@ -178,26 +370,100 @@ namespace App {
 
         ImGui::SetCursorPosX(10);
         static char new_model_name[64] = "";
+        ChatTab& tab = ActiveTab();
+        bool busy = tab.client.running || IsCompareRunning(); // sampled once so Begin/EndDisabled stay paired
+
+        // combo preview, compare mode lists how many models are picked
+        std::string preview = model_names.empty() ? "No Models" : model_names[tab.selected];
+        if (compareMode) {
+            preview = std::to_string(std::count(compareSelected.begin(), compareSelected.end(), true)) + " models selected";
+        }
 
         // "Select Model" dropdown
-        if (client.running) {
+        if (busy) {
             ImGui::BeginDisabled();
         }
         ImGui::SetNextItemWidth(465.0f);
-        if (ImGui::BeginCombo("Select Model", model_names.empty() ? "No Models" : model_names[selected].c_str())) {
-            
-            // list of models
-            for (int i = 0; i < model_names.size(); i++) {
-                bool is_selected = (selected == i);
-                
-                if (ImGui::Selectable(model_names[i].c_str(), is_selected)) {
-                    selected = i;
-                    client.setModel(model_names[selected]); // set model
-                    model_info = get_ollama_model_info(model_names[selected]); // retrieve model info
+        if (ImGui::BeginCombo("Select Model", preview.c_str(), ImGuiComboFlags_HeightLargest)) {
+
+            // search field
+            if (ImGui::IsWindowAppearing()) {
+                ImGui::SetKeyboardFocusHere();
+            }
+            ImGui::SetNextItemWidth(300.0f);
+            ImGui::InputTextWithHint("##CatalogFilter", "Search models", catalogFilter, IM_ARRAYSIZE(catalogFilter));
+            ImGui::SameLine();
+            ImGui::TextDisabled("%d of %d", (int)catalogView.order().size(), (int)catalog.size());
+
+            // table of models - sorted on precomputed keys when the sort or filter changes, clipped to the visible rows
+            ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit
+                                  | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Sortable;
+            if (ImGui::BeginTable("ModelTable", 6, flags, ImVec2(680.0f, 300.0f))) {
+                ImGui::TableSetupScrollFreeze(0, 1);
+                ImGui::TableSetupColumn("Model", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_WidthStretch, 0.0f, ModelCatalog::View::Name);
+                ImGui::TableSetupColumn("Size", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, ModelCatalog::View::Size);
+                ImGui::TableSetupColumn("Modified", ImGuiTableColumnFlags_PreferSortDescending, 0.0f, ModelCatalog::View::Modified);
+                ImGui::TableSetupColumn("Family", 0, 0.0f, ModelCatalog::View::Family);
+                ImGui::TableSetupColumn("ID", 0, 0.0f, ModelCatalog::View::Digest);
+                ImGui::TableSetupColumn("State", ImGuiTableColumnFlags_NoSort);
+                ImGui::TableHeadersRow();
+
+                ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs();
+                int sortColumn = ModelCatalog::View::Name;
+                bool ascending = true;
+                if (sortSpecs != nullptr && sortSpecs->SpecsCount > 0) {
+                    sortColumn = (int)sortSpecs->Specs[0].ColumnUserID;
+                    ascending = sortSpecs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+                    sortSpecs->SpecsDirty = false;
                 }
-                if (is_selected) {
-                    ImGui::SetItemDefaultFocus();
+                catalogView.update(catalog, catalogFilter, sortColumn, ascending);
+
+                const std::vector<int>& rows = catalogView.order();
+                int64_t now = (int64_t)time(nullptr);
+                ImGuiListClipper clipper;
+                clipper.Begin((int)rows.size());
+                while (clipper.Step()) {
+                    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row) {
+                        int i = rows[row];
+                        const ModelCatalog::Entry& entry = catalog[i];
+                        ImGui::TableNextRow();
+                        ImGui::TableNextColumn();
+                        ImGui::PushID(i);
+
+                        // compare mode - toggle models in/out of the comparison
+                        if (compareMode) {
+                            if (ImGui::Selectable(entry.name.c_str(), compareSelected[i], ImGuiSelectableFlags_SpanAllColumns | ImGuiSelectableFlags_DontClosePopups)) {
+                                compareSelected[i] = !compareSelected[i];
+                            }
+                        }
+                        else {
+                            bool is_selected = (tab.selected == i);
+                            if (ImGui::Selectable(entry.name.c_str(), is_selected, ImGuiSelectableFlags_SpanAllColumns)) {
+                                tab.selected = i;
+                                tab.client.setModel(model_names[tab.selected]); // set model
+                                if (ModelResidency::preloadOnSelect()) {
+                                    ModelResidency::preload(model_names[tab.selected]); // load while the prompt is being typed
+                                }
+                                if (ResponseCache::enabled()) {
+                                    ResponseCache::prepare(model_names[tab.selected]); // so the first prompt can hit
+                                }
+                                model_info_model = model_names[tab.selected]; // info is read by UpdateCatalog()
+                            }
+                            if (is_selected) {
+                                ImGui::SetItemDefaultFocus();
+                            }
+                        }
+                        ImGui::PopID();
+
+                        ImGui::TableNextColumn();
+                        if (entry.sizeBytes > 0) ImGui::Text("%.1f GB", entry.sizeBytes / 1e9); else ImGui::TextDisabled("-");
+                        ImGui::TableNextColumn(); ImGui::TextUnformatted(ModelCatalog::FormatAge(entry.modified, now).c_str());
+                        ImGui::TableNextColumn(); ImGui::TextUnformatted(entry.family.c_str());
+                        ImGui::TableNextColumn(); ImGui::TextUnformatted(entry.digest.c_str());
+                        ImGui::TableNextColumn(); RenderResidencyState(entry.name);
+                    }
                 }
+                ImGui::EndTable();
             }
 
             // input field 'New Model Name'
@@ -228,15 +494,19 @@ namespace App {
             if (ImGui::Button("Add")) {
                 if (strlen(new_model_name) > 0) {
                     model_names.push_back(std::string(new_model_name));
-                    selected = model_names.size() - 1; // Select the new model
-                    client.setModel(model_names[selected]);
+                    catalog.push_back(ModelCatalog::MakeEntry(new_model_name)); // not pulled yet, no size or digest
+                    PullManager::pull(new_model_name); // download now rather than inside the first prompt
+                    showPullsWindow = true;
+                    compareSelected.push_back(compareMode); // picked for comparison when added in compare mode
+                    tab.selected = model_names.size() - 1; // Select the new model
+                    tab.client.setModel(model_names[tab.selected]);
                     memset(new_model_name, 0, sizeof(new_model_name)); // Clear input field
                 }
             }
 
             ImGui::EndCombo();
         }
-        if (client.running) {
+        if (busy) {
             ImGui::EndDisabled();
         }
 
@@ -251,7 +521,7 @@ namespace App {
             ImGui::EndTooltip();
         }
         if (ImGui::BeginPopup("ModelInfoPopup")) {
-            ImGui::SeparatorText(model_info.c_str()); // Display the 'Model' section
+            ImGui::SeparatorText(model_info_shown == model_info_model ? model_info.c_str() : "Loading model info..."); // Display the 'Model' section
             ImGui::NewLine();
             
             ImGui::EndPopup();
@@ -260,11 +530,11 @@ namespace App {
         // 'show console' toggle button
         ImGui::SameLine();
         ImGui::SetCursorPosX(ImGui::GetCursorPosX() + 55);
-        if (client.running) {
+        if (busy) {
             ImGui::BeginDisabled();
         }
         ImGui::Checkbox("Show Console", &showConsole);
-        if (client.running) {
+        if (busy) {
             ImGui::EndDisabled();
         }
         ImGui::Separator();
@@ -278,66 +548,37 @@ namespace App {
         ImGui::Text("Saved Chat Histories:");
         ImGui::SetCursorPos(ImVec2(626, 63));
         ImGui::BeginChild("ChatHistoryList", ImVec2(165, 525), true);
-        for (int fileNumber = 1; fileNumber <= 60; ++fileNumber) { // temp limit to 60 history. (will soon have filenames given by ai, theres limits without filesystem from C++17)
-            std::string filePath = "chat_history/chat_history_" + std::to_string(fileNumber) + ".txt";
-            if (!std::ifstream(filePath).good()) {
-                continue;
-            }
+        TRACE_SCOPE("ChatHistory list");
+        std::vector<int> savedFiles;
+        {
+            std::lock_guard<std::mutex> lock(historyMutex);
+            savedFiles = historyFiles;
+        }
+        for (int fileNumber : savedFiles) {
             std::string buttonLabel = "chat_history_" + std::to_string(fileNumber);
             
             //is running? (begin)
-            if (client.running) {
+            if (busy) {
                 ImGui::BeginDisabled();
             }
 
             // load chat
             if (ImGui::Selectable(buttonLabel.c_str())) {
-                std::ifstream inFile(filePath);
-                if (inFile.is_open()) {
-                    std::string line;
-                    std::string currentMessage;
-                    bool isPrompt = false;
-
-                    inputVector.clear();
-                    outputVector.clear();
-
-                    // save chat file
-                    while (std::getline(inFile, line)) {
-                        if (line.empty()) continue;
-
-                        if (line.find("User Prompt: ") == 0) {
-                            // Save previous message before resetting
-                            if (!currentMessage.empty()) {
-                                (isPrompt ? inputVector : outputVector).push_back(currentMessage);
-                            }
-                            currentMessage = line.substr(12);
-                            isPrompt = true;
-                        }
-                        else if (line.find("Response: ") == 0) {
-                            // Save previous message before resetting
-                            if (!currentMessage.empty()) {
-                                (isPrompt ? inputVector : outputVector).push_back(currentMessage);
-                            }
-                            currentMessage = line.substr(10);
-                            isPrompt = false;
-                        }
-                        else {
-                            currentMessage += (currentMessage.empty() ? "" : "\n") + line;
-                        }
-                    }
-                    // store last msg
-                    if (!currentMessage.empty()) {
-                        (isPrompt ? inputVector : outputVector).push_back(currentMessage);
-                    }
-
-                    inFile.close();
-                }
+                std::shared_ptr<HistoryLoad> load = std::make_shared<HistoryLoad>();
+                tab.pendingLoad = load;
+                ThreadPool::group("history").submit([load, fileNumber]() {
+                    ChatHistory::Load(fileNumber, load->conversation);
+                    load->done = true;
+                });
             }
             // right clicked?
             if (ImGui::BeginPopupContextItem()) {
                 ImGui::Text("Are you sure you want\nto delete this chat?");
                 if (ImGui::Button("Yes")) {
-                    if(std::ifstream(filePath).good()) std::remove(filePath.c_str()); // deletion
+                    ThreadPool::group("history").submit([fileNumber]() {
+                        ChatHistory::Remove(fileNumber); // deletion
+                        RefreshHistoryList();
+                    });
                     ImGui::CloseCurrentPopup();
                 }
                 ImGui::SameLine();
@@ -349,7 +590,7 @@ namespace App {
 
 
             //is running? (end)
-            if (client.running) {
+            if (busy) {
                 ImGui::EndDisabled();
             }
         }
@@ -404,65 +645,85 @@ namespace App {
         InputTextWithResize("##YourQuestion", "Enter your message here...", inputText);
         
         // dynamically update output if running
-            if (!outputVector.empty() && client.running) {
-                outputVector.back() = client.getOutput();
-            }
+        ChatTab& tab = ActiveTab();
+        SyncTab(tab);
         
         //is running? (begin)
-        if (client.running) {
+        bool busy = tab.client.running || IsCompareRunning(); // sampled once so Begin/EndDisabled stay paired
+        if (busy) {
             ImGui::BeginDisabled();
         }
 
-        // Submit button
-        if (ImGui::Button("Submit") || (ImGui::IsKeyPressed(ImGuiKey_Enter))) {
+        // Submit button - held back while the model is still being pulled
+        bool pulling = !compareMode && PullManager::pulling(tab.client.getModel());
+        if (pulling) {
+            ImGui::BeginDisabled();
+        }
+        if (ImGui::Button("Submit") || (ImGui::IsKeyPressed(ImGuiKey_Enter) && !busy && !pulling)) {
             std::string prompt = inputText;  // copy input to avoid lifetime issues
 
             // Replace all newline characters with spaces
             std::replace(prompt.begin(), prompt.end(), '\n', ' ');
 
-            std::thread([prompt, clientPtr = &client]() {
-                std::string result = clientPtr->sendPrompt(prompt, showConsole);
-                }).detach();
-
-            outputVector.push_back(client.getOutput());
-            //client.clearOutput();
-            inputVector.push_back(inputText);
+            // compare mode - one client and stream per selected model, all running concurrently
+            if (compareMode) {
+                compareClients.clear();
+                comparePrompt = inputText;
+                for (size_t i = 0; i < model_names.size(); ++i) {
+                    if (compareSelected[i]) {
+                        compareClients.push_back(std::unique_ptr<ModelClient>(new ModelClient(model_names[i]))); // Interactive like chat, every column is watched as it streams
+                    }
+                }
+                for (auto& compareClient : compareClients) {
+                    // console echo is skipped, interleaved streams would be unreadable
+                    // streams need no thread of their own, only the generations producing them run on the pool
+                    compareClient->streamPrompt(prompt, false);
+                }
+            }
+            else {
+                tab.synced = false;
+                tab.client.streamPrompt(prompt, showConsole);
+
+                size_t question = tab.conversation.add(Conversation::User, tab.client.getModel());
+                tab.conversation.append(question, inputText);
+                size_t response = tab.conversation.add(Conversation::Assistant, tab.client.getModel());
+                tab.conversation.append(response, tab.client.getOutput());
+            }
             ImGui::SetKeyboardFocusHere();
             inputText.clear(); // clear input after sending
         }
         if (ImGui::IsItemHovered()) {
             ImGui::BeginTooltip();
-            ImGui::SeparatorText(("Send Question to " + client.getModel()).c_str());
+            if (compareMode) {
+                ImGui::SeparatorText(("Send Question to " + std::to_string(std::count(compareSelected.begin(), compareSelected.end(), true)) + " models").c_str());
+            }
+            else {
+                ImGui::SeparatorText(("Send Question to " + tab.client.getModel()).c_str());
+                RenderContextFit(tab.client.getModel());
+            }
+            ImGui::EndTooltip();
+        }
+        if (pulling) {
+            ImGui::EndDisabled();
+        }
+
+        // compare mode toggle
+        ImGui::SameLine();
+        ImGui::Checkbox("Compare", &compareMode);
+        if (ImGui::IsItemHovered()) {
+            ImGui::BeginTooltip();
+            ImGui::SeparatorText("Send one prompt to every model picked in \"Select Model\"!");
             ImGui::EndTooltip();
         }
 
         // save button
         ImGui::SetCursorPos(ImVec2(488, 76));
         if (ImGui::Button("Save")) {
-            #ifdef _WIN32
-                 _mkdir("chat_history");
-            #else
-                 mkdir("chat_history", 0755);
-            #endif
-            int fileNumber = 1;
-            std::string filePath;
-            do {
-                filePath = "chat_history/chat_history_" + std::to_string(fileNumber) + ".txt";
-                fileNumber++;
-            } while (std::ifstream(filePath).good());
-            std::ofstream outFile(filePath);
-            if (outFile.is_open()) {
-                size_t maxMessages = inputVector.size() >= outputVector.size() ? inputVector.size() : outputVector.size();
-                for (size_t i = 0; i < maxMessages; ++i) {
-                    if (i < inputVector.size() && !inputVector[i].empty()) {
-                        outFile << "User Prompt: " << inputVector[i] << "\n\n";
-                    }
-                    if (i < outputVector.size() && !outputVector[i].empty()) {
-                        outFile << "Response: " << outputVector[i] << "\n\n";
-                    }
-                }
-                outFile.close();
-            }
+            std::shared_ptr<Conversation> saved = std::make_shared<Conversation>(tab.conversation);
+            ThreadPool::group("history").submit([saved]() {
+                ChatHistory::Save(*saved);
+                RefreshHistoryList();
+            });
         }
         if (ImGui::IsItemHovered()) {
             ImGui::BeginTooltip();
@@ -471,16 +732,24 @@ namespace App {
         }
 
         //is running? (end)
-        if (client.running) {
+        if (busy) {
             ImGui::EndDisabled();
         }
 
         // new button
         ImGui::SetCursorPos(ImVec2(534, 76));
         if (ImGui::Button("New Chat")) {
-            inputVector.clear();
-            outputVector.clear();
-            client.TerminateOllamaTasks(showConsole);
+            tab.conversation.clear();
+            tab.synced = true;
+            // cancel only this tab's request (and the comparison), other tabs keep generating
+            tab.client.cancel();
+            for (const auto& compareClient : compareClients) {
+                compareClient->cancel();
+            }
+            if (!IsCompareRunning()) { // cancelled clients are still finishing, keep them alive until then
+                compareClients.clear();
+                comparePrompt.clear();
+            }
         }
         if (ImGui::IsItemHovered()) {
             ImGui::BeginTooltip();
@@ -491,6 +760,125 @@ namespace App {
         ImGui::End();
     }
 
+    // Renders side-by-side answers of compare mode - called by RenderQuestionOutputWindow()
+    void RenderCompareView() {
+        if (compareClients.empty()) {
+            ImGui::TextWrapped("Pick models in \"Select Model\" and submit a prompt to compare their answers.");
+            return;
+        }
+
+        ImGui::TextWrapped("Prompt: %s", comparePrompt.c_str());
+        ImGui::Separator();
+
+        if (ImGui::BeginTable("CompareTable", (int)compareClients.size(), ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_SizingStretchSame)) {
+            for (const auto& compareClient : compareClients) {
+                ImGui::TableSetupColumn(compareClient->getModel().c_str());
+            }
+            ImGui::TableHeadersRow();
+
+            // answers
+            ImGui::TableNextRow();
+            for (size_t i = 0; i < compareClients.size(); ++i) {
+                ImGui::TableSetColumnIndex((int)i);
+                ImGui::TextWrapped("%s", compareClients[i]->getOutput().c_str());
+            }
+
+            // per-model timings underneath
+            ImGui::TableNextRow();
+            for (size_t i = 0; i < compareClients.size(); ++i) {
+                ImGui::TableSetColumnIndex((int)i);
+                ImGui::Separator();
+                GenerationStats stats = compareClients[i]->getStats();
+                if (stats.hasFirstToken) {
+                    ImGui::Text("TTFT: %.2f s", stats.timeToFirstToken);
+                }
+                else {
+                    ImGui::TextDisabled(compareClients[i]->running ? "TTFT: waiting..." : "TTFT: -");
+                }
+                if (stats.evalCount > 0) {
+                    ImGui::Text("%.1f tokens/s (%d tokens)", stats.tokensPerSecond(), stats.evalCount);
+                }
+                else {
+                    ImGui::TextDisabled("tokens/s: -");
+                }
+            }
+            ImGui::EndTable();
+        }
+
+        // total wall time should track the slowest model, not the sum
+        if (!IsCompareRunning()) {
+            double slowest = 0.0, sum = 0.0;
+            for (const auto& compareClient : compareClients) {
+                GenerationStats stats = compareClient->getStats();
+                slowest = stats.wallTime > slowest ? stats.wallTime : slowest;
+                sum += stats.wallTime;
+            }
+            ImGui::Separator();
+            ImGui::Text("Wall time: %.2f s (serial would be %.2f s)", slowest, sum);
+        }
+    }
+
+    // Renders conversation tabs - called by RenderQuestionOutputWindow()
+    void RenderConversationTabs() {
+        ActiveTab(); // always keep one tab open
+
+        if (ImGui::BeginTabBar("ConversationTabs", ImGuiTabBarFlags_AutoSelectNewTabs | ImGuiTabBarFlags_FittingPolicyScroll)) {
+            // '+' opens a new conversation with the current tab's model
+            if (ImGui::TabItemButton("+", ImGuiTabItemFlags_Trailing | ImGuiTabItemFlags_NoTooltip)) {
+                OpenTab(tabs[activeTab]->selected);
+            }
+
+            for (size_t i = 0; i < tabs.size(); ++i) {
+                ChatTab& chatTab = *tabs[i];
+                bool open = true;
+                bool running = chatTab.client.running;
+                std::string label = "Chat " + std::to_string(chatTab.id) + (running ? " ..." : "") + "###ChatTab" + std::to_string(chatTab.id);
+
+                // running tabs can't close, their worker still writes into the client
+                if (ImGui::BeginTabItem(label.c_str(), (running || tabs.size() == 1) ? nullptr : &open)) {
+                    if (activeTab != i) {
+                        activeTab = i;
+                        if (!model_names.empty() && chatTab.client.getModel() != model_info_model) {
+                            model_info_model = chatTab.client.getModel();
+                        }
+                    }
+                    ImGui::EndTabItem();
+                }
+                if (!open) {
+                    tabs.erase(tabs.begin() + i);
+                    if (activeTab > i || activeTab == tabs.size()) {
+                        activeTab--;
+                    }
+                    --i;
+                }
+            }
+            ImGui::EndTabBar();
+        }
+    }
+
+    // MessageTextSize() - size RenderMessage() will take, measured line by line
+    ImVec2 MessageTextSize(const Conversation& conversation, size_t index, float wrapWidth, std::string& scratch) {
+        ImVec2 size(0.0f, 0.0f);
+        conversation.forEachLine(index, scratch, [&size, wrapWidth](const char* begin, const char* end) {
+            ImVec2 line = ImGui::CalcTextSize(begin, end, false, wrapWidth);
+            size.x = line.x > size.x ? line.x : size.x;
+            size.y += line.y;
+        });
+        return size;
+    }
+
+    // RenderMessage() - wrapped message text, one item per line so no contiguous copy of the message is needed
+    // lines start at the group's x and are not spaced apart, so they read as one block of text
+    void RenderMessage(const Conversation& conversation, size_t index, std::string& scratch) {
+        ImGui::BeginGroup();
+        ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(ImGui::GetStyle().ItemSpacing.x, 0.0f));
+        conversation.forEachLine(index, scratch, [](const char* begin, const char* end) {
+            ImGui::TextUnformatted(begin, end);
+        });
+        ImGui::PopStyleVar();
+        ImGui::EndGroup();
+    }
+
     // Renders Question Output Window
     void RenderQuestionOutputWindow() {
         // set window size, begin, set pos, and round window
@@ -499,19 +887,32 @@ namespace App {
         ImGui::SetNextWindowPos(ImVec2(3, 80));
         ImGui::Begin("Question Out Window", nullptr, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 
+        RenderConversationTabs();
+        ChatTab& tab = ActiveTab();
+
         // scrollable region
-        ImGui::BeginChild("ChatRegion", ImVec2(0, ImGui::GetWindowHeight() - 20), true);
+        ImGui::BeginChild("ChatRegion", ImVec2(0, ImGui::GetContentRegionAvail().y - 8), true);
+
+        // compare mode - columns share this region's scroll
+        if (compareMode) {
+            RenderCompareView();
+        }
 
         float padding = 5.0f;
+        static std::string lineScratch; // lines crossing a piece boundary, reused every frame
         ImGui::PushTextWrapPos(ImGui::GetWindowWidth() - 2 * padding - ImGui::GetStyle().ScrollbarSize);
 
-        // Alternate messages (inputVector/outputVector)
-        size_t maxMessages = inputVector.size() >= outputVector.size() ? inputVector.size() : outputVector.size();
-        for (size_t i = 0; i < maxMessages; ++i) {
-            // Display user prompt if available (right-aligned)
-            if (i < inputVector.size() && !inputVector[i].empty()) {
+        // Messages in order, prompts and responses
+        for (size_t i = 0; i < tab.conversation.size() && !compareMode; ++i) {
+            const Conversation::Message& message = tab.conversation[i];
+            if (message.length == 0) {
+                continue;
+            }
+
+            // Display user prompt (right-aligned)
+            if (message.role == Conversation::User) {
                 // Calculate text size
-                ImVec2 textSize = ImGui::CalcTextSize(inputVector[i].c_str(), nullptr, false, ImGui::GetWindowWidth() - 2 * padding);
+                ImVec2 textSize = MessageTextSize(tab.conversation, i, ImGui::GetWindowWidth() - 2 * padding, lineScratch);
 
                 // Move cursor to the right side for text
                 float windowWidth = ImGui::GetWindowWidth();
@@ -526,16 +927,22 @@ namespace App {
                 ImGui::GetWindowDrawList()->AddRectFilled(bubbleMin, bubbleMax, IM_COL32(80, 140, 255, 255), 10.0f);
 
                 // Draw prompt text (right-aligned)
-                ImGui::TextWrapped("%s", inputVector[i].c_str());
+                RenderMessage(tab.conversation, i, lineScratch);
                 ImGui::Spacing();
             }
 
-            // Display response if available (left-aligned)
-            if (i < outputVector.size() && !outputVector[i].empty()) {
+            // Display response (left-aligned)
+            else {
                 ImGui::SetCursorPosY(ImGui::GetCursorPosY() + 10.0f);
                    
                 // response text
-                ImGui::TextWrapped("%s", outputVector[i].c_str());
+                RenderMessage(tab.conversation, i, lineScratch);
+                if (ImGui::IsItemHovered() && message.durationMs > 0) {
+                    ImGui::BeginTooltip();
+                    ImGui::SeparatorText(tab.conversation.models()[message.model].c_str());
+                    ImGui::Text("%u tokens in %.1f s", message.tokens, message.durationMs / 1000.0);
+                    ImGui::EndTooltip();
+                }
                 ImGui::Spacing();
             }
         }
@@ -551,12 +958,912 @@ namespace App {
     }
 
 
+    // Renders Generation Stats Window - per model latency percentiles from Telemetry
+    void RenderStatsWindow() {
+        if (!showStatsWindow) {
+            return;
+        }
+
+        ImGui::SetNextWindowPos(ImVec2(40, 100), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(720, 300), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Generation Stats", &showStatsWindow, ImGuiWindowFlags_NoCollapse)) {
+            std::vector<std::string> models = Telemetry::modelNames();
+            if (models.empty()) {
+                ImGui::Text("No generations recorded yet.");
+            }
+            else if (ImGui::BeginTable("StatsTable", 10, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_ScrollX)) {
+                ImGui::TableSetupColumn("Model");
+                ImGui::TableSetupColumn("Requests");
+                ImGui::TableSetupColumn("First byte p50/p99");
+                ImGui::TableSetupColumn("TTFT p50/p99");
+                ImGui::TableSetupColumn("Inter-token p50/p99");
+                ImGui::TableSetupColumn("Tokens/s p50/p99");
+                ImGui::TableSetupColumn("Prefill p50/p99");
+                ImGui::TableSetupColumn("Total p50/p99");
+                ImGui::TableSetupColumn("TTFT warm p50 (n)");
+                ImGui::TableSetupColumn("TTFT cold p50 (n)");
+                ImGui::TableHeadersRow();
+
+                // p50/p99 cell of a histogram
+                auto percentiles = [](const Histogram& histogram) {
+                    if (histogram.count() == 0) {
+                        ImGui::TextDisabled("-");
+                        return;
+                    }
+                    ImGui::Text("%s / %s", FormatMicros(histogram.percentile(0.50)).c_str(), FormatMicros(histogram.percentile(0.99)).c_str());
+                };
+
+                for (const std::string& model : models) {
+                    ModelTelemetry& histograms = Telemetry::forModel(model);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(model.c_str());
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)histograms.total.count());
+                    ImGui::TableNextColumn(); percentiles(histograms.firstByte);
+                    ImGui::TableNextColumn(); percentiles(histograms.firstToken);
+                    ImGui::TableNextColumn(); percentiles(histograms.interToken);
+                    ImGui::TableNextColumn();
+                    // slow tail of tokens/s is the p99 of per-token latency
+                    if (histograms.tokenLatency.count() == 0) {
+                        ImGui::TextDisabled("-");
+                    }
+                    else {
+                        ImGui::Text("%.1f / %.1f", 1e6 / (histograms.tokenLatency.percentile(0.50) + 1), 1e6 / (histograms.tokenLatency.percentile(0.99) + 1));
+                    }
+                    ImGui::TableNextColumn(); percentiles(histograms.promptEval);
+                    ImGui::TableNextColumn(); percentiles(histograms.total);
+                    // first prompt latency with the model preloaded vs loaded on demand
+                    for (const Histogram* histogram : { &histograms.firstTokenWarm, &histograms.firstTokenCold }) {
+                        ImGui::TableNextColumn();
+                        if (histogram->count() == 0) {
+                            ImGui::TextDisabled("-");
+                        }
+                        else {
+                            ImGui::Text("%s (%llu)", FormatMicros(histogram->percentile(0.50)).c_str(), (unsigned long long)histogram->count());
+                        }
+                    }
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // Renders Metrics Export Window - endpoint/file controls and a preview of the exposition
+    void RenderMetricsWindow() {
+        if (!showMetricsWindow) {
+            return;
+        }
+        static int port = 9464;
+        static char filePath[260] = "model_app_metrics.prom";
+        static int interval = 15;
+
+        ImGui::SetNextWindowPos(ImVec2(60, 120), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(620, 420), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Metrics Export", &showMetricsWindow, ImGuiWindowFlags_NoCollapse)) {
+            ImGui::TextUnformatted(MetricsExporter::status().c_str());
+            ImGui::SetNextItemWidth(120);
+            ImGui::InputInt("Port", &port);
+            ImGui::SameLine();
+            if (ImGui::Button("Serve")) {
+                MetricsExporter::serve(port);
+            }
+
+            ImGui::TextUnformatted(MetricsExporter::fileStatus().c_str());
+            ImGui::SetNextItemWidth(300);
+            ImGui::InputText("File", filePath, sizeof(filePath));
+            ImGui::SetNextItemWidth(120);
+            ImGui::InputInt("Interval (s)", &interval);
+            interval = interval < 1 ? 1 : interval;
+            ImGui::SameLine();
+            if (ImGui::Button("Write")) {
+                MetricsExporter::writeFile(filePath, interval);
+            }
+
+            // preview is rendered at most twice a second, history size walks the disk
+            static std::string preview;
+            static double previewTime = -1.0;
+            static std::vector<TaskGroup::Stats> poolStats;
+            static std::map<std::string, double> utilization; // busy threads per group over the last interval
+            if (ImGui::GetTime() - previewTime > 0.5) {
+                preview = MetricsRegistry::renderPrometheus();
+                std::vector<TaskGroup::Stats> stats = ThreadPool::groupStats();
+                for (const TaskGroup::Stats& group : stats) {
+                    for (const TaskGroup::Stats& previous : poolStats) {
+                        if (previous.name == group.name && previewTime >= 0.0) {
+                            utilization[group.name] = (group.busyMicros - previous.busyMicros) / 1e6 / (ImGui::GetTime() - previewTime);
+                        }
+                    }
+                }
+                poolStats = stats;
+                previewTime = ImGui::GetTime();
+            }
+
+            // thread pool utilization, busy = average threads running the group's tasks
+            ImGui::SeparatorText(("Thread pool (" + std::to_string(ThreadPool::workerCount()) + " workers)").c_str());
+            if (ImGui::BeginTable("PoolTable", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                ImGui::TableSetupColumn("Group");
+                ImGui::TableSetupColumn("Running");
+                ImGui::TableSetupColumn("Queued");
+                ImGui::TableSetupColumn("Done");
+                ImGui::TableSetupColumn("Dropped");
+                ImGui::TableSetupColumn("Busy threads");
+                ImGui::TableHeadersRow();
+                for (const TaskGroup::Stats& group : poolStats) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(group.name.c_str());
+                    ImGui::TableNextColumn(); ImGui::Text("%d", group.running);
+                    ImGui::TableNextColumn(); ImGui::Text("%d", group.queued);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)group.completed);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)group.dropped);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f", utilization[group.name]);
+                }
+                ImGui::EndTable();
+            }
+            ImGui::Separator();
+            ImGui::BeginChild("MetricsPreview", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
+            ImGui::TextUnformatted(preview.c_str(), preview.c_str() + preview.length());
+            ImGui::EndChild();
+        }
+        ImGui::End();
+    }
+
+    // Renders Response Cache Window - cache settings and hit rate
+    void RenderCacheWindow() {
+        if (!showCacheWindow) {
+            return;
+        }
+
+        ImGui::SetNextWindowPos(ImVec2(80, 140), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(420, 260), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Response Cache", &showCacheWindow, ImGuiWindowFlags_NoCollapse)) {
+            bool enabled = ResponseCache::enabled();
+            if (ImGui::Checkbox("Cache responses", &enabled)) {
+                ResponseCache::setEnabled(enabled);
+            }
+            bool deterministicOnly = ResponseCache::deterministicOnly();
+            if (ImGui::Checkbox("Only models with temperature 0", &deterministicOnly)) {
+                ResponseCache::setDeterministicOnly(deterministicOnly);
+            }
+
+            int replayMode = ResponseCache::replayMode();
+            ImGui::Text("Replay:");
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Recorded pace", &replayMode, ResponseCache::ReplayRecorded)) {
+                ResponseCache::setReplayMode(ResponseCache::ReplayRecorded);
+            }
+            ImGui::SameLine();
+            if (ImGui::RadioButton("Instant", &replayMode, ResponseCache::ReplayInstant)) {
+                ResponseCache::setReplayMode(ResponseCache::ReplayInstant);
+            }
+
+            int maxMegabytes = (int)(ResponseCache::maxBytes() / (1024 * 1024));
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputInt("Max size (MB)", &maxMegabytes, 16, 128, ImGuiInputTextFlags_EnterReturnsTrue)) {
+                ResponseCache::setMaxBytes((uint64_t)(maxMegabytes < 1 ? 1 : maxMegabytes) * 1024 * 1024);
+            }
+
+            // summary reads the index under the cache lock, a few times a second is plenty
+            static ResponseCache::Summary summary;
+            static double summaryTime = -1.0;
+            if (ImGui::GetTime() - summaryTime > 0.5) {
+                summary = ResponseCache::summary();
+                summaryTime = ImGui::GetTime();
+            }
+            uint64_t lookups = summary.hits + summary.misses;
+            ImGui::Separator();
+            ImGui::Text("Entries: %zu (%.1f MB)", summary.entries, summary.bytes / (1024.0 * 1024.0));
+            ImGui::Text("Hits: %llu  Misses: %llu  Hit rate: %.1f%%", (unsigned long long)summary.hits, (unsigned long long)summary.misses, lookups == 0 ? 0.0 : 100.0 * summary.hits / lookups);
+            ImGui::Text("Evictions: %llu", (unsigned long long)summary.evictions);
+            if (ImGui::Button("Clear Cache")) {
+                ResponseCache::clear();
+                summaryTime = -1.0;
+            }
+        }
+        ImGui::End();
+    }
+
+    // Renders cold/loading/resident in the "State" column of the "Select Model" table
+    void RenderResidencyState(const std::string& model) {
+        if (PullManager::pulling(model)) {
+            ImGui::TextColored(ImVec4(0.5f, 0.7f, 1.0f, 1.0f), "pulling");
+            return;
+        }
+        ModelResidency::State state = ModelResidency::state(model);
+        ImVec4 color = state == ModelResidency::Resident ? ImVec4(0.4f, 0.9f, 0.4f, 1.0f)
+                     : state == ModelResidency::Loading ? ImVec4(0.9f, 0.8f, 0.3f, 1.0f)
+                     : ImGui::GetStyleColorVec4(ImGuiCol_TextDisabled);
+        ImGui::TextColored(color, "%s", ModelResidency::stateName(state));
+    }
+
+    // Renders Model Residency Window - preload/keep-alive settings and the memory budget
+    void RenderResidencyWindow() {
+        if (!showResidencyWindow) {
+            return;
+        }
+        static char keepAlive[32] = "30m";
+        static float budgetGigabytes = 0.0f;
+        static int pollSeconds = 5;
+        static double physicalGigabytes = []() {
+            MEMORYSTATUSEX memory = {};
+            memory.dwLength = sizeof(memory);
+            return GlobalMemoryStatusEx(&memory) ? memory.ullTotalPhys / 1e9 : 0.0;
+        }();
+
+        ImGui::SetNextWindowPos(ImVec2(100, 160), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(720, 380), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Model Residency", &showResidencyWindow, ImGuiWindowFlags_NoCollapse)) {
+            bool preloadOnSelect = ModelResidency::preloadOnSelect();
+            if (ImGui::Checkbox("Preload models when selected", &preloadOnSelect)) {
+                ModelResidency::setPreloadOnSelect(preloadOnSelect);
+            }
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputText("Keep-alive", keepAlive, sizeof(keepAlive))) {
+                ModelResidency::setKeepAlive(keepAlive);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("ollama duration, e.g. 30m or 2h, -1 keeps models loaded");
+            }
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputFloat("Memory budget (GB)", &budgetGigabytes, 1.0f, 4.0f, "%.1f")) {
+                budgetGigabytes = budgetGigabytes < 0.0f ? 0.0f : budgetGigabytes;
+                ModelResidency::setBudgetBytes((uint64_t)(budgetGigabytes * 1e9));
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("least recently used idle models are unloaded above this, 0 = no limit");
+            }
+            ImGui::SameLine();
+            ImGui::TextDisabled("of %.1f GB RAM", physicalGigabytes);
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputInt("Poll every (s)", &pollSeconds)) {
+                pollSeconds = pollSeconds < 1 ? 1 : pollSeconds;
+                ModelResidency::startPolling(pollSeconds);
+            }
+
+            uint64_t budget = ModelResidency::budgetBytes();
+            uint64_t resident = ModelResidency::residentBytes();
+            ImGui::Separator();
+            ImGui::Text("Resident: %.1f GB", resident / 1e9);
+            if (budget > 0) {
+                ImGui::SameLine();
+                ImGui::ProgressBar(resident >= budget ? 1.0f : (float)resident / budget, ImVec2(200, 0));
+            }
+
+            // live table, rows come from the last `ollama ps` poll plus our own preloads/requests
+            std::vector<ModelResidency::Row> rows = ModelResidency::snapshot();
+            if (ImGui::BeginTable("ResidencyTable", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_ScrollY)) {
+                ImGui::TableSetupColumn("Model");
+                ImGui::TableSetupColumn("State");
+                ImGui::TableSetupColumn("Size");
+                ImGui::TableSetupColumn("Processor");
+                ImGui::TableSetupColumn("Until");
+                ImGui::TableSetupColumn("Last used");
+                ImGui::TableSetupColumn("");
+                ImGui::TableHeadersRow();
+                for (const ModelResidency::Row& row : rows) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(row.name.c_str());
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(ModelResidency::stateName(row.state));
+                    ImGui::TableNextColumn();
+                    if (row.bytes > 0) ImGui::Text("%.1f GB", row.bytes / 1e9); else ImGui::TextDisabled("-");
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(row.state == ModelResidency::Resident ? row.processor.c_str() : "");
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(row.state == ModelResidency::Resident ? row.until.c_str() : "");
+                    ImGui::TableNextColumn();
+                    if (row.inFlight > 0) ImGui::Text("in use (%d)", row.inFlight);
+                    else if (row.idleSeconds >= 0.0) ImGui::Text("%.0f s ago", row.idleSeconds);
+                    else ImGui::TextDisabled("-");
+                    ImGui::TableNextColumn();
+                    if (row.state == ModelResidency::Resident && row.inFlight == 0) {
+                        ImGui::PushID(row.name.c_str());
+                        if (ImGui::SmallButton("Unload")) {
+                            ModelResidency::unload(row.name);
+                        }
+                        ImGui::PopID();
+                    }
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // Renders Endpoints Window - the daemons HTTP generations are spread over, with load and health
+    void RenderEndpointsWindow() {
+        if (!showEndpointsWindow) {
+            return;
+        }
+        static char endpoints[512] = "";
+        static bool endpointsRead = false;
+        if (!endpointsRead) {
+            snprintf(endpoints, sizeof(endpoints), "%s", EndpointPool::list().c_str());
+            endpointsRead = true;
+        }
+
+        ImGui::SetNextWindowPos(ImVec2(120, 180), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(720, 320), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Endpoints", &showEndpointsWindow, ImGuiWindowFlags_NoCollapse)) {
+            ImGui::SetNextItemWidth(420);
+            ImGui::InputText("##endpoints", endpoints, sizeof(endpoints));
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("comma separated host:port list, like MODEL_APP_ENDPOINTS");
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Apply")) {
+                EndpointPool::setList(endpoints);
+                snprintf(endpoints, sizeof(endpoints), "%s", EndpointPool::list().c_str());
+            }
+            if (ModelClient::transport() != ModelClient::Http) {
+                ImGui::TextDisabled("Generations use `ollama run`, turn on Tools > Stream over HTTP API to use these hosts");
+            }
+
+            // deadlines end slow requests, hedges and retries go to another host within the budget, see RequestPolicy.h
+            if (ImGui::CollapsingHeader("Deadlines and hedging")) {
+                RequestPolicy::Deadlines deadlines = RequestPolicy::deadlines();
+                bool changed = false;
+                ImGui::SetNextItemWidth(120);
+                changed |= ImGui::InputInt("Connect (ms)", &deadlines.connectMs, 500, 5000);
+                ImGui::SetNextItemWidth(120);
+                changed |= ImGui::InputInt("First token (ms)", &deadlines.firstTokenMs, 1000, 10000);
+                ImGui::SetNextItemWidth(120);
+                changed |= ImGui::InputInt("Stall (ms)", &deadlines.stallMs, 1000, 10000);
+                if (changed) {
+                    deadlines.connectMs = std::max(0, deadlines.connectMs);
+                    deadlines.firstTokenMs = std::max(0, deadlines.firstTokenMs);
+                    deadlines.stallMs = std::max(0, deadlines.stallMs);
+                    RequestPolicy::setDeadlines(deadlines);
+                }
+                int hedgeAfter = RequestPolicy::hedgeAfterMs();
+                ImGui::SetNextItemWidth(120);
+                if (ImGui::InputInt("Hedge after (ms)", &hedgeAfter, 50, 500)) {
+                    RequestPolicy::setHedgeAfterMs(hedgeAfter);
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("a first token later than this sends a duplicate to another host, 0 = off");
+                }
+                RequestPolicy::Counts counts = RequestPolicy::counts();
+                ImGui::Text("Hedges: %llu (%llu won)   Retries: %llu   Denied: %llu   Budget: %.1f",
+                            (unsigned long long)counts.hedges, (unsigned long long)counts.hedgeWins, (unsigned long long)counts.retries,
+                            (unsigned long long)counts.denied, RequestPolicy::budget());
+                ImGui::TextDisabled("0 = no deadline; `ollama run` only has the first token and stall deadlines");
+            }
+
+            // requests go to the least loaded host that is not ejected, warm hosts first, see EndpointPool.h
+            std::vector<EndpointPool::Row> rows = EndpointPool::snapshot();
+            if (ImGui::BeginTable("EndpointsTable", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_ScrollY)) {
+                ImGui::TableSetupColumn("Host");
+                ImGui::TableSetupColumn("State");
+                ImGui::TableSetupColumn("In flight");
+                ImGui::TableSetupColumn("Requests");
+                ImGui::TableSetupColumn("Check");
+                ImGui::TableSetupColumn("Loaded models", ImGuiTableColumnFlags_WidthStretch);
+                ImGui::TableHeadersRow();
+                for (const EndpointPool::Row& row : rows) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(row.name.c_str());
+                    ImGui::TableNextColumn();
+                    if (row.ejected) ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.4f, 1.0f), "ejected %.0f s", row.ejectedSeconds);
+                    else if (row.failures > 0) ImGui::TextColored(ImVec4(0.9f, 0.8f, 0.3f, 1.0f), "retrying");
+                    else ImGui::TextColored(ImVec4(0.4f, 0.9f, 0.4f, 1.0f), "healthy");
+                    if (row.failures > 0 && ImGui::IsItemHovered()) {
+                        ImGui::SetTooltip("%d consecutive failures", row.failures);
+                    }
+                    ImGui::TableNextColumn(); ImGui::Text("%d", row.inFlight);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)row.requests);
+                    ImGui::TableNextColumn();
+                    if (row.checkMilliseconds >= 0.0) ImGui::Text("%.0f ms", row.checkMilliseconds); else ImGui::TextDisabled("-");
+                    ImGui::TableNextColumn();
+                    std::string loaded;
+                    for (const std::string& model : row.resident) {
+                        loaded += (loaded.empty() ? "" : ", ") + model;
+                    }
+                    ImGui::TextUnformatted(loaded.c_str());
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // Renders Admission Window - rate and concurrency limits per priority class, and what each model has running and queued
+    void RenderAdmissionWindow() {
+        if (!showAdmissionWindow) {
+            return;
+        }
+
+        ImGui::SetNextWindowPos(ImVec2(140, 200), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(760, 340), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Admission", &showAdmissionWindow, ImGuiWindowFlags_NoCollapse)) {
+            // limits hold per model, 0 = unlimited; batch requests also count against the interactive concurrency
+            if (ImGui::BeginTable("AdmissionLimits", 8, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                ImGui::TableSetupColumn("Class");
+                ImGui::TableSetupColumn("Concurrency");
+                ImGui::TableSetupColumn("Rate (/s)");
+                ImGui::TableSetupColumn("Burst");
+                ImGui::TableSetupColumn("Queue");
+                ImGui::TableSetupColumn("Admitted");
+                ImGui::TableSetupColumn("Rejected");
+                ImGui::TableSetupColumn("Queue time p50 / p99");
+                ImGui::TableHeadersRow();
+                for (int priority = 0; priority < AdmissionControl::PriorityCount; ++priority) {
+                    AdmissionControl::Priority type = (AdmissionControl::Priority)priority;
+                    AdmissionControl::Limits limits = AdmissionControl::limits(type);
+                    AdmissionControl::Counts counts = AdmissionControl::counts(type);
+                    bool changed = false;
+                    ImGui::PushID(priority);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(AdmissionControl::name(type));
+                    ImGui::TableNextColumn(); ImGui::SetNextItemWidth(90); changed |= ImGui::InputInt("##concurrent", &limits.maxConcurrent);
+                    ImGui::TableNextColumn(); ImGui::SetNextItemWidth(90); changed |= ImGui::InputDouble("##rate", &limits.ratePerSecond, 0.5, 1.0, "%.1f");
+                    ImGui::TableNextColumn(); ImGui::SetNextItemWidth(90); changed |= ImGui::InputInt("##burst", &limits.burst);
+                    ImGui::TableNextColumn(); ImGui::SetNextItemWidth(90); changed |= ImGui::InputInt("##queued", &limits.maxQueued, 8, 64);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.admitted);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)counts.rejected);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f s / %.2f s (%llu waited)", counts.queueP50Seconds, counts.queueP99Seconds, (unsigned long long)counts.queued);
+                    ImGui::PopID();
+                    if (changed) {
+                        AdmissionControl::setLimits(type, limits);
+                    }
+                }
+                ImGui::EndTable();
+            }
+            ImGui::TextDisabled("Interactive prompts (chat, model comparisons) start before queued batch ones (headless callers); a full queue rejects the request");
+
+            ImGui::SeparatorText("Models");
+            std::vector<AdmissionControl::Row> rows = AdmissionControl::snapshot();
+            if (ImGui::BeginTable("AdmissionModels", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_ScrollY)) {
+                ImGui::TableSetupColumn("Model", ImGuiTableColumnFlags_WidthStretch);
+                ImGui::TableSetupColumn("Interactive running / queued");
+                ImGui::TableSetupColumn("Batch running / queued");
+                ImGui::TableSetupColumn("Interactive tokens");
+                ImGui::TableSetupColumn("Batch tokens");
+                ImGui::TableHeadersRow();
+                for (const AdmissionControl::Row& row : rows) {
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(row.model.c_str());
+                    ImGui::TableNextColumn(); ImGui::Text("%d / %d", row.running[AdmissionControl::Interactive], row.queued[AdmissionControl::Interactive]);
+                    ImGui::TableNextColumn(); ImGui::Text("%d / %d", row.running[AdmissionControl::Batch], row.queued[AdmissionControl::Batch]);
+                    ImGui::TableNextColumn(); ImGui::Text("%.1f", row.tokens[AdmissionControl::Interactive]);
+                    ImGui::TableNextColumn(); ImGui::Text("%.1f", row.tokens[AdmissionControl::Batch]);
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // planningBudget() - bytes one model may use, the planner budget or else the RAM available right now
+    static uint64_t planningBudget() {
+        if (plannedBudgetGigabytes > 0.0f) {
+            return (uint64_t)(plannedBudgetGigabytes * 1e9);
+        }
+        MEMORYSTATUSEX memory = {};
+        memory.dwLength = sizeof(memory);
+        return GlobalMemoryStatusEx(&memory) ? memory.ullAvailPhys : 0;
+    }
+
+    // Renders whether the planned num_ctx fits the budget - shown before a prompt is sent
+    void RenderContextFit(const std::string& model) {
+        ModelShape shape = MemoryEstimator::shapeOf(model);
+        if (!shape.valid()) {
+            return;
+        }
+        MemoryEstimator::CacheType cacheType = (MemoryEstimator::CacheType)plannedCacheType;
+        MemoryEstimate estimate = MemoryEstimator::estimate(shape, plannedContext, plannedBatch, plannedParallel, cacheType);
+        uint64_t budget = planningBudget();
+        uint64_t recommended = MemoryEstimator::recommendContext(shape, budget, plannedBatch, plannedParallel, cacheType);
+        if (estimate.total() > budget) {
+            ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "num_ctx %d needs %.1f GB, budget is %.1f GB", plannedContext, estimate.total() / 1e9, budget / 1e9);
+        }
+        else {
+            ImGui::Text("num_ctx %d needs %.1f GB of %.1f GB", plannedContext, estimate.total() / 1e9, budget / 1e9);
+        }
+        ImGui::TextDisabled("largest num_ctx that fits: %llu", (unsigned long long)recommended);
+    }
+
+    // Renders Context Planner Window - weight/KV-cache estimate and the largest num_ctx that fits a budget
+    void RenderContextWindow() {
+        if (!showContextWindow) {
+            return;
+        }
+        ImGui::SetNextWindowPos(ImVec2(120, 180), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(640, 460), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Context Planner", &showContextWindow, ImGuiWindowFlags_NoCollapse)) {
+            std::string model = tabs.empty() ? "" : tabs[activeTab]->client.getModel();
+            ModelShape shape = MemoryEstimator::shapeOf(model);
+            ImGui::SeparatorText(model.c_str());
+            if (!shape.valid()) {
+                ImGui::TextDisabled("No GGUF metadata - the model is not in the local store (OLLAMA_MODELS).");
+            }
+            else {
+                ImGui::Text("%s, %llu layers, %llu/%llu heads (kv), head size %llu, trained context %llu",
+                    shape.architecture.c_str(), (unsigned long long)shape.layers, (unsigned long long)shape.heads,
+                    (unsigned long long)shape.kvHeads, (unsigned long long)shape.keyLength, (unsigned long long)shape.trainedContext);
+            }
+
+            ImGui::SetNextItemWidth(160);
+            if (ImGui::InputInt("num_ctx", &plannedContext, 1024, 8192)) {
+                plannedContext = plannedContext < 256 ? 256 : plannedContext;
+            }
+            ImGui::SetNextItemWidth(160);
+            if (ImGui::InputInt("num_batch", &plannedBatch, 128, 512)) {
+                plannedBatch = plannedBatch < 1 ? 1 : plannedBatch;
+            }
+            ImGui::SetNextItemWidth(160);
+            if (ImGui::InputInt("Parallel slots", &plannedParallel)) {
+                plannedParallel = plannedParallel < 1 ? 1 : plannedParallel;
+            }
+            const char* cacheTypes[] = { "f16", "q8_0", "q4_0" };
+            ImGui::SetNextItemWidth(160);
+            ImGui::Combo("KV cache type", &plannedCacheType, cacheTypes, IM_ARRAYSIZE(cacheTypes));
+            ImGui::SetNextItemWidth(160);
+            if (ImGui::InputFloat("Budget (GB)", &plannedBudgetGigabytes, 1.0f, 4.0f, "%.1f")) {
+                plannedBudgetGigabytes = plannedBudgetGigabytes < 0.0f ? 0.0f : plannedBudgetGigabytes;
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("0 = RAM available right now");
+            }
+
+            if (shape.valid()) {
+                MemoryEstimator::CacheType cacheType = (MemoryEstimator::CacheType)plannedCacheType;
+                MemoryEstimate estimate = MemoryEstimator::estimate(shape, plannedContext, plannedBatch, plannedParallel, cacheType);
+                uint64_t budget = planningBudget();
+                ImGui::Separator();
+                ImGui::Text("Weights %.2f GB + KV cache %.2f GB + graph %.2f GB = %.2f GB",
+                    estimate.weights / 1e9, estimate.kvCache / 1e9, estimate.graph / 1e9, estimate.total() / 1e9);
+                ImGui::ProgressBar(budget == 0 || estimate.total() >= budget ? 1.0f : (float)estimate.total() / budget, ImVec2(-1, 0),
+                    (std::to_string((int)(estimate.total() * 100.0 / (budget ? budget : 1))) + "% of budget").c_str());
+                uint64_t recommended = MemoryEstimator::recommendContext(shape, budget, plannedBatch, plannedParallel, cacheType);
+                ImGui::Text("Largest num_ctx that fits %.1f GB: %llu", budget / 1e9, (unsigned long long)recommended);
+                if (recommended > 0) {
+                    ImGui::SameLine();
+                    if (ImGui::SmallButton("Use")) {
+                        plannedContext = (int)recommended;
+                    }
+                }
+            }
+
+            // estimator vs. KV cache sizes llama.cpp reports for published models
+            ImGui::SeparatorText("Known configurations (f16 KV cache, 1 slot)");
+            if (ImGui::BeginTable("KnownConfigurations", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+                ImGui::TableSetupColumn("Model");
+                ImGui::TableSetupColumn("num_ctx");
+                ImGui::TableSetupColumn("Reported");
+                ImGui::TableSetupColumn("Estimated");
+                ImGui::TableSetupColumn("");
+                ImGui::TableHeadersRow();
+                for (const MemoryEstimator::KnownConfiguration& known : MemoryEstimator::knownConfigurations()) {
+                    uint64_t estimated = MemoryEstimator::kvCacheBytes(MemoryEstimator::knownShape(known), known.numContext, 1) / (1024 * 1024);
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(known.model);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)known.numContext);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu MiB", (unsigned long long)known.kvCacheMiB);
+                    ImGui::TableNextColumn(); ImGui::Text("%llu MiB", (unsigned long long)estimated);
+                    ImGui::TableNextColumn();
+                    if (estimated == known.kvCacheMiB) ImGui::TextColored(ImVec4(0.4f, 0.9f, 0.4f, 1.0f), "ok");
+                    else ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "off");
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // Renders Model Store Window - disk usage per model with shared blobs counted once
+    void RenderStoreWindow() {
+        if (!showStoreWindow) {
+            return;
+        }
+        static StoreInspector::Report report;
+        static std::vector<size_t> order; // report.models indices in display order
+        static int shownScan = 0;
+        bool scanning = StoreInspector::scanning();
+        bool resort = false;
+        if (shownScan != StoreInspector::completedScans()) {
+            shownScan = StoreInspector::completedScans();
+            report = StoreInspector::lastReport();
+            order.resize(report.models.size());
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            resort = true;
+        }
+
+        ImGui::SetNextWindowPos(ImVec2(140, 200), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(820, 440), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Model Store", &showStoreWindow, ImGuiWindowFlags_NoCollapse)) {
+            ImGui::BeginDisabled(scanning);
+            if (ImGui::Button(scanning ? "Scanning..." : "Rescan")) {
+                StoreInspector::startScan();
+            }
+            ImGui::EndDisabled();
+            ImGui::SameLine();
+            ImGui::TextDisabled("%s", report.root.c_str());
+            if (report.scanned) {
+                ImGui::Text("%d models, %d blobs, %.2f GB on disk (listed sizes add up to %.2f GB), scanned in %.0f ms",
+                    (int)report.models.size(), (int)report.blobCount, report.storeBytes / 1e9, report.declaredBytes / 1e9, report.seconds * 1000.0);
+                if (report.orphanBlobs > 0) {
+                    ImGui::TextColored(ImVec4(0.9f, 0.8f, 0.3f, 1.0f), "%d blobs (%.2f GB) are not referenced by any model",
+                        (int)report.orphanBlobs, report.orphanBytes / 1e9);
+                }
+            }
+
+            ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit
+                                  | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Sortable | ImGuiTableFlags_SortMulti;
+            if (ImGui::BeginTable("StoreTable", 7, flags)) {
+                ImGui::TableSetupScrollFreeze(0, 1);
+                ImGui::TableSetupColumn("Model", ImGuiTableColumnFlags_DefaultSort);
+                ImGui::TableSetupColumn("Layers");
+                ImGui::TableSetupColumn("Listed");
+                ImGui::TableSetupColumn("On disk", ImGuiTableColumnFlags_PreferSortDescending);
+                ImGui::TableSetupColumn("Unique", ImGuiTableColumnFlags_PreferSortDescending);
+                ImGui::TableSetupColumn("Shared", ImGuiTableColumnFlags_PreferSortDescending);
+                ImGui::TableSetupColumn("Missing");
+                ImGui::TableHeadersRow();
+
+                // sort only when the sort specs or the data change, not every frame
+                ImGuiTableSortSpecs* sortSpecs = ImGui::TableGetSortSpecs();
+                if (sortSpecs != nullptr && (sortSpecs->SpecsDirty || resort)) {
+                    const std::vector<StoreInspector::ModelUsage>& models = report.models;
+                    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                        for (int s = 0; s < sortSpecs->SpecsCount; ++s) {
+                            const ImGuiTableColumnSortSpecs& spec = sortSpecs->Specs[s];
+                            const StoreInspector::ModelUsage& x = models[a];
+                            const StoreInspector::ModelUsage& y = models[b];
+                            int compare = 0;
+                            switch (spec.ColumnIndex) {
+                            case 0: compare = x.name.compare(y.name); break;
+                            case 1: compare = (x.layers > y.layers) - (x.layers < y.layers); break;
+                            case 2: compare = (x.declaredBytes > y.declaredBytes) - (x.declaredBytes < y.declaredBytes); break;
+                            case 3: compare = (x.diskBytes > y.diskBytes) - (x.diskBytes < y.diskBytes); break;
+                            case 4: compare = (x.uniqueBytes > y.uniqueBytes) - (x.uniqueBytes < y.uniqueBytes); break;
+                            case 5: compare = (x.sharedBytes > y.sharedBytes) - (x.sharedBytes < y.sharedBytes); break;
+                            default: compare = (x.missingBlobs > y.missingBlobs) - (x.missingBlobs < y.missingBlobs); break;
+                            }
+                            if (compare != 0) {
+                                return spec.SortDirection == ImGuiSortDirection_Ascending ? compare < 0 : compare > 0;
+                            }
+                        }
+                        return false;
+                    });
+                    sortSpecs->SpecsDirty = false;
+                }
+
+                for (size_t index : order) {
+                    const StoreInspector::ModelUsage& model = report.models[index];
+                    ImGui::TableNextRow();
+                    ImGui::TableNextColumn(); ImGui::TextUnformatted(model.name.c_str());
+                    ImGui::TableNextColumn(); ImGui::Text("%d", model.layers);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f GB", model.declaredBytes / 1e9);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f GB", model.diskBytes / 1e9);
+                    ImGui::TableNextColumn(); ImGui::Text("%.2f GB", model.uniqueBytes / 1e9);
+                    ImGui::TableNextColumn();
+                    if (model.sharedBytes > 0) ImGui::Text("%.2f GB", model.sharedBytes / 1e9); else ImGui::TextDisabled("-");
+                    ImGui::TableNextColumn();
+                    if (model.missingBlobs > 0) ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "%d", model.missingBlobs); else ImGui::TextDisabled("-");
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
+    // RefreshCatalog() - applies a reloaded ollama list, updating entries in place so indices stay valid
+    static void RefreshCatalog(const std::vector<ModelCatalog::Entry>& entries) {
+        for (const ModelCatalog::Entry& loaded : entries) {
+            auto found = std::find(model_names.begin(), model_names.end(), loaded.name);
+            if (found == model_names.end()) {
+                found = std::find(model_names.begin(), model_names.end(), loaded.name.substr(0, loaded.name.rfind(':'))); // added without tag
+            }
+            if (found != model_names.end()) {
+                catalog[found - model_names.begin()] = loaded;
+                *found = loaded.name;
+            }
+            else {
+                catalog.push_back(loaded);
+                model_names.push_back(loaded.name);
+                compareSelected.push_back(false);
+            }
+        }
+        catalogView.invalidate();
+    }
+
+    // formatDuration() - 75 -> "1m 15s"
+    static std::string formatDuration(double seconds) {
+        int total = (int)seconds;
+        if (total >= 3600) return std::to_string(total / 3600) + "h " + std::to_string(total % 3600 / 60) + "m";
+        if (total >= 60) return std::to_string(total / 60) + "m " + std::to_string(total % 60) + "s";
+        return std::to_string(total) + "s";
+    }
+
+    // UpdateCatalog() - called every frame, keeps `ollama list` and `ollama show` off the UI thread
+    // the catalog is read at startup and after each finished pull; model info is read one model at a time,
+    // since the ollama show fallback shares one temporary file
+    static void UpdateCatalog() {
+        if (catalogPulls != PullManager::completedPulls() && !pendingCatalog) {
+            catalogPulls = PullManager::completedPulls();
+            std::shared_ptr<CatalogLoad> load = std::make_shared<CatalogLoad>();
+            pendingCatalog = load;
+            ThreadPool::group("catalog").submit([load]() {
+                load->entries = ModelCatalog::Load();
+                load->done = true;
+            });
+        }
+        if (pendingCatalog && pendingCatalog->done) {
+            if (pendingCatalog->entries.empty()) {
+                std::cerr << "Error: Failed to run ollama list command" << std::endl;
+            }
+            RefreshCatalog(pendingCatalog->entries); // model_names and catalog share indices
+            pendingCatalog.reset();
+            for (auto& chatTab : tabs) {
+                if (chatTab->client.getModel().empty() && !model_names.empty()) {
+                    chatTab->client.setModel(model_names[chatTab->selected]); // tabs opened before the first load
+                }
+            }
+            if (model_info_model.empty() && !model_names.empty()) {
+                model_info_model = ActiveTab().client.getModel();
+            }
+        }
+        if (pendingInfo && pendingInfo->done) {
+            model_info = pendingInfo->text;
+            model_info_shown = pendingInfo->model;
+            pendingInfo.reset();
+        }
+        if (!pendingInfo && !model_info_model.empty() && model_info_shown != model_info_model) {
+            std::shared_ptr<ModelInfoLoad> load = std::make_shared<ModelInfoLoad>();
+            load->model = model_info_model;
+            pendingInfo = load;
+            ThreadPool::group("catalog").submit([load]() {
+                load->text = get_ollama_model_info(load->model);
+                load->done = true;
+            });
+        }
+    }
+
+    // Renders Model Pulls Window - per-layer progress, throughput and ETA of model downloads
+    void RenderPullsWindow() {
+        if (!showPullsWindow) {
+            return;
+        }
+        static char pullName[64] = "";
+        static int concurrent = PullManager::maxConcurrent();
+        static float capMegabytes = 0.0f;
+
+        ImGui::SetNextWindowPos(ImVec2(160, 220), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowSize(ImVec2(760, 400), ImGuiCond_FirstUseEver);
+        if (ImGui::Begin("Model Pulls", &showPullsWindow, ImGuiWindowFlags_NoCollapse)) {
+            ImGui::SetNextItemWidth(260);
+            bool submitted = ImGui::InputTextWithHint("##PullName", "model[:tag]", pullName, IM_ARRAYSIZE(pullName), ImGuiInputTextFlags_EnterReturnsTrue);
+            ImGui::SameLine();
+            if ((ImGui::Button("Pull") || submitted) && strlen(pullName) > 0) {
+                PullManager::pull(pullName);
+                memset(pullName, 0, sizeof(pullName));
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear finished")) {
+                PullManager::clearFinished();
+            }
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputInt("Concurrent pulls", &concurrent)) {
+                concurrent = concurrent < 1 ? 1 : concurrent;
+                PullManager::setMaxConcurrent(concurrent);
+            }
+            ImGui::SameLine();
+            ImGui::SetNextItemWidth(120);
+            if (ImGui::InputFloat("Bandwidth cap (MB/s)", &capMegabytes, 5.0f, 50.0f, "%.0f")) {
+                capMegabytes = capMegabytes < 0.0f ? 0.0f : capMegabytes;
+                PullManager::setBandwidthCap((uint64_t)(capMegabytes * 1e6));
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("0 = no limit; pulls are paused and resumed to stay under the cap");
+            }
+            ImGui::Text("Total: %.1f MB/s", PullManager::throughput() / 1e6);
+
+            for (const PullManager::Row& row : PullManager::snapshot()) {
+                ImGui::PushID(row.model.c_str());
+                ImGui::Separator();
+                bool open = ImGui::TreeNode("##layers", "%s", row.model.c_str());
+                ImGui::SameLine(220);
+                ImGui::TextUnformatted(PullManager::stateName(row.state));
+                ImGui::SameLine(300);
+                char overlay[64];
+                snprintf(overlay, sizeof(overlay), "%.2f / %.2f GB", row.completed / 1e9, row.total / 1e9);
+                ImGui::ProgressBar(row.total > 0 ? (float)row.completed / row.total : 0.0f, ImVec2(200, 0), overlay);
+                ImGui::SameLine();
+                if (row.state == PullManager::Pulling) {
+                    ImGui::Text("%.1f MB/s", row.bytesPerSecond / 1e6);
+                    if (row.etaSeconds >= 0.0) {
+                        ImGui::SameLine();
+                        ImGui::TextDisabled("ETA %s", formatDuration(row.etaSeconds).c_str());
+                    }
+                    ImGui::SameLine();
+                }
+                if (row.state == PullManager::Queued || row.state == PullManager::Pulling || row.state == PullManager::Paused) {
+                    if (ImGui::SmallButton("Cancel")) {
+                        PullManager::cancel(row.model);
+                    }
+                }
+                else if (row.state != PullManager::Done) {
+                    if (ImGui::SmallButton("Retry")) {
+                        PullManager::pull(row.model); // resumes from the blobs already downloaded
+                    }
+                }
+                if (!row.error.empty()) {
+                    ImGui::TextColored(ImVec4(0.9f, 0.4f, 0.3f, 1.0f), "%s (attempt %d)", row.error.c_str(), row.attempts);
+                }
+                if (open) {
+                    ImGui::TextDisabled("%s", row.status.c_str());
+                    for (const PullManager::Layer& layer : row.layers) {
+                        ImGui::TextUnformatted(layer.digest.substr(0, 19).c_str());
+                        ImGui::SameLine(220);
+                        ImGui::ProgressBar(layer.total > 0 ? (float)layer.completed / layer.total : 0.0f, ImVec2(200, 0));
+                        ImGui::SameLine();
+                        ImGui::Text("%.1f MB", layer.total / 1e6);
+                    }
+                    ImGui::TreePop();
+                }
+                ImGui::PopID();
+            }
+        }
+        ImGui::End();
+    }
+
+    // RefreshHistoryList() - lists the saved chats, called on the "history" pool group
+    void RefreshHistoryList() {
+        std::vector<int> files;
+        for (int fileNumber = 1; fileNumber <= ChatHistory::MaxFiles; ++fileNumber) {
+            if (ChatHistory::Exists(fileNumber)) {
+                files.push_back(fileNumber);
+            }
+        }
+        std::lock_guard<std::mutex> lock(historyMutex);
+        historyFiles = files;
+    }
+
+    // Init() - starts background work that runs ollama, once the window is up rather than during static initialization
+    void Init() {
+        ModelResidency::startPolling(5); // keeps the residency table current
+    }
+
+    // Shutdown() - stops generations and background work before the app state is destroyed
+    void Shutdown() {
+        for (auto& chatTab : tabs) {
+            chatTab->client.cancel();
+        }
+        for (auto& compareClient : compareClients) {
+            compareClient->cancel();
+        }
+        PullManager::shutdown();
+        ModelResidency::stopPolling();
+        EndpointPool::shutdown();
+        AdmissionControl::shutdown();
+        MetricsExporter::shutdown();
+        ThreadPool::shutdown();
+        ResponseCache::flush(); // a batched index write the pool dropped
+    }
+
     // Main Render Function for UI
     void RenderUI() {
-        RenderApplicationWindow();
+        TRACE_SCOPE("App::RenderUI");
+        UpdateCatalog();
+        {
+            TRACE_SCOPE("RenderApplicationWindow");
+            RenderApplicationWindow();
+        }
 
-        RenderQuestionInputWindow();
-        RenderQuestionOutputWindow();
+        {
+            TRACE_SCOPE("RenderQuestionInputWindow");
+            RenderQuestionInputWindow();
+        }
+        {
+            TRACE_SCOPE("RenderQuestionOutputWindow");
+            RenderQuestionOutputWindow();
+        }
+        RenderStatsWindow();
+        RenderMetricsWindow();
+        RenderCacheWindow();
+        RenderResidencyWindow();
+        RenderEndpointsWindow();
+        RenderAdmissionWindow();
+        RenderContextWindow();
+        RenderStoreWindow();
+        RenderPullsWindow();
     }
 
 }
\ No newline at end of file
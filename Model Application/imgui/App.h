@@ -1,4 +1,5 @@
 ﻿#pragma once
+#include <string>
 #include <vector>
 #include <fstream>
 #include <algorithm>
@@ -22,6 +23,54 @@ namespace App {
     // Renders Question Output Window
     void RenderQuestionOutputWindow();
 
+    // Renders side-by-side answers of compare mode - called by RenderQuestionOutputWindow()
+    void RenderCompareView();
+
+    // Renders conversation tabs - called by RenderQuestionOutputWindow()
+    void RenderConversationTabs();
+
+    // Renders Generation Stats Window
+    void RenderStatsWindow();
+
+    // Renders Metrics Export Window
+    void RenderMetricsWindow();
+
+    // Renders Response Cache Window
+    void RenderCacheWindow();
+
+    // Renders a model's residency state - called by RenderApplicationWindow() and RenderResidencyWindow()
+    void RenderResidencyState(const std::string& model);
+
+    // Renders Model Residency Window
+    void RenderResidencyWindow();
+
+    // Renders Endpoints Window
+    void RenderEndpointsWindow();
+
+    // Renders Admission Window
+    void RenderAdmissionWindow();
+
+    // Renders whether the planned num_ctx fits - called by RenderQuestionInputWindow() before sending
+    void RenderContextFit(const std::string& model);
+
+    // Renders Context Planner Window
+    void RenderContextWindow();
+
+    // Renders Model Store Window
+    void RenderStoreWindow();
+
+    // Renders Model Pulls Window
+    void RenderPullsWindow();
+
+    // Lists saved chats - called on the "history" pool group after saving/removing
+    void RefreshHistoryList();
+
+    // Starts residency polling - called by main() before the message loop
+    void Init();
+
+    // Stops generations and joins the thread pool - called by main() after the message loop
+    void Shutdown();
+
     // Main Render Function for UI
     void RenderUI();
 
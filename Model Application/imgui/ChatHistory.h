@@ -0,0 +1,141 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Conversation.h"
+#include "Trace.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// ChatHistory - saved conversations, stored as chat_history/chat_history_N.txt
+namespace ChatHistory {
+
+    // temp limit to 60 history. (will soon have filenames given by ai, theres limits without filesystem from C++17)
+    const int MaxFiles = 60;
+
+    // FilePath() - path of the given history file number
+    inline std::string FilePath(int fileNumber) {
+        return "chat_history/chat_history_" + std::to_string(fileNumber) + ".txt";
+    }
+
+    // Exists() - is there a saved chat with this number?
+    inline bool Exists(int fileNumber) {
+        return std::ifstream(FilePath(fileNumber)).good();
+    }
+
+    // Save() - writes a conversation to the next free history file
+    inline bool Save(const Conversation& conversation) {
+        TRACE_SCOPE("ChatHistory::Save");
+        #ifdef _WIN32
+             _mkdir("chat_history");
+        #else
+             mkdir("chat_history", 0755);
+        #endif
+        int fileNumber = 1;
+        std::string filePath;
+        do {
+            filePath = FilePath(fileNumber);
+            fileNumber++;
+        } while (std::ifstream(filePath).good());
+        std::ofstream outFile(filePath);
+        if (!outFile.is_open()) {
+            return false;
+        }
+        for (size_t i = 0; i < conversation.size(); ++i) {
+            if (conversation[i].length == 0) {
+                continue;
+            }
+            // pieces are written as they are stored, the message is never made contiguous
+            outFile << (conversation[i].role == Conversation::User ? "User Prompt: " : "Response: ");
+            conversation.forEachSegment(i, [&outFile](const char* begin, const char* end) { outFile.write(begin, end - begin); });
+            outFile << "\n\n";
+        }
+        outFile.close();
+        return true;
+    }
+
+    // AddMessage() - appends a loaded message, its model and times are not saved
+    inline void AddMessage(Conversation& conversation, bool isPrompt, const std::string& message) {
+        size_t index = conversation.add(isPrompt ? Conversation::User : Conversation::Assistant, "", 0);
+        conversation.append(index, message);
+    }
+
+    // Load() - reads a saved conversation, replacing the given one
+    inline bool Load(int fileNumber, Conversation& conversation) {
+        TRACE_SCOPE("ChatHistory::Load");
+        std::ifstream inFile(FilePath(fileNumber));
+        if (!inFile.is_open()) {
+            return false;
+        }
+        std::string line;
+        std::string currentMessage;
+        bool isPrompt = false;
+
+        conversation.clear();
+
+        while (std::getline(inFile, line)) {
+            if (line.empty()) continue;
+
+            if (line.find("User Prompt: ") == 0) {
+                // Save previous message before resetting
+                if (!currentMessage.empty()) {
+                    AddMessage(conversation, isPrompt, currentMessage);
+                }
+                currentMessage = line.substr(12);
+                isPrompt = true;
+            }
+            else if (line.find("Response: ") == 0) {
+                // Save previous message before resetting
+                if (!currentMessage.empty()) {
+                    AddMessage(conversation, isPrompt, currentMessage);
+                }
+                currentMessage = line.substr(10);
+                isPrompt = false;
+            }
+            else {
+                currentMessage += (currentMessage.empty() ? "" : "\n") + line;
+            }
+        }
+        // store last msg
+        if (!currentMessage.empty()) {
+            AddMessage(conversation, isPrompt, currentMessage);
+        }
+
+        inFile.close();
+        return true;
+    }
+
+    // Remove() - deletes a saved chat
+    inline void Remove(int fileNumber) {
+        TRACE_SCOPE("ChatHistory::Remove");
+        std::string filePath = FilePath(fileNumber);
+        if (std::ifstream(filePath).good()) std::remove(filePath.c_str());
+    }
+
+    // StoreSize - number and total bytes of saved chats
+    struct StoreSize {
+        int files = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Size() - walks the history files, used by the metrics export
+    inline StoreSize Size() {
+        TRACE_SCOPE("ChatHistory::Size");
+        StoreSize size;
+        for (int fileNumber = 1; fileNumber <= MaxFiles; ++fileNumber) {
+            std::ifstream file(FilePath(fileNumber), std::ios::binary | std::ios::ate);
+            if (!file.good()) {
+                continue;
+            }
+            size.files++;
+            size.bytes += (uint64_t)file.tellg();
+        }
+        return size;
+    }
+
+}
@@ -0,0 +1,128 @@
+﻿#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+
+// ChunkedDecoder - HTTP/1.1 chunked transfer decoding as a resumable state machine
+// Fed whatever each read returned, it hands payload out as spans of the same buffer, so no payload byte is
+// copied; chunk size lines, extensions and trailers split across reads just leave it in the state they reached.
+class ChunkedDecoder {
+public:
+    typedef std::function<void(char* data, size_t length)> PayloadHandler;
+
+    // decode() - consumes a read, calling onPayload for every run of payload in it; false once the encoding is broken
+    bool decode(char* data, size_t length, const PayloadHandler& onPayload) {
+        char* end = data + length;
+        for (char* cursor = data; cursor < end && state != Done && state != Failed; ) {
+            if (state == Payload) {
+                size_t run = (size_t)(end - cursor) < remaining ? (size_t)(end - cursor) : (size_t)remaining;
+                onPayload(cursor, run);
+                cursor += run;
+                remaining -= run;
+                if (remaining == 0) {
+                    state = PayloadEnd;
+                }
+                continue;
+            }
+            step(*cursor++);
+        }
+        return state != Failed;
+    }
+
+    // done() - the last chunk and the trailers have been read
+    bool done() const { return state == Done; }
+
+    bool failed() const { return state == Failed; }
+
+private:
+    enum State {
+        Size,         // hex digits of the chunk size
+        Extension,    // ";name=value" after the size, ignored
+        SizeLf,       // '\n' ending the size line
+        Payload,
+        PayloadEnd,   // "\r\n" after the payload
+        PayloadLf,
+        TrailerStart, // start of a trailer line, an empty one ends the message
+        Trailer,
+        TrailerLf,
+        Done,
+        Failed
+    };
+
+    State state = Size;
+    uint64_t size = 0;      // of the chunk whose size line is being read
+    uint64_t remaining = 0; // payload bytes of the current chunk still to come
+    bool digits = false;    // size line had at least one digit
+
+    // step() - one byte outside the payload
+    void step(char c) {
+        switch (state) {
+        case Size: {
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit >= 0) {
+                if (size >> 56 != 0) {
+                    state = Failed; // absurd chunk size
+                    return;
+                }
+                size = size * 16 + digit;
+                digits = true;
+            }
+            else if (c == ';' || c == ' ' || c == '\t') {
+                state = Extension;
+            }
+            else if (c == '\r') {
+                state = SizeLf;
+            }
+            else if (c == '\n') {
+                endSizeLine();
+            }
+            else {
+                state = Failed;
+            }
+            return;
+        }
+        case Extension:
+            if (c == '\r') state = SizeLf;
+            else if (c == '\n') endSizeLine();
+            return;
+        case SizeLf:
+            if (c == '\n') endSizeLine();
+            else state = Failed;
+            return;
+        case PayloadEnd:
+            if (c == '\r') state = PayloadLf;
+            else if (c == '\n') state = Size; // bare LF, tolerated
+            else state = Failed;
+            return;
+        case PayloadLf:
+            state = c == '\n' ? Size : Failed;
+            return;
+        case TrailerStart:
+            if (c == '\r') state = TrailerLf;
+            else if (c == '\n') state = Done;
+            else state = Trailer;
+            return;
+        case Trailer:
+            if (c == '\n') state = TrailerStart;
+            return;
+        case TrailerLf:
+            state = c == '\n' ? Done : Failed;
+            return;
+        default:
+            return;
+        }
+    }
+
+    // endSizeLine() - starts the chunk's payload, or the trailers after the last (zero size) chunk
+    void endSizeLine() {
+        if (!digits) {
+            state = Failed;
+            return;
+        }
+        remaining = size;
+        state = size == 0 ? TrailerStart : Payload;
+        size = 0;
+        digits = false;
+    }
+};
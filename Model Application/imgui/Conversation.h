@@ -0,0 +1,209 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Conversation - the messages of one chat, a compact table plus an arena holding their text
+// Text lives in pieces carved from fixed-size blocks; a piece that is the newest thing in the arena grows in place,
+// so a streamed answer fills its block without moving a byte and links a new piece only when the block is full.
+// There is no allocation per message, and clear() frees the whole chat at once.
+class Conversation {
+public:
+    enum Role : uint8_t { User, Assistant };
+    static const uint32_t None = 0xFFFFFFFF; // offset of no piece, pieces are 4 byte aligned so none sits there
+
+    // Message - one row of the table, 32 bytes
+    struct Message {
+        int64_t created = 0;      // unix time, 0 when loaded from a history file
+        uint32_t first = None;    // arena offset of the first piece
+        uint32_t last = None;     // arena offset of the last piece, where appends go
+        uint32_t length = 0;      // bytes of text
+        uint32_t tokens = 0;      // prompt tokens evaluated, or tokens generated
+        uint32_t durationMs = 0;  // generation time of a response, 0 while streaming
+        uint16_t model = 0;       // index into models()
+        uint8_t role = User;
+    };
+
+    static const size_t BlockSize = 64 * 1024; // bytes of one arena block
+    static const size_t MaxBlocks = 65536;     // offsets are 32 bit, so a chat holds at most 4 GiB of text
+
+    Conversation() {}
+    Conversation(const Conversation& other) : messages(other.messages), modelNames(other.modelNames), top(other.top) {
+        for (size_t i = 0; i < other.blocks.size(); ++i) {
+            blocks.emplace_back(new char[BlockSize]);
+            std::memcpy(blocks.back().get(), other.blocks[i].get(), i + 1 == other.blocks.size() ? top : (size_t)BlockSize);
+        }
+    }
+    Conversation(Conversation&&) = default;
+    Conversation& operator=(Conversation&&) = default;
+    Conversation& operator=(const Conversation& other) {
+        if (this != &other) {
+            Conversation copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    size_t size() const { return messages.size(); }
+    bool empty() const { return messages.empty(); }
+    const Message& operator[](size_t index) const { return messages[index]; }
+
+    // models() - names messages refer to by index
+    const std::vector<std::string>& models() const { return modelNames; }
+
+    // add() - starts an empty message, returns its index
+    size_t add(Role role, const std::string& model, int64_t created = (int64_t)time(nullptr)) {
+        Message message;
+        message.role = role;
+        message.model = modelIndex(model);
+        message.created = created;
+        messages.push_back(message);
+        return messages.size() - 1;
+    }
+
+    // append() - adds text to a message, in place when its last piece is the newest one in the arena
+    void append(size_t index, const char* text, size_t count) {
+        Message& message = messages[index];
+        while (count > 0) {
+            if (message.last == None || message.last + sizeof(Piece) + piece(message.last).length != end() || top == BlockSize) {
+                if (!startPiece(message)) {
+                    return; // arena full, the rest is dropped
+                }
+            }
+            size_t room = BlockSize - top;
+            size_t run = room < count ? room : count;
+            std::memcpy(blocks.back().get() + top, text, run);
+            piece(message.last).length += (uint32_t)run;
+            message.length += (uint32_t)run;
+            top += run;
+            text += run;
+            count -= run;
+        }
+    }
+    void append(size_t index, const std::string& text) { append(index, text.data(), text.size()); }
+
+    // setTokens()/setDuration() - filled in once the generation reports them
+    void setTokens(size_t index, int tokens) { messages[index].tokens = tokens > 0 ? (uint32_t)tokens : 0; }
+    void setDuration(size_t index, double seconds) { messages[index].durationMs = seconds > 0.0 ? (uint32_t)(seconds * 1000.0) : 0; }
+
+    // clear() - drops every message and frees the arena in one go ("New Chat")
+    void clear() {
+        std::vector<Message>().swap(messages);
+        std::vector<std::unique_ptr<char[]>>().swap(blocks);
+        modelNames.clear();
+        top = BlockSize;
+    }
+
+    // forEachSegment() - calls visit(begin, end) for every piece of a message's text, in order
+    template <typename Visit>
+    void forEachSegment(size_t index, Visit visit) const {
+        for (uint32_t offset = messages[index].first; offset != None; ) {
+            const Piece& current = piece(offset);
+            const char* text = at(offset) + sizeof(Piece);
+            visit(text, text + current.length);
+            offset = current.next;
+        }
+    }
+
+    // forEachLine() - calls visit(begin, end) for every line of a message, without its '\n'
+    // lines inside one piece are passed in place, only a line crossing a piece boundary is gathered in scratch;
+    // a final '\n' does not start another line, as with ImGui's text measurement
+    template <typename Visit>
+    void forEachLine(size_t index, std::string& scratch, Visit visit) const {
+        scratch.clear();
+        bool carrying = false; // scratch holds the start of the current line
+        for (uint32_t offset = messages[index].first; offset != None; ) {
+            const Piece& current = piece(offset);
+            const char* cursor = at(offset) + sizeof(Piece);
+            const char* end = cursor + current.length;
+            while (cursor < end) {
+                const char* newline = (const char*)std::memchr(cursor, '\n', (size_t)(end - cursor));
+                if (!newline) {
+                    if (current.next == None && !carrying) {
+                        visit(cursor, end); // last line, no copy
+                    }
+                    else {
+                        scratch.append(cursor, end);
+                        carrying = true;
+                    }
+                    break;
+                }
+                if (carrying) {
+                    scratch.append(cursor, newline);
+                    visit(scratch.data(), scratch.data() + scratch.size());
+                    scratch.clear();
+                    carrying = false;
+                }
+                else {
+                    visit(cursor, newline);
+                }
+                cursor = newline + 1;
+            }
+            offset = current.next;
+        }
+        if (carrying) {
+            visit(scratch.data(), scratch.data() + scratch.size());
+        }
+    }
+
+    // bytesReserved() - table and arena, what the chat holds in memory
+    size_t bytesReserved() const {
+        return messages.capacity() * sizeof(Message) + blocks.size() * BlockSize;
+    }
+
+private:
+    // Piece - header in front of a run of text in the arena
+    struct Piece {
+        uint32_t next;   // offset of the following piece, None for the last
+        uint32_t length; // bytes of text after the header
+    };
+
+    std::vector<Message> messages;
+    std::vector<std::string> modelNames;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t top = BlockSize; // bytes used in the last block, a full "block" before the first one
+
+    char* at(uint32_t offset) { return blocks[offset / BlockSize].get() + offset % BlockSize; }
+    const char* at(uint32_t offset) const { return blocks[offset / BlockSize].get() + offset % BlockSize; }
+    Piece& piece(uint32_t offset) { return *reinterpret_cast<Piece*>(at(offset)); }
+    const Piece& piece(uint32_t offset) const { return *reinterpret_cast<const Piece*>(at(offset)); }
+
+    // end() - offset of the next free byte
+    size_t end() const { return blocks.empty() ? 0 : (blocks.size() - 1) * BlockSize + top; }
+
+    // startPiece() - links an empty piece to the message, in a new block when the last has no room; false when full
+    bool startPiece(Message& message) {
+        top = (top + alignof(Piece) - 1) / alignof(Piece) * alignof(Piece);
+        if (top + sizeof(Piece) >= BlockSize) {
+            if (blocks.size() == MaxBlocks) {
+                return false;
+            }
+            blocks.emplace_back(new char[BlockSize]);
+            top = 0;
+        }
+        uint32_t offset = (uint32_t)end();
+        Piece& created = piece(offset);
+        created.next = None;
+        created.length = 0;
+        if (message.last == None) message.first = offset;
+        else piece(message.last).next = offset;
+        message.last = offset;
+        top += sizeof(Piece);
+        return true;
+    }
+
+    // modelIndex() - index of a model name, added on first use
+    uint16_t modelIndex(const std::string& model) {
+        for (size_t i = 0; i < modelNames.size(); ++i) {
+            if (modelNames[i] == model) {
+                return (uint16_t)i;
+            }
+        }
+        modelNames.push_back(model);
+        return (uint16_t)(modelNames.size() - 1);
+    }
+};
@@ -0,0 +1,389 @@
+﻿#pragma once
+// EndpointPool.h - spreads generations over several ollama daemons
+// include before <windows.h>, like Net.h
+#include "HttpLoop.h"
+#include "Metrics.h"
+#include "ModelResidency.h"
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// EndpointPool - the daemons HTTP generations can go to, with their load and health
+// MODEL_APP_ENDPOINTS lists them ("gpu1:11434,gpu2:11434"), otherwise the pool is the one daemon OLLAMA_HOST names.
+// A request goes to the host with the fewest requests in flight, preferring hosts that already have the model
+// loaded. Every host's /api/ps is polled, which tells both whether it answers and what it has loaded; a host that
+// fails a check or a request is ejected for a backoff that doubles with each consecutive failure. The checker also
+// resolves the host names, so requests (and hedges and retries on the HTTP loop thread) never wait for a lookup.
+class EndpointPool {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Row - one host of the endpoints table
+    struct Row {
+        std::string name;                 // host:port
+        bool ejected = false;
+        double ejectedSeconds = 0.0;      // until the host is tried again
+        int inFlight = 0;
+        uint64_t requests = 0;
+        int failures = 0;                 // consecutive, reset by a success
+        double checkMilliseconds = -1.0;  // last /api/ps round trip, -1 before the first answer
+        std::vector<std::string> resident;
+    };
+
+    enum : size_t { none = (size_t)-1 }; // no host
+
+    // acquire() - picks the host for a request to model and counts it in flight, pass the index to release()
+    // avoid is skipped unless it is the only host, a hedge or retry should not go where the first attempt went
+    static size_t acquire(const std::string& model, OllamaApi::Endpoint& endpoint, size_t avoid = none) {
+        EndpointPool& pool = instance();
+        pool.startChecking();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        std::string name = OllamaCli::CanonicalName(model);
+        Clock::time_point now = Clock::now();
+        size_t best = pool.hosts.size();
+        for (int pass = 0; pass < 2 && best == pool.hosts.size(); ++pass) {
+            for (size_t i = 0; i < pool.hosts.size(); ++i) {
+                if (pool.hosts[i]->listed && (pass == 1 || i != avoid) &&
+                    (best == pool.hosts.size() || pool.better(*pool.hosts[i], *pool.hosts[best], name, now))) {
+                    best = i;
+                }
+            }
+        }
+        Host& host = *pool.hosts[best];
+        host.inFlight++;
+        host.requests++;
+        host.requestCount.add();
+        host.inFlightGauge.add(1);
+        endpoint = host.endpoint;
+        return best;
+    }
+
+    // release() - the request on host finished with status; hostFailed if the host did not answer properly (connect, 5xx, cut off)
+    static void release(size_t index, const std::string& model, bool hostFailed, int status) {
+        EndpointPool& pool = instance();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        Host& host = *pool.hosts[index];
+        host.inFlight--;
+        host.inFlightGauge.add(-1);
+        if (hostFailed) {
+            pool.fail(host);
+            return;
+        }
+        host.failures = 0;
+        if (status == 200) { // not for a 404 of a model the host does not have
+            host.resident.insert(OllamaCli::CanonicalName(model)); // it is now, until the next check says otherwise
+        }
+    }
+
+    // list() - the configured hosts, comma separated
+    static std::string list() {
+        EndpointPool& pool = instance();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        std::string text;
+        for (const auto& host : pool.hosts) {
+            if (host->listed) {
+                text += (text.empty() ? "" : ",") + host->name;
+            }
+        }
+        return text;
+    }
+
+    // setList() - replaces the hosts with a comma separated list, unchanged hosts keep their state
+    // removed hosts stay in the table unlisted, so requests still running on them can release()
+    static void setList(const std::string& text) {
+        EndpointPool& pool = instance();
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.configure(text);
+            pool.checkNow = true; // resolves new hosts, until then they only get requests if no host is resolved
+        }
+        pool.wakeChecker.notify_all();
+    }
+
+    // size() - number of configured hosts
+    static size_t size() {
+        EndpointPool& pool = instance();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        size_t listed = 0;
+        for (const auto& host : pool.hosts) {
+            listed += host->listed ? 1 : 0;
+        }
+        return listed;
+    }
+
+    // shutdown() - ends the health checker and waits for it, see App::Shutdown()
+    static void shutdown() {
+        EndpointPool& pool = instance();
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.stopping = true;
+            pool.checking = true; // a later acquire() does not start it again
+        }
+        pool.wakeChecker.notify_all();
+        if (pool.checker.joinable()) {
+            pool.checker.join();
+        }
+    }
+
+    // snapshot() - the configured hosts in list order
+    static std::vector<Row> snapshot() {
+        EndpointPool& pool = instance();
+        pool.startChecking();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        Clock::time_point now = Clock::now();
+        std::vector<Row> rows;
+        for (const auto& host : pool.hosts) {
+            if (!host->listed) {
+                continue;
+            }
+            Row row;
+            row.name = host->name;
+            row.ejected = host->ejectedUntil > now;
+            row.ejectedSeconds = row.ejected ? std::chrono::duration<double>(host->ejectedUntil - now).count() : 0.0;
+            row.inFlight = host->inFlight;
+            row.requests = host->requests;
+            row.failures = host->failures;
+            row.checkMilliseconds = host->checkMilliseconds;
+            row.resident.assign(host->resident.begin(), host->resident.end());
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+private:
+    // Host - one daemon, guarded by the pool mutex
+    struct Host {
+        OllamaApi::Endpoint endpoint;
+        std::string name;
+        bool listed = true;
+        int inFlight = 0;
+        uint64_t requests = 0;
+        int failures = 0;
+        Clock::time_point ejectedUntil;
+        bool checkPending = false;     // /api/ps request open
+        HttpLoop::RequestId check = 0; // its id, once HttpLoop::get() returned it
+        Clock::time_point checkStarted;
+        double checkMilliseconds = -1.0;
+        std::set<std::string> resident; // canonical model names
+        Counter& requestCount;
+        Counter& ejections;
+        Gauge& inFlightGauge;
+
+        explicit Host(const OllamaApi::Endpoint& hostEndpoint)
+            : endpoint(hostEndpoint), name(hostEndpoint.host + ":" + std::to_string(hostEndpoint.port)),
+              requestCount(MetricsRegistry::counter("model_app_endpoint_requests_total", "Generations sent to each endpoint.", MetricsRegistry::label("endpoint", name))),
+              ejections(MetricsRegistry::counter("model_app_endpoint_ejections_total", "Times an endpoint was ejected after failing.", MetricsRegistry::label("endpoint", name))),
+              inFlightGauge(MetricsRegistry::gauge("model_app_endpoint_in_flight", "Generations running on each endpoint.", MetricsRegistry::label("endpoint", name))) {}
+    };
+
+    enum {
+        checkIntervalSeconds = 5,
+        coldPenalty = 2,        // a cold host wins once every warm one has this many more requests in flight
+        maxBackoffSeconds = 60
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Host>> hosts; // never shrinks, indexes handed out by acquire() stay valid
+    bool checking = false;
+    bool checkNow = false;                    // run the next round without waiting out the interval
+    bool stopping = false;                    // shutdown() was called, the checker ends and is not restarted
+    std::condition_variable wakeChecker;
+    std::thread checker;
+
+    EndpointPool() {
+        configure(MetricsExporter::environment("MODEL_APP_ENDPOINTS"));
+    }
+
+    // instance() - never destroyed, health checks finish on the HTTP loop thread
+    static EndpointPool& instance() {
+        static EndpointPool* pool = new EndpointPool();
+        return *pool;
+    }
+
+    // configure() - applies a comma separated host list, OLLAMA_HOST's daemon if it names none, mutex held
+    void configure(const std::string& text) {
+        std::vector<std::string> items;
+        for (size_t start = 0; start <= text.length(); ) {
+            size_t comma = std::min(text.find(',', start), text.length());
+            std::string item = text.substr(start, comma - start);
+            item.erase(0, item.find_first_not_of(" \t"));
+            item.erase(item.find_last_not_of(" \t") + 1);
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+            start = comma + 1;
+        }
+        if (items.empty()) {
+            items.push_back(MetricsExporter::environment("OLLAMA_HOST"));
+        }
+        for (auto& host : hosts) {
+            host->listed = false;
+        }
+        for (const std::string& item : items) {
+            OllamaApi::Endpoint endpoint = OllamaApi::ParseEndpoint(item);
+            std::string name = endpoint.host + ":" + std::to_string(endpoint.port);
+            auto found = std::find_if(hosts.begin(), hosts.end(), [&name](const std::unique_ptr<Host>& host) { return host->name == name; });
+            if (found == hosts.end()) {
+                hosts.push_back(std::unique_ptr<Host>(new Host(endpoint)));
+            }
+            else {
+                (*found)->listed = true;
+            }
+        }
+    }
+
+    // better() - whether a should take the next request for model rather than b, mutex held
+    // ejected (or not yet resolved) hosts only when every host is (the one back soonest), then least load with
+    // cold hosts penalized
+    bool better(const Host& a, const Host& b, const std::string& model, Clock::time_point now) const {
+        bool aEjected = a.ejectedUntil > now || a.endpoint.address.empty();
+        bool bEjected = b.ejectedUntil > now || b.endpoint.address.empty();
+        if (aEjected != bEjected) {
+            return bEjected;
+        }
+        if (aEjected) {
+            return a.ejectedUntil < b.ejectedUntil;
+        }
+        int aScore = a.inFlight + (a.resident.count(model) ? 0 : coldPenalty);
+        int bScore = b.inFlight + (b.resident.count(model) ? 0 : coldPenalty);
+        if (aScore != bScore) {
+            return aScore < bScore;
+        }
+        return a.requests < b.requests; // even out hosts that tie
+    }
+
+    // fail() - counts a failure and ejects the host, 1 s doubling up to a minute, mutex held
+    void fail(Host& host) {
+        host.failures++;
+        int backoff = std::min<int>(maxBackoffSeconds, 1 << std::min(host.failures - 1, 6));
+        host.ejectedUntil = Clock::now() + std::chrono::seconds(backoff);
+        host.ejections.add();
+        Trace::instant("endpoint ejected", host.name + " for " + std::to_string(backoff) + " s");
+    }
+
+    // startChecking() - resolves the hosts and starts the health checker on first use
+    // the first use comes from a request being started (UI thread) or the endpoints table, never the HTTP loop thread
+    void startChecking() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (checking) {
+                return;
+            }
+            checking = true;
+        }
+        resolveAll();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            return;
+        }
+        checker = std::thread([this]() {
+            Trace::setThreadName("Endpoint checker");
+            for (;;) {
+                checkAll();
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeChecker.wait_for(lock, std::chrono::seconds(checkIntervalSeconds), [this]() { return checkNow || stopping; });
+                checkNow = false;
+                if (stopping) {
+                    return;
+                }
+            }
+        });
+    }
+
+    // resolveAll() - looks up every listed host and caches its address, an unresolvable host counts as failed
+    // the lookups block, so they run without the mutex: a name changing its address is picked up every round
+    void resolveAll() {
+        std::vector<std::pair<size_t, OllamaApi::Endpoint>> listed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < hosts.size(); ++i) {
+                if (hosts[i]->listed) {
+                    listed.push_back(std::make_pair(i, hosts[i]->endpoint));
+                }
+            }
+        }
+        for (auto& entry : listed) {
+            bool ok = OllamaApi::Resolve(entry.second);
+            std::lock_guard<std::mutex> lock(mutex);
+            Host& host = *hosts[entry.first];
+            if (ok) {
+                host.endpoint = entry.second;
+            }
+            else if (host.endpoint.address.empty() && host.ejectedUntil <= Clock::now()) {
+                fail(host); // a known address is kept when a later lookup fails
+            }
+        }
+    }
+
+    // checkAll() - resolves the hosts, then asks every host that is not ejected for /api/ps; a check still open
+    // from last time counts as failed
+    void checkAll() {
+        resolveAll();
+        std::vector<std::pair<size_t, OllamaApi::Endpoint>> due;
+        std::vector<HttpLoop::RequestId> overdue;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Clock::time_point now = Clock::now();
+            for (size_t i = 0; i < hosts.size(); ++i) {
+                Host& host = *hosts[i];
+                if (host.checkPending) {
+                    overdue.push_back(host.check); // its onDone reports the failure
+                }
+                else if (host.listed && host.ejectedUntil <= now && !host.endpoint.address.empty()) {
+                    host.checkPending = true;
+                    host.checkStarted = now;
+                    due.push_back(std::make_pair(i, host.endpoint));
+                }
+            }
+        }
+        for (HttpLoop::RequestId id : overdue) {
+            HttpLoop::cancel(id);
+        }
+        for (const auto& entry : due) {
+            size_t index = entry.first;
+            std::shared_ptr<std::string> body = std::make_shared<std::string>();
+            HttpLoop::RequestId id = HttpLoop::get(entry.second, "/api/ps",
+                [body](int, char* data, size_t length) {
+                    if (body->length() < (1 << 20)) {
+                        body->append(data, length);
+                    }
+                },
+                [this, index, body](const OllamaApi::Result& outcome) {
+                    finishCheck(index, outcome, *body);
+                });
+            std::lock_guard<std::mutex> lock(mutex);
+            if (hosts[index]->checkPending) { // not answered yet
+                hosts[index]->check = id;
+            }
+        }
+    }
+
+    // finishCheck() - a host answered /api/ps (healthy, with its loaded models) or failed to
+    // an answer does not reset the failures, a host that is up but fails requests keeps backing off longer
+    void finishCheck(size_t index, const OllamaApi::Result& outcome, const std::string& body) {
+        std::set<std::string> loaded;
+        for (size_t at = body.find("{\"name\":"); at != std::string::npos; at = body.find("{\"name\":", at + 1)) {
+            loaded.insert(OllamaCli::CanonicalName(OllamaApi::JsonUnescape(OllamaApi::JsonString(body.substr(at), "name"))));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Host& host = *hosts[index];
+        host.checkPending = false;
+        host.check = 0;
+        if (!outcome.error.empty() || outcome.status != 200) {
+            host.resident.clear();
+            fail(host);
+            return;
+        }
+        host.checkMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - host.checkStarted).count();
+        host.resident.swap(loaded);
+    }
+};
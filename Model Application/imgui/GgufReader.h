@@ -0,0 +1,341 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// MappedFile - read-only memory map of a whole file, pages are only read when touched
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        close();
+    }
+
+    // open() - maps a file, false if it cannot be opened or is empty
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            file = nullptr;
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        length = (size_t)fileSize.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+#else
+        descriptor = ::open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (descriptor < 0 || fstat(descriptor, &info) != 0 || info.st_size == 0) {
+            close();
+            return false;
+        }
+        length = (size_t)info.st_size;
+        void* view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        data = view == MAP_FAILED ? nullptr : (const uint8_t*)view;
+#endif
+        if (data == nullptr) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file) CloseHandle(file);
+        mapping = nullptr;
+        file = nullptr;
+#else
+        if (data) munmap((void*)data, length);
+        if (descriptor >= 0) ::close(descriptor);
+        descriptor = -1;
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* bytes() const { return data; }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = nullptr;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+};
+
+// GgufValue - one metadata value; arrays keep only their element type and count
+struct GgufValue {
+    enum Type {
+        Uint8 = 0, Int8 = 1, Uint16 = 2, Int16 = 3, Uint32 = 4, Int32 = 5, Float32 = 6, Bool = 7,
+        String = 8, Array = 9, Uint64 = 10, Int64 = 11, Float64 = 12
+    };
+    Type type = Uint8;
+    uint64_t unsignedValue = 0;
+    int64_t signedValue = 0;
+    double floatValue = 0.0;
+    std::string text;
+    Type arrayType = Uint8;
+    uint64_t arrayCount = 0;
+
+    // asUnsigned() - integer value of any numeric type, 0 otherwise
+    uint64_t asUnsigned() const {
+        switch (type) {
+        case Int8: case Int16: case Int32: case Int64: return signedValue < 0 ? 0 : (uint64_t)signedValue;
+        case Float32: case Float64: return floatValue < 0 ? 0 : (uint64_t)floatValue;
+        case String: case Array: return 0;
+        default: return unsignedValue;
+        }
+    }
+
+    // toString() - display form, arrays as "[type x count]"
+    std::string toString() const {
+        char buffer[64];
+        switch (type) {
+        case String: return text;
+        case Bool: return unsignedValue ? "true" : "false";
+        case Float32: case Float64: snprintf(buffer, sizeof(buffer), "%g", floatValue); return buffer;
+        case Int8: case Int16: case Int32: case Int64: return std::to_string(signedValue);
+        case Array: return "[" + std::to_string(arrayCount) + " items]";
+        default: return std::to_string(unsignedValue);
+        }
+    }
+};
+
+// GgufInfo - header of a GGUF file: key/value metadata and tensor shapes, no tensor data
+struct GgufInfo {
+    uint32_t version = 0;
+    uint64_t tensorCount = 0;
+    std::map<std::string, GgufValue> metadata;
+    uint64_t parameterCount = 0;              // sum of all tensor element counts
+    std::map<uint32_t, uint64_t> tensorTypes; // ggml type -> tensors of that type
+    uint64_t headerBytes = 0;                 // bytes parsed, tensor data starts after alignment
+
+    const GgufValue* find(const std::string& key) const {
+        auto found = metadata.find(key);
+        return found == metadata.end() ? nullptr : &found->second;
+    }
+
+    // number() - numeric value of a key, fallback if absent
+    uint64_t number(const std::string& key, uint64_t fallback = 0) const {
+        const GgufValue* value = find(key);
+        return value ? value->asUnsigned() : fallback;
+    }
+
+    // text() - string value of a key, empty if absent
+    std::string text(const std::string& key) const {
+        const GgufValue* value = find(key);
+        return value ? value->toString() : "";
+    }
+
+    std::string architecture() const { return text("general.architecture"); }
+
+    // archNumber() - "<architecture>.<key>", e.g. archNumber("context_length")
+    uint64_t archNumber(const std::string& key, uint64_t fallback = 0) const {
+        return number(architecture() + "." + key, fallback);
+    }
+};
+
+// GgufReader - parses GGUF v2/v3 headers straight out of a memory map
+// Every read is bounds checked, a truncated or corrupt header makes parse() fail instead of crashing.
+class GgufReader {
+public:
+    // parse() - reads metadata and tensor infos from a mapped file or any buffer
+    static bool parse(const uint8_t* data, size_t size, GgufInfo& info, std::string& error) {
+        GgufReader reader(data, size);
+        uint32_t magic = 0;
+        if (!reader.read(magic) || magic != 0x46554747) { // "GGUF" little endian
+            error = "not a GGUF file";
+            return false;
+        }
+        if (!reader.read(info.version) || info.version < 2 || info.version > 3) {
+            error = "unsupported GGUF version " + std::to_string(info.version);
+            return false;
+        }
+        uint64_t kvCount = 0;
+        if (!reader.read(info.tensorCount) || !reader.read(kvCount)) {
+            error = "truncated header";
+            return false;
+        }
+        for (uint64_t i = 0; i < kvCount; ++i) {
+            std::string key;
+            GgufValue value;
+            uint32_t type = 0;
+            if (!reader.readString(key) || !reader.read(type) || type > GgufValue::Float64 || !reader.readValue((GgufValue::Type)type, value)) {
+                error = "corrupt metadata entry " + std::to_string(i);
+                return false;
+            }
+            info.metadata[key] = value;
+        }
+        for (uint64_t i = 0; i < info.tensorCount; ++i) {
+            std::string name;
+            uint32_t dimensions = 0;
+            if (!reader.readString(name) || !reader.read(dimensions) || dimensions > 8) {
+                error = "corrupt tensor info " + std::to_string(i);
+                return false;
+            }
+            uint64_t elements = 1;
+            for (uint32_t d = 0; d < dimensions; ++d) {
+                uint64_t extent = 0;
+                if (!reader.read(extent)) {
+                    error = "corrupt tensor info " + std::to_string(i);
+                    return false;
+                }
+                elements *= extent;
+            }
+            uint32_t type = 0;
+            uint64_t offset = 0;
+            if (!reader.read(type) || !reader.read(offset)) {
+                error = "corrupt tensor info " + std::to_string(i);
+                return false;
+            }
+            info.parameterCount += elements;
+            info.tensorTypes[type]++;
+        }
+        info.headerBytes = reader.position;
+        return true;
+    }
+
+    // parseFile() - maps a file and parses its header
+    static bool parseFile(const std::string& path, GgufInfo& info, std::string& error) {
+        MappedFile file;
+        if (!file.open(path)) {
+            error = "cannot open " + path;
+            return false;
+        }
+        return parse(file.bytes(), file.size(), info, error);
+    }
+
+    // fileTypeName() - general.file_type (llama_ftype) as ollama prints it
+    static std::string fileTypeName(uint64_t fileType) {
+        static const char* names[] = {
+            "F32", "F16", "Q4_0", "Q4_1", "Q4_1_SOME_F16", "Q4_2", "Q4_3", "Q8_0", "Q5_0", "Q5_1",
+            "Q2_K", "Q3_K_S", "Q3_K_M", "Q3_K_L", "Q4_K_S", "Q4_K_M", "Q5_K_S", "Q5_K_M", "Q6_K",
+            "IQ2_XXS", "IQ2_XS", "Q2_K_S", "IQ3_XS", "IQ3_XXS", "IQ1_S", "IQ4_NL", "IQ3_S", "IQ3_M",
+            "IQ2_S", "IQ2_M", "IQ4_XS", "IQ1_M", "BF16"
+        };
+        return fileType < sizeof(names) / sizeof(names[0]) ? names[fileType] : "type " + std::to_string(fileType);
+    }
+
+    // formatParameters() - 8030261248 -> "8.0B"
+    static std::string formatParameters(uint64_t count) {
+        char buffer[32];
+        if (count >= 1000000000ull) snprintf(buffer, sizeof(buffer), "%.1fB", count / 1e9);
+        else if (count >= 1000000ull) snprintf(buffer, sizeof(buffer), "%.0fM", count / 1e6);
+        else snprintf(buffer, sizeof(buffer), "%llu", (unsigned long long)count);
+        return buffer;
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+
+    GgufReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    bool read(T& value) {
+        if (size - position < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data + position, sizeof(T)); // unaligned, GGUF packs fields
+        position += sizeof(T);
+        return true;
+    }
+
+    bool readString(std::string& text) {
+        uint64_t length = 0;
+        if (!read(length) || length > size - position) {
+            return false;
+        }
+        text.assign((const char*)data + position, (size_t)length);
+        position += (size_t)length;
+        return true;
+    }
+
+    // skipString() - like readString() without copying, used for array elements
+    bool skipString() {
+        uint64_t length = 0;
+        if (!read(length) || length > size - position) {
+            return false;
+        }
+        position += (size_t)length;
+        return true;
+    }
+
+    static size_t scalarSize(GgufValue::Type type) {
+        switch (type) {
+        case GgufValue::Uint8: case GgufValue::Int8: case GgufValue::Bool: return 1;
+        case GgufValue::Uint16: case GgufValue::Int16: return 2;
+        case GgufValue::Uint32: case GgufValue::Int32: case GgufValue::Float32: return 4;
+        case GgufValue::Uint64: case GgufValue::Int64: case GgufValue::Float64: return 8;
+        default: return 0;
+        }
+    }
+
+    bool readValue(GgufValue::Type type, GgufValue& value) {
+        value.type = type;
+        switch (type) {
+        case GgufValue::Uint8: { uint8_t v; if (!read(v)) return false; value.unsignedValue = v; return true; }
+        case GgufValue::Bool: { uint8_t v; if (!read(v)) return false; value.unsignedValue = v != 0; return true; }
+        case GgufValue::Int8: { int8_t v; if (!read(v)) return false; value.signedValue = v; return true; }
+        case GgufValue::Uint16: { uint16_t v; if (!read(v)) return false; value.unsignedValue = v; return true; }
+        case GgufValue::Int16: { int16_t v; if (!read(v)) return false; value.signedValue = v; return true; }
+        case GgufValue::Uint32: { uint32_t v; if (!read(v)) return false; value.unsignedValue = v; return true; }
+        case GgufValue::Int32: { int32_t v; if (!read(v)) return false; value.signedValue = v; return true; }
+        case GgufValue::Uint64: { uint64_t v; if (!read(v)) return false; value.unsignedValue = v; return true; }
+        case GgufValue::Int64: { int64_t v; if (!read(v)) return false; value.signedValue = v; return true; }
+        case GgufValue::Float32: { float v; if (!read(v)) return false; value.floatValue = v; return true; }
+        case GgufValue::Float64: { double v; if (!read(v)) return false; value.floatValue = v; return true; }
+        case GgufValue::String: return readString(value.text);
+        case GgufValue::Array: {
+            // arrays (token lists, merges, scores) are skipped, only their type and length are kept
+            uint32_t elementType = 0;
+            if (!read(elementType) || elementType > GgufValue::Float64 || !read(value.arrayCount)) {
+                return false;
+            }
+            value.arrayType = (GgufValue::Type)elementType;
+            if (value.arrayType == GgufValue::String) {
+                for (uint64_t i = 0; i < value.arrayCount; ++i) {
+                    if (!skipString()) return false;
+                }
+                return true;
+            }
+            size_t elementSize = scalarSize(value.arrayType);
+            if (elementSize == 0 || value.arrayCount > (size - position) / elementSize) {
+                return false; // nested arrays are not used by any model we load
+            }
+            position += (size_t)value.arrayCount * elementSize;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+};
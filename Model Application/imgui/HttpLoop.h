@@ -0,0 +1,536 @@
+﻿#pragma once
+// HttpLoop.h - one I/O thread multiplexing every streamed HTTP request to the daemon
+// include before <windows.h>, like Net.h
+#include "OllamaApi.h"
+#include "ChunkedDecoder.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <sys/epoll.h>
+#elif !defined(_WIN32)
+#include <poll.h>
+#endif
+
+
+// HttpLoop - non-blocking sockets driven by epoll (Linux) or WSAPoll/poll elsewhere
+// A request costs a socket and a few buffers instead of a blocked thread, so hundreds of generations
+// can stream at once. Callbacks run on the loop thread and must not block; whoever consumes the body
+// hands them on through a queue (a TokenStream for generations).
+class HttpLoop {
+public:
+    typedef uint64_t RequestId;
+    typedef std::function<void(int status, char* data, size_t length)> BodyHandler; // status of the response the body belongs to
+    typedef std::function<void(const OllamaApi::Result&)> DoneHandler;
+    typedef std::chrono::steady_clock Clock;
+
+    // Timeouts - deadlines of a request's phases in milliseconds, 0 = none (Timeouts() is all 0); an expired one
+    // ends the request with result.timeout naming the phase
+    struct Timeouts {
+        int connectMs;   // until the connection is up
+        int firstByteMs; // from post() until the first body byte
+        int idleMs;      // between body reads
+    };
+
+    // post() - starts a streamed POST; onBody gets the body as it arrives, onDone the outcome, both on the loop thread
+    // the daemon streams HTTP/1.1 responses chunked, the chunk framing is removed before onBody sees the bytes
+    static RequestId post(const OllamaApi::Endpoint& endpoint, const std::string& path, const std::string& body,
+                          const BodyHandler& onBody, const DoneHandler& onDone, const Timeouts& timeouts = Timeouts()) {
+        return instance().begin(endpoint, "POST " + path + " HTTP/1.1\r\nHost: " + endpoint.host + "\r\nConnection: close\r\n"
+                                "Content-Type: application/json\r\nContent-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body,
+                                onBody, onDone, timeouts);
+    }
+
+    // get() - like post(), for the small GET endpoints (/api/ps, /api/version)
+    static RequestId get(const OllamaApi::Endpoint& endpoint, const std::string& path, const BodyHandler& onBody, const DoneHandler& onDone,
+                         const Timeouts& timeouts = Timeouts()) {
+        return instance().begin(endpoint, "GET " + path + " HTTP/1.1\r\nHost: " + endpoint.host + "\r\nConnection: close\r\n\r\n", onBody, onDone, timeouts);
+    }
+
+    // after() - runs callback on the loop thread once milliseconds have passed, like the handlers it must not block
+    static void after(int milliseconds, const std::function<void()>& callback) {
+        HttpLoop& loop = instance();
+        if (!loop.start()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            loop.addedTimers.push_back(std::make_pair(Clock::now() + std::chrono::milliseconds(milliseconds), callback));
+        }
+        loop.wake();
+    }
+
+    // cancel() - ends a request early, its onDone reports "cancelled"
+    static void cancel(RequestId id) {
+        if (id == 0) {
+            return;
+        }
+        HttpLoop& loop = instance();
+        {
+            std::lock_guard<std::mutex> lock(loop.mutex);
+            loop.cancelled.push_back(id);
+        }
+        loop.wake();
+    }
+
+    // active() - requests currently open on the loop
+    static int64_t active() { return instance().streams.get(); }
+
+private:
+    // Request - one streamed request, owned by the loop thread once added
+    struct Request {
+        RequestId id = 0;
+        SocketHandle socket = INVALID_SOCKET;
+        std::string address; // sockaddr bytes
+        int family = AF_INET;
+        std::string target;  // host:port, for errors
+        std::string out;     // request bytes not yet sent start at sent
+        size_t sent = 0;
+        bool connected = false;
+        std::string headers; // response head until the blank line has arrived
+        bool inBody = false;
+        bool chunked = false; // Transfer-Encoding: chunked, the body ends with the last chunk
+        ChunkedDecoder decoder;
+        OllamaApi::Result result;
+        BodyHandler onBody;
+        DoneHandler onDone;
+        Timeouts timeouts;
+        Clock::time_point started;
+        Clock::time_point deadline = Clock::time_point::max(); // of the current phase
+        bool bodyStarted = false;
+    };
+
+    // begin() - hands a request (its bytes in out) to the loop thread, 0 if it failed already
+    RequestId begin(const OllamaApi::Endpoint& endpoint, const std::string& out, const BodyHandler& onBody, const DoneHandler& onDone,
+                    const Timeouts& timeouts) {
+        std::unique_ptr<Request> request(new Request());
+        request->id = ++lastId;
+        request->onBody = onBody;
+        request->onDone = onDone;
+        request->out = out;
+        request->timeouts = timeouts;
+        request->started = Clock::now();
+        if (!start()) {
+            request->result.error = "socket library unavailable";
+            onDone(request->result);
+            return 0;
+        }
+        // EndpointPool hands out resolved endpoints; a bare host is looked up here, but never on the loop thread
+        // (hedges and retries start there), where a slow lookup would stall every other stream
+        OllamaApi::Endpoint resolved = endpoint;
+        if (resolved.address.empty() && (std::this_thread::get_id() == loopThread || !OllamaApi::Resolve(resolved))) {
+            request->result.error = "cannot resolve " + endpoint.host;
+            onDone(request->result);
+            return 0;
+        }
+        request->address = resolved.address;
+        request->family = resolved.family;
+        request->target = endpoint.host + ":" + std::to_string(endpoint.port);
+
+        RequestId id = request->id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            added.push_back(std::move(request));
+        }
+        wake();
+        return id;
+    }
+
+    // Event - what the poller reported for one socket
+    struct Event {
+        SocketHandle socket;
+        bool readable;
+        bool writable;
+        bool failed;
+    };
+
+    std::mutex mutex; // guards added/cancelled, the rest belongs to the loop thread
+    std::vector<std::unique_ptr<Request>> added;
+    std::vector<RequestId> cancelled;
+    std::vector<std::pair<Clock::time_point, std::function<void()>>> addedTimers;
+    std::map<SocketHandle, std::unique_ptr<Request>> requests;
+    std::multimap<Clock::time_point, std::function<void()>> timers;
+    Clock::time_point nextDeadline = Clock::time_point::max(); // no request's deadline is earlier
+    std::atomic<RequestId> lastId{ 0 };
+    SocketHandle wakeSocket = INVALID_SOCKET; // UDP socket connected to itself, a datagram wakes the loop
+    bool started = false;
+    std::thread::id loopThread; // set by start(), before any request can reach begin()
+    char receiveBuffer[65536]; // every read lands here, body bytes are parsed in place
+#ifdef __linux__
+    int epollHandle = -1;
+#endif
+    Gauge& streams = MetricsRegistry::gauge("model_app_http_streams", "HTTP streams open on the event loop.");
+    Counter& receivedBytes = MetricsRegistry::counter("model_app_http_received_bytes_total", "Bytes received by the HTTP event loop.");
+
+    // instance() - never destroyed, the loop thread runs until the process exits
+    static HttpLoop& instance() {
+        static HttpLoop* loop = new HttpLoop();
+        return *loop;
+    }
+
+    // start() - creates the wake socket and the loop thread on first use
+    bool start() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (started) {
+            return true;
+        }
+        if (!Net::Startup()) {
+            return false;
+        }
+        wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (wakeSocket == INVALID_SOCKET ||
+            bind(wakeSocket, (const sockaddr*)&address, sizeof(address)) != 0 ||
+            getsockname(wakeSocket, (sockaddr*)&address, &length) != 0 ||
+            connect(wakeSocket, (const sockaddr*)&address, sizeof(address)) != 0) {
+            Net::Close(wakeSocket);
+            wakeSocket = INVALID_SOCKET;
+            return false;
+        }
+        setNonBlocking(wakeSocket);
+#ifdef __linux__
+        epollHandle = epoll_create1(EPOLL_CLOEXEC);
+        if (epollHandle < 0) {
+            Net::Close(wakeSocket);
+            wakeSocket = INVALID_SOCKET;
+            return false;
+        }
+        watch(wakeSocket, false, EPOLL_CTL_ADD);
+#endif
+        started = true;
+        std::thread thread([this]() { run(); });
+        loopThread = thread.get_id();
+        thread.detach();
+        return true;
+    }
+
+    // wake() - interrupts the poll so the loop picks up added/cancelled requests
+    void wake() {
+        send(wakeSocket, "w", 1, 0);
+    }
+
+    static void setNonBlocking(SocketHandle socketHandle) {
+#ifdef _WIN32
+        u_long enable = 1;
+        ioctlsocket(socketHandle, FIONBIO, &enable);
+#else
+        fcntl(socketHandle, F_SETFL, fcntl(socketHandle, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    }
+
+    static bool wouldBlock() {
+#ifdef _WIN32
+        int error = WSAGetLastError();
+        return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+#endif
+    }
+
+#ifdef __linux__
+    // watch() - (re)registers a socket with epoll, for writing while connecting/sending
+    void watch(SocketHandle socketHandle, bool writing, int operation) {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP | (writing ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = socketHandle;
+        epoll_ctl(epollHandle, operation, socketHandle, &event);
+    }
+#endif
+
+    // waitEvents() - waits for socket events (or the next timer/deadline), every request is either connecting, sending or receiving
+    std::vector<Event> waitEvents() {
+        std::vector<Event> events;
+        Clock::time_point until = std::min(nextDeadline, timers.empty() ? Clock::time_point::max() : timers.begin()->first);
+        Clock::time_point now = Clock::now();
+        int timeout = until <= now ? 0 : until - now >= std::chrono::seconds(1) ? 1000
+                    : (int)std::chrono::duration_cast<std::chrono::milliseconds>(until - now + std::chrono::microseconds(999)).count();
+#ifdef __linux__
+        epoll_event ready[64];
+        int count = epoll_wait(epollHandle, ready, 64, timeout);
+        for (int i = 0; i < count; ++i) {
+            events.push_back(Event{ ready[i].data.fd, (ready[i].events & (EPOLLIN | EPOLLRDHUP)) != 0,
+                                    (ready[i].events & EPOLLOUT) != 0, (ready[i].events & (EPOLLERR | EPOLLHUP)) != 0 });
+        }
+#else
+        std::vector<pollfd> sockets;
+        pollfd wakeEntry = {};
+        wakeEntry.fd = wakeSocket;
+        wakeEntry.events = POLLIN;
+        sockets.push_back(wakeEntry);
+        for (const auto& entry : requests) {
+            pollfd socketEntry = {};
+            socketEntry.fd = entry.first;
+            socketEntry.events = POLLIN | (entry.second->sent < entry.second->out.length() ? POLLOUT : 0);
+            sockets.push_back(socketEntry);
+        }
+#ifdef _WIN32
+        int count = WSAPoll(sockets.data(), (ULONG)sockets.size(), timeout);
+#else
+        int count = ::poll(sockets.data(), (nfds_t)sockets.size(), timeout);
+#endif
+        for (size_t i = 0; count > 0 && i < sockets.size(); ++i) {
+            if (sockets[i].revents != 0) {
+                events.push_back(Event{ sockets[i].fd, (sockets[i].revents & POLLIN) != 0,
+                                        (sockets[i].revents & POLLOUT) != 0, (sockets[i].revents & (POLLERR | POLLHUP)) != 0 });
+            }
+        }
+#endif
+        return events;
+    }
+
+    // run() - the loop thread
+    void run() {
+        Trace::setThreadName("HTTP loop");
+        for (;;) {
+            std::vector<std::unique_ptr<Request>> newRequests;
+            std::vector<RequestId> cancels;
+            std::vector<std::pair<Clock::time_point, std::function<void()>>> newTimers;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                newRequests.swap(added);
+                cancels.swap(cancelled);
+                newTimers.swap(addedTimers);
+            }
+            for (auto& timer : newTimers) {
+                timers.insert(std::move(timer));
+            }
+            for (auto& request : newRequests) {
+                open(std::move(request));
+            }
+            for (RequestId id : cancels) {
+                for (auto& entry : requests) {
+                    if (entry.second->id == id) {
+                        entry.second->result.error = "cancelled";
+                        close(entry.first);
+                        break;
+                    }
+                }
+            }
+
+            for (const Event& event : waitEvents()) {
+                if (event.socket == wakeSocket) {
+                    char drain[64];
+                    while (recv(wakeSocket, drain, sizeof(drain), 0) > 0) {}
+                    continue;
+                }
+                auto found = requests.find(event.socket);
+                if (found == requests.end()) {
+                    continue;
+                }
+                Request& request = *found->second;
+                if (!request.connected && (event.writable || event.failed)) {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(request.socket, SOL_SOCKET, SO_ERROR, (char*)&error, &length);
+                    if (error != 0 || (event.failed && !event.writable)) {
+                        request.result.error = "cannot connect to " + request.target;
+                        close(event.socket);
+                        continue;
+                    }
+                    request.connected = true;
+                    request.result.connected = true;
+                    setDeadline(request, deadlineAfter(request.started, request.timeouts.firstByteMs));
+                }
+                if (request.connected && event.writable && !flush(request)) {
+                    continue;
+                }
+                if (event.readable || event.failed) {
+                    receive(request);
+                }
+            }
+
+            Clock::time_point now = Clock::now();
+            while (!timers.empty() && timers.begin()->first <= now) {
+                std::function<void()> callback = std::move(timers.begin()->second);
+                timers.erase(timers.begin());
+                callback();
+            }
+            if (nextDeadline <= now) {
+                expire(now);
+            }
+        }
+    }
+
+    // setDeadline() - moves a request's deadline, nextDeadline only ever needs to be early, not exact
+    void setDeadline(Request& request, Clock::time_point deadline) {
+        request.deadline = deadline;
+        nextDeadline = std::min(nextDeadline, deadline);
+    }
+
+    // deadlineAfter() - a deadline milliseconds after start, none for 0
+    static Clock::time_point deadlineAfter(Clock::time_point start, int milliseconds) {
+        return milliseconds > 0 ? start + std::chrono::milliseconds(milliseconds) : Clock::time_point::max();
+    }
+
+    // expire() - ends the requests whose phase ran out of time and finds the next deadline
+    void expire(Clock::time_point now) {
+        std::vector<SocketHandle> expired;
+        nextDeadline = Clock::time_point::max();
+        for (auto& entry : requests) {
+            Request& request = *entry.second;
+            if (request.deadline > now) {
+                nextDeadline = std::min(nextDeadline, request.deadline);
+                continue;
+            }
+            request.result.timeout = !request.connected ? "connect" : !request.bodyStarted ? "first token" : "stall";
+            request.result.error = request.result.timeout + " timeout";
+            expired.push_back(entry.first);
+        }
+        for (SocketHandle socketHandle : expired) {
+            close(socketHandle);
+        }
+    }
+
+    // open() - starts the non-blocking connect of a new request
+    void open(std::unique_ptr<Request> request) {
+        SocketHandle connection = socket(request->family, SOCK_STREAM, IPPROTO_TCP);
+        if (connection == INVALID_SOCKET) {
+            request->result.error = "cannot connect to " + request->target;
+            request->onDone(request->result);
+            return;
+        }
+        setNonBlocking(connection);
+        int noDelay = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+        if (connect(connection, (const sockaddr*)request->address.data(), (int)request->address.length()) != 0 && !wouldBlock()) {
+            Net::Close(connection);
+            request->result.error = "cannot connect to " + request->target;
+            request->onDone(request->result);
+            return;
+        }
+        request->socket = connection;
+        setDeadline(*request, request->timeouts.connectMs > 0 ? deadlineAfter(Clock::now(), request->timeouts.connectMs)
+                                                              : deadlineAfter(request->started, request->timeouts.firstByteMs));
+        streams.add(1);
+#ifdef __linux__
+        watch(connection, true, EPOLL_CTL_ADD);
+#endif
+        requests[connection] = std::move(request);
+    }
+
+    // flush() - sends what the socket takes of the request, false if the request ended
+    bool flush(Request& request) {
+        while (request.sent < request.out.length()) {
+            int sent = send(request.socket, request.out.data() + request.sent, (int)(request.out.length() - request.sent), 0);
+            if (sent < 0 && wouldBlock()) {
+                return true;
+            }
+            if (sent <= 0) {
+                request.result.error = "request failed";
+                close(request.socket);
+                return false;
+            }
+            request.sent += sent;
+        }
+        request.out.clear();
+        request.out.shrink_to_fit();
+        request.sent = 0;
+#ifdef __linux__
+        watch(request.socket, false, EPOLL_CTL_MOD);
+#endif
+        return true;
+    }
+
+    // receive() - reads until the socket would block; headers are collected, body bytes are handed over
+    // in the receive buffer itself, which onBody may modify
+    void receive(Request& request) {
+        for (;;) {
+            int received = recv(request.socket, receiveBuffer, sizeof(receiveBuffer), 0);
+            if (received == 0) {
+                request.result.complete = request.inBody && !request.chunked; // a chunked body ends in deliver()
+                if (!request.inBody || (request.chunked && !request.decoder.done())) {
+                    request.result.error = "connection closed mid-response"; // a truncated answer is a failure, not a short one
+                }
+                close(request.socket);
+                return;
+            }
+            if (received < 0) {
+                if (wouldBlock()) {
+                    return;
+                }
+                request.result.error = "connection lost";
+                close(request.socket);
+                return;
+            }
+            receivedBytes.add(received);
+            if (request.inBody) {
+                if (!deliver(request, receiveBuffer, received)) {
+                    return;
+                }
+                continue;
+            }
+            request.headers.append(receiveBuffer, received);
+            size_t headerEnd = request.headers.find("\r\n\r\n");
+            if (headerEnd == std::string::npos) {
+                continue;
+            }
+            size_t space = request.headers.find(' ');
+            request.result.status = space < headerEnd ? std::atoi(request.headers.c_str() + space + 1) : 0;
+            std::string head = request.headers.substr(0, headerEnd);
+            std::transform(head.begin(), head.end(), head.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            size_t encoding = head.find("\r\ntransfer-encoding:");
+            request.chunked = encoding != std::string::npos && head.find("chunked", encoding) < head.find("\r\n", encoding + 2);
+            request.inBody = true;
+            std::string rest = request.headers.substr(headerEnd + 4);
+            request.headers.clear();
+            request.headers.shrink_to_fit();
+            if (!rest.empty() && !deliver(request, &rest[0], rest.length())) {
+                return;
+            }
+        }
+    }
+
+    // deliver() - passes body bytes on, through the chunked decoder if the response is chunked
+    // false if the request ended (last chunk seen, or broken framing)
+    bool deliver(Request& request, char* data, size_t length) {
+        request.bodyStarted = true;
+        setDeadline(request, deadlineAfter(Clock::now(), request.timeouts.idleMs));
+        int status = request.result.status;
+        const BodyHandler& onBody = request.onBody;
+        if (!request.chunked) {
+            onBody(status, data, length);
+            return true;
+        }
+        if (!request.decoder.decode(data, length, [status, &onBody](char* payload, size_t count) { onBody(status, payload, count); })) {
+            request.result.error = "malformed chunked response";
+            close(request.socket);
+            return false;
+        }
+        if (request.decoder.done()) {
+            request.result.complete = true;
+            close(request.socket);
+            return false;
+        }
+        return true;
+    }
+
+    // close() - removes a request and reports how it ended
+    void close(SocketHandle socketHandle) {
+        auto found = requests.find(socketHandle);
+        if (found == requests.end()) {
+            return;
+        }
+        std::unique_ptr<Request> request = std::move(found->second);
+        requests.erase(found);
+#ifdef __linux__
+        epoll_ctl(epollHandle, EPOLL_CTL_DEL, socketHandle, nullptr);
+#endif
+        Net::Close(socketHandle);
+        streams.add(-1);
+        request->onDone(request->result);
+    }
+};
@@ -0,0 +1,186 @@
+﻿#pragma once
+#include "GgufReader.h"
+#include "ModelStore.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// ModelShape - the parts of a model's metadata that decide how much memory it needs
+struct ModelShape {
+    std::string architecture;
+    uint64_t weightBytes = 0;   // tensor data, about the blob size
+    uint64_t layers = 0;        // <arch>.block_count
+    uint64_t embedding = 0;     // <arch>.embedding_length
+    uint64_t heads = 0;         // <arch>.attention.head_count
+    uint64_t kvHeads = 0;       // <arch>.attention.head_count_kv, fewer than heads with grouped-query attention
+    uint64_t keyLength = 0;     // per head, embedding / heads unless the model says otherwise
+    uint64_t valueLength = 0;
+    uint64_t vocabulary = 0;
+    uint64_t trainedContext = 0; // <arch>.context_length, the largest num_ctx worth asking for
+
+    bool valid() const { return layers > 0 && kvHeads > 0 && keyLength > 0 && valueLength > 0; }
+};
+
+// MemoryEstimate - what a loaded model needs for one num_ctx / batch / parallel setting
+struct MemoryEstimate {
+    uint64_t weights = 0;
+    uint64_t kvCache = 0; // keys + values for every layer, token and slot
+    uint64_t graph = 0;   // compute buffer for one batch
+    uint64_t total() const { return weights + kvCache + graph; }
+};
+
+// MemoryEstimator - predicts weight and KV-cache memory from GGUF metadata, mirroring how the
+// ollama runner sizes its buffers:
+//   KV cache = layers * num_ctx * parallel * kvHeads * (keyLength + valueLength) * bytes per element
+//   graph    = max(4 * batch * (1 + 4 * embedding + num_ctx * (1 + heads)), 4 * batch * (embedding + vocabulary))
+// ollama allocates num_ctx tokens for each parallel slot, so parallel requests multiply the KV cache.
+class MemoryEstimator {
+public:
+    // KV cache element types (OLLAMA_KV_CACHE_TYPE)
+    enum CacheType { F16, Q8_0, Q4_0 };
+
+    static const char* cacheTypeName(CacheType type) {
+        switch (type) {
+        case Q8_0: return "q8_0";
+        case Q4_0: return "q4_0";
+        default: return "f16";
+        }
+    }
+
+    // shapeFromGguf() - model shape from a parsed header
+    static ModelShape shapeFromGguf(const GgufInfo& info, uint64_t weightBytes) {
+        ModelShape shape;
+        shape.architecture = info.architecture();
+        shape.weightBytes = weightBytes;
+        shape.layers = info.archNumber("block_count");
+        shape.embedding = info.archNumber("embedding_length");
+        shape.heads = info.archNumber("attention.head_count");
+        shape.kvHeads = info.archNumber("attention.head_count_kv", shape.heads);
+        uint64_t headLength = shape.heads > 0 ? shape.embedding / shape.heads : 0;
+        shape.keyLength = info.archNumber("attention.key_length", headLength);
+        shape.valueLength = info.archNumber("attention.value_length", headLength);
+        const GgufValue* tokens = info.find("tokenizer.ggml.tokens");
+        shape.vocabulary = info.archNumber("vocab_size", tokens != nullptr ? tokens->arrayCount : 0);
+        shape.trainedContext = info.archNumber("context_length");
+        return shape;
+    }
+
+    // shapeOf() - shape of a local model, parsed once and cached; valid() is false if the blob is not local
+    static ModelShape shapeOf(const std::string& model) {
+        MemoryEstimator& estimator = instance();
+        {
+            std::lock_guard<std::mutex> lock(estimator.mutex);
+            auto found = estimator.shapes.find(model);
+            if (found != estimator.shapes.end()) {
+                return found->second;
+            }
+        }
+        ModelShape shape;
+        std::string blob = ModelStore::ModelBlobPath(model);
+        MappedFile file;
+        GgufInfo info;
+        std::string error;
+        if (!blob.empty() && file.open(blob) && GgufReader::parse(file.bytes(), file.size(), info, error)) {
+            shape = shapeFromGguf(info, file.size() - info.headerBytes);
+        }
+        std::lock_guard<std::mutex> lock(estimator.mutex);
+        estimator.shapes[model] = shape;
+        return shape;
+    }
+
+    // kvCacheBytes() - keys and values for numContext tokens in each of parallel slots
+    static uint64_t kvCacheBytes(const ModelShape& shape, uint64_t numContext, uint64_t parallel, CacheType type = F16) {
+        uint64_t elements = shape.layers * numContext * std::max<uint64_t>(parallel, 1) * shape.kvHeads * (shape.keyLength + shape.valueLength);
+        switch (type) {
+        case Q8_0: return elements * 34 / 32; // 32 int8 values + f16 scale per block
+        case Q4_0: return elements * 18 / 32; // 32 nibbles + f16 scale per block
+        default: return elements * 2;
+        }
+    }
+
+    // graphBytes() - compute buffer for a batch attending over numContext tokens
+    static uint64_t graphBytes(const ModelShape& shape, uint64_t numContext, uint64_t batch) {
+        uint64_t attention = 4 * batch * (1 + 4 * shape.embedding + numContext * (1 + shape.heads));
+        uint64_t logits = 4 * batch * (shape.embedding + shape.vocabulary);
+        return std::max(attention, logits);
+    }
+
+    // estimate() - weights + KV cache + graph for one setting
+    static MemoryEstimate estimate(const ModelShape& shape, uint64_t numContext, uint64_t batch, uint64_t parallel, CacheType type = F16) {
+        MemoryEstimate result;
+        result.weights = shape.weightBytes;
+        result.kvCache = kvCacheBytes(shape, numContext, parallel, type);
+        result.graph = graphBytes(shape, numContext, batch);
+        return result;
+    }
+
+    // recommendContext() - largest num_ctx (a multiple of step, at most the trained context) that fits budgetBytes,
+    // 0 if not even step tokens fit
+    static uint64_t recommendContext(const ModelShape& shape, uint64_t budgetBytes, uint64_t batch, uint64_t parallel,
+                                     CacheType type = F16, uint64_t step = 1024) {
+        if (!shape.valid() || estimate(shape, step, batch, parallel, type).total() > budgetBytes) {
+            return 0;
+        }
+        // memory grows monotonically with num_ctx, so binary search over multiples of step
+        uint64_t limit = shape.trainedContext > 0 ? shape.trainedContext : 131072;
+        uint64_t low = 1, high = std::max<uint64_t>(limit / step, 1);
+        while (low < high) {
+            uint64_t middle = (low + high + 1) / 2;
+            if (estimate(shape, middle * step, batch, parallel, type).total() <= budgetBytes) {
+                low = middle;
+            }
+            else {
+                high = middle - 1;
+            }
+        }
+        return std::min(low * step, limit);
+    }
+
+    // KnownConfiguration - KV cache size reported by llama.cpp ("KV self size") for a published model
+    struct KnownConfiguration {
+        const char* model;
+        uint64_t layers, heads, kvHeads, headLength, numContext;
+        uint64_t kvCacheMiB; // f16 cache, one slot
+    };
+
+    // knownConfigurations() - reference table the estimator is checked against, in the Context Planner and MemoryEstimatorTest
+    static const std::vector<KnownConfiguration>& knownConfigurations() {
+        static const std::vector<KnownConfiguration> table = {
+            { "llama2:7b",     32, 32, 32, 128,  4096, 2048 },
+            { "llama3:8b",     32, 32,  8, 128,  8192, 1024 },
+            { "llama3:70b",    80, 64,  8, 128,  8192, 2560 },
+            { "mistral:7b",    32, 32,  8, 128, 32768, 4096 },
+            { "gemma2:9b",     42, 16,  8, 256,  8192, 2688 },
+            { "qwen2:7b",      28, 28,  4, 128, 32768, 1792 },
+            { "phi3:mini",     32, 32, 32,  96,  4096, 1536 },
+        };
+        return table;
+    }
+
+    // knownShape() - shape of a reference row, for running it through kvCacheBytes()
+    static ModelShape knownShape(const KnownConfiguration& known) {
+        ModelShape shape;
+        shape.architecture = known.model;
+        shape.layers = known.layers;
+        shape.heads = known.heads;
+        shape.kvHeads = known.kvHeads;
+        shape.keyLength = known.headLength;
+        shape.valueLength = known.headLength;
+        shape.embedding = known.heads * known.headLength;
+        shape.trainedContext = known.numContext;
+        return shape;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, ModelShape> shapes;
+
+    static MemoryEstimator& instance() {
+        static MemoryEstimator estimator;
+        return estimator;
+    }
+};
@@ -0,0 +1,415 @@
+﻿#pragma once
+#include "Net.h"
+#include "Telemetry.h"
+#include "ChatHistory.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Counter - monotonically increasing metric, updated with a relaxed atomic add
+class Counter {
+public:
+    void add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{ 0 };
+};
+
+// Gauge - metric that goes up and down, updated with relaxed atomics
+class Gauge {
+public:
+    void add(int64_t amount) { value.fetch_add(amount, std::memory_order_relaxed); }
+    void set(int64_t amount) { value.store(amount, std::memory_order_relaxed); }
+    int64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value{ 0 };
+};
+
+// MetricsRegistry - named counters/gauges rendered as Prometheus text
+// Registering takes a lock, updating a returned Counter/Gauge never does, so hold on to the reference.
+class MetricsRegistry {
+public:
+    // counter() - registers (or finds) a counter series
+    static Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "") {
+        Series& series = findSeries(name, help, "counter", labels);
+        return *series.counter;
+    }
+
+    // gauge() - registers (or finds) a gauge series
+    static Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "") {
+        Series& series = findSeries(name, help, "gauge", labels);
+        return *series.gauge;
+    }
+
+    // collector() - adds a callback that appends series computed at scrape time
+    static void collector(const std::function<void(std::string&)>& write) {
+        MetricsRegistry& registry = instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.collectors.push_back(write);
+    }
+
+    // label() - one escaped label pair, e.g. model="llama3:8b"
+    static std::string label(const std::string& key, const std::string& value) {
+        std::string escaped;
+        for (char c : value) {
+            if (c == '\\' || c == '"') escaped += '\\';
+            if (c == '\n') { escaped += "\\n"; continue; }
+            escaped += c;
+        }
+        return key + "=\"" + escaped + "\"";
+    }
+
+    // writeFamily() - HELP/TYPE header of a metric family, for collectors
+    static void writeFamily(std::string& out, const std::string& name, const std::string& help, const std::string& type) {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    }
+
+    // writeSample() - one sample line, for collectors
+    static void writeSample(std::string& out, const std::string& name, const std::string& labels, double value) {
+        char number[64];
+        snprintf(number, sizeof(number), "%.17g", value);
+        out += name + (labels.empty() ? "" : "{" + labels + "}") + " " + number + "\n";
+    }
+
+    // writeHistogram() - a microsecond Histogram as a Prometheus histogram in seconds
+    static void writeHistogram(std::string& out, const std::string& name, const std::string& labels, const Histogram& histogram) {
+        static const double bounds[] = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120 };
+        std::string prefix = labels.empty() ? "" : labels + ",";
+        for (double bound : bounds) {
+            char le[32];
+            snprintf(le, sizeof(le), "%g", bound);
+            writeSample(out, name + "_bucket", prefix + "le=\"" + le + "\"", (double)histogram.countAtOrBelow(Telemetry::toMicros(bound)));
+        }
+        writeSample(out, name + "_bucket", prefix + "le=\"+Inf\"", (double)histogram.count());
+        writeSample(out, name + "_sum", labels, histogram.sumOfValues() / 1e6);
+        writeSample(out, name + "_count", labels, (double)histogram.count());
+    }
+
+    // renderPrometheus() - text exposition format 0.0.4
+    static std::string renderPrometheus() {
+        MetricsRegistry& registry = instance();
+        std::vector<std::function<void(std::string&)>> collectors;
+        std::string out;
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for (const Family& family : registry.families) {
+                writeFamily(out, family.name, family.help, family.type);
+                for (const Series& series : family.series) {
+                    double value = series.counter ? (double)series.counter->get() : (double)series.gauge->get();
+                    writeSample(out, family.name, series.labels, value);
+                }
+            }
+            collectors = registry.collectors;
+        }
+        for (const auto& write : collectors) {
+            write(out);
+        }
+        return out;
+    }
+
+private:
+    struct Series {
+        std::string labels;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+    };
+    struct Family {
+        std::string name, help, type;
+        std::deque<Series> series; // deque keeps references stable while growing
+    };
+
+    std::mutex mutex;
+    std::deque<Family> families;
+    std::vector<std::function<void(std::string&)>> collectors;
+
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    static Series& findSeries(const std::string& name, const std::string& help, const std::string& type, const std::string& labels) {
+        MetricsRegistry& registry = instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        Family* family = nullptr;
+        for (Family& candidate : registry.families) {
+            if (candidate.name == name) {
+                family = &candidate;
+                break;
+            }
+        }
+        if (family == nullptr) {
+            registry.families.push_back(Family());
+            family = &registry.families.back();
+            family->name = name;
+            family->help = help;
+            family->type = type;
+        }
+        for (Series& series : family->series) {
+            if (series.labels == labels) {
+                return series;
+            }
+        }
+        family->series.push_back(Series());
+        Series& series = family->series.back();
+        series.labels = labels;
+        if (type == "counter") series.counter.reset(new Counter());
+        else series.gauge.reset(new Gauge());
+        return series;
+    }
+};
+
+// ClientMetrics - metrics of the client layer, registered once and then updated lock-free
+struct ClientMetrics {
+    Counter& requests = MetricsRegistry::counter("model_app_requests_total", "Generation requests dispatched.");
+    Counter& errors = MetricsRegistry::counter("model_app_request_errors_total", "Generation requests that failed.");
+    Counter& cancellations = MetricsRegistry::counter("model_app_request_cancellations_total", "Generation requests cancelled before completion.");
+    Gauge& inFlight = MetricsRegistry::gauge("model_app_requests_in_flight", "Generation requests currently running.");
+    Gauge& queueDepth = MetricsRegistry::gauge("model_app_request_queue_depth", "Dispatched requests still waiting for their first token.");
+    Counter& coalesced = MetricsRegistry::counter("model_app_requests_coalesced_total", "Requests that joined an identical generation already running.");
+
+    static ClientMetrics& get() {
+        static ClientMetrics metrics;
+        return metrics;
+    }
+
+private:
+    ClientMetrics() {
+        // per model telemetry and the history store are read at scrape time
+        MetricsRegistry::collector([](std::string& out) {
+            std::vector<std::string> models = Telemetry::modelNames();
+            MetricsRegistry::writeFamily(out, "model_app_time_to_first_token_seconds", "Dispatch to first visible token.", "histogram");
+            for (const std::string& model : models) {
+                MetricsRegistry::writeHistogram(out, "model_app_time_to_first_token_seconds", MetricsRegistry::label("model", model), Telemetry::forModel(model).firstToken);
+            }
+            MetricsRegistry::writeFamily(out, "model_app_inter_token_seconds", "Gap between consecutive streamed chunks.", "histogram");
+            for (const std::string& model : models) {
+                MetricsRegistry::writeHistogram(out, "model_app_inter_token_seconds", MetricsRegistry::label("model", model), Telemetry::forModel(model).interToken);
+            }
+            MetricsRegistry::writeFamily(out, "model_app_generated_tokens_total", "Tokens generated, as reported by the server.", "counter");
+            for (const std::string& model : models) {
+                MetricsRegistry::writeSample(out, "model_app_generated_tokens_total", MetricsRegistry::label("model", model), (double)Telemetry::forModel(model).generatedTokens.load());
+            }
+            MetricsRegistry::writeFamily(out, "model_app_eval_seconds_total", "Server time spent generating tokens, tokens/s = rate(tokens) / rate(eval seconds).", "counter");
+            for (const std::string& model : models) {
+                MetricsRegistry::writeSample(out, "model_app_eval_seconds_total", MetricsRegistry::label("model", model), Telemetry::forModel(model).evalMicros.load() / 1e6);
+            }
+
+            ChatHistory::StoreSize history = ChatHistory::Size();
+            MetricsRegistry::writeFamily(out, "model_app_history_files", "Saved chat history files.", "gauge");
+            MetricsRegistry::writeSample(out, "model_app_history_files", "", history.files);
+            MetricsRegistry::writeFamily(out, "model_app_history_bytes", "Bytes used by saved chat history files.", "gauge");
+            MetricsRegistry::writeSample(out, "model_app_history_bytes", "", (double)history.bytes);
+        });
+    }
+};
+
+// MetricsExporter - serves the registry on localhost and/or rewrites a metrics file periodically
+class MetricsExporter {
+public:
+    // serve() - starts the Prometheus endpoint on http://127.0.0.1:port/metrics
+    static bool serve(int port) {
+        MetricsExporter& exporter = instance();
+        std::lock_guard<std::mutex> lock(exporter.mutex);
+        if (exporter.listener != INVALID_SOCKET) {
+            exporter.statusText = "Already serving on port " + std::to_string(exporter.port);
+            return false;
+        }
+        SocketHandle listener = Net::Listen("127.0.0.1", port);
+        if (listener == INVALID_SOCKET) {
+            exporter.statusText = "Failed to listen on 127.0.0.1:" + std::to_string(port);
+            return false;
+        }
+        exporter.listener = listener;
+        exporter.port = port;
+        exporter.statusText = "Serving http://127.0.0.1:" + std::to_string(port) + "/metrics";
+        exporter.server = std::thread([listener]() { acceptLoop(listener); });
+        return true;
+    }
+
+    // writeFile() - rewrites path every intervalSeconds, replacing any previous file target
+    static void writeFile(const std::string& path, int intervalSeconds) {
+        MetricsExporter& exporter = instance();
+        std::lock_guard<std::mutex> lock(exporter.mutex);
+        exporter.fileStatusText = "Writing " + path + " every " + std::to_string(intervalSeconds) + " s";
+        exporter.filePath = path;
+        exporter.fileInterval = intervalSeconds;
+        if (exporter.writer.joinable()) {
+            exporter.fileChanged = true; // the running writer picks up the new target at once
+            exporter.fileWake.notify_all();
+            return;
+        }
+        exporter.writer = std::thread([]() {
+            MetricsExporter& exporter = instance();
+            std::unique_lock<std::mutex> lock(exporter.mutex);
+            while (!exporter.stopping) {
+                std::string path = exporter.filePath;
+                lock.unlock();
+                writeFileOnce(path);
+                lock.lock();
+                exporter.fileWake.wait_for(lock, std::chrono::seconds(exporter.fileInterval),
+                                           [&exporter]() { return exporter.stopping || exporter.fileChanged; });
+                exporter.fileChanged = false;
+            }
+        });
+    }
+
+    // shutdown() - stops serving and writing and waits for both threads, see App::Shutdown()
+    static void shutdown() {
+        MetricsExporter& exporter = instance();
+        {
+            std::lock_guard<std::mutex> lock(exporter.mutex);
+            exporter.stopping = true;
+            if (exporter.listener != INVALID_SOCKET) {
+#ifndef _WIN32
+                ::shutdown(exporter.listener, SHUT_RDWR); // wakes accept(), which closing alone does not on Linux
+#endif
+                Net::Close(exporter.listener);
+                exporter.listener = INVALID_SOCKET;
+                exporter.statusText = "Not serving";
+            }
+        }
+        exporter.fileWake.notify_all();
+        if (exporter.server.joinable()) {
+            exporter.server.join();
+        }
+        if (exporter.writer.joinable()) {
+            exporter.writer.join();
+        }
+    }
+
+    // startFromEnvironment() - MODEL_APP_METRICS_PORT / MODEL_APP_METRICS_FILE / MODEL_APP_METRICS_INTERVAL
+    static bool startFromEnvironment() {
+        ClientMetrics::get(); // register the client metrics before the first scrape
+        std::string port = environment("MODEL_APP_METRICS_PORT");
+        if (!port.empty()) {
+            serve(std::atoi(port.c_str()));
+        }
+        std::string path = environment("MODEL_APP_METRICS_FILE");
+        if (!path.empty()) {
+            std::string interval = environment("MODEL_APP_METRICS_INTERVAL");
+            writeFile(path, interval.empty() ? 15 : std::max(1, std::atoi(interval.c_str())));
+        }
+        return true;
+    }
+
+    // status() - endpoint state for the UI
+    static std::string status() {
+        MetricsExporter& exporter = instance();
+        std::lock_guard<std::mutex> lock(exporter.mutex);
+        return exporter.statusText;
+    }
+
+    // fileStatus() - file writer state for the UI
+    static std::string fileStatus() {
+        MetricsExporter& exporter = instance();
+        std::lock_guard<std::mutex> lock(exporter.mutex);
+        return exporter.fileStatusText;
+    }
+
+    // environment() - value of an environment variable, empty if unset
+    static std::string environment(const char* name) {
+#ifdef _WIN32
+        char* value = nullptr;
+        size_t length = 0;
+        if (_dupenv_s(&value, &length, name) != 0 || value == nullptr) {
+            return "";
+        }
+        std::string result(value);
+        free(value);
+        return result;
+#else
+        const char* value = std::getenv(name);
+        return value ? value : "";
+#endif
+    }
+
+private:
+    std::mutex mutex; // guards everything but the threads, which only serve()/writeFile()/shutdown() touch
+    SocketHandle listener = INVALID_SOCKET;
+    int port = 0;
+    std::string statusText = "Not serving";
+    std::string fileStatusText = "Not writing";
+    std::thread server;                // acceptLoop()
+    std::thread writer;                // rewrites filePath every fileInterval seconds
+    std::condition_variable fileWake;
+    std::string filePath;
+    int fileInterval = 15;
+    bool fileChanged = false;          // writeFile() changed the target, write now
+    bool stopping = false;             // shutdown() was called
+
+    static MetricsExporter& instance() {
+        static MetricsExporter exporter;
+        return exporter;
+    }
+
+    // acceptLoop() - answers one scrape at a time, scrapes are small and rare
+    static void acceptLoop(SocketHandle listener) {
+        while (true) {
+            SocketHandle connection = accept(listener, nullptr, nullptr);
+            if (connection == INVALID_SOCKET) {
+                break;
+            }
+#ifdef _WIN32
+            DWORD timeout = 2000;
+#else
+            timeval timeout = { 2, 0 };
+#endif
+            setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+            // read the request head, only the request line matters
+            std::string request;
+            char buffer[1024];
+            while (request.find("\r\n\r\n") == std::string::npos && request.length() < 8192) {
+                int received = recv(connection, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    break;
+                }
+                request.append(buffer, received);
+            }
+
+            std::string response;
+            if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0) {
+                std::string body = MetricsRegistry::renderPrometheus();
+                response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: " +
+                    std::to_string(body.length()) + "\r\nConnection: close\r\n\r\n" + body;
+            }
+            else {
+                response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            }
+            Net::SendAll(connection, response.c_str(), response.length());
+            Net::Close(connection);
+        }
+    }
+
+    // writeFileOnce() - writes to a temp file and swaps it in, so readers never see half a scrape
+    static void writeFileOnce(const std::string& path) {
+        std::string temp = path + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                return;
+            }
+            file << MetricsRegistry::renderPrometheus();
+        }
+#ifdef _WIN32
+        MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        std::rename(temp.c_str(), path.c_str());
+#endif
+    }
+};
@@ -0,0 +1,178 @@
+﻿#pragma once
+#include "OllamaCli.h"
+#include "ModelStore.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// ModelCatalog - `ollama list` parsed once into typed records
+namespace ModelCatalog {
+
+    // Entry - one installed (or added) model
+    struct Entry {
+        std::string name;       // "llama3.1:8b", what ollama run takes
+        std::string family;     // "llama", leading letters of the name
+        std::string tag;        // "8b"
+        std::string digest;     // ID column, short manifest digest
+        uint64_t sizeBytes = 0;
+        int64_t modified = 0;   // seconds since 1970, 0 if unknown
+        std::string nameKey;    // lower case name, precomputed for search and sorting
+    };
+
+    // Family() - "qwen2.5-coder:7b" -> "qwen", "hf.co/user/Model-GGUF:Q4" -> "model"
+    inline std::string Family(const std::string& name) {
+        size_t slash = name.rfind('/');
+        std::string family;
+        for (size_t i = slash == std::string::npos ? 0 : slash + 1; i < name.length() && std::isalpha((unsigned char)name[i]); ++i) {
+            family += (char)std::tolower((unsigned char)name[i]);
+        }
+        return family;
+    }
+
+    // ParseAge() - "2 weeks ago", "About an hour ago", "Less than a second ago" to seconds
+    inline int64_t ParseAge(const std::string& text) {
+        std::istringstream words(text);
+        std::string word;
+        int64_t count = 1;
+        while (words >> word) {
+            if (std::isdigit((unsigned char)word[0])) {
+                count = std::atoll(word.c_str());
+                continue;
+            }
+            if (word.back() == 's') word.pop_back();
+            if (word == "second") return count;
+            if (word == "minute") return count * 60;
+            if (word == "hour") return count * 3600;
+            if (word == "day") return count * 86400;
+            if (word == "week") return count * 7 * 86400;
+            if (word == "month") return count * 30 * 86400;
+            if (word == "year") return count * 365 * 86400;
+        }
+        return 0;
+    }
+
+    // MakeEntry() - entry with the name-derived fields filled in
+    inline Entry MakeEntry(const std::string& name) {
+        Entry entry;
+        entry.name = name;
+        size_t colon = name.rfind(':');
+        entry.tag = colon == std::string::npos ? "latest" : name.substr(colon + 1);
+        entry.family = Family(name);
+        entry.nameKey = name;
+        std::transform(entry.nameKey.begin(), entry.nameKey.end(), entry.nameKey.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+        return entry;
+    }
+
+    // Parse() - entries of `ollama list` output; modified times come from the manifest
+    // when it is in the local store, otherwise from the "2 weeks ago" column
+    inline std::vector<Entry> Parse(const std::string& output, int64_t now) {
+        std::vector<Entry> entries;
+        for (const auto& row : OllamaCli::Columns(output)) {
+            auto value = [&row](const char* column) {
+                auto found = row.find(column);
+                return found == row.end() ? std::string() : found->second;
+            };
+            if (value("NAME").empty()) {
+                continue;
+            }
+            Entry entry = MakeEntry(value("NAME"));
+            entry.digest = value("ID");
+            entry.sizeBytes = OllamaCli::ParseSize(value("SIZE"));
+            uint64_t manifestSize = 0;
+            if (!ModelStore::FileInfo(ModelStore::ManifestPath(entry.name), manifestSize, entry.modified)) {
+                entry.modified = now - ParseAge(value("MODIFIED"));
+            }
+            entries.push_back(entry);
+        }
+        return entries;
+    }
+
+    // Load() - installed models, empty if ollama could not be asked
+    inline std::vector<Entry> Load() {
+        int status = 0;
+        std::string output = OllamaCli::Run("ollama list", &status);
+        if (status != 0) {
+            return std::vector<Entry>();
+        }
+        return Parse(output, (int64_t)time(nullptr));
+    }
+
+    // FormatAge() - "3 days ago" style, like ollama list prints it
+    inline std::string FormatAge(int64_t modified, int64_t now) {
+        if (modified <= 0) {
+            return "-";
+        }
+        int64_t age = now > modified ? now - modified : 0;
+        struct Unit { int64_t seconds; const char* name; };
+        static const Unit units[] = { { 365 * 86400, "year" }, { 30 * 86400, "month" }, { 7 * 86400, "week" },
+                                      { 86400, "day" }, { 3600, "hour" }, { 60, "minute" } };
+        for (const Unit& unit : units) {
+            if (age >= unit.seconds) {
+                int64_t count = age / unit.seconds;
+                return std::to_string(count) + " " + unit.name + (count == 1 ? "" : "s") + " ago";
+            }
+        }
+        return "just now";
+    }
+
+    // View - filtered and sorted row order over the entries, rebuilt only when the
+    // filter, the sort or the number of entries changes rather than every frame
+    class View {
+    public:
+        enum Column { Name, Size, Modified, Family, Digest };
+
+        // update() - rebuilds rows if anything changed, true if it did
+        bool update(const std::vector<Entry>& entries, const std::string& filter, int column, bool ascending) {
+            if (filter == lastFilter && column == lastColumn && ascending == lastAscending && entries.size() == lastCount) {
+                return false;
+            }
+            std::string needle = filter;
+            std::transform(needle.begin(), needle.end(), needle.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+            rows.clear();
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (needle.empty() || entries[i].nameKey.find(needle) != std::string::npos) {
+                    rows.push_back((int)i);
+                }
+            }
+            std::stable_sort(rows.begin(), rows.end(), [&](int a, int b) {
+                const Entry& x = entries[a];
+                const Entry& y = entries[b];
+                int compare = 0;
+                switch (column) {
+                case Size: compare = (x.sizeBytes > y.sizeBytes) - (x.sizeBytes < y.sizeBytes); break;
+                case Modified: compare = (x.modified > y.modified) - (x.modified < y.modified); break;
+                case Family: compare = x.family.compare(y.family); break;
+                case Digest: compare = x.digest.compare(y.digest); break;
+                default: break;
+                }
+                if (compare == 0) {
+                    compare = x.nameKey.compare(y.nameKey);
+                }
+                return ascending ? compare < 0 : compare > 0;
+            });
+            lastFilter = filter;
+            lastColumn = column;
+            lastAscending = ascending;
+            lastCount = entries.size();
+            return true;
+        }
+
+        // invalidate() - forces the next update() to rebuild, e.g. after entries were reloaded
+        void invalidate() { lastCount = (size_t)-1; }
+
+        const std::vector<int>& order() const { return rows; }
+
+    private:
+        std::vector<int> rows;
+        std::string lastFilter;
+        int lastColumn = -1;
+        bool lastAscending = true;
+        size_t lastCount = (size_t)-1;
+    };
+
+}
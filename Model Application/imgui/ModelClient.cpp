@@ -2,22 +2,80 @@
 #include <string>
 #include <cstdlib>  // For the system() function
 #include <functional>
+#include "Metrics.h" // pulls in winsock2.h, which has to come before <windows.h>
+#include "HttpLoop.h"
+#include "EndpointPool.h"
+#include "RequestPolicy.h"
+#include "AdmissionControl.h"
+#include "NdjsonParser.h"
 #include <windows.h>
 #include <thread>
 #include <cstdio>
 #include <memory>
 #include <stdexcept>
 #include <sstream>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <map>
+#include <vector>
+#include "Telemetry.h"
+#include "Trace.h"
+#include "ResponseCache.h"
+#include "ModelResidency.h"
+#include "ThreadPool.h"
+#include "TokenStream.h"
 
 
+class Generation;
+
 // ModelClient class for interacting with Ollama
 class ModelClient {
 private:
     std::string model; // model name
+    AdmissionControl::Priority priority = AdmissionControl::Interactive; // class of this client's requests
+    bool publishAtEnd = false; // headless caller, nobody watches the output while it is produced
     std::string output;
+    GenerationStats stats;
+    GenerationTrace trace;
+    mutable std::mutex outputMutex; // guards output/stats/trace, written by the generation thread
+    std::string ansiBuffer;         // partial ANSI sequence carried between chunks
+    ModelTelemetry* telemetry = nullptr; // histograms of the model being run
+    bool commandFailed = false;          // last OpenTerminal() command could not run or exited non-zero
+    std::vector<CachedChunk> recordedChunks; // chunks of the current response, stored on a cache miss
+    bool cacheHit = false;                   // replaying from ResponseCache, kept out of telemetry/metrics
+    std::atomic<bool> cancelRequested{ false }; // set by cancel(), checked by the running request
+    std::mutex processMutex;                    // guards process, httpRace and subscription, cancel() comes from the UI thread
+    HANDLE process = nullptr;                   // ollama process of a running generate()
+    const char* watchdogPhase = nullptr;        // deadline the watchdog of generate() is timing, see armWatchdog()
+    const char* expiredPhase = nullptr;         // set when it terminated the process
+    struct HttpRace;
+    std::shared_ptr<HttpRace> httpRace;         // requests of a running generateAsync()
+    int startEpoch = 0;                         // terminateEpoch() when the generation started
+    std::mutex publishMutex;                    // guards lastPublish/publishArmed, the flush timer runs on the loop thread
+    GenerationTrace::Clock::time_point lastPublish; // last onOutput() call, see publishOutput()
+    bool publishArmed = false;                  // a trailing publish is scheduled
+    bool startedWarm = false;                   // model was resident when the generation started
+    class Subscription;
+    std::shared_ptr<Subscription> subscription; // feeds this client and its stream, see streamPrompt()
+
+    // --verbose footer detection, see takeResponseText()
+    std::string heldBack;   // start of a line that may still turn out to be the footer
+    std::string footerLine; // footer line being assembled
+    bool atLineStart = true;
+    bool inFooter = false;
+
+    typedef GenerationTrace::Clock Clock;
 
 public:
-    bool running = false; // currently running?
+    // Transport - how generations reach the model: `ollama run` per request, or the daemon's HTTP API on the event loop
+    enum Transport { Cli, Http };
+
+    std::atomic<bool> running{ false }; // currently running?
+    std::function<void()> onOutput;     // called after output updates, set by the Generation owning this client
+    std::atomic<bool> deferOutput{ false }; // publish-at-end work, onOutput only runs when the generation ends
+    std::function<void(int)> schedulePublish; // runs flushOutput() after the given milliseconds, set by the Generation
 
     // Constructor
     ModelClient(const std::string& modelName){
@@ -33,50 +91,589 @@ public:
     std::string getModel() const {
         return model;
     }
+
+    // setPriority() - Mutator for the admission class of the next prompts, see AdmissionControl.h
+    void setPriority(AdmissionControl::Priority value) {
+        priority = value;
+    }
+
+    // setPublishAtEnd() - Mutator, true for headless callers that only read the finished response: the stream
+    // gets the whole text when the generation ends instead of chunk by chunk (it is independent of the priority)
+    void setPublishAtEnd(bool value) {
+        publishAtEnd = value;
+    }
     
     // getOutput() - Accessor to get output
     std::string getOutput() const {
+        std::lock_guard<std::mutex> lock(outputMutex);
         return output;
     }
 
+    // getOutputFrom() - Accessor to get output past offset, empty if nothing was added since
+    std::string getOutputFrom(size_t offset) const {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        return offset < output.length() ? output.substr(offset) : std::string();
+    }
+
     // setOutput() - Mutator for output
     void setOutput(const std::string& output) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         this->output = output;
     }
-    
+
     // clearOutput() - clears output
     void clearOutput() {
+        std::lock_guard<std::mutex> lock(outputMutex);
         output.clear();
     }
 
-    // sendPrompt() - Method to send a prompt and get a response
-    std::string sendPrompt(const std::string& prompt, bool showConsole = true) {
-        // Check if has model
-        if (model.empty()) {
-            throw std::runtime_error("Model name is not specified");
+    // getStats() - Accessor to get timings of the current/last generation
+    GenerationStats getStats() const {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        return stats;
+    }
+
+    // getTrace() - Accessor to get timestamps of the current/last generation
+    GenerationTrace getTrace() const {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        return trace;
+    }
+
+    // sendPrompt() - Method to send a prompt and get a response, blocks until the response is complete
+    // identical prompts to the same model share one Generation, see below
+    std::string sendPrompt(const std::string& prompt, bool showConsole = true);
+
+    // streamPrompt() - sends a prompt and returns at once, the response arrives on the stream (and in getOutput())
+    // no thread waits for it, the producing thread pushes every chunk, see TokenStream.h
+    std::shared_ptr<TokenStream> streamPrompt(const std::string& prompt, bool showConsole = true);
+
+    // cancel() - stops the current request, the shared generation only ends once every subscriber cancelled
+    void cancel();
+
+    // transport() - transport of new generations, the CLI unless MODEL_APP_TRANSPORT=http, several endpoints or changed in Tools
+    static Transport transport() { return (Transport)transportSetting().load(std::memory_order_relaxed); }
+    static void setTransport(Transport value) { transportSetting().store(value, std::memory_order_relaxed); }
+
+    // publishInterval() - shortest gap between two output updates of a generation in milliseconds, 16 (a 60 Hz frame)
+    // unless MODEL_APP_PUBLISH_INTERVAL_MS or Tools changed it, 0 = every chunk; see publishOutput()
+    static int publishInterval() { return publishIntervalSetting().load(std::memory_order_relaxed); }
+    static void setPublishInterval(int milliseconds) { publishIntervalSetting().store(milliseconds < 0 ? 0 : milliseconds, std::memory_order_relaxed); }
+
+    // generate() - runs the model and streams into this client, used by the producer of a Generation
+    std::string generate(const std::string& prompt, bool showConsole, const std::string& cacheKey) {
+        Trace::setThreadName("Generation (" + model + ")");
+        TRACE_SCOPE_DETAIL("generate", model);
+        beginGeneration();
+
+        // Construct command (--verbose appends the server's timing footer)
+        // --keepalive keeps the model loaded for the next prompt, see ModelResidency
+        std::string command = "ollama run " + model + " --verbose --keepalive " + ModelResidency::keepAlive() + " " + quoteArgument(prompt);
+
+        // Execute command (recieves response dynamically)
+        std::string result = OpenTerminal(command, true, showConsole);
+        return endGeneration(result, cacheKey);
+    }
+
+    // generateAsync() - generate() over a daemon's /api/generate, returns at once and calls done with the
+    // result on the event loop thread; many of these share one I/O thread, see HttpLoop.h
+    // the daemon is picked by EndpointPool, so generations spread over every configured host; a late first token
+    // sends a hedged duplicate to another host and a request failing before it streams is retried elsewhere,
+    // both within RequestPolicy's budget, the first attempt to stream wins
+    void generateAsync(const std::string& prompt, const std::string& cacheKey, const std::function<void(const std::string&)>& done) {
+        Trace::instant("generate (http)", model);
+        beginGeneration();
+        commandFailed = true;
+        RequestPolicy::admitted();
+
+        // keep_alive takes a duration string, or a number of seconds ("-1" = forever)
+        std::string keepAlive = ModelResidency::keepAlive();
+        bool seconds = keepAlive.find_first_not_of("-0123456789") == std::string::npos;
+        std::shared_ptr<HttpRace> race = std::make_shared<HttpRace>();
+        race->body = "{\"model\":\"" + OllamaApi::JsonEscape(model) + "\",\"prompt\":\"" + OllamaApi::JsonEscape(prompt) +
+                     "\",\"keep_alive\":" + (seconds ? keepAlive : "\"" + keepAlive + "\"") + "}";
+        race->cacheKey = cacheKey;
+        race->done = done;
+        race->reserve();
+        {
+            std::lock_guard<std::mutex> lock(processMutex);
+            httpRace = race;
+            race->cancelled = cancelRequested; // cancelled while starting
+        }
+        int hedgeAfter = EndpointPool::size() > 1 ? RequestPolicy::hedgeAfterMs() : 0;
+        ModelClient* client = this; // only used by the timer while the race is open, see hedge()
+        startAttempt(race, 0, EndpointPool::none);
+        if (hedgeAfter > 0) {
+            HttpLoop::after(hedgeAfter, [client, race]() { hedge(client, race); });
         }
+    }
 
+private:
+    // transportSetting() - storage of transport(), read from the environment once
+    // several MODEL_APP_ENDPOINTS also mean HTTP, `ollama run` only reaches one daemon
+    static std::atomic<int>& transportSetting() {
+        static std::atomic<int> setting{ MetricsExporter::environment("MODEL_APP_TRANSPORT") == "http" || EndpointPool::size() > 1 ? Http : Cli };
+        return setting;
+    }
+
+    // publishIntervalSetting() - storage of publishInterval(), read from the environment once
+    static std::atomic<int>& publishIntervalSetting() {
+        static std::atomic<int> setting{ []() {
+            std::string value = MetricsExporter::environment("MODEL_APP_PUBLISH_INTERVAL_MS");
+            return value.empty() ? 16 : std::max(0, std::atoi(value.c_str()));
+        }() };
+        return setting;
+    }
+
+    // beginGeneration() - helper func, counts the request and resets stats before a generation starts
+    void beginGeneration() {
         running = true;
+        telemetry = &Telemetry::forModel(model);
+        ClientMetrics& metrics = ClientMetrics::get();
+        metrics.requests.add();
+        metrics.inFlight.add(1);
+        metrics.queueDepth.add(1); // until the first token arrives
+        startEpoch = terminateEpoch();
+        startedWarm = ModelResidency::state(model) == ModelResidency::Resident; // loaded before we asked?
+        ModelResidency::beginUse(model);
+        recordedChunks.clear();
+        std::lock_guard<std::mutex> lock(outputMutex);
+        stats = GenerationStats();
+        trace = GenerationTrace();
+        trace.dispatch = Clock::now();
+    }
+
+    // HttpRace - the attempts of one generateAsync(): the request, a hedge and retries
+    // the first attempt whose 200 response streams an object without an error wins, an error status or error object
+    // makes the attempt a failure that a retry may replace
+    struct HttpRace {
+        std::mutex mutex;                       // guards the attempt state below
+        std::vector<HttpLoop::RequestId> requests; // per attempt, 0 once it ended
+        std::vector<size_t> hosts;              // EndpointPool index per attempt
+        int open = 0;                           // attempts started (or about to be) and not ended
+        int winner = -1;                        // attempt streaming into the client
+        int hedgeAttempt = -1;
+        bool cancelled = false;
+        bool finished = false;                  // done is being called, nothing may start
+        OllamaApi::Result outcome;              // the winner's, else the last failure's
+
+        // AttemptStream - what an attempt's body said so far, touched on the loop thread only
+        struct AttemptStream {
+            enum State { Waiting, Won, Failed, Lost };
+            NdjsonParser parser;
+            State state = Waiting;
+            std::string error;                  // "error" object of the body
+        };
+        std::unique_ptr<AttemptStream[]> streams{ new AttemptStream[RequestPolicy::maxAttempts()] }; // never reallocated
 
-        // Escape special characters in prompt
-        std::string escapedPrompt;
-        for (char c : prompt) {
-            if (c == '"' || c == '\\') {
-                escapedPrompt += '\\';
+        // the winner's response, touched on the loop thread only
+        std::string result;
+        std::string failure;                    // error object of the last attempt that failed before any text
+
+        std::string body;                       // request JSON, the same for every attempt
+        std::string cacheKey;
+        std::function<void(const std::string&)> done;
+
+        // reserve() - counts an attempt as open before it is sent, so the race cannot finish meanwhile, mutex held
+        int reserve() {
+            requests.push_back(0);
+            hosts.push_back(EndpointPool::none);
+            open++;
+            return (int)requests.size() - 1;
+        }
+
+        // cancel() - ends every open attempt
+        void cancel() {
+            std::vector<HttpLoop::RequestId> open;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                cancelled = true;
+                open = requests;
+            }
+            for (HttpLoop::RequestId request : open) {
+                HttpLoop::cancel(request);
             }
-            escapedPrompt += c;
         }
+    };
 
-        // Construct command
-        std::string command = "ollama run " + model + " \"" + escapedPrompt + "\"";
+    // startAttempt() - helper func, sends a reserved attempt to an endpoint, another than avoid if there is one
+    // the client may be gone once post() returned (a failure finishes the race synchronously), only race is used after it
+    void startAttempt(const std::shared_ptr<HttpRace>& race, int attempt, size_t avoid) {
+        OllamaApi::Endpoint endpoint;
+        size_t host = EndpointPool::acquire(model, endpoint, avoid);
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            race->hosts[attempt] = host;
+        }
+        RequestPolicy::Deadlines deadlines = RequestPolicy::deadlines();
+        HttpLoop::Timeouts timeouts = HttpLoop::Timeouts();
+        timeouts.connectMs = deadlines.connectMs;
+        timeouts.firstByteMs = deadlines.firstTokenMs;
+        timeouts.idleMs = deadlines.stallMs;
+        HttpLoop::RequestId request = HttpLoop::post(endpoint, "/api/generate", race->body,
+            [this, race, attempt](int status, char* data, size_t length) {
+                takeAttemptBody(race, attempt, status, data, length);
+            },
+            [this, race, attempt, host](const OllamaApi::Result& outcome) {
+                endAttempt(race, attempt, host, outcome);
+            },
+            timeouts);
+        bool cancel;
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            if (!race->finished) {
+                race->requests[attempt] = request; // stale if the attempt ended already, cancelling it then does nothing
+            }
+            cancel = race->cancelled || (race->winner >= 0 && race->winner != attempt);
+        }
+        if (cancel) {
+            HttpLoop::cancel(request);
+        }
+    }
 
-        // Execute command (recieves response dynamically)
-        std::string result = OpenTerminal(command, true, showConsole);
+    // hedge() - helper func, the first token is late: sends a duplicate to another endpoint if the race still waits
+    // the client is only used once the race is known to be open, it lives until the race finishes
+    static void hedge(ModelClient* client, const std::shared_ptr<HttpRace>& race) {
+        int attempt;
+        size_t avoid;
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            if (race->finished || race->cancelled || race->winner >= 0 || race->requests.size() != 1 || !RequestPolicy::tryHedge()) {
+                return;
+            }
+            attempt = race->reserve();
+            race->hedgeAttempt = attempt;
+            avoid = race->hosts[0];
+        }
+        Trace::instant("hedge", client->model);
+        client->startAttempt(race, attempt, avoid);
+    }
+
+    // takeAttemptBody() - helper func, body bytes of an attempt with the response status
+    // an attempt wins with its first object if the status is 200 and the object is no error, the others are cancelled then;
+    // the body of an attempt that failed is only read for its error
+    void takeAttemptBody(const std::shared_ptr<HttpRace>& race, int attempt, int status, char* data, size_t length) {
+        HttpRace::AttemptStream& stream = race->streams[attempt];
+        if (stream.state == HttpRace::AttemptStream::Waiting && status != 200) {
+            stream.state = HttpRace::AttemptStream::Failed;
+        }
+        if (stream.state == HttpRace::AttemptStream::Lost) {
+            return;
+        }
+        std::vector<HttpLoop::RequestId> losers;
+        stream.parser.feed(data, length, [&](const NdjsonParser::Object& object) {
+            if (stream.state == HttpRace::AttemptStream::Waiting) {
+                stream.state = !object.error.empty() ? HttpRace::AttemptStream::Failed : claimRace(race, attempt, losers);
+            }
+            if (stream.state == HttpRace::AttemptStream::Won) {
+                takeResponseObject(object, race->result, stream.error);
+            }
+            else if (stream.state == HttpRace::AttemptStream::Failed && !object.error.empty()) {
+                stream.error = object.error.str();
+            }
+        });
+        for (HttpLoop::RequestId loser : losers) {
+            HttpLoop::cancel(loser);
+        }
+    }
 
+    // claimRace() - helper func, makes attempt the winner unless another won first, collecting the requests to cancel
+    HttpRace::AttemptStream::State claimRace(const std::shared_ptr<HttpRace>& race, int attempt, std::vector<HttpLoop::RequestId>& losers) {
+        std::lock_guard<std::mutex> lock(race->mutex);
+        if (race->winner >= 0) {
+            return HttpRace::AttemptStream::Lost;
+        }
+        race->winner = attempt;
+        for (size_t i = 0; i < race->requests.size(); ++i) {
+            if ((int)i != attempt && race->requests[i] != 0) {
+                losers.push_back(race->requests[i]);
+            }
+        }
+        if (attempt == race->hedgeAttempt) {
+            RequestPolicy::hedgeWon();
+        }
+        return HttpRace::AttemptStream::Won;
+    }
+
+    // endAttempt() - helper func, an attempt ended: retries a failure that streamed nothing, or finishes the race
+    // once no attempt is open
+    void endAttempt(const std::shared_ptr<HttpRace>& race, int attempt, size_t host, const OllamaApi::Result& outcome) {
+        // the host is to blame if it could not be reached, was too slow, broke off or failed itself, not for an unknown model
+        bool hostFailed = outcome.error != "cancelled" && (!outcome.connected || !outcome.error.empty() || outcome.status >= 500);
+        EndpointPool::release(host, model, hostFailed, outcome.status);
+        if (!outcome.timeout.empty()) {
+            RequestPolicy::timedOut(outcome.timeout);
+        }
+        int retry = -1;
+        bool won;
+        bool finished = false;
+        {
+            std::lock_guard<std::mutex> lock(race->mutex);
+            race->requests[attempt] = 0;
+            race->open--;
+            won = race->winner == attempt;
+            if (won || race->winner < 0) {
+                race->outcome = outcome;
+            }
+            if (race->winner < 0 && !race->streams[attempt].error.empty()) {
+                race->failure = race->streams[attempt].error;
+            }
+            if (race->winner < 0 && race->open == 0 && !race->cancelled && hostFailed &&
+                (int)race->requests.size() < RequestPolicy::maxAttempts() && RequestPolicy::tryRetry()) {
+                retry = race->reserve();
+            }
+            else if (race->open == 0) {
+                race->finished = finished = true;
+            }
+        }
+        if (retry >= 0) {
+            Trace::instant("retry", model);
+            startAttempt(race, retry, host);
+            return;
+        }
+        if (won) {
+            HttpRace::AttemptStream& stream = race->streams[attempt];
+            stream.parser.finish([&](const NdjsonParser::Object& object) {
+                takeResponseObject(object, race->result, stream.error);
+            });
+        }
+        if (!finished) {
+            return; // a cancelled loser still has to end, the race finishes then
+        }
+        {
+            std::lock_guard<std::mutex> lock(processMutex);
+            if (httpRace == race) {
+                httpRace.reset();
+            }
+        }
+        const OllamaApi::Result& last = race->outcome;
+        std::string text = race->result;
+        std::string streamError = race->winner >= 0 ? race->streams[race->winner].error : race->failure;
+        if (!streamError.empty() || !last.error.empty() || (last.status != 0 && last.status != 200)) {
+            std::string reason = !streamError.empty() ? streamError : !last.error.empty() ? last.error : "HTTP " + std::to_string(last.status);
+            text = "Request failed (" + reason + "): " + text;
+        }
+        else {
+            commandFailed = !last.complete;
+        }
+        race->done(endGeneration(text, race->cacheKey));
+    }
+
+    // takeResponseObject() - helper func, one NDJSON object of /api/generate: a piece of the response, or the final timings
+    void takeResponseObject(const NdjsonParser::Object& object, std::string& result, std::string& error) {
+        Clock::time_point now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            if (!stats.hasFirstByte) {
+                stats.hasFirstByte = true;
+                trace.firstByte = now;
+                stats.timeToFirstByte = trace.offset(now);
+            }
+        }
+        if (!object.error.empty()) {
+            error = object.error.str();
+            return;
+        }
+        if (!object.text.empty()) {
+            result.append(object.text.data, object.text.length);
+            recordedChunks.push_back(CachedChunk{ (float)trace.offset(now), (uint32_t)result.length() });
+            bool visible = false;
+            for (size_t i = 0; i < object.text.length && !visible; ++i) {
+                visible = object.text.data[i] != ' ' && object.text.data[i] != '\n';
+            }
+            recordChunk(now, visible);
+            publishOutput(result);
+        }
+        if (object.done) {
+            // durations are reported in nanoseconds
+            std::lock_guard<std::mutex> lock(outputMutex);
+            stats.loadDuration = object.loadDuration / 1e9;
+            stats.promptEvalCount = (int)object.promptEvalCount;
+            stats.promptEvalDuration = object.promptEvalDuration / 1e9;
+            stats.evalCount = (int)object.evalCount;
+            stats.evalDuration = object.evalDuration / 1e9;
+        }
+    }
+
+    // endGeneration() - helper func, records timings and metrics of a finished generation, returns result
+    std::string endGeneration(const std::string& result, const std::string& cacheKey) {
+        ClientMetrics& metrics = ClientMetrics::get();
+        bool warm = startedWarm;
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            trace.completion = Clock::now();
+            stats.wallTime = trace.offset(trace.completion);
+            stats.done = true;
+            Telemetry::recordCompletion(*telemetry, trace, stats);
+            if (stats.hasFirstToken) {
+                (warm ? telemetry->firstTokenWarm : telemetry->firstTokenCold).record(Telemetry::toMicros(stats.timeToFirstToken));
+            }
+            if (!stats.hasFirstToken) {
+                metrics.queueDepth.add(-1);
+            }
+            traceServerPhases();
+        }
+        if (terminateEpoch() != startEpoch || cancelRequested) {
+            metrics.cancellations.add(); // cancelled, or TerminateOllamaTasks() killed the process under us
+        }
+        else if (commandFailed) {
+            metrics.errors.add();
+        }
+        else if (!cacheKey.empty()) {
+            storeCached(cacheKey, result);
+        }
+        metrics.inFlight.add(-1);
+        ModelResidency::endUse(model);
         running = false;
         return result;
     }
 
+public:
+
+    // quoteArgument() - helper func, quotes one argument for CreateProcess (CommandLineToArgvW rules)
+    static std::string quoteArgument(const std::string& argument) {
+        std::string quoted = "\"";
+        size_t backslashes = 0;
+        for (char c : argument) {
+            if (c == '\\') {
+                backslashes++;
+                continue;
+            }
+            // backslashes are only special in front of a quote
+            quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+            backslashes = 0;
+            quoted += c;
+        }
+        quoted.append(backslashes * 2, '\\');
+        return quoted + "\"";
+    }
+
+    // replayCached() - helper func, streams a cached response through the same path as a live one
+    std::string replayCached(const CachedResponse& cached) {
+        TRACE_SCOPE("replay cached response");
+        bool recordedPace = ResponseCache::replayMode() == ResponseCache::ReplayRecorded;
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            stats = GenerationStats();
+            trace = GenerationTrace();
+            trace.dispatch = Clock::now();
+        }
+        std::string result;
+        for (const CachedChunk& chunk : cached.chunks) {
+            if (cancelRequested) {
+                break;
+            }
+            if (recordedPace) {
+                std::this_thread::sleep_until(trace.dispatch + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(chunk.offset)));
+            }
+            std::string text = cached.text.substr(result.length(), chunk.end - result.length());
+            result += text;
+            Clock::time_point now = Clock::now();
+            {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                if (!stats.hasFirstByte) {
+                    stats.hasFirstByte = true;
+                    trace.firstByte = now;
+                    stats.timeToFirstByte = trace.offset(now);
+                }
+            }
+            recordChunk(now, text.find_first_not_of(" \n") != std::string::npos);
+            if (recordedPace) {
+                publishOutput(result); // instant replay publishes once, below
+            }
+        }
+        if (!cancelRequested) {
+            result = cached.text;
+        }
+        publishOutput(result);
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        stats.loadDuration = cached.stats.loadDuration;
+        stats.promptEvalCount = cached.stats.promptEvalCount;
+        stats.promptEvalDuration = cached.stats.promptEvalDuration;
+        stats.evalCount = cached.stats.evalCount;
+        stats.evalDuration = cached.stats.evalDuration;
+        trace.completion = Clock::now();
+        stats.wallTime = trace.offset(trace.completion);
+        stats.done = true;
+        return result;
+    }
+
+    // storeCached() - helper func, saves the response that just finished under its cache key
+    void storeCached(const std::string& cacheKey, const std::string& result) {
+        CachedResponse response;
+        response.text = result;
+        response.chunks = recordedChunks;
+        if (response.chunks.empty() || response.chunks.back().end < result.length()) { // held back footer prefix
+            response.chunks.push_back(CachedChunk{ (float)stats.wallTime, (uint32_t)result.length() });
+        }
+        response.stats = getStats();
+        ResponseCache::store(cacheKey, response);
+    }
+
+    // takeResponseText() - helper func, splits raw pipe bytes into response text and the --verbose footer
+    // a line is held back only while it still matches "total duration:", so text keeps streaming
+    std::string takeResponseText(const char* data, size_t length) {
+        static const std::string marker = "total duration:";
+        std::string text;
+        for (size_t i = 0; i < length; ++i) {
+            char c = data[i];
+            if (inFooter) {
+                if (c == '\n') {
+                    parseVerboseLine(footerLine);
+                    footerLine.clear();
+                }
+                else if (c != '\r') {
+                    footerLine += c;
+                }
+                continue;
+            }
+            if (atLineStart) {
+                heldBack += c;
+                if (marker.compare(0, heldBack.length(), heldBack) == 0) {
+                    if (heldBack.length() == marker.length()) {
+                        inFooter = true;
+                        footerLine = heldBack;
+                        heldBack.clear();
+                    }
+                    continue;
+                }
+                text += heldBack;
+                heldBack.clear();
+                atLineStart = (c == '\n');
+                continue;
+            }
+            text += c;
+            atLineStart = (c == '\n');
+        }
+        return text;
+    }
+
+    // parseVerboseLine() - helper func, reads one line of the --verbose footer into stats
+    // returns false if the line is not part of the footer
+    bool parseVerboseLine(const std::string& line) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        std::string key = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front()))) {
+            value.erase(value.begin());
+        }
+
+        std::lock_guard<std::mutex> lock(outputMutex);
+        if (key == "total duration" || key == "prompt eval rate" || key == "eval rate") {
+            // derived values, recomputed from the counts/durations below
+        }
+        else if (key == "load duration") stats.loadDuration = ParseGoDuration(value);
+        else if (key == "prompt eval count") stats.promptEvalCount = std::atoi(value.c_str());
+        else if (key == "prompt eval duration") stats.promptEvalDuration = ParseGoDuration(value);
+        else if (key == "eval count") stats.evalCount = std::atoi(value.c_str());
+        else if (key == "eval duration") stats.evalDuration = ParseGoDuration(value);
+        else return false;
+        return true;
+    }
+
     // removeAnsiCodes() - helper func
     std::string removeAnsiCodes(const std::string& text, std::string& buffer) {
         std::string result;
@@ -122,7 +719,7 @@ public:
     // OpenTerminal() - Open terminal and execute command
     std::string OpenTerminal(const std::string& command, bool wait, bool showConsole = true) {
         static bool consoleAllocated = false;
-        static std::string ansiBuffer; // Persistent buffer for ANSI sequences
+        ansiBuffer.clear(); // Per-client buffer for ANSI sequences, clients may run concurrently
 
         // showing console
         if (showConsole) {
@@ -179,21 +776,99 @@ public:
         }
 
         // Execute command and capture output
-        std::string fullCommand = "cmd.exe /C \"" + command + " < nul 2>&1\"";
+        // started directly (no cmd.exe) with stdout/stderr on a pipe, so cancel() can terminate ollama itself
         std::string result;
+        commandFailed = true;
+        bool tracing = Trace::enabled(); // sampled once, the read loop below is hot
+        uint64_t spawnStart = tracing ? Trace::now() : 0;
 
-        std::unique_ptr<FILE, decltype(&_pclose)> pipe(_popen(fullCommand.c_str(), "r"), _pclose);
-        if (!pipe) {
+        SECURITY_ATTRIBUTES security = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+        HANDLE readPipe = nullptr;
+        HANDLE writePipe = nullptr;
+        if (!CreatePipe(&readPipe, &writePipe, &security, 0)) {
             return "Failed to open pipe.";
         }
+        SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+        HANDLE nulInput = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ, &security, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
 
-        char buffer[128];
-        // handle stream in chunks
-        while (fgets(buffer, sizeof(buffer), pipe.get()) != nullptr) {
-            std::string chunk(buffer);
-            std::string cleanChunk = removeAnsiCodes(chunk, ansiBuffer); // Pass persistent buffer
+        STARTUPINFOA startup = {};
+        startup.cb = sizeof(startup);
+        startup.dwFlags = STARTF_USESTDHANDLES;
+        startup.hStdInput = nulInput;
+        startup.hStdOutput = writePipe;
+        startup.hStdError = writePipe;
+        PROCESS_INFORMATION processInfo = {};
+        std::vector<char> commandLine(command.begin(), command.end());
+        commandLine.push_back('\0');
+        BOOL started = CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &startup, &processInfo);
+        CloseHandle(writePipe); // ours is closed so ReadFile ends when ollama exits
+        if (nulInput != INVALID_HANDLE_VALUE) {
+            CloseHandle(nulInput);
+        }
+        if (!started) {
+            CloseHandle(readPipe);
+            return "Failed to start ollama.";
+        }
+        CloseHandle(processInfo.hThread);
+        {
+            std::lock_guard<std::mutex> lock(processMutex);
+            process = processInfo.hProcess;
+            if (cancelRequested) { // cancelled while starting
+                TerminateProcess(process, 1);
+            }
+        }
+        if (tracing) Trace::complete("spawn process", spawnStart, Trace::now() - spawnStart);
+
+        // deadlines, see RequestPolicy: a timer terminates ollama when the first chunk, or the next one, is overdue
+        RequestPolicy::Deadlines deadlines = RequestPolicy::deadlines();
+        HANDLE watchdog = nullptr;
+        bool streaming = false; // first text arrived, the stall deadline applies from here on
+        expiredPhase = nullptr;
+        armWatchdog(watchdog, deadlines.firstTokenMs, "first token");
+
+        char buffer[256];
+        DWORD bytesRead = 0;
+        heldBack.clear();
+        footerLine.clear();
+        atLineStart = true;
+        inFooter = false;
+        // handle stream in chunks, ReadFile returns as soon as the pipe has data so chunks follow tokens
+        // readStart is taken again after every chunk, so "pipe read" is the time spent waiting on ollama
+        uint64_t readStart = tracing ? Trace::now() : 0;
+        for (; ReadFile(readPipe, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0; readStart = tracing ? Trace::now() : 0) {
+            Clock::time_point now = Clock::now();
+            if (tracing) Trace::complete("pipe read", readStart, Trace::toMicros(now) - readStart);
+            if (streaming && watchdog != nullptr) {
+                ChangeTimerQueueTimer(nullptr, watchdog, deadlines.stallMs, 0);
+            }
+            {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                if (!stats.hasFirstByte) {
+                    stats.hasFirstByte = true;
+                    trace.firstByte = now;
+                    stats.timeToFirstByte = trace.offset(now);
+                }
+            }
+
+            // footer is parsed from raw bytes so units like "µs" survive ANSI stripping
+            std::string cleanChunk;
+            {
+                TRACE_SCOPE("strip footer/ANSI");
+                std::string chunk = takeResponseText(buffer, bytesRead);
+                cleanChunk = removeAnsiCodes(chunk, ansiBuffer); // Pass persistent buffer
+            }
+            if (cleanChunk.empty()) {
+                continue;
+            }
+            if (!streaming) {
+                streaming = true;
+                armWatchdog(watchdog, deadlines.stallMs, "stall");
+            }
+            TRACE_SCOPE("publish chunk");
             result += cleanChunk;
-            setOutput(result); // Set output for imgui to dynamically update
+            recordedChunks.push_back(CachedChunk{ (float)trace.offset(now), (uint32_t)result.length() });
+            recordChunk(now, cleanChunk.find_first_not_of(" \n") != std::string::npos);
+            publishOutput(result); // Set output for imgui to dynamically update
             if (showConsole && consoleAllocated) { // write to allocated console
                 HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
                 if (hConsole != INVALID_HANDLE_VALUE) {
@@ -203,14 +878,164 @@ public:
             }
         }
 
-        int status = _pclose(pipe.get());
+        if (!heldBack.empty()) { // response ended mid-check
+            result += removeAnsiCodes(heldBack, ansiBuffer);
+            heldBack.clear();
+            publishOutput(result);
+        }
+
+        if (watchdog != nullptr) {
+            DeleteTimerQueueTimer(nullptr, watchdog, INVALID_HANDLE_VALUE); // waits for a running expireProcess()
+        }
+
+        DWORD status = 0;
+        {
+            TRACE_SCOPE("wait for exit");
+            WaitForSingleObject(processInfo.hProcess, INFINITE);
+            GetExitCodeProcess(processInfo.hProcess, &status);
+            std::lock_guard<std::mutex> lock(processMutex);
+            process = nullptr;
+        }
+        CloseHandle(processInfo.hProcess);
+        CloseHandle(readPipe);
+        if (expiredPhase != nullptr) {
+            RequestPolicy::timedOut(expiredPhase);
+            return std::string("Request timed out (") + expiredPhase + " timeout): " + result;
+        }
         if (status != 0) {
             return "Command failed with status " + std::to_string(status) + ": " + result;
         }
 
+        commandFailed = false;
         return result;
     }
 
+    // armWatchdog() - helper func, (re)starts the timer terminating ollama after milliseconds for phase, 0 stops it
+    void armWatchdog(HANDLE& timer, int milliseconds, const char* phase) {
+        {
+            std::lock_guard<std::mutex> lock(processMutex);
+            watchdogPhase = phase;
+        }
+        if (milliseconds <= 0) {
+            if (timer != nullptr) {
+                DeleteTimerQueueTimer(nullptr, timer, INVALID_HANDLE_VALUE);
+                timer = nullptr;
+            }
+        }
+        else if (timer != nullptr) {
+            ChangeTimerQueueTimer(nullptr, timer, milliseconds, 0);
+        }
+        else if (!CreateTimerQueueTimer(&timer, nullptr, expireProcess, this, milliseconds, 0, WT_EXECUTEONLYONCE)) {
+            timer = nullptr;
+        }
+    }
+
+    // expireProcess() - helper func, watchdog timer callback on a pool thread: a deadline passed, ends ollama
+    static VOID CALLBACK expireProcess(PVOID context, BOOLEAN) {
+        ModelClient* client = (ModelClient*)context;
+        std::lock_guard<std::mutex> lock(client->processMutex);
+        if (client->process != nullptr) {
+            client->expiredPhase = client->watchdogPhase;
+            TerminateProcess(client->process, 1);
+        }
+    }
+
+    // publishOutput() - helper func, sets output (result only grows during a generation, so just its new tail is
+    // copied) and wakes whoever follows this client, at most once per publishInterval(): chunks in between go out
+    // with the next publish, or with a trailing one scheduled when the interval runs out (so the last chunks
+    // before a pause are not held back). The end of the generation always publishes (Generation::complete()),
+    // which is the only publish of deferred publish-at-end work
+    void publishOutput(const std::string& result) {
+        {
+            std::lock_guard<std::mutex> lock(outputMutex);
+            if (result.length() > output.length()) {
+                output.append(result, output.length(), std::string::npos);
+            }
+        }
+        if (deferOutput) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            std::chrono::milliseconds interval(publishInterval());
+            if (now - lastPublish < interval) {
+                if (!publishArmed && schedulePublish) {
+                    publishArmed = true;
+                    int wait = (int)std::chrono::duration_cast<std::chrono::milliseconds>(lastPublish + interval - now).count();
+                    schedulePublish(wait > 0 ? wait : 1);
+                }
+                return;
+            }
+            lastPublish = now;
+        }
+        if (onOutput) {
+            onOutput();
+        }
+    }
+
+    // flushOutput() - the trailing publish armed by publishOutput(), on the event loop thread
+    void flushOutput() {
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            publishArmed = false;
+            if (deferOutput) {
+                return;
+            }
+            lastPublish = Clock::now();
+        }
+        if (onOutput) {
+            onOutput();
+        }
+    }
+
+    // recordChunk() - helper func, timestamps a chunk of output
+    void recordChunk(Clock::time_point now, bool visible) {
+        std::lock_guard<std::mutex> lock(outputMutex);
+        float offset = (float)trace.offset(now);
+        if (!stats.hasFirstToken) {
+            if (!visible) {
+                return; // leading blank lines are not the first token
+            }
+            stats.hasFirstToken = true;
+            trace.firstToken = now;
+            stats.timeToFirstToken = offset;
+            if (!cacheHit) {
+                ClientMetrics::get().queueDepth.add(-1);
+            }
+            Trace::instant("first token", model);
+        }
+        else if (telemetry != nullptr && !cacheHit) {
+            telemetry->interToken.record(Telemetry::toMicros(offset - trace.chunkOffsets.back()));
+        }
+        trace.chunkOffsets.push_back(offset);
+        stats.chunkCount++;
+    }
+
+    // traceServerPhases() - helper func, adds the --verbose load/prefill/decode durations to the trace
+    // the server reports durations only, so they are laid out back to back on their own track, ending at the last chunk
+    void traceServerPhases() {
+        if (!Trace::enabled() || !stats.hasFirstToken) {
+            return;
+        }
+        uint64_t decodeEnd = Trace::toMicros(trace.dispatch) + Telemetry::toMicros(trace.chunkOffsets.back());
+        uint64_t decode = Telemetry::toMicros(stats.evalDuration);
+        uint64_t prefill = Telemetry::toMicros(stats.promptEvalDuration);
+        uint64_t load = Telemetry::toMicros(stats.loadDuration);
+        if (decode + prefill + load > decodeEnd) {
+            return; // clocks disagree, skip rather than draw nonsense
+        }
+        Trace::completeOn("ollama (" + model + ")", "load", decodeEnd - decode - prefill - load, load, model);
+        Trace::completeOn("ollama (" + model + ")", "prefill", decodeEnd - decode - prefill, prefill, std::to_string(stats.promptEvalCount) + " tokens");
+        Trace::completeOn("ollama (" + model + ")", "decode", decodeEnd - decode, decode, std::to_string(stats.evalCount) + " tokens");
+    }
+
+    // terminateEpoch() - bumped by TerminateOllamaTasks(), lets running requests tell a kill from a failure
+    static int terminateEpoch(bool bump = false) {
+        static std::atomic<int> epoch{ 0 };
+        return bump ? ++epoch : epoch.load();
+    }
+
     // TerminateOllamaTasks() - terminates ollama tasks to begin new chat
     std::string TerminateOllamaTasks(bool showConsole = true) {
         static bool consoleAllocated = false;
@@ -268,6 +1093,7 @@ public:
         }
 
         // Command to terminate all Ollama processes
+        terminateEpoch(true);
         std::string command = "taskkill /IM ollama.exe /F /T";
         std::string fullCommand = "cmd.exe /C \"" + command + " < nul 2>&1\"";
         std::string result;
@@ -307,3 +1133,407 @@ public:
     }
 
 };
+
+// Generation - one running `ollama run`, shared by every client that sends the same prompt to the same model
+// The producer client streams into itself, subscribers mirror its output (so a late one replays what
+// was already produced, then follows live). The process is terminated once the last subscriber cancels.
+class Generation {
+public:
+    ModelClient producer;           // runs the command, its output is what subscribers see
+    std::mutex mutex;               // guards finished/result/listeners
+    bool finished = false;
+    std::string result;             // return value of the producer's generate()
+
+    Generation(const std::string& key, const std::string& model) : producer(model), key(key) {
+        producer.onOutput = [this]() {
+            notify();
+        };
+    }
+
+    // join() - subscribes to the running generation of this prompt, or starts one once AdmissionControl admits it
+    static std::shared_ptr<Generation> join(const std::string& model, const std::string& prompt, const std::string& cacheKey, bool showConsole,
+                                            AdmissionControl::Priority priority, bool publishAtEnd, bool& joined) {
+        static bool hooked = (ThreadPool::group("generation").onCancel(cancelAll), true); // shutdown ends running generations
+        (void)hooked;
+        std::string key = model + "\n" + prompt;
+        Registry& registry = getRegistry();
+        std::shared_ptr<Generation> generation;
+        joined = false;
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            auto found = registry.running.find(key);
+            if (found != registry.running.end()) {
+                generation = found->second.lock();
+                if (generation) {
+                    generation->subscribers++;
+                    joined = true;
+                }
+            }
+            if (!joined) {
+                generation = std::make_shared<Generation>(key, model);
+                generation->subscribers = 1;
+                registry.running[key] = generation;
+            }
+        }
+        if (joined) {
+            if (priority == AdmissionControl::Interactive) {
+                AdmissionControl::promote(generation->admission); // still queued as batch work, a person waits on it now
+            }
+            if (!publishAtEnd) {
+                generation->producer.deferOutput = false; // someone watches it now
+            }
+            return generation;
+        }
+        generation->producer.deferOutput = publishAtEnd;
+        std::weak_ptr<Generation> flushed = generation; // the timer must not keep a finished generation alive
+        generation->producer.schedulePublish = [flushed](int milliseconds) {
+            HttpLoop::after(milliseconds, [flushed]() {
+                std::shared_ptr<Generation> pending = flushed.lock();
+                if (pending && !pending->isFinished()) {
+                    pending->producer.flushOutput();
+                }
+            });
+        };
+        // the guard finishes the generation when the task goes away, even if shutdown dropped it unstarted
+        // or it was withdrawn from the admission queue
+        std::shared_ptr<Completion> completion(new Completion{ generation });
+        auto start = [completion, model, prompt, cacheKey, showConsole](AdmissionControl::Ticket ticket) {
+            completion->generation->admission = ticket;
+            // runs on the admitting thread (UI or event loop), so a model being unloaded starts later instead of blocking it
+            ModelResidency::reserve(model, [completion, prompt, cacheKey, showConsole]() {
+                Generation& admitted = *completion->generation;
+                if (ModelClient::transport() == ModelClient::Http) {
+                    // no thread per request, the event loop streams it (a request that cannot start completes right here)
+                    admitted.producer.generateAsync(prompt, cacheKey, [completion](const std::string& result) {
+                        completion->generation->complete(result);
+                    });
+                    return;
+                }
+                ThreadPool::group("generation").submit([completion, prompt, cacheKey, showConsole]() {
+                    completion->generation->complete(completion->generation->producer.generate(prompt, showConsole, cacheKey));
+                    });
+            });
+        };
+        generation->admission = AdmissionControl::admit(model, priority, start, [completion](const std::string& reason) {
+            completion->generation->complete("Request rejected (" + reason + ")");
+        });
+        return generation;
+    }
+
+    // watch() - calls listener after every producer update and once more when finished, on the producer's thread
+    // it is also called right away, so a late subscriber catches up with what was already produced
+    void watch(const std::function<void()>& listener) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!finished) {
+                listeners.push_back(listener);
+            }
+        }
+        listener();
+    }
+
+    // isFinished() - true once the generation ended
+    bool isFinished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return finished;
+    }
+
+    // finishedWith() - true and the producer's result once the generation ended
+    bool finishedWith(std::string& output) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) {
+            output = result;
+        }
+        return finished;
+    }
+
+    // cancelAll() - terminates every running generation, used when the pool shuts down
+    static void cancelAll() {
+        Registry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const auto& entry : registry.running) {
+            std::shared_ptr<Generation> generation = entry.second.lock();
+            if (generation) {
+                AdmissionControl::withdraw(generation->admission);
+                generation->producer.cancel();
+            }
+        }
+    }
+
+    // leave() - drops a subscription, the last one out cancels an unfinished generation
+    static void leave(const std::shared_ptr<Generation>& generation) {
+        std::lock_guard<std::mutex> lock(getRegistry().mutex);
+        if (--generation->subscribers > 0) {
+            return;
+        }
+        bool done;
+        {
+            std::lock_guard<std::mutex> generationLock(generation->mutex);
+            done = generation->finished;
+        }
+        if (!done) {
+            generation->forget(); // new identical prompts start over instead of joining a dying run
+            AdmissionControl::withdraw(generation->admission); // never started, the Completion finishes it
+            generation->producer.cancel();
+        }
+    }
+
+private:
+    // Registry - running generations by model + prompt
+    struct Registry {
+        std::mutex mutex; // also guards subscribers
+        std::map<std::string, std::weak_ptr<Generation>> running;
+    };
+
+    // Completion - completes the generation when the producer task is destroyed
+    struct Completion {
+        std::shared_ptr<Generation> generation;
+        ~Completion() { generation->complete(""); }
+    };
+
+    std::string key;
+    int subscribers = 0;
+    std::vector<std::function<void()>> listeners;
+    std::atomic<AdmissionControl::Ticket> admission{ 0 }; // queued or running in AdmissionControl, 0 if rejected
+
+    // notify() - runs the listeners, outside the mutex so they can take their own locks
+    void notify() {
+        std::vector<std::function<void()>> current;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            current = listeners;
+        }
+        for (const auto& listener : current) {
+            listener();
+        }
+    }
+
+    // complete() - publishes the result once, tells the listeners and leaves the registry
+    void complete(const std::string& output) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (finished) {
+                return;
+            }
+            result = output;
+            finished = true;
+        }
+        AdmissionControl::release(admission); // the next queued request of the model may start
+        notify();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            listeners.clear(); // they hold subscriptions, which hold this generation
+        }
+        std::lock_guard<std::mutex> lock(getRegistry().mutex);
+        forget();
+    }
+
+    static Registry& getRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    // forget() - removes this generation from the registry, registry mutex held
+    void forget() {
+        Registry& registry = getRegistry();
+        auto found = registry.running.find(key);
+        if (found != registry.running.end() && found->second.lock().get() == this) {
+            registry.running.erase(found);
+        }
+    }
+};
+
+// Subscription - connects a client and its stream to the client producing the text, the producer of a
+// Generation or a cache replay. Runs on the producer's thread; once ended, the client is never touched
+// again, so it may be destroyed as soon as its running flag drops. Stream callbacks run with no lock held
+// but the ordering one, so they may cancel().
+class ModelClient::Subscription {
+public:
+    std::function<void()> onEnd; // releases the producer (leaves the generation), called once
+
+    Subscription(ModelClient* client, const std::shared_ptr<TokenStream>& stream) : client(client), stream(stream) {}
+
+    // update() - mirrors the producer's output/stats into the client and pushes the new text
+    void update(const ModelClient& source) {
+        std::lock_guard<std::mutex> order(deliverMutex);
+        std::string chunk;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (client == nullptr) {
+                return;
+            }
+            chunk = source.getOutputFrom(delivered);
+            GenerationStats sourceStats = source.getStats();
+            GenerationTrace sourceTrace = source.getTrace();
+            std::lock_guard<std::mutex> outputLock(client->outputMutex);
+            if (delivered == 0) {
+                client->output = chunk; // drops the previous response
+            }
+            else {
+                client->output += chunk;
+            }
+            delivered += chunk.length();
+            client->stats = sourceStats;
+            client->trace = sourceTrace;
+        }
+        stream->push(chunk);
+    }
+
+    // complete() - the producer finished with result
+    void complete(const std::string& result) {
+        {
+            std::lock_guard<std::mutex> order(deliverMutex);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!release()) {
+                return;
+            }
+        }
+        stream->finish(result);
+    }
+
+    // cancel() - ends with the output so far, the producer keeps going if others still follow it
+    void cancel() {
+        std::string partial;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (client != nullptr) {
+                partial = client->getOutput();
+            }
+            if (!release()) {
+                return;
+            }
+        }
+        stream->finish(partial, true);
+    }
+
+private:
+    std::mutex deliverMutex; // keeps pushes in order, held while stream callbacks run
+    std::mutex mutex;        // guards client/delivered
+    ModelClient* client;     // null once ended
+    std::shared_ptr<TokenStream> stream;
+    size_t delivered = 0;    // length of the producer's output pushed so far
+
+    // release() - lets go of the producer and the client, false if already done, mutex held
+    bool release() {
+        if (client == nullptr) {
+            return false;
+        }
+        std::function<void()> releaseProducer;
+        releaseProducer.swap(onEnd);
+        if (releaseProducer) {
+            releaseProducer();
+        }
+        client->running = false;
+        client = nullptr;
+        return true;
+    }
+};
+
+// cancel() - terminates our own process, or ends the subscription to a shared one
+inline void ModelClient::cancel() {
+    cancelRequested = true;
+    std::shared_ptr<HttpRace> race;
+    std::shared_ptr<Subscription> active;
+    {
+        std::lock_guard<std::mutex> lock(processMutex);
+        if (process != nullptr) {
+            TerminateProcess(process, 1);
+        }
+        race = httpRace;
+        active = subscription;
+    }
+    if (race) {
+        race->cancel();
+    }
+    if (active) {
+        active->cancel();
+    }
+}
+
+// sendPrompt() - streams the prompt and waits for the result
+inline std::string ModelClient::sendPrompt(const std::string& prompt, bool showConsole) {
+    // Check if has model
+    if (model.empty()) {
+        throw std::runtime_error("Model name is not specified");
+    }
+    TRACE_SCOPE_DETAIL("sendPrompt", model);
+    return streamPrompt(prompt, showConsole)->wait();
+}
+
+// streamPrompt() - checks the response cache, then subscribes to (or starts) the generation of this prompt
+inline std::shared_ptr<TokenStream> ModelClient::streamPrompt(const std::string& prompt, bool showConsole) {
+    std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+    if (model.empty()) {
+        stream->finish("Model name is not specified");
+        return stream;
+    }
+
+    running = true;
+    cancelRequested = false;
+    std::shared_ptr<Subscription> current = std::make_shared<Subscription>(this, stream);
+    {
+        std::lock_guard<std::mutex> lock(processMutex);
+        subscription = current;
+    }
+    std::weak_ptr<Subscription> weak = current;
+    stream->onCancel([weak]() {
+        std::shared_ptr<Subscription> active = weak.lock();
+        if (active) {
+            active->cancel();
+        }
+    });
+
+    // opt-in response cache, a hit replays the stored stream instead of running the model
+    std::string cacheKey = ResponseCache::enabled() ? ResponseCache::keyFor(model, prompt) : "";
+    CachedResponse cached;
+    cacheHit = !cacheKey.empty() && ResponseCache::lookup(cacheKey, cached);
+    if (cacheHit) {
+        // replayed by a client of its own, so a cancelled subscriber is free to go while the replay stops
+        std::shared_ptr<ModelClient> replayer = std::make_shared<ModelClient>(model);
+        replayer->cacheHit = true;
+        ModelClient* source = replayer.get();
+        replayer->onOutput = [current, source]() {
+            current->update(*source);
+        };
+        current->onEnd = [source]() {
+            source->cancelRequested = true;
+        };
+        // the guard ends the subscription when the replay goes away, even if shutdown dropped it unstarted
+        struct ReplayEnd {
+            std::shared_ptr<Subscription> subscription;
+            ~ReplayEnd() { subscription->complete(""); }
+        };
+        std::shared_ptr<ReplayEnd> ending(new ReplayEnd{ current });
+        auto replay = [ending, replayer, cached]() {
+            std::string result = replayer->replayCached(cached);
+            ending->subscription->update(*replayer);
+            ending->subscription->complete(result);
+            replayer->onOutput = nullptr; // drops its reference to the subscription
+        };
+        if (ResponseCache::replayMode() == ResponseCache::ReplayRecorded) {
+            ThreadPool::group("generation").submit(replay);
+        }
+        else {
+            replay(); // instant replay is a copy, not worth a task
+        }
+        return stream;
+    }
+
+    bool joined = false;
+    std::shared_ptr<Generation> generation = Generation::join(model, prompt, cacheKey, showConsole, priority, publishAtEnd, joined);
+    if (joined) {
+        ClientMetrics::get().coalesced.add();
+    }
+    current->onEnd = [generation]() {
+        Generation::leave(generation);
+    };
+    Generation* producer = generation.get(); // listeners are owned by the generation, so it outlives them
+    generation->watch([current, producer]() {
+        current->update(producer->producer);
+        std::string result;
+        if (producer->finishedWith(result)) {
+            current->complete(result);
+        }
+    });
+    return stream;
+}
@@ -0,0 +1,401 @@
+﻿#pragma once
+#include "OllamaCli.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// ModelResidency - which models the daemon has loaded, preloading on selection and keeping recent ones warm
+// Recently used models stay loaded with the configured keep-alive; once the resident ones exceed the
+// memory budget, the least recently used idle model is unloaded (`ollama stop`, i.e. keep-alive 0).
+// A poller keeps the picture current, models loaded by other ollama clients count against the budget too.
+class ModelResidency {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum State {
+        Cold,     // not loaded
+        Loading,  // preload or first request running
+        Resident  // loaded, answers without load time
+    };
+
+    // state() - residency of a model as last seen
+    static State state(const std::string& model) {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        auto found = residency.models.find(OllamaCli::CanonicalName(model));
+        return found == residency.models.end() ? Cold : found->second.state;
+    }
+
+    static const char* stateName(State state) {
+        switch (state) {
+        case Loading: return "loading";
+        case Resident: return "resident";
+        default: return "cold";
+        }
+    }
+
+    // Row - one model of the residency table
+    struct Row {
+        std::string name;
+        State state = Cold;
+        uint64_t bytes = 0;     // footprint from `ollama ps`, 0 if never seen loaded
+        std::string processor;  // CPU/GPU split
+        std::string until;      // keep-alive expiry as printed by ollama
+        double idleSeconds = -1.0; // since our last request/preload, -1 if never used by us
+        int inFlight = 0;
+    };
+
+    // snapshot() - every known model, most recently used first
+    static std::vector<Row> snapshot() {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        std::vector<std::pair<uint64_t, Row>> ordered;
+        Clock::time_point now = Clock::now();
+        for (const auto& entry : residency.models) {
+            Row row;
+            row.name = entry.first;
+            row.state = entry.second.state;
+            row.bytes = entry.second.bytes;
+            row.processor = entry.second.processor;
+            row.until = entry.second.until;
+            row.inFlight = entry.second.inFlight;
+            if (entry.second.lastUse > 0) {
+                row.idleSeconds = std::chrono::duration<double>(now - entry.second.lastUsedAt).count();
+            }
+            ordered.push_back(std::make_pair(entry.second.lastUse, row));
+        }
+        std::sort(ordered.begin(), ordered.end(), [](const std::pair<uint64_t, Row>& a, const std::pair<uint64_t, Row>& b) {
+            return a.first != b.first ? a.first > b.first : a.second.name < b.second.name;
+        });
+        std::vector<Row> rows;
+        for (const auto& entry : ordered) {
+            rows.push_back(entry.second);
+        }
+        return rows;
+    }
+
+    // residentBytes() - footprint of everything loaded as of the last poll
+    static uint64_t residentBytes() {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        return residency.usedBytes();
+    }
+
+    // startPolling() - polls `ollama ps` every intervalSeconds; a running poller takes the new interval (and
+    // polls now) instead of being replaced, so the UI never waits for a poll in progress
+    static void startPolling(int intervalSeconds) {
+        ModelResidency& residency = instance();
+        {
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            residency.pollInterval = intervalSeconds;
+            if (residency.poller.joinable()) {
+                residency.pollChanged = true;
+                residency.pollWake.notify_all();
+                return;
+            }
+            residency.pollStopping = false;
+        }
+        residency.poller = std::thread([]() {
+            Trace::setThreadName("Residency poller");
+            ModelResidency& residency = instance();
+            for (;;) {
+                refresh();
+                std::unique_lock<std::mutex> lock(residency.mutex);
+                residency.pollWake.wait_for(lock, std::chrono::seconds(residency.pollInterval.load()),
+                                            [&residency]() { return residency.pollStopping || residency.pollChanged; });
+                residency.pollChanged = false;
+                if (residency.pollStopping) {
+                    return;
+                }
+            }
+        });
+    }
+
+    // stopPolling() - ends the poller and waits for it (a poll in progress finishes first), see App::Shutdown()
+    static void stopPolling() {
+        ModelResidency& residency = instance();
+        {
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            residency.pollStopping = true;
+            residency.pollInterval = 0;
+        }
+        residency.pollWake.notify_all();
+        if (residency.poller.joinable()) {
+            residency.poller.join();
+        }
+    }
+
+    // pollInterval() - seconds between polls, 0 when not polling
+    static int pollIntervalSeconds() { return instance().pollInterval.load(); }
+
+    // unload() - unloads an idle model now, false if a request is using it
+    static bool unload(const std::string& model) {
+        std::string name = OllamaCli::CanonicalName(model);
+        {
+            ModelResidency& residency = instance();
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            ModelState& entry = residency.models[name];
+            if (entry.inFlight > 0 || entry.reserved > 0 || entry.preloading || entry.unloading) {
+                return false;
+            }
+            entry.state = Cold;
+            entry.unloading = true; // requests reserve() it again once the stop is done
+            residency.unloads.add();
+        }
+        ThreadPool::group("residency").submit([name]() {
+            stop(name);
+            refresh();
+        });
+        return true;
+    }
+
+    // preload() - loads a model in the background, so the first prompt does not pay the load time
+    static void preload(const std::string& model) {
+        std::string name = OllamaCli::CanonicalName(model);
+        {
+            ModelResidency& residency = instance();
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            ModelState& entry = residency.models[name];
+            entry.lastUse = ++residency.useCounter;
+            entry.lastUsedAt = Clock::now();
+            if (entry.state != Cold) {
+                return; // loaded or on its way
+            }
+            entry.state = Loading;
+            entry.preloading = true;
+        }
+        ThreadPool::group("residency").submit([name]() {
+            TRACE_SCOPE_DETAIL("ModelResidency::preload", name);
+            waitForStop(name);
+            // an empty prompt only loads the model, --keepalive sets how long it stays
+            OllamaCli::Run("ollama run " + name + " --keepalive " + keepAlive() + " \"\"");
+            {
+                ModelResidency& residency = instance();
+                std::lock_guard<std::mutex> lock(residency.mutex);
+                residency.models[name].preloading = false;
+            }
+            refresh();
+        });
+    }
+
+    // reserve() - a request for the model is about to start: runs start right away, or, while the model is
+    // being stopped, once `ollama stop` is done (on the thread that ran it), so the request loads the model again
+    // instead of losing it to the stop. Never blocks the caller (the UI or the event loop thread); the model is
+    // not unloaded between the reservation and the request's beginUse()
+    static void reserve(const std::string& model, const std::function<void()>& start) {
+        {
+            ModelResidency& residency = instance();
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            ModelState& entry = residency.models[OllamaCli::CanonicalName(model)];
+            if (entry.unloading) {
+                entry.waiting.push_back(start);
+                residency.deferredStarts.add();
+                return;
+            }
+            entry.reserved++;
+        }
+        start();
+    }
+
+    // beginUse() - a request for the model is starting, it is now the most recently used one
+    static void beginUse(const std::string& model) {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        ModelState& entry = residency.models[OllamaCli::CanonicalName(model)];
+        if (entry.reserved > 0) {
+            entry.reserved--; // the reservation of reserve() turns into the use
+        }
+        entry.lastUse = ++residency.useCounter;
+        entry.lastUsedAt = Clock::now();
+        entry.inFlight++;
+        if (entry.state == Cold) {
+            entry.state = Loading;
+        }
+    }
+
+    // endUse() - the request finished, refreshes residency (and applies the budget) in the background
+    static void endUse(const std::string& model) {
+        {
+            ModelResidency& residency = instance();
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            residency.models[OllamaCli::CanonicalName(model)].inFlight--;
+        }
+        ThreadPool::group("residency").submit(refresh); // `ollama ps` takes a while, don't hold up the finished request
+    }
+
+    // refresh() - reads `ollama ps`, then unloads least recently used idle models over the budget
+    static void refresh() {
+        TRACE_SCOPE("ModelResidency::refresh");
+        std::lock_guard<std::mutex> refreshing(instance().refreshMutex); // poller, preloads and requests all refresh
+        bool ok = false;
+        std::vector<OllamaCli::RunningModel> running = OllamaCli::ListRunning(&ok);
+        if (!ok) {
+            return;
+        }
+        std::vector<std::string> unload;
+        {
+            ModelResidency& residency = instance();
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            for (auto& entry : residency.models) {
+                if (entry.second.state == Resident) {
+                    entry.second.state = Cold; // unless listed below
+                }
+            }
+            for (const OllamaCli::RunningModel& model : running) {
+                ModelState& entry = residency.models[OllamaCli::CanonicalName(model.name)];
+                entry.state = Resident;
+                entry.bytes = model.sizeBytes;
+                entry.processor = model.processor;
+                entry.until = model.until;
+            }
+            for (auto& entry : residency.models) {
+                if (entry.second.state == Loading && entry.second.inFlight == 0 && !entry.second.preloading) {
+                    entry.second.state = Cold; // preload failed
+                }
+            }
+            unload = residency.overBudget();
+            for (const std::string& name : unload) {
+                residency.models[name].state = Cold;
+                residency.models[name].unloading = true; // idle now, reserve() holds new requests until the stop is done
+                residency.unloads.add();
+            }
+            residency.residentGauge.set((int64_t)residency.usedBytes());
+        }
+        for (const std::string& name : unload) {
+            stop(name);
+        }
+    }
+
+    // keepAlive() - how long a used model stays loaded, as an ollama duration ("30m", "-1" = forever)
+    static std::string keepAlive() {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        return residency.keepAliveValue;
+    }
+    static void setKeepAlive(const std::string& value) {
+        ModelResidency& residency = instance();
+        std::lock_guard<std::mutex> lock(residency.mutex);
+        residency.keepAliveValue = value.empty() ? "5m" : value;
+    }
+
+    // budgetBytes() - memory the resident models may use together, 0 = unlimited
+    static uint64_t budgetBytes() { return instance().budget.load(std::memory_order_relaxed); }
+    static void setBudgetBytes(uint64_t bytes) { instance().budget.store(bytes, std::memory_order_relaxed); }
+
+    // preloadOnSelect() - preload models picked in the "Select Model" combo?
+    static bool preloadOnSelect() { return instance().preloadSelected.load(std::memory_order_relaxed); }
+    static void setPreloadOnSelect(bool value) { instance().preloadSelected.store(value, std::memory_order_relaxed); }
+
+private:
+    struct ModelState {
+        State state = Cold;
+        uint64_t bytes = 0;   // footprint from `ollama ps`
+        uint64_t lastUse = 0; // useCounter at the last preload/request
+        Clock::time_point lastUsedAt;
+        std::string processor;
+        std::string until;
+        int inFlight = 0;     // running requests, never unloaded while > 0
+        int reserved = 0;     // requests between reserve() and beginUse(), never unloaded while > 0 either
+        bool preloading = false;
+        bool unloading = false; // `ollama stop` chosen or running, reserve() queues requests in waiting
+        std::vector<std::function<void()>> waiting; // starts of requests that arrived during the stop
+    };
+
+    std::mutex mutex;
+    std::condition_variable stopped; // an unloading model was stopped, see waitForStop()
+    std::map<std::string, ModelState> models; // by OllamaCli::CanonicalName(), "llama3" and "llama3:latest" share one entry
+    uint64_t useCounter = 0;
+    std::string keepAliveValue = "30m";
+    std::atomic<uint64_t> budget{ 0 };
+    std::atomic<bool> preloadSelected{ true };
+    std::mutex refreshMutex;
+    std::thread poller;                // started by startPolling(), joined by stopPolling()
+    std::condition_variable pollWake;  // ends the poller's wait, guarded by mutex like the flags below
+    bool pollStopping = false;
+    bool pollChanged = false;          // the interval changed, poll now
+    std::atomic<int> pollInterval{ 0 };
+
+    Counter& unloads = MetricsRegistry::counter("model_app_model_unloads_total", "Models unloaded by the residency manager.");
+    Counter& deferredStarts = MetricsRegistry::counter("model_app_unload_deferred_starts_total", "Requests started after an unload of their model finished.");
+    Gauge& residentGauge = MetricsRegistry::gauge("model_app_resident_bytes", "Memory used by loaded models, from ollama ps.");
+
+    // instance() - never destroyed, pool tasks and the HTTP loop may still end a use while the process exits
+    static ModelResidency& instance() {
+        static ModelResidency* residency = new ModelResidency();
+        return *residency;
+    }
+
+    // stop() - runs `ollama stop` for a model marked unloading, then starts the requests that arrived meanwhile
+    static void stop(const std::string& name) {
+        {
+            TRACE_SCOPE_DETAIL("ModelResidency::unload", name);
+            OllamaCli::Run("ollama stop " + name);
+        }
+        ModelResidency& residency = instance();
+        std::vector<std::function<void()>> starts;
+        {
+            std::lock_guard<std::mutex> lock(residency.mutex);
+            ModelState& entry = residency.models[name];
+            entry.unloading = false;
+            starts.swap(entry.waiting);
+            entry.reserved += (int)starts.size();
+        }
+        residency.stopped.notify_all();
+        for (const std::function<void()>& start : starts) {
+            start();
+        }
+    }
+
+    // waitForStop() - returns once a stop of the model, if one is running, is done
+    static void waitForStop(const std::string& name) {
+        ModelResidency& residency = instance();
+        std::unique_lock<std::mutex> lock(residency.mutex);
+        residency.stopped.wait(lock, [&residency, &name]() { return !residency.models[name].unloading; });
+    }
+
+    // usedBytes() - footprint of resident models, mutex held
+    uint64_t usedBytes() const {
+        uint64_t used = 0;
+        for (const auto& entry : models) {
+            used += entry.second.state == Resident ? entry.second.bytes : 0;
+        }
+        return used;
+    }
+
+    // overBudget() - least recently used idle resident models to unload, mutex held
+    std::vector<std::string> overBudget() const {
+        std::vector<std::string> unload;
+        uint64_t limit = budget.load(std::memory_order_relaxed);
+        if (limit == 0) {
+            return unload;
+        }
+        uint64_t used = usedBytes();
+        std::vector<std::pair<uint64_t, std::string>> idle; // (lastUse, name), models loaded by others have lastUse 0
+        for (const auto& entry : models) {
+            if (entry.second.state == Resident && entry.second.inFlight == 0 && entry.second.reserved == 0 && !entry.second.preloading) {
+                idle.push_back(std::make_pair(entry.second.lastUse, entry.first));
+            }
+        }
+        std::sort(idle.begin(), idle.end());
+        for (size_t i = 0; used > limit && i < idle.size(); ++i) {
+            if (idle[i].first == useCounter) {
+                break; // never unload the model just picked
+            }
+            used -= models.at(idle[i].second).bytes;
+            unload.push_back(idle[i].second);
+        }
+        return unload;
+    }
+};
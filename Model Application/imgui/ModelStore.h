@@ -0,0 +1,277 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// ModelStore - paths inside ollama's local model store (manifests + content-addressed blobs)
+//   <root>/manifests/<registry>/<namespace>/<name>/<tag>   JSON listing the layers of a model
+//   <root>/blobs/sha256-<hex>                              layer contents, shared between models
+namespace ModelStore {
+
+    // GetEnvironment() - value of an environment variable, empty if unset
+    inline std::string GetEnvironment(const char* name) {
+#ifdef _WIN32
+        char* value = nullptr;
+        size_t length = 0;
+        if (_dupenv_s(&value, &length, name) != 0 || value == nullptr) {
+            return "";
+        }
+        std::string result(value);
+        free(value);
+        return result;
+#else
+        const char* value = std::getenv(name);
+        return value ? value : "";
+#endif
+    }
+
+    // Root() - OLLAMA_MODELS, or .ollama/models in the user's home directory
+    inline std::string Root() {
+        std::string root = GetEnvironment("OLLAMA_MODELS");
+        if (!root.empty()) {
+            return root;
+        }
+#ifdef _WIN32
+        return GetEnvironment("USERPROFILE") + "\\.ollama\\models";
+#else
+        return GetEnvironment("HOME") + "/.ollama/models";
+#endif
+    }
+
+    // ModelName - "[registry/][namespace/]name[:tag]" split into parts, with ollama's defaults
+    struct ModelName {
+        std::string registry = "registry.ollama.ai";
+        std::string space = "library"; // namespace
+        std::string name;
+        std::string tag = "latest";
+    };
+
+    inline ModelName ParseName(const std::string& model) {
+        ModelName parsed;
+        std::string path = model;
+        size_t colon = path.rfind(':');
+        if (colon != std::string::npos && path.find('/', colon) == std::string::npos) {
+            parsed.tag = path.substr(colon + 1);
+            path = path.substr(0, colon);
+        }
+        size_t slash = path.rfind('/');
+        parsed.name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        if (slash != std::string::npos) {
+            path = path.substr(0, slash);
+            size_t first = path.find('/');
+            if (first == std::string::npos) {
+                parsed.space = path;
+            }
+            else {
+                parsed.registry = path.substr(0, first);
+                parsed.space = path.substr(first + 1);
+            }
+        }
+        return parsed;
+    }
+
+    inline std::string Join(const std::string& a, const std::string& b) {
+#ifdef _WIN32
+        return a + "\\" + b;
+#else
+        return a + "/" + b;
+#endif
+    }
+
+    // DisplayName() - how ollama lists a model, default registry and namespace left out
+    inline std::string DisplayName(const ModelName& name) {
+        ModelName defaults;
+        std::string prefix;
+        if (name.registry != defaults.registry) {
+            prefix = name.registry + "/" + name.space + "/";
+        }
+        else if (name.space != defaults.space) {
+            prefix = name.space + "/";
+        }
+        return prefix + name.name + ":" + name.tag;
+    }
+
+    // ManifestPath() - manifest file of a model name
+    inline std::string ManifestPath(const std::string& model) {
+        ModelName name = ParseName(model);
+        return Join(Join(Join(Join(Join(Root(), "manifests"), name.registry), name.space), name.name), name.tag);
+    }
+
+    // BlobPath() - blob file of a digest ("sha256:abc..." is stored as "sha256-abc...")
+    inline std::string BlobPath(std::string digest) {
+        size_t colon = digest.find(':');
+        if (colon != std::string::npos) {
+            digest[colon] = '-';
+        }
+        return Join(Join(Root(), "blobs"), digest);
+    }
+
+    // FileInfo() - size and modification time (seconds since 1970) of a file, false if it does not exist
+    inline bool FileInfo(const std::string& path, uint64_t& size, int64_t& modified) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+            return false;
+        }
+        size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+        uint64_t ticks = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+        modified = (int64_t)(ticks / 10000000ull) - 11644473600ll; // 100 ns ticks since 1601
+#else
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return false;
+        }
+        size = (uint64_t)info.st_size;
+        modified = (int64_t)info.st_mtime;
+#endif
+        return true;
+    }
+
+    // ListDirectory() - names of the entries in a directory, directories and files separately
+    inline void ListDirectory(const std::string& directory, std::vector<std::string>& directories, std::vector<std::string>& files) {
+#ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        HANDLE find = FindFirstFileA(Join(directory, "*").c_str(), &data);
+        if (find == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        do {
+            std::string name = data.cFileName;
+            if (name == "." || name == "..") continue;
+            ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? directories : files).push_back(name);
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+#else
+        DIR* dir = opendir(directory.c_str());
+        if (dir == nullptr) {
+            return;
+        }
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            struct stat info;
+            bool isDirectory = stat(Join(directory, name).c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+            (isDirectory ? directories : files).push_back(name);
+        }
+        closedir(dir);
+#endif
+    }
+
+    // Manifest - one manifest file of the store
+    struct Manifest {
+        ModelName name;
+        std::string path;
+    };
+
+    // ListManifests() - every manifests/<registry>/<namespace>/<name>/<tag> file
+    inline std::vector<Manifest> ListManifests() {
+        std::vector<Manifest> manifests;
+        std::string root = Join(Root(), "manifests");
+        std::vector<std::string> registries, ignored;
+        ListDirectory(root, registries, ignored);
+        for (const std::string& registry : registries) {
+            std::vector<std::string> spaces;
+            ListDirectory(Join(root, registry), spaces, ignored);
+            for (const std::string& space : spaces) {
+                std::vector<std::string> names;
+                ListDirectory(Join(Join(root, registry), space), names, ignored);
+                for (const std::string& name : names) {
+                    std::string directory = Join(Join(Join(root, registry), space), name);
+                    std::vector<std::string> subdirectories, tags;
+                    ListDirectory(directory, subdirectories, tags);
+                    for (const std::string& tag : tags) {
+                        Manifest manifest;
+                        manifest.name.registry = registry;
+                        manifest.name.space = space;
+                        manifest.name.name = name;
+                        manifest.name.tag = tag;
+                        manifest.path = Join(directory, tag);
+                        manifests.push_back(manifest);
+                    }
+                }
+            }
+        }
+        return manifests;
+    }
+
+    // ReadText() - whole file as a string, empty if missing
+    inline std::string ReadText(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    }
+
+    // JsonString() - value of "key":"..." inside text (manifests are flat enough for this), empty if absent
+    inline std::string JsonString(const std::string& text, const std::string& key, size_t from = 0, size_t to = std::string::npos) {
+        std::string needle = "\"" + key + "\"";
+        size_t at = text.find(needle, from);
+        if (at == std::string::npos || at >= to) {
+            return "";
+        }
+        size_t open = text.find('"', text.find(':', at + needle.length()) + 1);
+        size_t close = open == std::string::npos ? std::string::npos : text.find('"', open + 1);
+        if (close == std::string::npos || close >= to) {
+            return "";
+        }
+        return text.substr(open + 1, close - open - 1);
+    }
+
+    // LayerDigest() - digest of the manifest layer with the given media type, empty if absent
+    inline std::string LayerDigest(const std::string& manifest, const std::string& mediaType) {
+        size_t at = manifest.find("\"" + mediaType + "\"");
+        if (at == std::string::npos) {
+            return "";
+        }
+        size_t open = manifest.rfind('{', at);
+        size_t close = manifest.find('}', at);
+        if (open == std::string::npos || close == std::string::npos) {
+            return "";
+        }
+        return JsonString(manifest, "digest", open, close);
+    }
+
+    // Layer - one entry of a manifest's "config" or "layers"
+    struct Layer {
+        std::string mediaType;
+        std::string digest;
+        uint64_t size = 0; // as declared by the manifest
+    };
+
+    // Layers() - config and layers of a manifest, in order
+    inline std::vector<Layer> Layers(const std::string& manifest) {
+        std::vector<Layer> layers;
+        for (size_t at = manifest.find("\"digest\""); at != std::string::npos; at = manifest.find("\"digest\"", at + 8)) {
+            size_t open = manifest.rfind('{', at);
+            size_t close = manifest.find('}', at);
+            if (open == std::string::npos || close == std::string::npos) {
+                break;
+            }
+            Layer layer;
+            layer.mediaType = JsonString(manifest, "mediaType", open, close);
+            layer.digest = JsonString(manifest, "digest", open, close);
+            size_t size = manifest.find("\"size\"", open);
+            if (size != std::string::npos && size < close) {
+                layer.size = strtoull(manifest.c_str() + manifest.find(':', size) + 1, nullptr, 10);
+            }
+            layers.push_back(layer);
+        }
+        return layers;
+    }
+
+    // ModelBlobPath() - GGUF weights blob of a model, empty if the model is not in the local store
+    inline std::string ModelBlobPath(const std::string& model) {
+        std::string digest = LayerDigest(ReadText(ManifestPath(model)), "application/vnd.ollama.image.model");
+        return digest.empty() ? "" : BlobPath(digest);
+    }
+
+}
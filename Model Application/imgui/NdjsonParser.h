@@ -0,0 +1,364 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NDJSON_SSE2 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+
+// NdjsonParser - incremental parser for the streamed objects of /api/generate and /api/chat
+// Bytes are parsed where they were received: complete lines are decoded in place in the caller's buffer and
+// the fields handed out point into it, only a line split across two reads is copied (into carry). It knows the
+// response schema instead of building a DOM, so a token costs no allocation.
+class NdjsonParser {
+public:
+    // Span - bytes in the receive buffer (or carry), valid until the callback returns
+    struct Span {
+        const char* data = nullptr;
+        size_t length = 0;
+
+        bool empty() const { return length == 0; }
+        std::string str() const { return std::string(data, length); }
+        template <size_t N>
+        bool equals(const char (&text)[N]) const { return length == N - 1 && std::memcmp(data, text, N - 1) == 0; }
+    };
+
+    // Object - the fields of one line that the client uses
+    struct Object {
+        Span text;                  // "response" (generate) or "message":{"content"} (chat), escapes decoded
+        Span error;                 // "error", escapes decoded
+        bool done = false;
+        uint64_t totalDuration = 0; // nanoseconds, only in the final object
+        uint64_t loadDuration = 0;
+        uint64_t promptEvalCount = 0;
+        uint64_t promptEvalDuration = 0;
+        uint64_t evalCount = 0;
+        uint64_t evalDuration = 0;
+    };
+
+    typedef std::function<void(const Object&)> Handler;
+
+    // feed() - parses every line completed by data (modified in place), calling onObject for each
+    void feed(char* data, size_t length, const Handler& onObject) {
+        char* end = data + length;
+        if (!carry.empty()) {
+            char* newline = findNewline(data, end);
+            if (newline == nullptr) {
+                carry.append(data, length);
+                return;
+            }
+            carry.append(data, newline - data);
+            parseLine(&carry[0], &carry[0] + carry.length(), onObject);
+            carry.clear();
+            data = newline + 1;
+        }
+        for (char* newline; (newline = findNewline(data, end)) != nullptr; data = newline + 1) {
+            parseLine(data, newline, onObject);
+        }
+        carry.append(data, end - data);
+    }
+
+    // finish() - parses a last line that had no newline, at the end of the body
+    void finish(const Handler& onObject) {
+        if (!carry.empty()) {
+            parseLine(&carry[0], &carry[0] + carry.length(), onObject);
+            carry.clear();
+        }
+    }
+
+    // malformedLines() - lines that were not a JSON object, skipped
+    uint64_t malformedLines() const { return malformed; }
+
+    // findNewline() - first '\n' in [begin, end), 16 bytes per step where SSE2 is available
+    static char* findNewline(char* begin, char* end) {
+#ifdef NDJSON_SSE2
+        const __m128i newline = _mm_set1_epi8('\n');
+        while (end - begin >= 16) {
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)begin), newline));
+            if (mask != 0) {
+#ifdef _MSC_VER
+                unsigned long index;
+                _BitScanForward(&index, (unsigned long)mask);
+                return begin + index;
+#else
+                return begin + __builtin_ctz((unsigned)mask);
+#endif
+            }
+            begin += 16;
+        }
+#endif
+        return begin < end ? (char*)std::memchr(begin, '\n', end - begin) : nullptr;
+    }
+
+private:
+    std::string carry; // start of a line whose newline has not arrived yet
+    uint64_t malformed = 0;
+
+    // parseLine() - one line, blank lines and a trailing '\r' are ignored
+    void parseLine(char* begin, char* end, const Handler& onObject) {
+        if (end > begin && end[-1] == '\r') {
+            end--;
+        }
+        char* cursor = skipSpace(begin, end);
+        if (cursor == end) {
+            return;
+        }
+        Object object;
+        if (*cursor != '{' || !parseObject(cursor, end, object, false)) {
+            malformed++;
+            return;
+        }
+        onObject(object);
+    }
+
+    static char* skipSpace(char* cursor, char* end) {
+        while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n')) {
+            cursor++;
+        }
+        return cursor;
+    }
+
+    // parseObject() - {...} at cursor, the fields of interest go to object; inMessage reads chat's "message"
+    static bool parseObject(char*& cursor, char* end, Object& object, bool inMessage) {
+        cursor = skipSpace(cursor + 1, end);
+        if (cursor < end && *cursor == '}') {
+            cursor++;
+            return true;
+        }
+        while (cursor < end) {
+            Span key;
+            if (*cursor != '"' || !parseString(cursor, end, key, false)) {
+                return false;
+            }
+            cursor = skipSpace(cursor, end);
+            if (cursor >= end || *cursor != ':') {
+                return false;
+            }
+            cursor = skipSpace(cursor + 1, end);
+            if (cursor >= end) {
+                return false;
+            }
+            bool parsed;
+            if (*cursor == '"') {
+                Span value;
+                parsed = parseString(cursor, end, value, true);
+                if (inMessage ? key.equals("content") : key.equals("response")) object.text = value;
+                else if (!inMessage && key.equals("error")) object.error = value;
+            }
+            else if (*cursor == '{') {
+                parsed = !inMessage && key.equals("message") ? parseObject(cursor, end, object, true) : skipValue(cursor, end);
+            }
+            else if (*cursor >= '0' && *cursor <= '9') {
+                uint64_t value = 0;
+                parsed = parseNumber(cursor, end, value);
+                if (inMessage) {}
+                else if (key.equals("total_duration")) object.totalDuration = value;
+                else if (key.equals("load_duration")) object.loadDuration = value;
+                else if (key.equals("prompt_eval_count")) object.promptEvalCount = value;
+                else if (key.equals("prompt_eval_duration")) object.promptEvalDuration = value;
+                else if (key.equals("eval_count")) object.evalCount = value;
+                else if (key.equals("eval_duration")) object.evalDuration = value;
+            }
+            else if (*cursor == 't' && !inMessage && key.equals("done")) {
+                parsed = end - cursor >= 4 && std::memcmp(cursor, "true", 4) == 0;
+                cursor += 4;
+                object.done = parsed;
+            }
+            else {
+                parsed = skipValue(cursor, end);
+            }
+            if (!parsed) {
+                return false;
+            }
+            cursor = skipSpace(cursor, end);
+            if (cursor < end && *cursor == ',') {
+                cursor = skipSpace(cursor + 1, end);
+                continue;
+            }
+            if (cursor < end && *cursor == '}') {
+                cursor++;
+                return true;
+            }
+            return false;
+        }
+        return false;
+    }
+
+    // parseString() - "..." at cursor; with decode, escapes are rewritten in place (the text only shrinks)
+    static bool parseString(char*& cursor, char* end, Span& value, bool decode) {
+        char* read = cursor + 1;
+        char* write = read;
+        value.data = read;
+        for (;;) {
+            // plain text is skipped in blocks, and only moved once an escape has shrunk the string
+            char* special = findQuoteOrEscape(read, end);
+            if (special == nullptr) {
+                return false;
+            }
+            if (decode && write != read) {
+                std::memmove(write, read, special - read);
+            }
+            write += special - read;
+            read = special;
+            if (*read == '"') {
+                value.length = write - value.data;
+                cursor = read + 1;
+                return true;
+            }
+            if (end - read < 2) {
+                return false;
+            }
+            if (!decode) {
+                read += 2;
+                write = read;
+                continue;
+            }
+            char escape = read[1];
+            read += 2;
+            switch (escape) {
+            case 'n': *write++ = '\n'; break;
+            case 'r': *write++ = '\r'; break;
+            case 't': *write++ = '\t'; break;
+            case 'b': *write++ = '\b'; break;
+            case 'f': *write++ = '\f'; break;
+            case 'u': {
+                uint32_t code;
+                if (!parseHex(read, end, code)) {
+                    return false;
+                }
+                read += 4;
+                if (code >= 0xD800 && code < 0xDC00 && end - read >= 6 && read[0] == '\\' && read[1] == 'u') {
+                    uint32_t low;
+                    if (parseHex(read + 2, end, low) && low >= 0xDC00 && low < 0xE000) {
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        read += 6;
+                    }
+                }
+                write = encodeUtf8(code, write);
+                break;
+            }
+            default: *write++ = escape; break; // \" \\ \/
+            }
+        }
+    }
+
+    // findQuoteOrEscape() - first '"' or '\\' in [begin, end), like findNewline()
+    static char* findQuoteOrEscape(char* begin, char* end) {
+#ifdef NDJSON_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        while (end - begin >= 16) {
+            __m128i block = _mm_loadu_si128((const __m128i*)begin);
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+            if (mask != 0) {
+#ifdef _MSC_VER
+                unsigned long index;
+                _BitScanForward(&index, (unsigned long)mask);
+                return begin + index;
+#else
+                return begin + __builtin_ctz((unsigned)mask);
+#endif
+            }
+            begin += 16;
+        }
+#endif
+        for (; begin < end; ++begin) {
+            if (*begin == '"' || *begin == '\\') {
+                return begin;
+            }
+        }
+        return nullptr;
+    }
+
+    static bool parseHex(const char* at, const char* end, uint32_t& code) {
+        if (end - at < 4) {
+            return false;
+        }
+        code = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = at[i];
+            int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (digit < 0) {
+                return false;
+            }
+            code = code * 16 + digit;
+        }
+        return true;
+    }
+
+    // encodeUtf8() - at most 4 bytes for the 6 (or 12) of the escape, so decoding in place is safe
+    static char* encodeUtf8(uint32_t code, char* out) {
+        if (code < 0x80) {
+            *out++ = (char)code;
+        }
+        else if (code < 0x800) {
+            *out++ = (char)(0xC0 | (code >> 6));
+            *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000) {
+            *out++ = (char)(0xE0 | (code >> 12));
+            *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+            *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        else {
+            *out++ = (char)(0xF0 | (code >> 18));
+            *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+            *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+            *out++ = (char)(0x80 | (code & 0x3F));
+        }
+        return out;
+    }
+
+    // parseNumber() - the integer part of a number, fractions/exponents are skipped
+    static bool parseNumber(char*& cursor, char* end, uint64_t& value) {
+        value = 0;
+        while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+            value = value * 10 + (*cursor++ - '0');
+        }
+        while (cursor < end && ((*cursor >= '0' && *cursor <= '9') || *cursor == '.' || *cursor == 'e' || *cursor == 'E' || *cursor == '+' || *cursor == '-')) {
+            cursor++;
+        }
+        return true;
+    }
+
+    // skipValue() - any value we do not read: nested objects/arrays, literals, negative numbers
+    static bool skipValue(char*& cursor, char* end) {
+        int depth = 0;
+        while (cursor < end) {
+            char c = *cursor;
+            if (c == '"') {
+                Span ignored;
+                if (!parseString(cursor, end, ignored, false)) {
+                    return false;
+                }
+                if (depth == 0) {
+                    return true;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                depth++;
+            }
+            else if (c == '}' || c == ']') {
+                if (depth == 0) {
+                    return true; // end of the enclosing object, a literal ended right before it
+                }
+                if (--depth == 0) {
+                    cursor++;
+                    return true;
+                }
+            }
+            else if (depth == 0 && c == ',') {
+                return true;
+            }
+            cursor++;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,88 @@
+﻿#pragma once
+// Net.h - minimal socket helpers shared by the metrics endpoint and HTTP code
+// include before <windows.h>, winsock2.h must come first on Windows
+#include <string>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET SocketHandle;
+#else
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+typedef int SocketHandle;
+#define INVALID_SOCKET (-1)
+#endif
+
+namespace Net {
+
+    // Startup() - initializes the socket library once (WSAStartup on Windows)
+    inline bool Startup() {
+#ifdef _WIN32
+        static bool started = []() {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+#else
+        return true;
+#endif
+    }
+
+    // Close() - closes a socket
+    inline void Close(SocketHandle socketHandle) {
+        if (socketHandle == INVALID_SOCKET) {
+            return;
+        }
+#ifdef _WIN32
+        closesocket(socketHandle);
+#else
+        close(socketHandle);
+#endif
+    }
+
+    // Listen() - binds a listening TCP socket, INVALID_SOCKET on failure
+    inline SocketHandle Listen(const std::string& host, int port) {
+        if (!Startup()) {
+            return INVALID_SOCKET;
+        }
+        SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listener == INVALID_SOCKET) {
+            return INVALID_SOCKET;
+        }
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons((unsigned short)port);
+        if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1 ||
+            bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 ||
+            listen(listener, 16) != 0) {
+            Close(listener);
+            return INVALID_SOCKET;
+        }
+        return listener;
+    }
+
+    // SendAll() - writes the whole buffer to a blocking socket
+    inline bool SendAll(SocketHandle socketHandle, const char* data, size_t length) {
+        while (length > 0) {
+            int sent = send(socketHandle, data, (int)length, 0);
+            if (sent <= 0) {
+                return false;
+            }
+            data += sent;
+            length -= sent;
+        }
+        return true;
+    }
+
+}
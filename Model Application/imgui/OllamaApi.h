@@ -0,0 +1,299 @@
+﻿#pragma once
+// OllamaApi.h - streaming requests to the ollama daemon's HTTP API
+// include before <windows.h>, like Net.h
+#include "Net.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+namespace OllamaApi {
+
+    // Endpoint - where the daemon listens
+    struct Endpoint {
+        std::string host = "127.0.0.1";
+        int port = 11434;
+        std::string address; // sockaddr bytes once Resolve() looked host up, empty before
+        int family = 0;
+    };
+
+    // ParseEndpoint() - OLLAMA_HOST forms: "host", "host:port", ":port", "http://host:port/"
+    inline Endpoint ParseEndpoint(std::string text) {
+        Endpoint endpoint;
+        size_t scheme = text.find("://");
+        if (scheme != std::string::npos) {
+            text = text.substr(scheme + 3);
+        }
+        size_t slash = text.find('/');
+        if (slash != std::string::npos) {
+            text = text.substr(0, slash);
+        }
+        size_t colon = text.rfind(':');
+        if (colon != std::string::npos) {
+            endpoint.port = std::atoi(text.c_str() + colon + 1);
+            text = text.substr(0, colon);
+        }
+        if (!text.empty() && text != "0.0.0.0") { // the daemon binds 0.0.0.0, clients connect locally
+            endpoint.host = text;
+        }
+        return endpoint;
+    }
+
+    // Resolve() - looks the host up (getaddrinfo, which blocks) and keeps its first address, false if it does not resolve
+    inline bool Resolve(Endpoint& endpoint) {
+        if (!Net::Startup()) {
+            return false;
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(endpoint.host.c_str(), std::to_string(endpoint.port).c_str(), &hints, &addresses) != 0 || addresses == nullptr) {
+            return false;
+        }
+        endpoint.address.assign((const char*)addresses->ai_addr, addresses->ai_addrlen);
+        endpoint.family = addresses->ai_family;
+        freeaddrinfo(addresses);
+        return true;
+    }
+
+    // DefaultEndpoint() - OLLAMA_HOST, or 127.0.0.1:11434
+    inline Endpoint DefaultEndpoint() {
+#ifdef _WIN32
+        char* value = nullptr;
+        size_t length = 0;
+        std::string host;
+        if (_dupenv_s(&value, &length, "OLLAMA_HOST") == 0 && value != nullptr) {
+            host = value;
+            free(value);
+        }
+#else
+        const char* value = std::getenv("OLLAMA_HOST");
+        std::string host = value ? value : "";
+#endif
+        return ParseEndpoint(host);
+    }
+
+    // JsonString() - value of "key":"..." in one NDJSON line, empty if absent (escapes are kept as is)
+    inline std::string JsonString(const std::string& line, const std::string& key) {
+        std::string needle = "\"" + key + "\":";
+        size_t at = line.find(needle);
+        if (at == std::string::npos) {
+            return "";
+        }
+        size_t open = line.find('"', at + needle.length());
+        if (open == std::string::npos) {
+            return "";
+        }
+        size_t close = open + 1;
+        while (close < line.length() && line[close] != '"') {
+            close += line[close] == '\\' ? 2 : 1;
+        }
+        return close < line.length() ? line.substr(open + 1, close - open - 1) : "";
+    }
+
+    // JsonEscape() - text as the inside of a JSON string
+    inline std::string JsonEscape(const std::string& text) {
+        std::string escaped;
+        escaped.reserve(text.length() + 8);
+        for (char c : text) {
+            switch (c) {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if ((unsigned char)c < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                }
+                else {
+                    escaped += c;
+                }
+            }
+        }
+        return escaped;
+    }
+
+    // JsonUnescape() - decodes the escapes JsonString() keeps, \uXXXX (and surrogate pairs) to UTF-8
+    inline std::string JsonUnescape(const std::string& text) {
+        if (text.find('\\') == std::string::npos) {
+            return text;
+        }
+        std::string decoded;
+        decoded.reserve(text.length());
+        auto hex = [&text](size_t at) {
+            unsigned value = 0;
+            for (size_t i = at; i < at + 4 && i < text.length(); ++i) {
+                char c = text[i];
+                value = value * 16 + (c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : 0);
+            }
+            return value;
+        };
+        for (size_t i = 0; i < text.length(); ++i) {
+            if (text[i] != '\\' || i + 1 >= text.length()) {
+                decoded += text[i];
+                continue;
+            }
+            char c = text[++i];
+            switch (c) {
+            case 'n': decoded += '\n'; break;
+            case 'r': decoded += '\r'; break;
+            case 't': decoded += '\t'; break;
+            case 'b': decoded += '\b'; break;
+            case 'f': decoded += '\f'; break;
+            case 'u': {
+                unsigned code = hex(i + 1);
+                i += 4;
+                if (code >= 0xD800 && code < 0xDC00 && i + 6 < text.length() && text[i + 1] == '\\' && text[i + 2] == 'u') {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (hex(i + 3) - 0xDC00);
+                    i += 6;
+                }
+                if (code < 0x80) {
+                    decoded += (char)code;
+                }
+                else if (code < 0x800) {
+                    decoded += (char)(0xC0 | (code >> 6));
+                    decoded += (char)(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000) {
+                    decoded += (char)(0xE0 | (code >> 12));
+                    decoded += (char)(0x80 | ((code >> 6) & 0x3F));
+                    decoded += (char)(0x80 | (code & 0x3F));
+                }
+                else {
+                    decoded += (char)(0xF0 | (code >> 18));
+                    decoded += (char)(0x80 | ((code >> 12) & 0x3F));
+                    decoded += (char)(0x80 | ((code >> 6) & 0x3F));
+                    decoded += (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default: decoded += c; break; // \" \\ \/
+            }
+        }
+        return decoded;
+    }
+
+    // JsonNumber() - value of "key":123 in one NDJSON line, 0 if absent
+    inline uint64_t JsonNumber(const std::string& line, const std::string& key) {
+        std::string needle = "\"" + key + "\":";
+        size_t at = line.find(needle);
+        return at == std::string::npos ? 0 : std::strtoull(line.c_str() + at + needle.length(), nullptr, 10);
+    }
+
+    // Result - how a streamed request ended
+    struct Result {
+        bool connected = false; // reached the daemon at all
+        int status = 0;         // HTTP status, 0 if no response
+        bool complete = false;  // server closed the stream normally
+        std::string error;
+        std::string timeout;    // phase whose deadline ended the request ("connect", "first token", "stall"), see HttpLoop
+    };
+
+    // Post() - POSTs a JSON body and calls onLine for every line of the streamed response
+    // Sent as HTTP/1.0, so the daemon answers close-delimited instead of chunked. The receive timeout
+    // is used to poll cancelled(), once it returns true the request ends and the connection is closed.
+    inline Result Post(const Endpoint& endpoint, const std::string& path, const std::string& body,
+                       const std::function<void(const std::string&)>& onLine, const std::function<bool()>& cancelled = nullptr) {
+        Result result;
+        if (!Net::Startup()) {
+            result.error = "socket library unavailable";
+            return result;
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (getaddrinfo(endpoint.host.c_str(), std::to_string(endpoint.port).c_str(), &hints, &addresses) != 0) {
+            result.error = "cannot resolve " + endpoint.host;
+            return result;
+        }
+        SocketHandle connection = INVALID_SOCKET;
+        for (addrinfo* address = addresses; address != nullptr && connection == INVALID_SOCKET; address = address->ai_next) {
+            connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (connection != INVALID_SOCKET && connect(connection, address->ai_addr, (int)address->ai_addrlen) != 0) {
+                Net::Close(connection);
+                connection = INVALID_SOCKET;
+            }
+        }
+        freeaddrinfo(addresses);
+        if (connection == INVALID_SOCKET) {
+            result.error = "cannot connect to " + endpoint.host + ":" + std::to_string(endpoint.port);
+            return result;
+        }
+        result.connected = true;
+#ifdef _WIN32
+        DWORD timeout = 250;
+#else
+        timeval timeout = { 0, 250000 };
+#endif
+        setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+
+        std::string request = "POST " + path + " HTTP/1.0\r\nHost: " + endpoint.host + "\r\nContent-Type: application/json\r\n"
+                              "Content-Length: " + std::to_string(body.length()) + "\r\n\r\n" + body;
+        if (!Net::SendAll(connection, request.data(), request.length())) {
+            Net::Close(connection);
+            result.error = "request failed";
+            return result;
+        }
+
+        std::string pending;
+        bool inBody = false;
+        char buffer[4096];
+        for (;;) {
+            if (cancelled && cancelled()) {
+                result.error = "cancelled";
+                break;
+            }
+            int received = recv(connection, buffer, sizeof(buffer), 0);
+            if (received == 0) {
+                result.complete = inBody;
+                break;
+            }
+            if (received < 0) {
+#ifdef _WIN32
+                bool timedOut = WSAGetLastError() == WSAETIMEDOUT;
+#else
+                bool timedOut = errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+                if (timedOut) {
+                    continue;
+                }
+                result.error = "connection lost";
+                break;
+            }
+            pending.append(buffer, received);
+            size_t end;
+            while ((end = pending.find('\n')) != std::string::npos) {
+                std::string line = pending.substr(0, end);
+                pending.erase(0, end + 1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!inBody) {
+                    if (result.status == 0) {
+                        size_t space = line.find(' ');
+                        result.status = space == std::string::npos ? 0 : std::atoi(line.c_str() + space + 1);
+                    }
+                    else if (line.empty()) {
+                        inBody = true;
+                    }
+                    continue;
+                }
+                if (!line.empty()) {
+                    onLine(line);
+                }
+            }
+        }
+        if (result.complete && !pending.empty()) {
+            onLine(pending);
+        }
+        Net::Close(connection);
+        return result;
+    }
+
+}
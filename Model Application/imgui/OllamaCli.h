@@ -0,0 +1,182 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h> // has to come before <windows.h>, see Net.h
+#include <windows.h>
+#endif
+
+// OllamaCli - short ollama commands whose output is parsed (not streamed)
+namespace OllamaCli {
+
+    // Run() - output (stdout + stderr) of a command, exit status through status
+    // started directly with CREATE_NO_WINDOW like generations, cmd.exe (_popen) would flash a console every poll
+    inline std::string Run(const std::string& command, int* status = nullptr) {
+        if (status != nullptr) *status = -1;
+#ifdef _WIN32
+        SECURITY_ATTRIBUTES security = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+        HANDLE readPipe = nullptr;
+        HANDLE writePipe = nullptr;
+        if (!CreatePipe(&readPipe, &writePipe, &security, 0)) {
+            return "";
+        }
+        SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+        HANDLE nulInput = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ, &security, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+        STARTUPINFOA startup = {};
+        startup.cb = sizeof(startup);
+        startup.dwFlags = STARTF_USESTDHANDLES;
+        startup.hStdInput = nulInput;
+        startup.hStdOutput = writePipe;
+        startup.hStdError = writePipe;
+        PROCESS_INFORMATION processInfo = {};
+        std::vector<char> commandLine(command.begin(), command.end());
+        commandLine.push_back('\0');
+        BOOL started = CreateProcessA(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &startup, &processInfo);
+        CloseHandle(writePipe); // ours is closed so ReadFile ends when the command exits
+        if (nulInput != INVALID_HANDLE_VALUE) {
+            CloseHandle(nulInput);
+        }
+        if (!started) {
+            CloseHandle(readPipe);
+            return "";
+        }
+        CloseHandle(processInfo.hThread);
+
+        std::string output;
+        char buffer[256];
+        DWORD bytesRead = 0;
+        while (ReadFile(readPipe, buffer, sizeof(buffer), &bytesRead, nullptr) && bytesRead > 0) {
+            output.append(buffer, bytesRead);
+        }
+        CloseHandle(readPipe);
+        WaitForSingleObject(processInfo.hProcess, INFINITE);
+        DWORD exitCode = 1;
+        GetExitCodeProcess(processInfo.hProcess, &exitCode);
+        CloseHandle(processInfo.hProcess);
+        if (status != nullptr) *status = (int)exitCode;
+        return output;
+#else
+        FILE* pipe = popen((command + " < /dev/null 2>&1").c_str(), "r");
+        if (pipe == nullptr) {
+            return "";
+        }
+        std::string output;
+        char buffer[256];
+        while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+            output += buffer;
+        }
+        int exitStatus = pclose(pipe);
+        if (status != nullptr) *status = exitStatus;
+        return output;
+#endif
+    }
+
+    // ParseSize() - "6.7 GB" style sizes (decimal units, as ollama prints them) to bytes
+    inline uint64_t ParseSize(const std::string& text) {
+        std::istringstream stream(text);
+        double value = 0.0;
+        std::string unit;
+        if (!(stream >> value)) {
+            return 0;
+        }
+        stream >> unit;
+        double scale = 1.0;
+        if (unit == "KB") scale = 1e3;
+        else if (unit == "MB") scale = 1e6;
+        else if (unit == "GB") scale = 1e9;
+        else if (unit == "TB") scale = 1e12;
+        return (uint64_t)(value * scale);
+    }
+
+    // Columns() - splits a table printed by the CLI using the header's column positions
+    // values may contain spaces ("100% GPU", "4 minutes from now"), so whitespace splitting is not enough
+    inline std::vector<std::map<std::string, std::string>> Columns(const std::string& table) {
+        std::vector<std::map<std::string, std::string>> rows;
+        std::istringstream lines(table);
+        std::string line;
+        std::vector<std::pair<std::string, size_t>> header;
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (header.empty()) {
+                for (size_t i = 0; i < line.length(); ) {
+                    size_t start = line.find_first_not_of(' ', i);
+                    if (start == std::string::npos) break;
+                    size_t end = line.find("  ", start);
+                    end = end == std::string::npos ? line.length() : end;
+                    header.push_back(std::make_pair(line.substr(start, end - start), start));
+                    i = end;
+                }
+                continue;
+            }
+            if (line.find_first_not_of(' ') == std::string::npos) {
+                continue;
+            }
+            std::map<std::string, std::string> row;
+            for (size_t c = 0; c < header.size(); ++c) {
+                size_t start = header[c].second;
+                size_t end = c + 1 < header.size() ? header[c + 1].second : line.length();
+                std::string value = start < line.length() ? line.substr(start, end - start) : "";
+                size_t first = value.find_first_not_of(' ');
+                size_t last = value.find_last_not_of(' ');
+                row[header[c].first] = first == std::string::npos ? "" : value.substr(first, last - first + 1);
+            }
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+    // RunningModel - one line of `ollama ps`
+    struct RunningModel {
+        std::string name;
+        std::string id;
+        uint64_t sizeBytes = 0; // memory footprint (weights + KV cache)
+        std::string processor;  // "100% GPU", "48%/52% CPU/GPU"
+        std::string until;      // keep-alive expiry, "4 minutes from now"
+    };
+
+    // ListRunning() - models currently loaded by the daemon, ok = false if ollama could not be asked
+    inline std::vector<RunningModel> ListRunning(bool* ok = nullptr) {
+        int status = 0;
+        std::string output = Run("ollama ps", &status);
+        std::vector<RunningModel> models;
+        if (ok != nullptr) *ok = status == 0;
+        if (status != 0) {
+            return models;
+        }
+        for (const auto& row : Columns(output)) {
+            RunningModel model;
+            auto value = [&row](const char* column) {
+                auto found = row.find(column);
+                return found == row.end() ? std::string() : found->second;
+            };
+            model.name = value("NAME");
+            model.id = value("ID");
+            model.sizeBytes = ParseSize(value("SIZE"));
+            model.processor = value("PROCESSOR");
+            model.until = value("UNTIL");
+            if (!model.name.empty()) {
+                models.push_back(model);
+            }
+        }
+        return models;
+    }
+
+    // CanonicalName() - a model name with its tag, "llama3" is "llama3:latest"
+    inline std::string CanonicalName(const std::string& model) {
+        return model.find(':') == std::string::npos ? model + ":latest" : model;
+    }
+
+    // SameModel() - "llama3" and "llama3:latest" name the same model
+    inline bool SameModel(const std::string& a, const std::string& b) {
+        return CanonicalName(a) == CanonicalName(b);
+    }
+
+}
@@ -0,0 +1,444 @@
+﻿#pragma once
+#include "OllamaApi.h"
+#include "Metrics.h"
+#include "ResponseCache.h"
+#include "Trace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// PullManager - explicit model downloads through the daemon's /api/pull, with per-layer progress
+// Pulls run concurrently up to a cap. Interrupted pulls are retried with backoff and the daemon
+// resumes partially downloaded blobs, unfinished pulls are saved to pulls.txt and resumed on startup.
+// The daemon downloads on its own connection, so the bandwidth cap is applied by admission: while the
+// pulls together exceed it, no new pull starts and the newest running one is paused (and later resumed).
+class PullManager {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum State {
+        Queued,
+        Pulling,
+        Paused,    // over the bandwidth cap, resumes when there is room
+        Done,
+        Failed,
+        Cancelled
+    };
+
+    static const char* stateName(State state) {
+        switch (state) {
+        case Pulling: return "pulling";
+        case Paused: return "paused";
+        case Done: return "done";
+        case Failed: return "failed";
+        case Cancelled: return "cancelled";
+        default: return "queued";
+        }
+    }
+
+    // Layer - progress of one blob of the model
+    struct Layer {
+        std::string digest;
+        uint64_t total = 0;
+        uint64_t completed = 0;
+    };
+
+    // Row - one pull as shown in the Pulls window
+    struct Row {
+        std::string model;
+        State state = Queued;
+        std::string status;          // last status line from the daemon
+        std::vector<Layer> layers;
+        uint64_t total = 0;
+        uint64_t completed = 0;
+        double bytesPerSecond = 0.0;
+        double etaSeconds = -1.0;    // -1 while unknown
+        int attempts = 0;
+        std::string error;
+    };
+
+    // pull() - queues a model, no-op if it is already queued or running
+    static void pull(const std::string& model) {
+        PullManager& manager = instance();
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            std::shared_ptr<Job> job = manager.find(model);
+            if (job && (job->state == Queued || job->state == Pulling || job->state == Paused)) {
+                return;
+            }
+            if (!job) {
+                job = std::make_shared<Job>();
+                job->model = model;
+                manager.jobs.push_back(job);
+            }
+            job->state = Queued;
+            job->error.clear();
+            job->attempts = 0;
+            job->cancel = false;
+            manager.save();
+        }
+        schedule();
+    }
+
+    // cancel() - stops a queued or running pull, the daemon keeps what was downloaded for a later pull
+    static void cancel(const std::string& model) {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        std::shared_ptr<Job> job = manager.find(model);
+        if (job && (job->state == Queued || job->state == Pulling || job->state == Paused)) {
+            job->cancel = true;
+            if (job->state != Pulling) {
+                job->state = Cancelled;
+            }
+            manager.save();
+        }
+    }
+
+    // clearFinished() - drops done, failed and cancelled rows
+    static void clearFinished() {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        manager.jobs.erase(std::remove_if(manager.jobs.begin(), manager.jobs.end(), [](const std::shared_ptr<Job>& job) {
+            return job->state == Done || job->state == Failed || job->state == Cancelled;
+        }), manager.jobs.end());
+    }
+
+    // pulling() - is the model queued or downloading? prompts to it would start a download inside ollama run
+    static bool pulling(const std::string& model) {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        std::shared_ptr<Job> job = manager.find(model);
+        return job && (job->state == Queued || job->state == Pulling || job->state == Paused);
+    }
+
+    // completedPulls() - pulls finished successfully so far, changes when the catalog should be reloaded
+    static int completedPulls() { return instance().completed.load(); }
+
+    // snapshot() - every pull in the order they were queued
+    static std::vector<Row> snapshot() {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        std::vector<Row> rows;
+        for (const std::shared_ptr<Job>& job : manager.jobs) {
+            Row row;
+            row.model = job->model;
+            row.state = job->state;
+            row.status = job->status;
+            row.layers = job->layers;
+            for (const Layer& layer : job->layers) {
+                row.total += layer.total;
+                row.completed += layer.completed;
+            }
+            row.bytesPerSecond = job->state == Pulling ? job->bytesPerSecond : 0.0;
+            if (row.bytesPerSecond > 0.0 && row.total > row.completed) {
+                row.etaSeconds = (row.total - row.completed) / row.bytesPerSecond;
+            }
+            row.attempts = job->attempts;
+            row.error = job->error;
+            rows.push_back(row);
+        }
+        return rows;
+    }
+
+    // throughput() - bytes per second of all running pulls together
+    static double throughput() {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        return manager.aggregateRate();
+    }
+
+    // maxConcurrent() - pulls that may download at the same time
+    static int maxConcurrent() { return instance().concurrency.load(); }
+    static void setMaxConcurrent(int value) {
+        instance().concurrency.store(value < 1 ? 1 : value);
+        schedule();
+    }
+
+    // bandwidthCap() - bytes per second all pulls together should stay under, 0 = unlimited
+    static uint64_t bandwidthCap() { return instance().cap.load(); }
+    static void setBandwidthCap(uint64_t bytesPerSecond) {
+        instance().cap.store(bytesPerSecond);
+        schedule();
+    }
+
+    // shutdown() - ends the scheduler thread and waits for it, see App::Shutdown(); the pool's cancel hook then
+    // pauses the running pulls, so they stay in pulls.txt
+    static void shutdown() {
+        PullManager& manager = instance();
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            manager.stopping = true;
+        }
+        manager.wake.notify_all();
+        if (manager.scheduler.joinable()) {
+            manager.scheduler.join();
+        }
+    }
+
+    // resumePending() - queues the pulls that were unfinished when the app last exited
+    static void resumePending() {
+        std::ifstream file(pendingPath());
+        std::string model;
+        while (std::getline(file, model)) {
+            if (!model.empty() && model.back() == '\r') {
+                model.pop_back();
+            }
+            if (!model.empty()) {
+                pull(model);
+            }
+        }
+    }
+
+private:
+    struct Job {
+        std::string model;
+        State state = Queued;
+        std::string status;
+        std::vector<Layer> layers;
+        double bytesPerSecond = 0.0; // smoothed
+        int attempts = 0;
+        std::string error;
+        std::atomic<bool> cancel{ false };
+        std::atomic<bool> pause{ false };
+        Clock::time_point startedAt;
+        Clock::time_point retryAt;
+    };
+
+    static const int MaxAttempts = 5;
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<Job>> jobs;
+    std::atomic<int> concurrency{ 2 };
+    std::atomic<uint64_t> cap{ 0 };
+    std::atomic<int> completed{ 0 };
+    std::thread scheduler;         // started by the first schedule(), joined by shutdown()
+    std::condition_variable wake;  // ends the scheduler's wait, guarded by mutex like the flags below
+    bool rescheduled = false;      // schedule() was called since the last step
+    bool stopping = false;
+
+    Counter& pulled = MetricsRegistry::counter("model_app_pulls_total", "Model pulls that finished successfully.");
+    Counter& pullFailures = MetricsRegistry::counter("model_app_pull_failures_total", "Model pulls that failed after all retries.");
+    Counter& pulledBytes = MetricsRegistry::counter("model_app_pulled_bytes_total", "Bytes downloaded by model pulls, as reported by the daemon.");
+
+    PullManager() {
+        // on shutdown running pulls are paused, not cancelled, so they stay in pulls.txt and resume next time
+        ThreadPool::group("pulls").onCancel([this]() {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const std::shared_ptr<Job>& job : jobs) {
+                job->pause = job->state == Pulling;
+            }
+        });
+    }
+
+    static PullManager& instance() {
+        static PullManager manager;
+        return manager;
+    }
+
+    static std::string pendingPath() { return "pulls.txt"; }
+
+    // find() - job of a model, mutex held
+    std::shared_ptr<Job> find(const std::string& model) const {
+        for (const std::shared_ptr<Job>& job : jobs) {
+            if (job->model == model) {
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    // aggregateRate() - mutex held
+    double aggregateRate() const {
+        double rate = 0.0;
+        for (const std::shared_ptr<Job>& job : jobs) {
+            rate += job->state == Pulling ? job->bytesPerSecond : 0.0;
+        }
+        return rate;
+    }
+
+    // save() - unfinished pulls to pulls.txt, mutex held
+    void save() const {
+        std::ofstream file(pendingPath(), std::ios::trunc);
+        for (const std::shared_ptr<Job>& job : jobs) {
+            if (job->state == Queued || job->state == Pulling || job->state == Paused) {
+                file << job->model << "\n";
+            }
+        }
+    }
+
+    // schedule() - wakes the scheduler thread, started on first use; while pulls are waiting or running it steps
+    // every 250 ms, starting queued pulls while there is room under the concurrency and bandwidth caps and pausing
+    // the newest pull while over the bandwidth cap, otherwise it sleeps until the next schedule()
+    static void schedule() {
+        PullManager& manager = instance();
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        if (manager.stopping) {
+            return;
+        }
+        manager.rescheduled = true;
+        if (manager.scheduler.joinable()) {
+            manager.wake.notify_all();
+            return;
+        }
+        manager.scheduler = std::thread([]() {
+            Trace::setThreadName("Pull scheduler");
+            PullManager& manager = instance();
+            std::unique_lock<std::mutex> lock(manager.mutex);
+            while (!manager.stopping) {
+                manager.rescheduled = false;
+                auto woken = [&manager]() { return manager.stopping || manager.rescheduled; };
+                if (manager.admit()) {
+                    manager.wake.wait_for(lock, std::chrono::milliseconds(250), woken);
+                }
+                else {
+                    manager.wake.wait(lock, woken);
+                }
+            }
+        });
+    }
+
+    // admit() - one scheduling step, false once nothing is waiting or running, mutex held
+    bool admit() {
+        int running = 0;
+        bool waiting = false;
+        for (const std::shared_ptr<Job>& job : jobs) {
+            running += job->state == Pulling ? 1 : 0;
+            waiting = waiting || job->state == Queued || job->state == Paused;
+        }
+        uint64_t limit = cap.load();
+        double rate = aggregateRate();
+        if (limit > 0 && rate > limit && running > 1) {
+            // over the cap, pause the most recently started pull (one per step, rates need time to settle)
+            std::shared_ptr<Job> newest;
+            for (const std::shared_ptr<Job>& job : jobs) {
+                if (job->state == Pulling && !job->pause && (!newest || job->startedAt > newest->startedAt)) {
+                    newest = job;
+                }
+            }
+            if (newest) {
+                newest->pause = true;
+            }
+        }
+        Clock::time_point now = Clock::now();
+        for (const std::shared_ptr<Job>& job : jobs) {
+            if (running >= concurrency.load() || (limit > 0 && running > 0 && rate >= limit * 0.9)) {
+                break;
+            }
+            if ((job->state == Queued || job->state == Paused) && now >= job->retryAt) {
+                job->state = Pulling;
+                job->startedAt = now;
+                job->pause = false;
+                running++;
+                ThreadPool::group("pulls").submit([job]() { run(job); });
+            }
+        }
+        return waiting || running > 0;
+    }
+
+    // run() - one attempt of a pull on its own thread, requeued with backoff if the connection drops
+    static void run(std::shared_ptr<Job> job) {
+        TRACE_SCOPE_DETAIL("PullManager::run", job->model);
+        PullManager& manager = instance();
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            job->attempts++;
+            job->status = "connecting";
+        }
+        Clock::time_point lastSample = Clock::now();
+        uint64_t lastCompleted = 0;
+        bool success = false;
+        std::string error;
+        auto onLine = [&](const std::string& line) {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            std::string message = OllamaApi::JsonString(line, "error");
+            if (!message.empty()) {
+                error = message;
+                return;
+            }
+            job->status = OllamaApi::JsonString(line, "status");
+            success = success || job->status == "success";
+            std::string digest = OllamaApi::JsonString(line, "digest");
+            if (digest.empty()) {
+                return;
+            }
+            auto layer = std::find_if(job->layers.begin(), job->layers.end(), [&digest](const Layer& l) { return l.digest == digest; });
+            if (layer == job->layers.end()) {
+                job->layers.push_back(Layer());
+                layer = job->layers.end() - 1;
+                layer->digest = digest;
+            }
+            uint64_t before = layer->completed;
+            layer->total = OllamaApi::JsonNumber(line, "total");
+            layer->completed = OllamaApi::JsonNumber(line, "completed");
+            if (layer->completed > before) {
+                manager.pulledBytes.add(layer->completed - before);
+            }
+
+            // throughput, smoothed over samples at least 250 ms apart
+            uint64_t done = 0;
+            for (const Layer& l : job->layers) done += l.completed;
+            double elapsed = std::chrono::duration<double>(Clock::now() - lastSample).count();
+            if (elapsed >= 0.25) {
+                double sample = done > lastCompleted ? (done - lastCompleted) / elapsed : 0.0;
+                job->bytesPerSecond = job->bytesPerSecond == 0.0 ? sample : 0.7 * job->bytesPerSecond + 0.3 * sample;
+                lastSample = Clock::now();
+                lastCompleted = done;
+            }
+        };
+        {
+            std::lock_guard<std::mutex> lock(manager.mutex);
+            for (const Layer& l : job->layers) lastCompleted += l.completed; // resumed attempts continue from here
+        }
+        OllamaApi::Result result = OllamaApi::Post(OllamaApi::DefaultEndpoint(), "/api/pull",
+            "{\"model\":\"" + job->model + "\",\"stream\":true}", onLine, [&job]() { return job->cancel || job->pause; });
+
+        if (success && !job->cancel) {
+            ResponseCache::forget(job->model); // cached responses of the old digest must not replay for the new one
+        }
+        std::lock_guard<std::mutex> lock(manager.mutex);
+        job->bytesPerSecond = 0.0;
+        if (job->cancel) {
+            job->state = Cancelled;
+        }
+        else if (job->pause) {
+            job->state = Paused;
+            job->status = "paused (bandwidth cap)";
+            job->attempts--; // not a failure
+            job->retryAt = Clock::now() + std::chrono::seconds(5); // let the others' rates settle before resuming
+        }
+        else if (success) {
+            job->state = Done;
+            manager.completed++;
+            manager.pulled.add();
+        }
+        else if (!error.empty() || (result.status != 0 && result.status != 200)) {
+            // the daemon answered with an error (unknown model, disk full), retrying will not help
+            job->state = Failed;
+            job->error = error.empty() ? "HTTP " + std::to_string(result.status) : error;
+            manager.pullFailures.add();
+        }
+        else if (job->attempts < MaxAttempts) {
+            // connection refused or dropped, try again later, the daemon resumes partial blobs
+            job->state = Queued;
+            job->error = result.error.empty() ? "stream ended early" : result.error;
+            job->status = "retrying: " + job->error;
+            job->retryAt = Clock::now() + std::chrono::seconds(1 << job->attempts);
+        }
+        else {
+            job->state = Failed;
+            job->error = result.error.empty() ? "stream ended early" : result.error;
+            manager.pullFailures.add();
+        }
+        manager.save();
+    }
+};
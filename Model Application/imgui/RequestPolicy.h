@@ -0,0 +1,131 @@
+﻿#pragma once
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+
+// RequestPolicy - how long each phase of a generation may take, and how much extra load hedges and retries may add
+// Deadlines end a request that connects, starts or streams too slowly instead of leaving the UI waiting forever.
+// A hedge is a duplicate sent to another endpoint when the first token is late, the first one to stream wins.
+// Hedges and retries draw on one budget that every request tops up by a fraction, so they stay a small share
+// of the traffic: when daemons are overloaded, failing requests do not turn into twice the requests.
+class RequestPolicy {
+public:
+    // Deadlines - per phase, in milliseconds, 0 = no deadline
+    struct Deadlines {
+        int connectMs = 5000;      // TCP connect to the daemon, HTTP only
+        int firstTokenMs = 120000; // dispatch to the first chunk, covers loading a cold model
+        int stallMs = 30000;       // longest gap between two chunks
+    };
+
+    static Deadlines deadlines() {
+        RequestPolicy& policy = instance();
+        std::lock_guard<std::mutex> lock(policy.mutex);
+        return policy.limits;
+    }
+    static void setDeadlines(const Deadlines& value) {
+        RequestPolicy& policy = instance();
+        std::lock_guard<std::mutex> lock(policy.mutex);
+        policy.limits = value;
+    }
+
+    // hedgeAfterMs() - waiting this long for the first token sends a duplicate to another endpoint, 0 = never
+    static int hedgeAfterMs() { return instance().hedgeAfter.load(std::memory_order_relaxed); }
+    static void setHedgeAfterMs(int value) { instance().hedgeAfter.store(std::max(0, value), std::memory_order_relaxed); }
+
+    // maxAttempts() - requests one generation may send at most: the first, a hedge and a retry
+    static int maxAttempts() { return 3; }
+
+    // admitted() - a generation started, tops up the budget
+    static void admitted() {
+        RequestPolicy& policy = instance();
+        std::lock_guard<std::mutex> lock(policy.mutex);
+        policy.tokens = policy.tokens + budgetRatio < budgetCap ? policy.tokens + budgetRatio : budgetCap;
+    }
+
+    // tryRetry()/tryHedge() - takes one extra request from the budget, false (and counted) if it is spent
+    static bool tryRetry() { return withdraw(instance().retries); }
+    static bool tryHedge() { return withdraw(instance().hedges); }
+
+    // hedgeWon() - the duplicate streamed first
+    static void hedgeWon() { instance().hedgeWins.add(); }
+
+    // timedOut() - counts a request ended by the deadline of phase ("connect", "first token", "stall")
+    static void timedOut(const std::string& phase) {
+        MetricsRegistry::counter("model_app_request_timeouts_total", "Requests ended by a deadline.", MetricsRegistry::label("phase", phase)).add();
+    }
+
+    // budget() - extra requests that may be sent right now
+    static double budget() {
+        RequestPolicy& policy = instance();
+        std::lock_guard<std::mutex> lock(policy.mutex);
+        return policy.tokens;
+    }
+
+    // Counts - for the policy window
+    struct Counts {
+        uint64_t hedges = 0;
+        uint64_t hedgeWins = 0;
+        uint64_t retries = 0;
+        uint64_t denied = 0;
+    };
+    static Counts counts() {
+        RequestPolicy& policy = instance();
+        Counts counts;
+        counts.hedges = policy.hedges.get();
+        counts.hedgeWins = policy.hedgeWins.get();
+        counts.retries = policy.retries.get();
+        counts.denied = policy.denied.get();
+        return counts;
+    }
+
+private:
+    static constexpr double budgetRatio = 0.1; // extra requests earned per generation
+    static constexpr double budgetCap = 10.0;  // burst after a quiet period
+
+    std::mutex mutex;
+    Deadlines limits;
+    double tokens = budgetCap;
+    std::atomic<int> hedgeAfter{ 0 };
+
+    Counter& hedges = MetricsRegistry::counter("model_app_hedged_requests_total", "Duplicates sent to another endpoint because the first token was late.");
+    Counter& hedgeWins = MetricsRegistry::counter("model_app_hedge_wins_total", "Hedged duplicates that streamed before the original.");
+    Counter& retries = MetricsRegistry::counter("model_app_request_retries_total", "Requests sent again after failing before the first token.");
+    Counter& denied = MetricsRegistry::counter("model_app_retry_budget_exhausted_total", "Hedges and retries skipped because the budget was spent.");
+
+    RequestPolicy() {
+        // MODEL_APP_*_TIMEOUT_MS override the deadlines, MODEL_APP_HEDGE_AFTER_MS turns hedging on
+        std::string connect = MetricsExporter::environment("MODEL_APP_CONNECT_TIMEOUT_MS");
+        std::string firstToken = MetricsExporter::environment("MODEL_APP_FIRST_TOKEN_TIMEOUT_MS");
+        std::string stall = MetricsExporter::environment("MODEL_APP_STALL_TIMEOUT_MS");
+        std::string hedge = MetricsExporter::environment("MODEL_APP_HEDGE_AFTER_MS");
+        if (!connect.empty()) limits.connectMs = std::max(0, std::atoi(connect.c_str()));
+        if (!firstToken.empty()) limits.firstTokenMs = std::max(0, std::atoi(firstToken.c_str()));
+        if (!stall.empty()) limits.stallMs = std::max(0, std::atoi(stall.c_str()));
+        hedgeAfter = std::max(0, std::atoi(hedge.c_str()));
+    }
+
+    // instance() - never destroyed, hedge timers and retries run on the HTTP loop thread
+    static RequestPolicy& instance() {
+        static RequestPolicy* policy = new RequestPolicy();
+        return *policy;
+    }
+
+    // withdraw() - takes one token, counting the extra request or the denial
+    static bool withdraw(Counter& taken) {
+        RequestPolicy& policy = instance();
+        {
+            std::lock_guard<std::mutex> lock(policy.mutex);
+            if (policy.tokens < 1.0) {
+                policy.denied.add();
+                return false;
+            }
+            policy.tokens -= 1.0;
+        }
+        taken.add();
+        return true;
+    }
+};
@@ -0,0 +1,463 @@
+﻿#pragma once
+#include "Metrics.h"
+#include "OllamaCli.h"
+#include "Telemetry.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+
+// CachedChunk - one chunk of a recorded stream
+struct CachedChunk {
+    float offset = 0.0f; // seconds after dispatch the chunk arrived
+    uint32_t end = 0;    // end of the chunk in CachedResponse::text
+};
+
+// CachedResponse - a recorded generation, enough to replay it chunk by chunk
+struct CachedResponse {
+    std::string text;
+    std::vector<CachedChunk> chunks;
+    GenerationStats stats; // footer values (--verbose) of the original run
+};
+
+// ResponseCache - opt-in on-disk cache of responses, stored as response_cache/<hash>.bin
+// Keys are model digest + sampling parameters + prompt, so a re-pulled or re-configured model misses.
+// Entries are bounded by total size, the least recently used ones are evicted first.
+class ResponseCache {
+public:
+    enum ReplayMode {
+        ReplayInstant,  // whole response at once
+        ReplayRecorded  // chunks at the pace they were recorded
+    };
+
+    // Summary - counts shown by the cache window
+    struct Summary {
+        size_t entries = 0;
+        uint64_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    static bool enabled() { return instance().on.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enable) { instance().on.store(enable, std::memory_order_relaxed); }
+
+    // deterministicOnly() - only cache models that sample with temperature 0
+    static bool deterministicOnly() { return instance().deterministic.load(std::memory_order_relaxed); }
+    static void setDeterministicOnly(bool value) { instance().deterministic.store(value, std::memory_order_relaxed); }
+
+    static ReplayMode replayMode() { return (ReplayMode)instance().replay.load(std::memory_order_relaxed); }
+    static void setReplayMode(ReplayMode mode) { instance().replay.store(mode, std::memory_order_relaxed); }
+
+    // maxBytes() - size bound of the cache, evicts when lowered
+    static uint64_t maxBytes() { return instance().limit.load(std::memory_order_relaxed); }
+    static void setMaxBytes(uint64_t bytes) {
+        ResponseCache& cache = instance();
+        cache.limit.store(bytes, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.loadIndex();
+        cache.evict();
+        cache.saveIndex();
+    }
+
+    // keyFor() - cache key of a prompt, empty if the model is unknown or (deterministicOnly) samples randomly
+    // never runs ollama on the caller's (UI) thread: a model not identified yet is identified in the background,
+    // see prepare(), and its prompts skip the cache until then
+    static std::string keyFor(const std::string& model, const std::string& prompt) {
+        ModelIdentity identity;
+        if (!identified(model, identity)) {
+            prepare(model);
+            return "";
+        }
+        if (deterministicOnly() && !identity.deterministic) {
+            return "";
+        }
+        return "model " + model + "\ndigest " + identity.digest + "\nparameters\n" + identity.parameters + "prompt\n" + prompt;
+    }
+
+    // prepare() - identifies a model on the catalog pool, unless it is known, on its way or failed within
+    // identifyRetrySeconds (the daemon is down: no two CLI timeouts per prompt)
+    static void prepare(const std::string& model) {
+        ResponseCache& cache = instance();
+        {
+            std::lock_guard<std::mutex> lock(cache.identityMutex);
+            auto failed = cache.identifyFailures.find(model);
+            if (cache.identities.count(model) || cache.identifying.count(model) ||
+                (failed != cache.identifyFailures.end() && Clock::now() - failed->second < std::chrono::seconds(identifyRetrySeconds))) {
+                return;
+            }
+            cache.identifying.insert(model);
+        }
+        ThreadPool::group("catalog").submit([model]() {
+            ModelIdentity identity;
+            bool ok = identify(model, identity);
+            ResponseCache& cache = instance();
+            std::lock_guard<std::mutex> lock(cache.identityMutex);
+            cache.identifying.erase(model);
+            if (ok) {
+                cache.identities[model] = identity;
+                cache.identifyFailures.erase(model);
+            }
+            else {
+                cache.identifyFailures[model] = Clock::now();
+            }
+        });
+    }
+
+    // lookup() - reads the entry of a key, counts a hit or a miss
+    static bool lookup(const std::string& key, CachedResponse& response) {
+        TRACE_SCOPE("ResponseCache::lookup");
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.loadIndex();
+        std::string name = hashName(key);
+        auto entry = cache.index.find(name);
+        if (entry == cache.index.end() || !readEntry(name, key, response)) {
+            cache.misses.add();
+            return false;
+        }
+        entry->second.lastUse = ++cache.useCounter;
+        cache.scheduleFlush(); // hits only touch lastUse, their index writes are batched
+        cache.hits.add();
+        return true;
+    }
+
+    // store() - writes an entry, then evicts down to maxBytes()
+    static void store(const std::string& key, const CachedResponse& response) {
+        TRACE_SCOPE("ResponseCache::store");
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.loadIndex();
+        std::string name = hashName(key);
+        uint64_t bytes = writeEntry(name, key, response);
+        if (bytes == 0) {
+            return;
+        }
+        Entry& entry = cache.index[name];
+        entry.bytes = bytes;
+        entry.lastUse = ++cache.useCounter;
+        cache.evict();
+        cache.saveIndex();
+    }
+
+    // clear() - deletes every entry and forgets the model identities
+    static void clear() {
+        ResponseCache& cache = instance();
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            cache.loadIndex();
+            for (const auto& entry : cache.index) {
+                std::remove(entryPath(entry.first).c_str());
+            }
+            cache.index.clear();
+            cache.saveIndex();
+        }
+        std::lock_guard<std::mutex> lock(cache.identityMutex);
+        cache.identities.clear();
+        cache.identifyFailures.clear();
+    }
+
+    // forget() - drops what is known about a model's identity, a (re)pull may have changed its digest
+    // the next prompt identifies it again, see prepare()
+    static void forget(const std::string& model) {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.identityMutex);
+        for (auto entry = cache.identities.begin(); entry != cache.identities.end(); ) {
+            entry = OllamaCli::SameModel(entry->first, model) ? cache.identities.erase(entry) : std::next(entry);
+        }
+        for (auto entry = cache.identifyFailures.begin(); entry != cache.identifyFailures.end(); ) {
+            entry = OllamaCli::SameModel(entry->first, model) ? cache.identifyFailures.erase(entry) : std::next(entry);
+        }
+    }
+
+    // flush() - writes the index if hits changed it since the last write, the batched write of lookup()
+    static void flush() {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.flushPending = false;
+        if (cache.indexDirty) {
+            cache.saveIndex();
+        }
+    }
+
+    // summary() - entry count, size and counters
+    static Summary summary() {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.loadIndex();
+        Summary summary;
+        summary.entries = cache.index.size();
+        summary.bytes = cache.totalBytes();
+        summary.hits = cache.hits.get();
+        summary.misses = cache.misses.get();
+        summary.evictions = cache.evictions.get();
+        return summary;
+    }
+
+private:
+    // ModelIdentity - what a response depends on besides the prompt
+    struct ModelIdentity {
+        std::string digest;      // ID column of ollama list
+        std::string parameters;  // ollama show --parameters, the sampling options
+        bool deterministic = false;
+    };
+
+    // Entry - index line of one cached response
+    struct Entry {
+        uint64_t bytes = 0;
+        uint64_t lastUse = 0;
+    };
+
+    std::atomic<bool> on{ false };
+    std::atomic<bool> deterministic{ true };
+    std::atomic<int> replay{ ReplayRecorded };
+    std::atomic<uint64_t> limit{ 256ull * 1024 * 1024 };
+
+    typedef std::chrono::steady_clock Clock;
+    enum { identifyRetrySeconds = 10 };
+
+    std::mutex mutex; // guards the index and the files
+    std::map<std::string, Entry> index;
+    uint64_t useCounter = 0;
+    bool indexLoaded = false;
+    bool indexDirty = false;   // index.txt is behind index
+    bool flushPending = false; // a flush() task is queued
+
+    std::mutex identityMutex; // guards the identity maps
+    std::map<std::string, ModelIdentity> identities;
+    std::map<std::string, Clock::time_point> identifyFailures; // ollama did not answer, by model
+    std::set<std::string> identifying;                         // identify() queued or running
+
+    Counter& hits = MetricsRegistry::counter("model_app_cache_hits_total", "Response cache lookups that replayed a stored response.");
+    Counter& misses = MetricsRegistry::counter("model_app_cache_misses_total", "Response cache lookups that had to generate.");
+    Counter& evictions = MetricsRegistry::counter("model_app_cache_evictions_total", "Response cache entries evicted by the size bound.");
+    Gauge& bytesGauge = MetricsRegistry::gauge("model_app_cache_bytes", "Bytes used by the response cache.");
+    Gauge& entriesGauge = MetricsRegistry::gauge("model_app_cache_entries", "Responses stored in the response cache.");
+
+    static ResponseCache& instance() {
+        static ResponseCache cache;
+        return cache;
+    }
+
+    static std::string entryPath(const std::string& name) {
+        return "response_cache/" + name + ".bin";
+    }
+
+    // hashName() - FNV-1a of the key, the full key is stored in the entry and compared on read
+    static std::string hashName(const std::string& key) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : key) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        char name[17];
+        snprintf(name, sizeof(name), "%016llx", (unsigned long long)hash);
+        return name;
+    }
+
+    // identified() - the identity of a model if prepare() found it
+    static bool identified(const std::string& model, ModelIdentity& identity) {
+        ResponseCache& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.identityMutex);
+        auto found = cache.identities.find(model);
+        if (found == cache.identities.end()) {
+            return false;
+        }
+        identity = found->second;
+        return true;
+    }
+
+    // identify() - digest and sampling parameters of a model from `ollama list` and `ollama show`, on a pool
+    // thread; false if ollama did not answer or does not list the model
+    static bool identify(const std::string& model, ModelIdentity& identity) {
+        TRACE_SCOPE_DETAIL("ResponseCache::identify", model);
+        int status = 0;
+        std::istringstream list(OllamaCli::Run("ollama list", &status));
+        std::string line;
+        while (std::getline(list, line)) {
+            std::istringstream columns(line);
+            std::string name, id;
+            columns >> name >> id;
+            if (OllamaCli::SameModel(name, model)) {
+                identity.digest = id;
+                break;
+            }
+        }
+
+        // unset temperature means ollama's default (0.8), which is not deterministic
+        std::istringstream parameters(status == 0 ? OllamaCli::Run("ollama show " + model + " --parameters", &status) : "");
+        while (std::getline(parameters, line)) {
+            std::istringstream columns(line);
+            std::string name, value;
+            columns >> name >> value;
+            if (name.empty()) {
+                continue;
+            }
+            identity.parameters += name + " " + value + "\n";
+            if (name == "temperature") {
+                identity.deterministic = std::atof(value.c_str()) == 0.0;
+            }
+        }
+        return status == 0 && !identity.digest.empty();
+    }
+
+    // scheduleFlush() - queues one flush() for the index changes of any number of hits, mutex held
+    void scheduleFlush() {
+        indexDirty = true;
+        if (flushPending) {
+            return;
+        }
+        flushPending = true;
+        ThreadPool::group("cache").submit(flush);
+    }
+
+    // readEntry() - reads an entry file, false if missing, corrupt or a hash collision
+    static bool readEntry(const std::string& name, const std::string& key, CachedResponse& response) {
+        std::ifstream file(entryPath(name), std::ios::binary);
+        std::string magic(9, '\0');
+        if (!file.read(&magic[0], magic.size()) || magic != "MACACHE1\n") {
+            return false;
+        }
+        std::string storedKey;
+        uint32_t count = 0;
+        if (!readString(file, storedKey) || storedKey != key) {
+            return false;
+        }
+        GenerationStats& stats = response.stats;
+        file.read((char*)&stats.loadDuration, sizeof(stats.loadDuration));
+        file.read((char*)&stats.promptEvalCount, sizeof(stats.promptEvalCount));
+        file.read((char*)&stats.promptEvalDuration, sizeof(stats.promptEvalDuration));
+        file.read((char*)&stats.evalCount, sizeof(stats.evalCount));
+        file.read((char*)&stats.evalDuration, sizeof(stats.evalDuration));
+        file.read((char*)&count, sizeof(count));
+        if (!file || count > (1u << 24)) {
+            return false;
+        }
+        response.chunks.resize(count);
+        if (count > 0) {
+            file.read((char*)&response.chunks[0], count * sizeof(CachedChunk));
+        }
+        if (!readString(file, response.text)) {
+            return false;
+        }
+        for (const CachedChunk& chunk : response.chunks) {
+            if (chunk.end > response.text.length()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // writeEntry() - writes an entry file, returns its size (0 on failure)
+    static uint64_t writeEntry(const std::string& name, const std::string& key, const CachedResponse& response) {
+        #ifdef _WIN32
+             _mkdir("response_cache");
+        #else
+             mkdir("response_cache", 0755);
+        #endif
+        std::ofstream file(entryPath(name), std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return 0;
+        }
+        const GenerationStats& stats = response.stats;
+        uint32_t count = (uint32_t)response.chunks.size();
+        file.write("MACACHE1\n", 9);
+        writeString(file, key);
+        file.write((const char*)&stats.loadDuration, sizeof(stats.loadDuration));
+        file.write((const char*)&stats.promptEvalCount, sizeof(stats.promptEvalCount));
+        file.write((const char*)&stats.promptEvalDuration, sizeof(stats.promptEvalDuration));
+        file.write((const char*)&stats.evalCount, sizeof(stats.evalCount));
+        file.write((const char*)&stats.evalDuration, sizeof(stats.evalDuration));
+        file.write((const char*)&count, sizeof(count));
+        if (count > 0) {
+            file.write((const char*)&response.chunks[0], count * sizeof(CachedChunk));
+        }
+        writeString(file, response.text);
+        uint64_t bytes = (uint64_t)file.tellp();
+        return file.good() ? bytes : 0;
+    }
+
+    static bool readString(std::ifstream& file, std::string& text) {
+        uint32_t length = 0;
+        if (!file.read((char*)&length, sizeof(length)) || length > (1u << 30)) {
+            return false;
+        }
+        text.resize(length);
+        return length == 0 || (bool)file.read(&text[0], length);
+    }
+
+    static void writeString(std::ofstream& file, const std::string& text) {
+        uint32_t length = (uint32_t)text.length();
+        file.write((const char*)&length, sizeof(length));
+        file.write(text.data(), length);
+    }
+
+    // loadIndex() - reads response_cache/index.txt once ("<hash> <bytes> <lastUse>" per line)
+    void loadIndex() {
+        if (indexLoaded) {
+            return;
+        }
+        indexLoaded = true;
+        std::ifstream file("response_cache/index.txt");
+        std::string name;
+        Entry entry;
+        while (file >> name >> entry.bytes >> entry.lastUse) {
+            index[name] = entry;
+            useCounter = entry.lastUse > useCounter ? entry.lastUse : useCounter;
+        }
+        updateGauges();
+    }
+
+    void saveIndex() {
+        indexDirty = false;
+        std::ofstream file("response_cache/index.txt", std::ios::trunc);
+        for (const auto& entry : index) {
+            file << entry.first << " " << entry.second.bytes << " " << entry.second.lastUse << "\n";
+        }
+        updateGauges();
+    }
+
+    uint64_t totalBytes() const {
+        uint64_t bytes = 0;
+        for (const auto& entry : index) {
+            bytes += entry.second.bytes;
+        }
+        return bytes;
+    }
+
+    // evict() - drops least recently used entries until the cache fits maxBytes()
+    void evict() {
+        uint64_t bytes = totalBytes();
+        while (bytes > limit.load(std::memory_order_relaxed) && !index.empty()) {
+            auto oldest = index.begin();
+            for (auto entry = index.begin(); entry != index.end(); ++entry) {
+                if (entry->second.lastUse < oldest->second.lastUse) {
+                    oldest = entry;
+                }
+            }
+            std::remove(entryPath(oldest->first).c_str());
+            bytes -= oldest->second.bytes;
+            index.erase(oldest);
+            evictions.add();
+        }
+    }
+
+    void updateGauges() {
+        bytesGauge.set((int64_t)totalBytes());
+        entriesGauge.set((int64_t)index.size());
+    }
+};
@@ -0,0 +1,190 @@
+﻿#pragma once
+#include "ModelStore.h"
+#include "Trace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// StoreInspector - real disk usage of the local model store
+// `ollama list` adds up every layer of a model, but blobs are content addressed and shared between
+// tags (and between models built FROM the same base), so the sizes it shows overcount the store.
+// Here every blob is counted once: a model's unique bytes are blobs only it references, the rest are shared.
+class StoreInspector {
+public:
+    // ModelUsage - one manifest of the store
+    struct ModelUsage {
+        std::string name;            // as ollama lists it
+        std::string family;          // model name without tag
+        std::string digest;          // weights layer digest
+        int64_t modified = 0;        // manifest modification time, seconds since 1970
+        int layers = 0;
+        uint64_t declaredBytes = 0;  // sum of the manifest's layer sizes (what `ollama list` shows)
+        uint64_t diskBytes = 0;      // blobs of this model present on disk
+        uint64_t uniqueBytes = 0;    // blobs no other model references, freed by `ollama rm`
+        uint64_t sharedBytes = 0;    // blobs also referenced by other models
+        int missingBlobs = 0;        // layers whose blob is not on disk
+    };
+
+    // Report - result of one scan
+    struct Report {
+        std::string root;
+        std::vector<ModelUsage> models;
+        size_t blobCount = 0;
+        uint64_t storeBytes = 0;      // every file in blobs/
+        uint64_t declaredBytes = 0;   // sum over models of declaredBytes, counting shared layers repeatedly
+        size_t orphanBlobs = 0;       // blobs no manifest references (interrupted pulls, removed models)
+        uint64_t orphanBytes = 0;
+        double seconds = 0.0;         // scan duration
+        bool scanned = false;
+    };
+
+    // scan() - walks manifests and blobs on all cores, blocking
+    static Report scan() {
+        TRACE_SCOPE("StoreInspector::scan");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Report report;
+        report.root = ModelStore::Root();
+        std::vector<ModelStore::Manifest> manifests = ModelStore::ListManifests();
+
+        // read and parse manifests in parallel
+        std::vector<std::vector<ModelStore::Layer>> layers(manifests.size());
+        std::vector<int64_t> modified(manifests.size(), 0);
+        TaskGroup& indexing = ThreadPool::group("indexing");
+        ThreadPool::parallelFor(indexing, manifests.size(), [&](size_t i) {
+            uint64_t size = 0;
+            ModelStore::FileInfo(manifests[i].path, size, modified[i]);
+            layers[i] = ModelStore::Layers(ModelStore::ReadText(manifests[i].path));
+        });
+
+        // every blob on disk plus every referenced digest, each stat'ed once in parallel
+        std::vector<std::string> directories, blobFiles;
+        ModelStore::ListDirectory(ModelStore::Join(report.root, "blobs"), directories, blobFiles);
+        std::map<std::string, size_t> blobIndex; // file name -> slot in blobs
+        std::vector<Blob> blobs;
+        auto slotOf = [&](const std::string& file) {
+            auto inserted = blobIndex.insert(std::make_pair(file, blobs.size()));
+            if (inserted.second) {
+                blobs.push_back(Blob());
+                blobs.back().file = file;
+            }
+            return inserted.first->second;
+        };
+        for (const std::string& file : blobFiles) {
+            slotOf(file);
+        }
+        std::vector<std::vector<size_t>> modelBlobs(manifests.size());
+        for (size_t i = 0; i < manifests.size(); ++i) {
+            for (const ModelStore::Layer& layer : layers[i]) {
+                std::string file = layer.digest;
+                std::replace(file.begin(), file.end(), ':', '-');
+                size_t slot = slotOf(file);
+                if (std::find(modelBlobs[i].begin(), modelBlobs[i].end(), slot) == modelBlobs[i].end()) {
+                    modelBlobs[i].push_back(slot);
+                    blobs[slot].references++;
+                }
+            }
+        }
+        std::string blobDirectory = ModelStore::Join(report.root, "blobs");
+        ThreadPool::parallelFor(indexing, blobs.size(), [&](size_t i) {
+            int64_t ignored = 0;
+            blobs[i].present = ModelStore::FileInfo(ModelStore::Join(blobDirectory, blobs[i].file), blobs[i].size, ignored);
+        });
+
+        // dedup accounting
+        for (const Blob& blob : blobs) {
+            if (!blob.present) continue;
+            report.blobCount++;
+            report.storeBytes += blob.size;
+            if (blob.references == 0) {
+                report.orphanBlobs++;
+                report.orphanBytes += blob.size;
+            }
+        }
+        for (size_t i = 0; i < manifests.size(); ++i) {
+            ModelUsage usage;
+            usage.name = ModelStore::DisplayName(manifests[i].name);
+            usage.family = usage.name.substr(0, usage.name.rfind(':'));
+            usage.modified = modified[i];
+            usage.layers = (int)layers[i].size();
+            for (const ModelStore::Layer& layer : layers[i]) {
+                usage.declaredBytes += layer.size;
+                if (layer.mediaType == "application/vnd.ollama.image.model") {
+                    usage.digest = layer.digest;
+                }
+            }
+            for (size_t slot : modelBlobs[i]) {
+                const Blob& blob = blobs[slot];
+                if (!blob.present) {
+                    usage.missingBlobs++;
+                    continue;
+                }
+                usage.diskBytes += blob.size;
+                (blob.references == 1 ? usage.uniqueBytes : usage.sharedBytes) += blob.size;
+            }
+            report.declaredBytes += usage.declaredBytes;
+            report.models.push_back(usage);
+        }
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report.scanned = true;
+        return report;
+    }
+
+    // startScan() - scans on the thread pool, false if a scan is already running
+    static bool startScan() {
+        StoreInspector& inspector = instance();
+        bool expected = false;
+        if (!inspector.running.compare_exchange_strong(expected, true)) {
+            return false;
+        }
+        ThreadPool::group("indexing").submit([]() {
+            Report report = scan();
+            StoreInspector& inspector = instance();
+            {
+                std::lock_guard<std::mutex> lock(inspector.mutex);
+                inspector.last = report;
+            }
+            inspector.completed++;
+            inspector.running = false;
+        });
+        return true;
+    }
+
+    // scanning() - is a background scan running?
+    static bool scanning() { return instance().running.load(); }
+
+    // completedScans() - background scans finished so far, changes when lastReport() does
+    static int completedScans() { return instance().completed.load(); }
+
+    // lastReport() - result of the last finished background scan
+    static Report lastReport() {
+        StoreInspector& inspector = instance();
+        std::lock_guard<std::mutex> lock(inspector.mutex);
+        return inspector.last;
+    }
+
+private:
+    struct Blob {
+        std::string file;   // sha256-<hex>
+        uint64_t size = 0;
+        int references = 0; // manifests using it
+        bool present = false;
+    };
+
+    std::mutex mutex;
+    Report last;
+    std::atomic<bool> running{ false };
+    std::atomic<int> completed{ 0 };
+
+    static StoreInspector& instance() {
+        static StoreInspector inspector;
+        return inspector;
+    }
+};
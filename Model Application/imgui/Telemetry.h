@@ -0,0 +1,261 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// GenerationStats - timings for one sendPrompt() call
+struct GenerationStats {
+    double timeToFirstByte = 0.0;    // seconds from dispatch to the first byte from the pipe
+    double timeToFirstToken = 0.0;   // seconds from dispatch to first visible output
+    double wallTime = 0.0;           // seconds from dispatch to completion
+    int chunkCount = 0;              // reads that carried visible output
+    double loadDuration = 0.0;       // seconds spent loading the model (from --verbose)
+    int promptEvalCount = 0;         // prompt tokens evaluated (from --verbose)
+    double promptEvalDuration = 0.0; // seconds spent on the prompt (from --verbose)
+    int evalCount = 0;               // tokens generated (from --verbose)
+    double evalDuration = 0.0;       // seconds spent generating (from --verbose)
+    bool hasFirstByte = false;
+    bool hasFirstToken = false;
+    bool done = false;
+
+    // tokensPerSecond() - decode throughput, 0 until the server reports it
+    double tokensPerSecond() const {
+        return evalDuration > 0.0 ? evalCount / evalDuration : 0.0;
+    }
+};
+
+// GenerationTrace - raw timestamps of one request
+struct GenerationTrace {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point dispatch;
+    Clock::time_point firstByte;
+    Clock::time_point firstToken;
+    Clock::time_point completion;
+    std::vector<float> chunkOffsets; // seconds after dispatch of every visible chunk
+
+    // offset() - seconds from dispatch to the given time
+    double offset(Clock::time_point when) const {
+        return std::chrono::duration<double>(when - dispatch).count();
+    }
+};
+
+// ParseGoDuration() - parses Go durations such as "1m2.5s", "12.3ms" or "850µs" into seconds
+inline double ParseGoDuration(const std::string& text) {
+    double seconds = 0.0;
+    size_t i = 0;
+    while (i < text.length()) {
+        char* end = nullptr;
+        double value = std::strtod(text.c_str() + i, &end);
+        if (end == text.c_str() + i) {
+            break;
+        }
+        i = end - text.c_str();
+        std::string unit;
+        while (i < text.length() && !std::isdigit(static_cast<unsigned char>(text[i])) && text[i] != '.' && !std::isspace(static_cast<unsigned char>(text[i]))) {
+            unit += text[i++];
+        }
+        if (unit == "h") seconds += value * 3600.0;
+        else if (unit == "m") seconds += value * 60.0;
+        else if (unit == "s") seconds += value;
+        else if (unit == "ms") seconds += value / 1e3;
+        else if (unit == "ns") seconds += value / 1e9;
+        else seconds += value / 1e6; // "us", "µs" (UTF-8 micro/mu sign)
+    }
+    return seconds;
+}
+
+// Histogram - HDR-style log-linear histogram of non-negative integers
+// 64 linear sub-buckets per power of two keep every bucket within ~3% of its value.
+// Recording is a few relaxed atomic adds, so it is safe (and lock-free) from any thread.
+class Histogram {
+public:
+    static const int SubBucketBits = 6;
+    static const int SubBucketCount = 1 << SubBucketBits;
+    static const int HalfCount = SubBucketCount / 2;
+    static const int MaxShift = 35; // values are clamped below 2^41 (~25 days in microseconds)
+    static const int BucketCount = SubBucketCount + MaxShift * HalfCount;
+
+    Histogram() {
+        reset();
+    }
+
+    // record() - adds one value
+    void record(uint64_t value) {
+        counts[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t seen = maximum.load(std::memory_order_relaxed);
+        while (value > seen && !maximum.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    // reset() - drops all recorded values
+    void reset() {
+        for (int i = 0; i < BucketCount; ++i) {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        maximum.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(std::memory_order_relaxed); }
+    uint64_t sumOfValues() const { return sum.load(std::memory_order_relaxed); }
+    double mean() const {
+        uint64_t n = count();
+        return n == 0 ? 0.0 : (double)sum.load(std::memory_order_relaxed) / n;
+    }
+
+    // countAtOrBelow() - values recorded in buckets that end at or below the given value
+    uint64_t countAtOrBelow(uint64_t value) const {
+        uint64_t seen = 0;
+        for (int i = 0; i < BucketCount && bucketUpperBound(i) <= value; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+        }
+        return seen;
+    }
+
+    // percentile() - highest value equivalent to the given quantile (0..1), 0 when empty
+    uint64_t percentile(double quantile) const {
+        uint64_t n = count();
+        if (n == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(quantile * n + 0.5);
+        rank = rank < 1 ? 1 : (rank > n ? n : rank);
+        uint64_t seen = 0;
+        for (int i = 0; i < BucketCount; ++i) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                uint64_t upper = bucketUpperBound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    // bucketIndex() - bucket of a value, linear below SubBucketCount, log-linear above
+    static int bucketIndex(uint64_t value) {
+        const uint64_t limit = (uint64_t)1 << (MaxShift + SubBucketBits);
+        if (value >= limit) {
+            value = limit - 1;
+        }
+        if (value < SubBucketCount) {
+            return (int)value;
+        }
+        int msb = 0;
+        for (uint64_t v = value; v > 1; v >>= 1) {
+            msb++;
+        }
+        int shift = msb - (SubBucketBits - 1); // keep the top bits (HalfCount..SubBucketCount-1)
+        int top = (int)(value >> shift);
+        return SubBucketCount + (shift - 1) * HalfCount + (top - HalfCount);
+    }
+
+    // bucketUpperBound() - largest value that lands in the given bucket
+    static uint64_t bucketUpperBound(int index) {
+        if (index < SubBucketCount) {
+            return (uint64_t)index;
+        }
+        int k = index - SubBucketCount;
+        int shift = k / HalfCount + 1;
+        uint64_t top = (uint64_t)(k % HalfCount + HalfCount);
+        return ((top + 1) << shift) - 1;
+    }
+
+private:
+    std::atomic<uint64_t> counts[BucketCount];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> maximum;
+};
+
+// ModelTelemetry - latency histograms of one model, all in microseconds
+struct ModelTelemetry {
+    Histogram firstByte;    // dispatch -> first byte from the pipe (process spawn + connect)
+    Histogram firstToken;   // dispatch -> first visible output
+    Histogram interToken;   // gap between consecutive visible chunks
+    Histogram tokenLatency; // server eval duration / eval count, the decode cost of one token
+    Histogram promptEval;   // server prompt eval duration (prefill)
+    Histogram load;         // server model load duration
+    Histogram total;        // dispatch -> completion
+    Histogram firstTokenWarm; // firstToken of requests that found the model already loaded
+    Histogram firstTokenCold; // firstToken of requests that had to load it
+    std::atomic<uint64_t> generatedTokens{ 0 }; // server eval counts
+    std::atomic<uint64_t> evalMicros{ 0 };      // server eval durations, tokens/s = generatedTokens / evalMicros
+    std::atomic<uint64_t> promptTokens{ 0 };    // server prompt eval counts
+};
+
+// Telemetry - per model histograms, shared by every ModelClient
+class Telemetry {
+public:
+    // forModel() - histograms of a model, created on first use
+    // look this up once per request, recording into it afterwards takes no lock
+    static ModelTelemetry& forModel(const std::string& model) {
+        Telemetry& telemetry = instance();
+        std::lock_guard<std::mutex> lock(telemetry.mutex);
+        std::unique_ptr<ModelTelemetry>& entry = telemetry.models[model];
+        if (!entry) {
+            entry.reset(new ModelTelemetry());
+        }
+        return *entry;
+    }
+
+    // modelNames() - models that have recorded at least one request
+    static std::vector<std::string> modelNames() {
+        Telemetry& telemetry = instance();
+        std::lock_guard<std::mutex> lock(telemetry.mutex);
+        std::vector<std::string> names;
+        for (const auto& entry : telemetry.models) {
+            names.push_back(entry.first);
+        }
+        return names;
+    }
+
+    // recordCompletion() - folds a finished request into its model's histograms
+    static void recordCompletion(ModelTelemetry& histograms, const GenerationTrace& trace, const GenerationStats& stats) {
+        if (stats.hasFirstByte) {
+            histograms.firstByte.record(toMicros(stats.timeToFirstByte));
+        }
+        if (stats.hasFirstToken) {
+            histograms.firstToken.record(toMicros(stats.timeToFirstToken));
+        }
+        if (stats.evalCount > 0) {
+            histograms.tokenLatency.record(toMicros(stats.evalDuration / stats.evalCount));
+            histograms.generatedTokens.fetch_add(stats.evalCount, std::memory_order_relaxed);
+            histograms.evalMicros.fetch_add(toMicros(stats.evalDuration), std::memory_order_relaxed);
+        }
+        histograms.promptTokens.fetch_add(stats.promptEvalCount, std::memory_order_relaxed);
+        if (stats.promptEvalDuration > 0.0) {
+            histograms.promptEval.record(toMicros(stats.promptEvalDuration));
+        }
+        if (stats.loadDuration > 0.0) {
+            histograms.load.record(toMicros(stats.loadDuration));
+        }
+        histograms.total.record(toMicros(trace.offset(trace.completion)));
+    }
+
+    // toMicros() - seconds to whole microseconds
+    static uint64_t toMicros(double seconds) {
+        return seconds <= 0.0 ? 0 : (uint64_t)(seconds * 1e6 + 0.5);
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<ModelTelemetry>> models;
+
+    static Telemetry& instance() {
+        static Telemetry telemetry;
+        return telemetry;
+    }
+};
@@ -0,0 +1,391 @@
+﻿#pragma once
+#include "Metrics.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool;
+
+// TaskGroup - named set of tasks on the shared pool, e.g. "generation" or "history"
+// Groups are created once and live until exit, so references to them stay valid.
+class TaskGroup {
+public:
+    // submit() - queues a task, dropped if the group is cancelled before it starts or the pool shut down
+    void submit(std::function<void()> task);
+
+    // cancel() - drops queued tasks and runs the cancel hooks so running tasks end early
+    void cancel() {
+        std::vector<std::function<void()>> hooks;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            epoch++;
+            hooks = cancelHooks;
+        }
+        for (const auto& hook : hooks) {
+            hook();
+        }
+    }
+
+    // onCancel() - registers a hook that stops this group's running tasks (terminate a process, close a socket)
+    void onCancel(std::function<void()> hook) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelHooks.push_back(hook);
+    }
+
+    // wait() - blocks until every queued and running task of the group has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return pending == 0; });
+    }
+
+    // Stats - for the metrics window
+    struct Stats {
+        std::string name;
+        int running = 0;
+        int queued = 0;
+        uint64_t completed = 0;
+        uint64_t dropped = 0;   // cancelled before they started
+        uint64_t busyMicros = 0; // summed task run time, rate = average busy threads
+    };
+
+    Stats stats() const {
+        Stats result;
+        result.name = name;
+        result.running = (int)running.get();
+        result.queued = (int)queued.get();
+        result.completed = completed.get();
+        result.dropped = dropped.get();
+        result.busyMicros = busyMicros.get();
+        return result;
+    }
+
+    const std::string& getName() const { return name; }
+
+private:
+    friend class ThreadPool;
+
+    std::string name;
+    ThreadPool* pool;
+    std::mutex mutex;
+    std::condition_variable idle;
+    uint64_t epoch = 0;  // bumped by cancel(), tasks queued under an older epoch are dropped
+    bool closed = false; // set by ThreadPool::shutdown(), later submits are dropped
+    int pending = 0;     // queued + running
+    std::vector<std::function<void()>> cancelHooks;
+
+    Counter& completed;
+    Counter& dropped;
+    Counter& busyMicros;
+    Gauge& running;
+    Gauge& queued;
+
+    TaskGroup(const std::string& name, ThreadPool* pool)
+        : name(name), pool(pool),
+          completed(MetricsRegistry::counter("model_app_pool_tasks_total", "Tasks run by the thread pool.", MetricsRegistry::label("group", name))),
+          dropped(MetricsRegistry::counter("model_app_pool_tasks_dropped_total", "Tasks cancelled before they started.", MetricsRegistry::label("group", name))),
+          busyMicros(MetricsRegistry::counter("model_app_pool_busy_microseconds_total", "Time pool threads spent running tasks, rate() = busy threads.", MetricsRegistry::label("group", name))),
+          running(MetricsRegistry::gauge("model_app_pool_tasks_running", "Tasks running on the thread pool.", MetricsRegistry::label("group", name))),
+          queued(MetricsRegistry::gauge("model_app_pool_tasks_queued", "Tasks waiting for a pool thread.", MetricsRegistry::label("group", name))) {}
+
+    // finished() - one task ran or was dropped
+    void finished() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            idle.notify_all();
+        }
+    }
+};
+
+// ThreadPool - one shared work-stealing pool for all background work
+// Every worker owns a deque: tasks submitted from a worker go to the back of its own deque and it pops
+// from the back (newest first, still cache warm), idle workers steal from the front of the others'.
+// Tasks submitted from other threads (the UI) go to a shared injection queue. Much of the work here
+// blocks (a generation waits on ollama for seconds), so when every worker is busy a new one is started,
+// up to MaxWorkers, instead of letting blocked tasks starve the queue.
+// shutdown() cancels every group and joins the workers; call it before the app state goes away.
+class ThreadPool {
+public:
+    static const int MaxWorkers = 64;
+
+    // shared() - the process wide pool
+    static ThreadPool& shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // group() - finds or creates a named task group on the shared pool
+    static TaskGroup& group(const std::string& name) {
+        ThreadPool& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.groupsMutex);
+        for (const auto& existing : pool.groups) {
+            if (existing->name == name) {
+                return *existing;
+            }
+        }
+        pool.groups.push_back(std::unique_ptr<TaskGroup>(new TaskGroup(name, &pool)));
+        return *pool.groups.back();
+    }
+
+    // groupStats() - every group's counters, for the UI
+    static std::vector<TaskGroup::Stats> groupStats() {
+        ThreadPool& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.groupsMutex);
+        std::vector<TaskGroup::Stats> stats;
+        for (const auto& existing : pool.groups) {
+            stats.push_back(existing->stats());
+        }
+        return stats;
+    }
+
+    // workerCount() - threads started so far
+    static int workerCount() { return shared().workerTotal.load(); }
+
+    // parallelFor() - body(0..count-1) spread over the pool, the calling thread takes part and returns when all are done
+    template <typename Body>
+    static void parallelFor(TaskGroup& group, size_t count, const Body& body) {
+        struct Shared {
+            std::atomic<size_t> next{ 0 };
+            std::mutex mutex;
+            std::condition_variable done;
+            size_t helpers = 0;
+        };
+        // a helper signals when its task is destroyed, so a helper dropped by cancel() still counts as done
+        struct Helper {
+            std::shared_ptr<Shared> state;
+            ~Helper() {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (--state->helpers == 0) state->done.notify_all();
+            }
+        };
+        std::shared_ptr<Shared> state = std::make_shared<Shared>();
+        auto work = [state, count, &body]() {
+            for (size_t i = state->next++; i < count; i = state->next++) {
+                body(i);
+            }
+        };
+        size_t helpers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+        state->helpers = helpers > 0 ? helpers - 1 : 0;
+        for (size_t h = 1; h < helpers; ++h) {
+            std::shared_ptr<Helper> helper(new Helper{ state });
+            group.submit([helper, work]() { work(); });
+        }
+        work();
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->done.wait(lock, [&state]() { return state->helpers == 0; });
+    }
+
+    // shutdown() - cancels every group, waits for running tasks and joins the workers
+    static void shutdown() {
+        ThreadPool& pool = shared();
+        std::vector<TaskGroup*> all;
+        {
+            std::lock_guard<std::mutex> lock(pool.groupsMutex);
+            for (const auto& existing : pool.groups) {
+                all.push_back(existing.get());
+            }
+        }
+        for (TaskGroup* existing : all) {
+            std::lock_guard<std::mutex> lock(existing->mutex);
+            existing->closed = true; // running tasks may not queue follow-up work
+        }
+        for (TaskGroup* existing : all) {
+            existing->cancel();
+        }
+        for (TaskGroup* existing : all) {
+            existing->wait();
+        }
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            pool.stopping = true;
+        }
+        pool.wake.notify_all();
+        int started = pool.workerTotal.load();
+        for (int i = 0; i < started; ++i) {
+            if (pool.workers[i]->thread.joinable()) {
+                pool.workers[i]->thread.join();
+            }
+        }
+    }
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> run;
+        TaskGroup* group = nullptr;
+        uint64_t epoch = 0;
+    };
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    std::mutex mutex;                 // injection queue, stopping and the wait below
+    std::condition_variable wake;
+    std::deque<Task> injected;
+    std::atomic<int> queuedTotal{ 0 }; // tasks in any queue, raised under mutex so sleepers never miss one
+    std::atomic<int> idleWorkers{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    std::unique_ptr<Worker> workers[MaxWorkers]; // fixed slots, so stealing never races a growing vector
+    std::atomic<int> workerTotal{ 0 };
+    std::mutex growMutex;
+
+    std::mutex groupsMutex;
+    std::vector<std::unique_ptr<TaskGroup>> groups;
+
+    Gauge& workerGauge = MetricsRegistry::gauge("model_app_pool_workers", "Threads started by the thread pool.");
+
+    ThreadPool() {}
+
+    ~ThreadPool() {
+        // shutdown() was skipped, joining from a static destructor can deadlock on Windows, so let them go
+        for (int i = 0; i < workerTotal.load(); ++i) {
+            if (workers[i]->thread.joinable()) {
+                workers[i]->thread.detach();
+            }
+        }
+    }
+
+    // currentWorker() - slot of the calling pool thread, -1 on other threads
+    static int& currentWorker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    void push(Task task) {
+        int self = currentWorker();
+        if (self >= 0) {
+            std::lock_guard<std::mutex> lock(workers[self]->mutex);
+            workers[self]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (self < 0) {
+                injected.push_back(std::move(task));
+            }
+            queuedTotal++;
+        }
+        wake.notify_one();
+        if (queuedTotal.load() > idleWorkers.load()) {
+            grow(); // more waiting than sleeping workers can pick up
+        }
+    }
+
+    // grow() - starts another worker while below MaxWorkers
+    void grow() {
+        std::lock_guard<std::mutex> lock(growMutex);
+        int index = workerTotal.load();
+        if (index >= MaxWorkers || stopping) {
+            return;
+        }
+        workers[index].reset(new Worker());
+        workers[index]->thread = std::thread(&ThreadPool::workerLoop, this, index);
+        workerTotal++; // published after the slot is filled
+        workerGauge.set(workerTotal.load());
+    }
+
+    // take() - own deque (newest), then the injection queue, then steal (oldest) from the others
+    bool take(int self, Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(workers[self]->mutex);
+            if (!workers[self]->tasks.empty()) {
+                task = std::move(workers[self]->tasks.back());
+                workers[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!injected.empty()) {
+                task = std::move(injected.front());
+                injected.pop_front();
+                return true;
+            }
+        }
+        int total = workerTotal.load();
+        for (int offset = 1; offset < total; ++offset) {
+            Worker& victim = *workers[(self + offset) % total];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int self) {
+        currentWorker() = self;
+        Trace::setThreadName("Pool worker " + std::to_string(self + 1));
+        for (;;) {
+            Task task;
+            if (take(self, task)) {
+                queuedTotal--;
+                execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            idleWorkers++;
+            wake.wait(lock, [this]() { return queuedTotal.load() > 0 || stopping; });
+            idleWorkers--;
+            if (stopping && queuedTotal.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    void execute(Task& task) {
+        TaskGroup& group = *task.group;
+        group.queued.add(-1);
+        bool current;
+        {
+            std::lock_guard<std::mutex> lock(group.mutex);
+            current = task.epoch == group.epoch;
+        }
+        if (current) {
+            TRACE_SCOPE_DETAIL("ThreadPool task", group.name);
+            group.running.add(1);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            task.run();
+            group.busyMicros.add((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+            group.running.add(-1);
+            group.completed.add();
+        }
+        else {
+            group.dropped.add();
+        }
+        task.run = nullptr; // release captures before signalling waiters
+        group.finished();
+    }
+};
+
+inline void TaskGroup::submit(std::function<void()> task) {
+    ThreadPool::Task queuedTask;
+    queuedTask.run = std::move(task);
+    queuedTask.group = this;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) {
+            dropped.add();
+            return;
+        }
+        queuedTask.epoch = epoch;
+        pending++;
+    }
+    queued.add(1);
+    pool->push(std::move(queuedTask));
+}
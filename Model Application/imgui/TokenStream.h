@@ -0,0 +1,275 @@
+﻿#pragma once
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#define TOKENSTREAM_COROUTINES 1
+#endif
+
+
+// TokenStream - one response, delivered chunk by chunk while the model produces it
+// The producer pushes chunks and finishes the stream. Consumers either pull (next() blocks, poll() does not)
+// or register callbacks, which run on the producer's thread, so a consumer needs no thread of its own.
+// Completion can be awaited with wait()/completion() or handled in then(); cancel() stops the request.
+// Built as C++20, a coroutine can co_await nextChunk() and finished() instead, see StreamTask below.
+class TokenStream {
+public:
+    enum Status { Streaming, Finished, Cancelled };
+
+    TokenStream() : resultFuture(resultPromise.get_future().share()) {}
+
+    // push() - producer side, appends a chunk, ignored once the stream ended
+    void push(const std::string& chunk) {
+        if (chunk.empty()) {
+            return;
+        }
+        std::vector<std::function<void(const std::string&)>> callbacks;
+        std::function<void()> waker;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state != Streaming) {
+                return;
+            }
+            text += chunk;
+            callbacks = chunkCallbacks;
+            waker.swap(pullWaker);
+        }
+        changed.notify_all();
+        for (const auto& callback : callbacks) {
+            callback(chunk);
+        }
+        if (waker) {
+            waker();
+        }
+    }
+
+    // finish() - producer side, ends the stream with the request's result, false if it already ended
+    bool finish(const std::string& finalResult, bool cancelled = false) {
+        std::vector<std::function<void(const std::string&)>> callbacks;
+        std::function<void()> waker;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state != Streaming) {
+                return false;
+            }
+            state = cancelled ? Cancelled : Finished;
+            result = finalResult;
+            callbacks.swap(doneCallbacks);
+            chunkCallbacks.clear();
+            cancelHook = nullptr;
+            waker.swap(pullWaker);
+        }
+        resultPromise.set_value(finalResult);
+        changed.notify_all();
+        if (waker) {
+            waker();
+        }
+        for (const auto& callback : callbacks) {
+            callback(finalResult);
+        }
+        return true;
+    }
+
+    // onCancel() - producer side, how cancel() reaches the request
+    void onCancel(std::function<void()> hook) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelHook = hook;
+    }
+
+    // onChunk() - calls callback with every new chunk, on the producer's thread
+    // text streamed before the call is passed first, so nothing is missed by registering late
+    void onChunk(std::function<void(const std::string&)> callback) {
+        std::string sofar;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sofar = text;
+            if (state == Streaming) {
+                chunkCallbacks.push_back(callback);
+            }
+        }
+        if (!sofar.empty()) {
+            callback(sofar);
+        }
+    }
+
+    // then() - calls callback with the result once the stream ends, right away if it already has
+    void then(std::function<void(const std::string&)> callback) {
+        std::string finalResult;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state == Streaming) {
+                doneCallbacks.push_back(callback);
+                return;
+            }
+            finalResult = result;
+        }
+        callback(finalResult);
+    }
+
+    // next() - blocks until there is text the puller has not taken yet, false once the stream ended and was read
+    bool next(std::string& chunk) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return readyLocked(); });
+        return takeLocked(chunk);
+    }
+
+    // poll() - text the puller has not taken yet without waiting, false if there is none
+    bool poll(std::string& chunk) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return takeLocked(chunk);
+    }
+
+    // wait() - blocks until the stream ends, returns the result
+    std::string wait() const { return resultFuture.get(); }
+
+    // completion() - the result as a future, for waiting with a timeout or alongside other streams
+    std::shared_future<std::string> completion() const { return resultFuture; }
+
+    // cancel() - stops the request, the stream ends with the text produced so far
+    void cancel() {
+        std::function<void()> hook;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state != Streaming) {
+                return;
+            }
+            hook = cancelHook;
+        }
+        if (hook) {
+            hook();
+        }
+        else {
+            finish(getText(), true);
+        }
+    }
+
+    Status status() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return state;
+    }
+
+    bool done() const { return status() != Streaming; }
+
+    // getText() - everything streamed so far
+    std::string getText() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return text;
+    }
+
+    // size() - length of the text streamed so far
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return text.length();
+    }
+
+#ifdef TOKENSTREAM_COROUTINES
+    // ChunkAwaiter - co_await nextChunk(): the text not taken yet, like next(), std::nullopt once the stream ended and was read
+    // a coroutine that had to wait is resumed on the producer's thread, so like a callback it must not block
+    class ChunkAwaiter {
+    public:
+        explicit ChunkAwaiter(TokenStream& stream) : stream(stream) {}
+        bool await_ready() const {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            return stream.readyLocked();
+        }
+        bool await_suspend(std::coroutine_handle<> waiting) {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            if (stream.readyLocked()) {
+                return false; // a chunk arrived after await_ready()
+            }
+            stream.pullWaker = [waiting]() { waiting.resume(); };
+            return true;
+        }
+        std::optional<std::string> await_resume() {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            std::string chunk;
+            if (!stream.takeLocked(chunk)) {
+                return std::nullopt;
+            }
+            return chunk;
+        }
+
+    private:
+        TokenStream& stream;
+    };
+
+    // ResultAwaiter - co_await finished(): the result once the stream ends, resumed like a then() callback
+    class ResultAwaiter {
+    public:
+        explicit ResultAwaiter(TokenStream& stream) : stream(stream) {}
+        bool await_ready() const { return stream.done(); }
+        bool await_suspend(std::coroutine_handle<> waiting) {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            if (stream.state != Streaming) {
+                return false;
+            }
+            stream.doneCallbacks.push_back([waiting](const std::string&) { waiting.resume(); });
+            return true;
+        }
+        std::string await_resume() {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            return stream.result;
+        }
+
+    private:
+        TokenStream& stream;
+    };
+
+    // nextChunk()/finished() - the coroutine forms of next() and wait(); the awaiting coroutine keeps the stream alive
+    ChunkAwaiter nextChunk() { return ChunkAwaiter(*this); }
+    ResultAwaiter finished() { return ResultAwaiter(*this); }
+#endif
+
+private:
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::string text;
+    size_t taken = 0;            // how much of text next()/poll() handed out
+    Status state = Streaming;
+    std::string result;
+    std::promise<std::string> resultPromise;
+    std::shared_future<std::string> resultFuture;
+    std::vector<std::function<void(const std::string&)>> chunkCallbacks;
+    std::vector<std::function<void(const std::string&)>> doneCallbacks;
+    std::function<void()> cancelHook;
+    std::function<void()> pullWaker; // resumes a coroutine waiting in nextChunk(), one puller like next()
+
+    // readyLocked() - next() would not block, mutex held
+    bool readyLocked() const { return taken < text.length() || state != Streaming; }
+
+    // takeLocked() - hands out the untaken text, mutex held
+    bool takeLocked(std::string& chunk) {
+        if (taken >= text.length()) {
+            chunk.clear();
+            return false;
+        }
+        chunk = text.substr(taken);
+        taken = text.length();
+        return true;
+    }
+};
+
+#ifdef TOKENSTREAM_COROUTINES
+// StreamTask - return type of a coroutine that consumes streams; it starts right away and frees itself when done
+//     StreamTask print(std::shared_ptr<TokenStream> stream) {
+//         while (std::optional<std::string> chunk = co_await stream->nextChunk()) { ... }
+//         std::string result = co_await stream->finished();
+//     }
+// the coroutine runs on the caller's thread until its first wait and on producer threads after that
+struct StreamTask {
+    struct promise_type {
+        StreamTask get_return_object() { return StreamTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
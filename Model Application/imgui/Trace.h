@@ -0,0 +1,285 @@
+﻿#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// TRACE_SCOPE(name) - times the rest of the enclosing block as one trace event
+// when tracing is off this is a single relaxed atomic load
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_DETAIL(name, detail) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, detail)
+
+// Trace - Chrome trace (chrome://tracing, ui.perfetto.dev) recorder
+// Every thread appends to its own ring of events, so recording threads never contend with each other.
+class Trace {
+public:
+    typedef std::chrono::steady_clock Clock;
+    static const size_t EventsPerThread = 1 << 16; // oldest events are overwritten once a thread's ring is full
+
+    // TraceEvent - one complete ("X") or instant ("i") event
+    struct TraceEvent {
+        const char* name = "";  // string literal, never freed
+        std::string detail;     // optional argument, shown as args.detail
+        uint64_t start = 0;     // microseconds since the trace epoch
+        uint64_t duration = 0;  // microseconds, instant events have none
+        bool instant = false;
+    };
+
+    // enabled() - is recording on? checked by every scope, so it stays a relaxed load
+    static bool enabled() {
+        return instance().recording.load(std::memory_order_relaxed);
+    }
+
+    // setEnabled() - starts/stops recording, events recorded so far are kept
+    static void setEnabled(bool enable) {
+        instance().recording.store(enable, std::memory_order_relaxed);
+    }
+
+    // now() - microseconds since the trace epoch
+    static uint64_t now() {
+        return toMicros(Clock::now());
+    }
+
+    // toMicros() - a steady_clock time as microseconds since the trace epoch
+    static uint64_t toMicros(Clock::time_point when) {
+        static const Clock::time_point epoch = Clock::now();
+        return when <= epoch ? 0 : (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(when - epoch).count();
+    }
+
+    // complete() - records an event with a known start and duration, e.g. phases reported by the server
+    static void complete(const char* name, uint64_t start, uint64_t duration, const std::string& detail = "") {
+        if (!enabled()) {
+            return;
+        }
+        TraceEvent event;
+        event.name = name;
+        event.detail = detail;
+        event.start = start;
+        event.duration = duration;
+        threadBuffer().push(event);
+    }
+
+    // completeOn() - like complete(), but on a named track of its own instead of the calling thread
+    // used for work that happens elsewhere (the ollama server) and would not nest inside this thread's events
+    static void completeOn(const std::string& track, const char* name, uint64_t start, uint64_t duration, const std::string& detail = "") {
+        if (!enabled()) {
+            return;
+        }
+        TraceEvent event;
+        event.name = name;
+        event.detail = detail;
+        event.start = start;
+        event.duration = duration;
+        trackBuffer(track).push(event);
+    }
+
+    // instant() - records a point in time, e.g. the first token
+    static void instant(const char* name, const std::string& detail = "") {
+        if (!enabled()) {
+            return;
+        }
+        TraceEvent event;
+        event.name = name;
+        event.detail = detail;
+        event.start = now();
+        event.instant = true;
+        threadBuffer().push(event);
+    }
+
+    // setThreadName() - label of the calling thread in the trace viewer, cheap enough to call per request
+    static void setThreadName(const std::string& name) {
+        threadName() = name;
+        std::shared_ptr<ThreadBuffer>& buffer = threadSlot();
+        if (buffer) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            buffer->name = name;
+        }
+    }
+
+    // clear() - drops all recorded events
+    static void clear() {
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers()) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            buffer->events.clear();
+            buffer->next = 0;
+        }
+    }
+
+    // eventCount() - events currently held across all threads
+    static size_t eventCount() {
+        size_t count = 0;
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers()) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            count += buffer->events.size();
+        }
+        return count;
+    }
+
+    // dump() - writes everything recorded so far as Chrome trace JSON
+    static bool dump(const std::string& path) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const std::shared_ptr<ThreadBuffer>& buffer : buffers()) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+                 << ",\"name\":\"thread_name\",\"args\":{\"name\":\"" << escape(buffer->name) << "\"}}";
+            first = false;
+            // oldest first, the ring starts at next once it has wrapped
+            size_t count = buffer->events.size();
+            size_t begin = count < EventsPerThread ? 0 : buffer->next;
+            for (size_t i = 0; i < count; ++i) {
+                const TraceEvent& event = buffer->events[(begin + i) % count];
+                file << ",\n{\"ph\":\"" << (event.instant ? "i" : "X") << "\",\"pid\":1,\"tid\":" << buffer->id
+                     << ",\"ts\":" << event.start << ",\"name\":\"" << escape(event.name) << "\"";
+                if (event.instant) {
+                    file << ",\"s\":\"t\"";
+                }
+                else {
+                    file << ",\"dur\":" << event.duration;
+                }
+                if (!event.detail.empty()) {
+                    file << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+                }
+                file << "}";
+            }
+        }
+        file << "\n]}\n";
+        return file.good();
+    }
+
+private:
+    // ThreadBuffer - events of one thread, the mutex is only contended while dumping
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+        size_t next = 0; // slot overwritten next once the ring is full
+        int id = 0;
+        std::string name;
+
+        void push(const TraceEvent& event) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (events.size() < EventsPerThread) {
+                events.push_back(event);
+                return;
+            }
+            events[next] = event;
+            next = (next + 1) % EventsPerThread;
+        }
+    };
+
+    std::atomic<bool> recording{ false };
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> threads; // kept after a thread exits so its events still dump
+    std::vector<std::shared_ptr<ThreadBuffer>> tracks;  // named tracks, also listed in threads
+
+    static Trace& instance() {
+        static Trace trace;
+        return trace;
+    }
+
+    // threadSlot() - ring of the calling thread, null until it records its first event
+    static std::shared_ptr<ThreadBuffer>& threadSlot() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        return buffer;
+    }
+
+    // threadName() - label given by setThreadName(), applied when the ring is registered
+    static std::string& threadName() {
+        thread_local std::string name;
+        return name;
+    }
+
+    // threadBuffer() - ring of the calling thread, registered on first use
+    static ThreadBuffer& threadBuffer() {
+        std::shared_ptr<ThreadBuffer>& buffer = threadSlot();
+        if (!buffer) {
+            buffer = std::make_shared<ThreadBuffer>();
+            Trace& trace = instance();
+            std::lock_guard<std::mutex> lock(trace.mutex);
+            buffer->id = (int)trace.threads.size() + 1;
+            buffer->name = threadName().empty() ? "Thread " + std::to_string(buffer->id) : threadName();
+            trace.threads.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    // trackBuffer() - ring of a named track, registered on first use
+    static ThreadBuffer& trackBuffer(const std::string& track) {
+        Trace& trace = instance();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        for (const std::shared_ptr<ThreadBuffer>& buffer : trace.tracks) {
+            if (buffer->name == track) {
+                return *buffer;
+            }
+        }
+        std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+        buffer->id = (int)trace.threads.size() + 1;
+        buffer->name = track;
+        trace.threads.push_back(buffer);
+        trace.tracks.push_back(buffer);
+        return *buffer;
+    }
+
+    // buffers() - snapshot of the registered rings
+    static std::vector<std::shared_ptr<ThreadBuffer>> buffers() {
+        Trace& trace = instance();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        return trace.threads;
+    }
+
+    // escape() - JSON string escaping
+    static std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ((unsigned char)c < 0x20) {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+                escaped += code;
+            }
+            else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+};
+
+// TraceScope - RAII helper behind TRACE_SCOPE, records [construction, destruction) as one event
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), active(Trace::enabled()), start(active ? Trace::now() : 0) {}
+    TraceScope(const char* name, const std::string& detail) : TraceScope(name) {
+        if (active) {
+            this->detail = detail;
+        }
+    }
+    ~TraceScope() {
+        if (active) {
+            Trace::complete(name, start, Trace::now() - start, detail);
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    bool active; // sampled once, so a scope never ends without having started
+    uint64_t start;
+    std::string detail;
+};
@@ -7,6 +7,7 @@
 #include <windowsx.h>
 
 #include "App.h"
+#include "Trace.h"
 
 #ifdef _DEBUG
 #define DX12_ENABLE_DEBUG_LAYER
@@ -192,19 +193,27 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
     init_info.SrvDescriptorFreeFn = [](ImGui_ImplDX12_InitInfo*, D3D12_CPU_DESCRIPTOR_HANDLE cpu_handle, D3D12_GPU_DESCRIPTOR_HANDLE gpu_handle)            { return g_pd3dSrvDescHeapAlloc.Free(cpu_handle, gpu_handle); };
     ImGui_ImplDX12_Init(&init_info);
 
+    // App
+    App::Init();
 
     // Main loop
+    Trace::setThreadName("Main");
     bool done = false;
     while (!done) {
+        TRACE_SCOPE("Frame");
+
         // Poll and handle messages (inputs, window resize, etc.)
         // See the WndProc() function below for our to dispatch events to the Win32 backend.
         MSG msg;
-        while (::PeekMessage(&msg, nullptr, 0U, 0U, PM_REMOVE))
         {
-            ::TranslateMessage(&msg);
-            ::DispatchMessage(&msg);
-            if (msg.message == WM_QUIT)
-                done = true;
+            TRACE_SCOPE("Poll Messages");
+            while (::PeekMessage(&msg, nullptr, 0U, 0U, PM_REMOVE))
+            {
+                ::TranslateMessage(&msg);
+                ::DispatchMessage(&msg);
+                if (msg.message == WM_QUIT)
+                    done = true;
+            }
         }
         if (done)
             break;
@@ -218,17 +227,27 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         g_SwapChainOccluded = false;
 
         // Start the Dear ImGui frame
-        ImGui_ImplDX12_NewFrame();
-        ImGui_ImplWin32_NewFrame();
-        ImGui::NewFrame();
+        {
+            TRACE_SCOPE("NewFrame");
+            ImGui_ImplDX12_NewFrame();
+            ImGui_ImplWin32_NewFrame();
+            ImGui::NewFrame();
+        }
 
         // App
         App::RenderUI();
 
         // Rendering
-        ImGui::Render();
+        {
+            TRACE_SCOPE("ImGui::Render");
+            ImGui::Render();
+        }
 
-        FrameContext* frameCtx = WaitForNextFrameResources();
+        FrameContext* frameCtx = nullptr;
+        {
+            TRACE_SCOPE("WaitForNextFrameResources");
+            frameCtx = WaitForNextFrameResources();
+        }
         UINT backBufferIdx = g_pSwapChain->GetCurrentBackBufferIndex();
         frameCtx->CommandAllocator->Reset();
 
@@ -257,8 +276,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
         g_pd3dCommandQueue->ExecuteCommandLists(1, (ID3D12CommandList* const*)&g_pd3dCommandList);
 
         // Present
-        HRESULT hr = g_pSwapChain->Present(1, 0);   // Present with vsync
-        //HRESULT hr = g_pSwapChain->Present(0, 0); // Present without vsync
+        HRESULT hr;
+        {
+            TRACE_SCOPE("Present");
+            hr = g_pSwapChain->Present(1, 0);   // Present with vsync
+            //hr = g_pSwapChain->Present(0, 0); // Present without vsync
+        }
         g_SwapChainOccluded = (hr == DXGI_STATUS_OCCLUDED);
 
         UINT64 fenceValue = g_fenceLastSignaledValue + 1;
@@ -269,6 +292,9 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 
     WaitForLastSubmittedFrame();
 
+    // Stop background work while the app state it uses still exists
+    App::Shutdown();
+
     // Cleanup
     ImGui_ImplDX12_Shutdown();
     ImGui_ImplWin32_Shutdown();
@@ -515,8 +541,8 @@ LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
         ScreenToClient(hWnd, &pt);
 
-        // If within header
-        if (pt.y < 40 && pt.x < 735) {
+        // If within header, left of the header buttons
+        if (pt.y < 40 && pt.x < 670) {
             return HTCAPTION;  // HTCAPTION means the window can be dragged
         }
         return DefWindowProcW(hWnd, msg, wParam, lParam);
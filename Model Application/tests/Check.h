@@ -0,0 +1,29 @@
+﻿#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+
+// CHECK() - reports a failed condition with its location and counts it, the test keeps going
+// A test's main() ends with "return CheckResult();" so ctest sees the failures.
+inline int& CheckFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            CheckFailures()++; \
+        } \
+    } while (0)
+
+// CheckResult() - process exit code, prints a summary
+inline int CheckResult() {
+    if (CheckFailures() == 0) {
+        std::printf("passed\n");
+        return EXIT_SUCCESS;
+    }
+    std::printf("%d check(s) failed\n", CheckFailures());
+    return EXIT_FAILURE;
+}
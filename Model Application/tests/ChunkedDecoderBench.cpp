@@ -0,0 +1,60 @@
+﻿// ChunkedDecoderBench - cost of the chunked framing, one NDJSON line per chunk as ollama streams and in large chunks
+// Payload is handed out in place and not touched, so the time is the size lines and CRLFs around it.
+#include "ChunkedDecoder.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+// encode() - total payload bytes in chunks of chunkSize
+static std::string encode(size_t total, size_t chunkSize, size_t& chunks) {
+    std::string bytes;
+    std::string payload(chunkSize, 'x');
+    payload.back() = '\n';
+    char line[32];
+    chunks = 0;
+    for (size_t at = 0; at < total; at += chunkSize, chunks++) {
+        size_t size = std::min(chunkSize, total - at);
+        std::snprintf(line, sizeof(line), "%zx\r\n", size);
+        bytes += line;
+        bytes.append(payload, 0, size);
+        bytes += "\r\n";
+    }
+    bytes += "0\r\n\r\n";
+    return bytes;
+}
+
+int main(int argc, char** argv) {
+    size_t total = argc > 1 ? (size_t)std::strtoull(argv[1], nullptr, 10) : 256u << 20;
+    const size_t chunkSizes[] = { 90, 1024, 16384 }; // a token line, a small and a large write
+    const size_t readSizes[] = { 4096, 65536 };
+    std::printf("%.0f MB of payload, best of 5\n", total / 1e6);
+    for (size_t chunkSize : chunkSizes) {
+        size_t chunks = 0;
+        std::string bytes = encode(total, chunkSize, chunks);
+        for (size_t readSize : readSizes) {
+            double best = 1e9;
+            size_t payload = 0;
+            for (int pass = 0; pass < 5; ++pass) {
+                ChunkedDecoder decoder;
+                payload = 0;
+                ChunkedDecoder::PayloadHandler onPayload = [&payload](char*, size_t length) { payload += length; };
+                auto start = std::chrono::steady_clock::now();
+                for (size_t at = 0; at < bytes.size(); at += readSize) {
+                    decoder.decode(&bytes[at], std::min(readSize, bytes.size() - at), onPayload);
+                }
+                best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                if (!decoder.done() || payload != total) {
+                    std::printf("decode failed\n");
+                    return 1;
+                }
+            }
+            std::printf("%5zu byte chunks, %5zu byte reads: %7.1f GB/s  %6.1f M chunks/s  %5.1f ns/chunk\n", chunkSize, readSize,
+                bytes.size() / best / 1e9, chunks / best / 1e6, best * 1e9 / chunks);
+        }
+    }
+    return 0;
+}
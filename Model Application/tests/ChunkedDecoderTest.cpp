@@ -0,0 +1,151 @@
+﻿// ChunkedDecoderTest - chunked bodies cut at every boundary must decode to the same payload
+#include "Check.h"
+#include "ChunkedDecoder.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Body - a generated chunked encoding and the payload it carries
+struct Body {
+    std::string bytes;
+    std::string payload;
+};
+
+// Result - what the decoder made of a body
+struct Result {
+    std::string payload;
+    bool done = false;
+    bool failed = false;
+};
+
+// encode() - payload in chunks of random size, with the variations a server may send:
+// upper/lower case hex and leading zeros, extensions, bare LF line ends and trailers
+static Body encode(std::mt19937& random, size_t length) {
+    static const char* lowerHex = "0123456789abcdef";
+    static const char* upperHex = "0123456789ABCDEF";
+    Body body;
+    for (size_t i = 0; i < length; ++i) body.payload += (char)(random() % 256); // CR, LF and NUL included
+    auto lineEnd = [&random]() { return random() % 5 == 0 ? "\n" : "\r\n"; };
+    for (size_t at = 0; ; ) {
+        size_t size = std::min(length - at, random() % 3 == 0 ? (size_t)(1 + random() % 4) : (size_t)(1 + random() % 300));
+        std::string hex;
+        const char* digits = random() % 2 ? lowerHex : upperHex;
+        for (size_t value = size; value > 0; value /= 16) hex.insert(hex.begin(), digits[value % 16]);
+        if (hex.empty()) hex = "0";
+        if (random() % 4 == 0) hex.insert(0, "00");
+        body.bytes += hex;
+        if (random() % 4 == 0) body.bytes += random() % 2 ? ";name=value" : " ;ext";
+        body.bytes += lineEnd();
+        if (size == 0) break;
+        body.bytes.append(body.payload, at, size);
+        body.bytes += lineEnd();
+        at += size;
+    }
+    int trailers = (int)(random() % 3);
+    for (int i = 0; i < trailers; ++i) body.bytes += std::string("X-Trailer: ") + std::to_string(i) + lineEnd();
+    body.bytes += lineEnd();
+    return body;
+}
+
+// decode() - feeds bytes cut at the given offsets, each read in a buffer of its own
+static Result decode(const std::string& bytes, const std::vector<size_t>& cuts) {
+    ChunkedDecoder decoder;
+    Result result;
+    ChunkedDecoder::PayloadHandler onPayload = [&result](char* data, size_t length) {
+        CHECK(length > 0);
+        result.payload.append(data, length);
+    };
+    size_t from = 0;
+    for (size_t i = 0; i <= cuts.size(); ++i) {
+        size_t to = i < cuts.size() ? cuts[i] : bytes.size();
+        std::vector<char> read(bytes.begin() + from, bytes.begin() + to);
+        bool ok = decoder.decode(read.data(), read.size(), onPayload);
+        CHECK(ok == !decoder.failed());
+        from = to;
+    }
+    result.done = decoder.done();
+    result.failed = decoder.failed();
+    return result;
+}
+
+static bool decodes(const Body& body, const std::vector<size_t>& cuts) {
+    Result result = decode(body.bytes, cuts);
+    return result.done && !result.failed && result.payload == body.payload;
+}
+
+int main() {
+    // random cuts, including empty reads, and bytes of the next response after the end
+    for (unsigned seed = 1; seed <= 300; ++seed) {
+        std::mt19937 random(seed);
+        Body body = encode(random, random() % 4000);
+        std::vector<size_t> cuts;
+        size_t pieces = random() % 24;
+        for (size_t i = 0; i < pieces; ++i) cuts.push_back(random() % (body.bytes.size() + 1));
+        std::sort(cuts.begin(), cuts.end());
+        CHECK(decodes(body, cuts));
+        Body followed = body;
+        followed.bytes += "HTTP/1.1 200 OK\r\n";
+        CHECK(decodes(followed, cuts));
+    }
+
+    // every two-piece split, every three-piece split of a small body, and one byte per read
+    for (unsigned seed = 1000; seed < 1020; ++seed) {
+        std::mt19937 random(seed);
+        Body body = encode(random, 1 + random() % 600);
+        std::vector<size_t> bytewise;
+        for (size_t at = 0; at <= body.bytes.size(); ++at) {
+            CHECK(decodes(body, std::vector<size_t>(1, at)));
+            if (at > 0 && at < body.bytes.size()) bytewise.push_back(at);
+        }
+        CHECK(decodes(body, bytewise));
+    }
+    {
+        std::mt19937 random(7);
+        Body body = encode(random, 40);
+        for (size_t first = 0; first <= body.bytes.size(); ++first) {
+            for (size_t second = first; second <= body.bytes.size(); ++second) {
+                std::vector<size_t> cuts;
+                cuts.push_back(first);
+                cuts.push_back(second);
+                CHECK(decodes(body, cuts));
+            }
+        }
+    }
+
+    // a body cut short anywhere is neither done nor failed, and hands out only a prefix of the payload
+    for (unsigned seed = 2000; seed < 2020; ++seed) {
+        std::mt19937 random(seed);
+        Body body = encode(random, random() % 500);
+        for (size_t at = 0; at < body.bytes.size(); ++at) {
+            Result result = decode(body.bytes.substr(0, at), std::vector<size_t>());
+            CHECK(!result.done && !result.failed);
+            CHECK(body.payload.compare(0, result.payload.size(), result.payload) == 0);
+        }
+    }
+
+    // broken encodings fail wherever they are cut, after the payload before the fault was handed out
+    struct Broken {
+        const char* bytes;
+        const char* payload;
+    };
+    const Broken broken[] = {
+        { "\r\n", "" },                          // size line without digits
+        { "g\r\n", "" },                         // not hex
+        { "3\r\nabcX\r\n", "abc" },              // payload not followed by CRLF
+        { "3\r\nabc\rX", "abc" },                // CR without LF
+        { "3\rX", "" },                          // size line CR without LF
+        { "2\r\nab\r\n0\r\n\rX", "ab" },         // final CR without LF
+        { "12345678901234567\r\n", "" },         // size over 2^64
+    };
+    for (const Broken& entry : broken) {
+        std::string bytes = entry.bytes;
+        for (size_t at = 0; at <= bytes.size(); ++at) {
+            Result result = decode(bytes, std::vector<size_t>(1, at));
+            CHECK(result.failed && !result.done);
+            CHECK(result.payload == entry.payload);
+        }
+    }
+    return CheckResult();
+}
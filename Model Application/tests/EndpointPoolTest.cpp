@@ -0,0 +1,192 @@
+﻿// EndpointPoolTest - routes requests over three stub daemons: least loaded, model resident, ejection with backoff
+// The stubs only answer the /api/ps health check; requests are acquired and released directly, so the test
+// controls exactly how many are in flight on each host.
+#include "Check.h"
+#include "EndpointPool.h"
+#include "StubDaemon.h"
+#include <cstdlib>
+
+
+// PsStub - one daemon's /api/ps answer, changed by the test while the checker polls it
+struct PsStub {
+    std::mutex mutex;                 // guards the fields below, connections are served on their own threads
+    std::vector<std::string> loaded;  // models listed as running
+    bool failing = false;             // answer 500 instead
+    int checks = 0;
+};
+
+// servePs() - answers /api/ps like the daemon, or with a server error while the stub is failing
+static void servePs(PsStub& stub, SocketHandle connection) {
+    std::string body = "{\"models\":[";
+    bool failing;
+    {
+        std::lock_guard<std::mutex> lock(stub.mutex);
+        stub.checks++;
+        failing = stub.failing;
+        for (size_t i = 0; i < stub.loaded.size(); ++i) {
+            body += (i == 0 ? "" : ",") + std::string("{\"name\":\"") + stub.loaded[i] + "\",\"model\":\"" + stub.loaded[i] + "\"}";
+        }
+    }
+    body += "]}";
+    if (failing) {
+        ThreadedStub::sendText(connection, "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        return;
+    }
+    ThreadedStub::sendText(connection, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                           std::to_string(body.length()) + "\r\nConnection: close\r\n\r\n" + body);
+}
+
+// rowOf() - the endpoints table row of the host at index
+static EndpointPool::Row rowOf(size_t index) {
+    std::vector<EndpointPool::Row> rows = EndpointPool::snapshot();
+    return index < rows.size() ? rows[index] : EndpointPool::Row();
+}
+
+// waitUntil() - polls condition, false after seconds
+template <typename Condition>
+static bool waitUntil(Condition condition, double seconds) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while (std::chrono::steady_clock::now() < until) {
+        if (condition()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// acquireMany() - count requests to model without releasing them, the hosts they went to
+static std::vector<size_t> acquireMany(const std::string& model, int count) {
+    std::vector<size_t> picked;
+    for (int i = 0; i < count; ++i) {
+        OllamaApi::Endpoint endpoint;
+        picked.push_back(EndpointPool::acquire(model, endpoint));
+    }
+    return picked;
+}
+
+// releaseAll() - ends the requests without a 200, which would mark the model resident on their hosts
+static void releaseAll(const std::string& model, const std::vector<size_t>& picked) {
+    for (size_t index : picked) {
+        EndpointPool::release(index, model, false, 404);
+    }
+}
+
+int main() {
+    enum { hostCount = 3 };
+    std::unique_ptr<PsStub> stubs[hostCount];
+    std::unique_ptr<ThreadedStub> servers[hostCount];
+    std::string list;
+    for (int i = 0; i < hostCount; ++i) {
+        PsStub* stub = new PsStub();
+        stubs[i].reset(stub);
+        servers[i].reset(new ThreadedStub([stub](SocketHandle connection, const std::string& head, const std::string&) {
+            if (head.compare(0, 12, "GET /api/ps ") == 0) {
+                servePs(*stub, connection);
+            }
+            else {
+                ThreadedStub::sendText(connection, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+            }
+        }));
+        int port = servers[i]->start();
+        CHECK(port != 0);
+        list += (i == 0 ? "" : ",") + std::string("127.0.0.1:") + std::to_string(port);
+    }
+    setenv("MODEL_APP_ENDPOINTS", list.c_str(), 1);
+    CHECK(EndpointPool::size() == hostCount);
+    CHECK(EndpointPool::list() == list);
+
+    // the first check round answers on every host
+    EndpointPool::snapshot(); // starts the checker
+    CHECK(waitUntil([]() {
+        for (const EndpointPool::Row& row : EndpointPool::snapshot()) {
+            if (row.checkMilliseconds < 0.0) return false;
+        }
+        return true;
+    }, 5));
+
+    // no host has the model: requests spread one per host, the next goes to the host that finished first
+    {
+        std::vector<size_t> picked = acquireMany("cold", hostCount);
+        CHECK(std::set<size_t>(picked.begin(), picked.end()).size() == hostCount);
+        for (int i = 0; i < hostCount; ++i) {
+            CHECK(rowOf(i).inFlight == 1);
+        }
+        size_t finished = picked[1];
+        EndpointPool::release(finished, "cold", false, 404);
+        picked.erase(picked.begin() + 1);
+        std::vector<size_t> next = acquireMany("cold", 1);
+        CHECK(next[0] == finished);
+        picked.push_back(next[0]);
+        releaseAll("cold", picked);
+    }
+
+    // host 1 has the model loaded: it takes requests until it has coldPenalty (2) more in flight than a cold host
+    {
+        {
+            std::lock_guard<std::mutex> lock(stubs[1]->mutex);
+            stubs[1]->loaded.push_back("warm:latest");
+        }
+        EndpointPool::setList(list); // unchanged hosts, wakes the checker for a round
+        CHECK(waitUntil([]() {
+            std::vector<std::string> resident = rowOf(1).resident;
+            return std::find(resident.begin(), resident.end(), "warm:latest") != resident.end();
+        }, 5));
+        std::vector<size_t> picked = acquireMany("warm", 3);
+        CHECK(picked[0] == 1);
+        CHECK(picked[1] == 1);
+        CHECK(picked[2] != 1); // 2 in flight against 0 + 2 for a cold host, the tie goes to the host that served fewer
+        releaseAll("warm", picked);
+    }
+
+    // host 2 fails its checks: ejected for 1 s, then 2 s, then 4 s, and skipped while ejected
+    {
+        {
+            std::lock_guard<std::mutex> lock(stubs[2]->mutex);
+            stubs[2]->failing = true;
+        }
+        for (int failures = 1; failures <= 3; ++failures) {
+            EndpointPool::setList(list); // a check round now rather than in 5 s
+            EndpointPool::Row row;
+            CHECK(waitUntil([&row, failures]() {
+                row = rowOf(2);
+                return row.failures >= failures;
+            }, 10));
+            double backoff = double(1 << (failures - 1));
+            CHECK(row.failures == failures);
+            CHECK(row.ejected);
+            CHECK(row.ejectedSeconds <= backoff && row.ejectedSeconds > backoff - 0.5);
+            std::vector<size_t> picked = acquireMany("cold", 4);
+            CHECK(std::count(picked.begin(), picked.end(), size_t(2)) == 0);
+            releaseAll("cold", picked);
+            CHECK(waitUntil([]() { return !rowOf(2).ejected; }, backoff + 1));
+        }
+
+        // back up: it passes the next check and takes requests again
+        {
+            std::lock_guard<std::mutex> lock(stubs[2]->mutex);
+            stubs[2]->failing = false;
+        }
+        int checks;
+        {
+            std::lock_guard<std::mutex> lock(stubs[2]->mutex);
+            checks = stubs[2]->checks;
+        }
+        EndpointPool::setList(list);
+        CHECK(waitUntil([&stubs, checks]() {
+            std::lock_guard<std::mutex> lock(stubs[2]->mutex);
+            return stubs[2]->checks > checks;
+        }, 5));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        CHECK(!rowOf(2).ejected);
+        std::vector<size_t> picked = acquireMany("cold", hostCount);
+        CHECK(std::count(picked.begin(), picked.end(), size_t(2)) == 1);
+        releaseAll("cold", picked);
+    }
+
+    EndpointPool::shutdown();
+    for (int i = 0; i < hostCount; ++i) {
+        servers[i]->stop();
+    }
+    return CheckResult();
+}
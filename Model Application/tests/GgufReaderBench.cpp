@@ -0,0 +1,148 @@
+﻿// GgufReaderBench - time to read model metadata from every GGUF file of a directory
+//   GgufReaderBench                 writes synthetic files shaped like real models to gguf-bench/ and reads those
+//   GgufReaderBench <directory>     reads the GGUF files already there, e.g. ~/.ollama/models/blobs
+// Cold runs drop the file's pages from the cache first (posix_fadvise), warm runs are the best of five.
+#include "GgufWriter.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+
+// Shape - the parts of a real model's header that make it large: vocabulary, merges and tensor count
+struct Shape {
+    const char* name;
+    const char* architecture;
+    size_t vocabulary;
+    size_t merges;
+    bool scores;         // sentencepiece vocabularies carry a float score per token
+    size_t blocks;
+    size_t tensorsPerBlock;
+    uint64_t dataBytes;  // size of the weights on disk
+};
+
+static const Shape shapes[] = {
+    { "llama3-8b-q4_k_m", "llama", 128256, 280147, false, 32, 9, 4920733696ull },
+    { "mistral-7b-q4_k_m", "llama", 32000, 58980, true, 32, 9, 4368439296ull },
+    { "gemma2-9b-q4_k_m", "gemma2", 256000, 0, true, 42, 11, 5761057728ull },
+    { "qwen2-0.5b-q4_k_m", "qwen2", 151936, 151387, false, 24, 12, 397807936ull },
+    { "phi3-mini-q4_k_m", "phi3", 32064, 0, true, 32, 6, 2393231072ull },
+};
+
+// writeModel() - a file with the shape's header and its weights as a hole
+static bool writeModel(const Shape& shape, const std::string& path) {
+    GgufWriter writer;
+    std::string arch = shape.architecture;
+    writer.addString("general.architecture", arch);
+    writer.addString("general.name", shape.name);
+    writer.addUint32("general.file_type", 15);
+    writer.addUint32(arch + ".context_length", 8192);
+    writer.addUint32(arch + ".block_count", (uint32_t)shape.blocks);
+    writer.addUint32(arch + ".embedding_length", 4096);
+    writer.addUint32(arch + ".attention.head_count", 32);
+    writer.addFloat32(arch + ".rope.freq_base", 500000.0f);
+    writer.addString("tokenizer.ggml.model", shape.merges ? "gpt2" : "llama");
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < shape.vocabulary; ++i) tokens.push_back("\xC4\xA0tok" + std::to_string(i));
+    writer.addStringArray("tokenizer.ggml.tokens", tokens);
+    writer.addArray("tokenizer.ggml.token_type", GgufValue::Int32, shape.vocabulary, 4);
+    if (shape.scores) writer.addArray("tokenizer.ggml.scores", GgufValue::Float32, shape.vocabulary, 4);
+    if (shape.merges) {
+        std::vector<std::string> merges;
+        for (size_t i = 0; i < shape.merges; ++i) merges.push_back("\xC4\xA0t " + std::to_string(i));
+        writer.addStringArray("tokenizer.ggml.merges", merges);
+    }
+    writer.addString("tokenizer.chat_template", std::string(1500, 't'));
+    size_t tensors = shape.blocks * shape.tensorsPerBlock + 3;
+    uint64_t perTensor = shape.dataBytes / tensors;
+    writer.addTensor("token_embd.weight", { 4096, shape.vocabulary }, 12, perTensor);
+    for (size_t block = 0; block < shape.blocks; ++block) {
+        for (size_t i = 0; i < shape.tensorsPerBlock; ++i) {
+            writer.addTensor("blk." + std::to_string(block) + ".t" + std::to_string(i) + ".weight", { 4096, 4096 }, 12, perTensor);
+        }
+    }
+    writer.addTensor("output_norm.weight", { 4096 }, 0, perTensor);
+    writer.addTensor("output.weight", { 4096, shape.vocabulary }, 14, perTensor);
+    return writer.writeFile(path);
+}
+
+// isGguf() - starts with the magic, so a blob store's manifests and other files are skipped
+static bool isGguf(const std::string& path) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    char magic[4] = {};
+    bool gguf = std::fread(magic, 1, 4, file) == 4 && std::memcmp(magic, "GGUF", 4) == 0;
+    std::fclose(file);
+    return gguf;
+}
+
+// dropCache() - evicts the file's pages so the next parse reads from disk, written back first or they stay
+static void dropCache(const std::string& path) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor >= 0) {
+        fdatasync(descriptor);
+        posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        close(descriptor);
+    }
+}
+
+static double parseSeconds(const std::string& path, GgufInfo& info) {
+    std::string error;
+    info = GgufInfo();
+    auto start = std::chrono::steady_clock::now();
+    bool parsed = GgufReader::parseFile(path, info, error);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!parsed) std::printf("%s: %s\n", path.c_str(), error.c_str());
+    return seconds;
+}
+
+int main(int argc, char** argv) {
+    std::string directory = argc > 1 ? argv[1] : "gguf-bench";
+    if (argc <= 1) {
+        mkdir(directory.c_str(), 0755);
+        for (const Shape& shape : shapes) {
+            if (!writeModel(shape, directory + "/" + shape.name + ".gguf")) {
+                std::printf("cannot write %s/%s.gguf\n", directory.c_str(), shape.name);
+                return 1;
+            }
+        }
+    }
+    std::vector<std::string> files;
+    if (DIR* listing = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(listing)) {
+            std::string path = directory + "/" + entry->d_name;
+            if (entry->d_name[0] != '.' && isGguf(path)) files.push_back(path);
+        }
+        closedir(listing);
+    }
+    std::sort(files.begin(), files.end());
+    if (files.empty()) {
+        std::printf("no GGUF files in %s\n", directory.c_str());
+        return 1;
+    }
+
+    std::printf("%-44s %9s %9s %8s %9s %9s\n", "file", "size", "header", "tensors", "cold", "warm");
+    double coldTotal = 0;
+    double warmTotal = 0;
+    for (const std::string& path : files) {
+        struct stat status;
+        stat(path.c_str(), &status);
+        GgufInfo info;
+        dropCache(path);
+        double cold = parseSeconds(path, info);
+        double warm = 1e9;
+        for (int pass = 0; pass < 5; ++pass) warm = std::min(warm, parseSeconds(path, info));
+        coldTotal += cold;
+        warmTotal += warm;
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        std::printf("%-44.44s %7.2f GB %6.2f MB %8llu %7.2f ms %7.2f ms\n", name.c_str(), status.st_size / 1e9,
+            info.headerBytes / 1e6, (unsigned long long)info.tensorCount, cold * 1e3, warm * 1e3);
+    }
+    std::printf("%zu files: %.1f ms cold, %.1f ms warm\n", files.size(), coldTotal * 1e3, warmTotal * 1e3);
+    return 0;
+}
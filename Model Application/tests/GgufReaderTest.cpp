@@ -0,0 +1,193 @@
+﻿// GgufReaderTest - synthetic GGUF headers parse to what was written, and every corruption fails cleanly
+#include "Check.h"
+#include "GgufWriter.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+// model() - a small llama shaped header: the usual metadata, a vocabulary and quantized tensors
+static GgufWriter model(size_t vocabulary) {
+    GgufWriter writer;
+    writer.addString("general.architecture", "llama");
+    writer.addString("general.name", "synthetic");
+    writer.addUint32("general.file_type", 15); // Q4_K_M
+    writer.addUint32("llama.context_length", 8192);
+    writer.addUint32("llama.block_count", 2);
+    writer.addUint32("llama.embedding_length", 64);
+    writer.addFloat32("llama.rope.freq_base", 500000.0f);
+    writer.addInt32("llama.rope.dimension_offset", -2);
+    writer.addBool("tokenizer.ggml.add_bos_token", true);
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < vocabulary; ++i) tokens.push_back("tok" + std::to_string(i));
+    writer.addStringArray("tokenizer.ggml.tokens", tokens);
+    writer.addArray("tokenizer.ggml.scores", GgufValue::Float32, vocabulary, 4);
+    writer.addTensor("token_embd.weight", { 64, vocabulary }, 12, 64 * vocabulary); // Q4_K
+    writer.addTensor("blk.0.attn_q.weight", { 64, 64 }, 12, 64 * 64);
+    writer.addTensor("blk.1.attn_q.weight", { 64, 64 }, 12, 64 * 64);
+    writer.addTensor("output_norm.weight", { 64 }, 0, 64 * 4); // F32
+    return writer;
+}
+
+// parses() - parse() of an exact size copy, so a read past the end is a read past the allocation
+static bool parses(const std::vector<uint8_t>& bytes, size_t size, GgufInfo& info, std::string& error) {
+    std::vector<uint8_t> copy(bytes.begin(), bytes.begin() + size);
+    return GgufReader::parse(copy.empty() ? nullptr : copy.data(), copy.size(), info, error);
+}
+
+static bool fails(const std::vector<uint8_t>& bytes) {
+    GgufInfo info;
+    std::string error;
+    bool parsed = parses(bytes, bytes.size(), info, error);
+    CHECK(parsed || !error.empty());
+    return !parsed;
+}
+
+// header() - magic, version, tensor and entry counts, then the given entries
+static std::vector<uint8_t> header(uint64_t tensors, uint64_t entries) {
+    std::vector<uint8_t> bytes;
+    GgufWriter::put(bytes, (uint32_t)0x46554747);
+    GgufWriter::put(bytes, (uint32_t)3);
+    GgufWriter::put(bytes, tensors);
+    GgufWriter::put(bytes, entries);
+    return bytes;
+}
+
+int main() {
+    // round trip
+    GgufWriter writer = model(100);
+    std::vector<uint8_t> bytes = writer.header();
+    {
+        GgufInfo info;
+        std::string error;
+        CHECK(parses(bytes, bytes.size(), info, error));
+        CHECK(info.version == 3);
+        CHECK(info.architecture() == "llama");
+        CHECK(info.text("general.name") == "synthetic");
+        CHECK(GgufReader::fileTypeName(info.number("general.file_type")) == "Q4_K_M");
+        CHECK(info.archNumber("context_length") == 8192);
+        CHECK(info.find("llama.rope.freq_base") && info.find("llama.rope.freq_base")->floatValue == 500000.0);
+        CHECK(info.find("llama.rope.dimension_offset") && info.find("llama.rope.dimension_offset")->signedValue == -2);
+        CHECK(info.text("tokenizer.ggml.add_bos_token") == "true");
+        const GgufValue* tokens = info.find("tokenizer.ggml.tokens");
+        CHECK(tokens && tokens->type == GgufValue::Array && tokens->arrayType == GgufValue::String && tokens->arrayCount == 100);
+        const GgufValue* scores = info.find("tokenizer.ggml.scores");
+        CHECK(scores && scores->arrayType == GgufValue::Float32 && scores->arrayCount == 100);
+        CHECK(info.tensorCount == 4);
+        CHECK(info.parameterCount == 64 * 100 + 64 * 64 * 2 + 64);
+        CHECK(info.tensorTypes[12] == 3 && info.tensorTypes[0] == 1);
+        CHECK(info.headerBytes == bytes.size());
+    }
+
+    // truncated header: every prefix fails, at whichever field it cuts
+    for (size_t size = 0; size < bytes.size(); ++size) {
+        GgufInfo info;
+        std::string error;
+        CHECK(!parses(bytes, size, info, error));
+        CHECK(!error.empty());
+    }
+    {
+        GgufInfo info;
+        std::string error;
+        CHECK(!parses(bytes, 20, info, error) && error == "truncated header");
+    }
+
+    // not GGUF, or a version we do not read
+    {
+        std::vector<uint8_t> copy = bytes;
+        copy[0] = 'X';
+        CHECK(fails(copy));
+        for (uint32_t version : { 1u, 4u }) {
+            copy = bytes;
+            std::memcpy(&copy[4], &version, 4);
+            CHECK(fails(copy));
+        }
+    }
+
+    // oversize array counts: more elements than bytes left, and counts whose byte size overflows 64 bits
+    const uint64_t counts[] = { 1000, 0x4000000000000000ull, 0x8000000000000001ull, ~0ull };
+    for (uint64_t count : counts) {
+        for (uint32_t elementType : { (uint32_t)GgufValue::Uint8, (uint32_t)GgufValue::Float32, (uint32_t)GgufValue::Uint64,
+                                      (uint32_t)GgufValue::String }) {
+            GgufWriter corrupt;
+            std::vector<uint8_t> value;
+            GgufWriter::put(value, elementType);
+            GgufWriter::put(value, count);
+            value.insert(value.end(), 64, 0);
+            corrupt.addRaw("tokenizer.ggml.tokens", GgufValue::Array, value);
+            CHECK(fails(corrupt.header()));
+        }
+    }
+    {
+        // nested arrays and unknown element or value types
+        for (uint32_t type : { (uint32_t)GgufValue::Array, 13u, 0xFFFFFFFFu }) {
+            GgufWriter corrupt;
+            std::vector<uint8_t> value;
+            GgufWriter::put(value, type);
+            GgufWriter::put(value, (uint64_t)1);
+            value.insert(value.end(), 64, 0);
+            corrupt.addRaw("key", GgufValue::Array, value);
+            CHECK(fails(corrupt.header()));
+            GgufWriter unknown;
+            unknown.addRaw("key", type == GgufValue::Array ? 13u : type, std::vector<uint8_t>(64, 0));
+            CHECK(fails(unknown.header()));
+        }
+    }
+
+    // bad string lengths: in a key, a value, an array element and a tensor name
+    const uint64_t lengths[] = { 65, 0x7FFFFFFFFFFFFFFFull, ~0ull };
+    for (uint64_t length : lengths) {
+        std::vector<uint8_t> key = header(0, 1);
+        GgufWriter::put(key, length);
+        key.insert(key.end(), 64, 'k');
+        CHECK(fails(key));
+
+        GgufWriter value;
+        std::vector<uint8_t> text;
+        GgufWriter::put(text, length);
+        text.insert(text.end(), 64, 'v');
+        value.addRaw("general.name", GgufValue::String, text);
+        CHECK(fails(value.header()));
+
+        GgufWriter element;
+        std::vector<uint8_t> array;
+        GgufWriter::put(array, (uint32_t)GgufValue::String);
+        GgufWriter::put(array, (uint64_t)2);
+        GgufWriter::putString(array, "ok");
+        GgufWriter::put(array, length);
+        array.insert(array.end(), 64, 'e');
+        element.addRaw("tokenizer.ggml.tokens", GgufValue::Array, array);
+        CHECK(fails(element.header()));
+
+        std::vector<uint8_t> tensor = header(1, 0);
+        GgufWriter::put(tensor, length);
+        tensor.insert(tensor.end(), 64, 't');
+        CHECK(fails(tensor));
+    }
+
+    // more entries or tensors than the file holds, and a tensor with too many dimensions
+    {
+        std::vector<uint8_t> entries = header(0, ~0ull);
+        CHECK(fails(entries));
+        std::vector<uint8_t> tensors = header(0x1000000000ull, 0);
+        CHECK(fails(tensors));
+        GgufWriter dimensions;
+        dimensions.addTensor("t", std::vector<uint64_t>(9, 1), 0, 4);
+        CHECK(fails(dimensions.header()));
+    }
+
+    // a file as large as a 7B model: only the header is mapped in, the tensor data is a hole
+    {
+        GgufWriter large = model(1000);
+        large.addTensor("blk.0.ffn_down.weight", { 14336, 4096 }, 12, 4400000000ull);
+        std::string path = "GgufReaderTest.gguf";
+        CHECK(large.writeFile(path));
+        GgufInfo info;
+        std::string error;
+        CHECK(GgufReader::parseFile(path, info, error));
+        CHECK(info.tensorCount == 5 && info.architecture() == "llama");
+        std::remove(path.c_str());
+        CHECK(!GgufReader::parseFile(path, info, error) && error == "cannot open " + path);
+    }
+    return CheckResult();
+}
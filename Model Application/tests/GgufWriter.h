@@ -0,0 +1,115 @@
+﻿#pragma once
+#include "GgufReader.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+// GgufWriter - builds synthetic GGUF v3 files for the reader tests and benchmark
+// Metadata and tensor infos are laid out as llama.cpp writes them; tensor data is left as a hole in the file,
+// so a file the size of a real model costs only its header on disk.
+class GgufWriter {
+public:
+    static const uint64_t Alignment = 32; // general.alignment default
+
+    // put() - appends a little endian value, GGUF fields are packed
+    template <typename T>
+    static void put(std::vector<uint8_t>& out, T value) {
+        size_t at = out.size();
+        out.resize(at + sizeof(T));
+        std::memcpy(&out[at], &value, sizeof(T));
+    }
+    static void putString(std::vector<uint8_t>& out, const std::string& text) {
+        put(out, (uint64_t)text.size());
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    void addUint32(const std::string& key, uint32_t value) { entry(key, GgufValue::Uint32); put(entries, value); }
+    void addUint64(const std::string& key, uint64_t value) { entry(key, GgufValue::Uint64); put(entries, value); }
+    void addInt32(const std::string& key, int32_t value) { entry(key, GgufValue::Int32); put(entries, value); }
+    void addFloat32(const std::string& key, float value) { entry(key, GgufValue::Float32); put(entries, value); }
+    void addBool(const std::string& key, bool value) { entry(key, GgufValue::Bool); put(entries, (uint8_t)value); }
+    void addString(const std::string& key, const std::string& value) { entry(key, GgufValue::String); putString(entries, value); }
+
+    // addArray() - count scalars of type, zero filled (scores, token types)
+    void addArray(const std::string& key, GgufValue::Type type, uint64_t count, size_t elementSize) {
+        entry(key, GgufValue::Array);
+        put(entries, (uint32_t)type);
+        put(entries, count);
+        entries.insert(entries.end(), (size_t)(count * elementSize), 0);
+    }
+
+    // addStringArray() - a vocabulary or merge list
+    void addStringArray(const std::string& key, const std::vector<std::string>& values) {
+        entry(key, GgufValue::Array);
+        put(entries, (uint32_t)GgufValue::String);
+        put(entries, (uint64_t)values.size());
+        for (const std::string& value : values) putString(entries, value);
+    }
+
+    // addRaw() - an entry whose value bytes are given as is, for corrupt headers
+    void addRaw(const std::string& key, uint32_t type, const std::vector<uint8_t>& value) {
+        entry(key, type);
+        entries.insert(entries.end(), value.begin(), value.end());
+    }
+
+    // addTensor() - a tensor info, its data placed after the previous tensor's
+    void addTensor(const std::string& name, const std::vector<uint64_t>& shape, uint32_t type, uint64_t dataBytes) {
+        putString(tensors, name);
+        put(tensors, (uint32_t)shape.size());
+        for (uint64_t extent : shape) put(tensors, extent);
+        put(tensors, type);
+        put(tensors, dataOffset);
+        dataOffset += (dataBytes + Alignment - 1) / Alignment * Alignment;
+        tensorCount++;
+    }
+
+    // header() - the bytes GgufReader::parse() reads
+    std::vector<uint8_t> header(uint32_t version = 3) const {
+        std::vector<uint8_t> out;
+        put(out, (uint32_t)0x46554747);
+        put(out, version);
+        put(out, tensorCount);
+        put(out, entryCount);
+        out.insert(out.end(), entries.begin(), entries.end());
+        out.insert(out.end(), tensors.begin(), tensors.end());
+        return out;
+    }
+
+    // dataBytes() - size of the tensor data that follows the aligned header
+    uint64_t dataBytes() const { return dataOffset; }
+
+    // writeFile() - header, alignment padding and the tensor data as a hole
+    bool writeFile(const std::string& path) const {
+        std::vector<uint8_t> bytes = header();
+        bytes.resize((size_t)((bytes.size() + Alignment - 1) / Alignment * Alignment), 0);
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+        if (written && dataOffset > 0) {
+            // seeking past the end and writing the last byte leaves the data unallocated
+#ifdef _WIN32
+            written = _fseeki64(file, (__int64)(dataOffset - 1), SEEK_CUR) == 0 && std::fputc(0, file) == 0;
+#else
+            written = fseeko(file, (off_t)(dataOffset - 1), SEEK_CUR) == 0 && std::fputc(0, file) == 0;
+#endif
+        }
+        return std::fclose(file) == 0 && written;
+    }
+
+private:
+    std::vector<uint8_t> entries;
+    std::vector<uint8_t> tensors;
+    uint64_t entryCount = 0;
+    uint64_t tensorCount = 0;
+    uint64_t dataOffset = 0;
+
+    void entry(const std::string& key, uint32_t type) {
+        putString(entries, key);
+        put(entries, type);
+        entryCount++;
+    }
+};
@@ -0,0 +1,147 @@
+﻿// HttpLoopBench - streams on the HttpLoop event loop against a thread per request, at 10, 100 and 1000 streams
+// A forked stub daemon answers every POST with a chunked NDJSON stream, either paced like a model generating
+// (one token per stream every 10 ms) or as fast as the sockets take it. Each client run is a process of its own,
+// so its peak RSS (VmHWM) and CPU time are its own.
+#include "HttpLoop.h"
+#include "NdjsonParser.h"
+#include "StubDaemon.h"
+#include <condition_variable>
+#include <cstdio>
+
+
+// Run - what one client run measured
+struct Run {
+    int completed = 0;
+    uint64_t tokens = 0;
+    double seconds = 0;
+};
+
+static std::string requestBody() {
+    return "{\"model\":\"llama3:8b\",\"prompt\":\"hello\",\"stream\":true}";
+}
+
+// runLoop() - every stream on the one HttpLoop thread
+static Run runLoop(int port, int streams) {
+    std::mutex mutex;
+    std::condition_variable finished;
+    Run run;
+    int pending = streams;
+    OllamaApi::Endpoint endpoint;
+    endpoint.port = port;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < streams; ++i) {
+        std::shared_ptr<NdjsonParser> parser = std::make_shared<NdjsonParser>();
+        std::shared_ptr<uint64_t> tokens = std::make_shared<uint64_t>(0);
+        HttpLoop::post(endpoint, "/api/generate", requestBody(),
+            [parser, tokens](int, char* data, size_t length) {
+                parser->feed(data, length, [&tokens](const NdjsonParser::Object& object) { if (!object.done) (*tokens)++; });
+            },
+            [&, tokens](const OllamaApi::Result& result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (result.error.empty()) run.completed++;
+                else std::printf("stream failed: %s\n", result.error.c_str());
+                run.tokens += *tokens;
+                if (--pending == 0) finished.notify_one();
+            });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&pending]() { return pending == 0; });
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return run;
+}
+
+// streamBlocking() - one request on a blocking socket, as a thread per request would do it
+static bool streamBlocking(int port, uint64_t& tokens) {
+    SocketHandle socketHandle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((unsigned short)port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    std::string body = requestBody();
+    std::string request = "POST /api/generate HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\nContent-Type: application/json\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    if (connect(socketHandle, (const sockaddr*)&address, sizeof(address)) != 0 || !Net::SendAll(socketHandle, request.data(), request.size())) {
+        Net::Close(socketHandle);
+        return false;
+    }
+    std::string headers;
+    ChunkedDecoder decoder;
+    NdjsonParser parser;
+    char buffer[16384];
+    bool inBody = false;
+    for (ssize_t received; !decoder.done() && (received = recv(socketHandle, buffer, sizeof(buffer), 0)) > 0; ) {
+        char* data = buffer;
+        size_t length = (size_t)received;
+        if (!inBody) {
+            headers.append(data, length);
+            size_t head = headers.find("\r\n\r\n");
+            if (head == std::string::npos) continue;
+            size_t rest = headers.size() - (head + 4);
+            data = buffer + length - rest;
+            length = rest;
+            inBody = true;
+        }
+        decoder.decode(data, length, [&](char* payload, size_t count) {
+            parser.feed(payload, count, [&tokens](const NdjsonParser::Object& object) { if (!object.done) tokens++; });
+        });
+    }
+    Net::Close(socketHandle);
+    return decoder.done();
+}
+
+// runThreads() - a blocked thread per stream
+static Run runThreads(int port, int streams) {
+    Run run;
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < streams; ++i) {
+        threads.emplace_back([&]() {
+            uint64_t tokens = 0;
+            bool completed = streamBlocking(port, tokens);
+            std::lock_guard<std::mutex> lock(mutex);
+            run.completed += completed ? 1 : 0;
+            run.tokens += tokens;
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return run;
+}
+
+int main() {
+    const Scenario scenarios[] = {
+        { "paced, 50 tokens at 10 ms", 50, 10 },
+        { "unpaced, 10000 tokens", 10000, 0 },
+    };
+    const int counts[] = { 10, 100, 1000 };
+    for (const Scenario& scenario : scenarios) {
+        int port = 0;
+        pid_t stub = startStub(scenario, port);
+        if (stub == 0) {
+            std::printf("cannot listen\n");
+            return 1;
+        }
+
+        std::printf("%s\n%-9s %7s %9s %12s %9s %11s\n", scenario.name, "client", "streams", "seconds", "tokens/s", "cpu s", "peak RSS");
+        for (int streams : counts) {
+            for (int threaded = 0; threaded < 2; ++threaded) {
+                fflush(stdout);
+                pid_t client = fork();
+                if (client == 0) {
+                    long baseline = statusKb("VmRSS:");
+                    double cpu = cpuSeconds();
+                    Run run = threaded ? runThreads(port, streams) : runLoop(port, streams);
+                    std::printf("%-9s %7d %9.2f %12.0f %9.2f %8.1f MB%s\n", threaded ? "threads" : "HttpLoop", streams, run.seconds,
+                        run.tokens / run.seconds, cpuSeconds() - cpu, (statusKb("VmHWM:") - baseline) / 1024.0,
+                        run.completed == streams && run.tokens == (uint64_t)streams * scenario.tokens ? "" : "  (incomplete)");
+                    fflush(stdout);
+                    _exit(0);
+                }
+                waitpid(client, nullptr, 0);
+            }
+        }
+        stopStub(stub);
+    }
+    return 0;
+}
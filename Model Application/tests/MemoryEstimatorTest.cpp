@@ -0,0 +1,128 @@
+﻿// MemoryEstimatorTest - the estimator against llama.cpp's reported KV cache sizes, hand-worked weight and graph
+// terms, shapes read from synthetic GGUF headers, and the edges of recommendContext()
+#include "Check.h"
+#include "GgufWriter.h"
+#include "MemoryEstimator.h"
+#include <string>
+#include <vector>
+
+
+static const uint64_t MiB = 1024 * 1024;
+
+// llama3() - llama3:8b as the GGUF header describes it, 4.7 GB of Q4_0 weights
+static ModelShape llama3() {
+    ModelShape shape = MemoryEstimator::knownShape(MemoryEstimator::knownConfigurations()[1]);
+    shape.weightBytes = 4661211808ull;
+    shape.vocabulary = 128256;
+    return shape;
+}
+
+int main() {
+    // every reference row matches the "KV self size" llama.cpp reports, to the MiB
+    for (const MemoryEstimator::KnownConfiguration& known : MemoryEstimator::knownConfigurations()) {
+        uint64_t estimated = MemoryEstimator::kvCacheBytes(MemoryEstimator::knownShape(known), known.numContext, 1);
+        if (estimated != known.kvCacheMiB * MiB) {
+            std::printf("%s: estimated %llu MiB, reported %llu MiB\n", known.model, (unsigned long long)(estimated / MiB),
+                        (unsigned long long)known.kvCacheMiB);
+        }
+        CHECK(estimated == known.kvCacheMiB * MiB);
+    }
+
+    // KV cache: linear in num_ctx and parallel slots, quantized caches per 32 element block
+    {
+        ModelShape shape = llama3();
+        uint64_t one = MemoryEstimator::kvCacheBytes(shape, 8192, 1);
+        CHECK(one == 1024 * MiB);
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 8192, 4) == 4 * one);
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 8192, 0) == one); // no slot count means one slot
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 2048, 1) == one / 4);
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 8192, 1, MemoryEstimator::Q8_0) == one / 2 * 34 / 32);
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 8192, 1, MemoryEstimator::Q4_0) == one / 2 * 18 / 32);
+    }
+
+    // weights are the blob's tensor data, graph is the larger of the attention and logits buffers
+    {
+        ModelShape shape = llama3();
+        MemoryEstimate estimate = MemoryEstimator::estimate(shape, 8192, 512, 1);
+        CHECK(estimate.weights == shape.weightBytes);
+        CHECK(estimate.kvCache == 1024 * MiB);
+        CHECK(estimate.graph == 4ull * 512 * (1 + 4 * 4096 + 8192 * (1 + 32))); // attention: 560 MiB
+        CHECK(estimate.total() == estimate.weights + estimate.kvCache + estimate.graph);
+
+        MemoryEstimate small = MemoryEstimator::estimate(shape, 1024, 512, 1);
+        CHECK(small.graph == 4ull * 512 * (4096 + 128256)); // short context, the logits of the vocabulary are larger
+        CHECK(MemoryEstimator::estimate(shape, 8192, 512, 1).graph == MemoryEstimator::estimate(shape, 8192, 512, 4).graph);
+    }
+
+    // a shape read from a GGUF header: explicit KV heads and key length, or the defaults when they are missing
+    {
+        GgufWriter writer;
+        writer.addString("general.architecture", "llama");
+        writer.addUint32("llama.context_length", 8192);
+        writer.addUint32("llama.block_count", 32);
+        writer.addUint32("llama.embedding_length", 4096);
+        writer.addUint32("llama.attention.head_count", 32);
+        writer.addUint32("llama.attention.head_count_kv", 8);
+        writer.addArray("tokenizer.ggml.tokens", GgufValue::String, 0, 0);
+        std::vector<uint8_t> bytes = writer.header();
+        GgufInfo info;
+        std::string error;
+        CHECK(GgufReader::parse(bytes.data(), bytes.size(), info, error));
+        ModelShape shape = MemoryEstimator::shapeFromGguf(info, 4661211808ull);
+        CHECK(shape.valid());
+        CHECK(shape.architecture == "llama");
+        CHECK(shape.weightBytes == 4661211808ull);
+        CHECK(shape.layers == 32 && shape.heads == 32 && shape.kvHeads == 8);
+        CHECK(shape.keyLength == 128 && shape.valueLength == 128); // embedding / heads
+        CHECK(shape.trainedContext == 8192);
+        CHECK(MemoryEstimator::kvCacheBytes(shape, 8192, 1) == 1024 * MiB);
+
+        GgufWriter noKvHeads;
+        noKvHeads.addString("general.architecture", "llama");
+        noKvHeads.addUint32("llama.block_count", 32);
+        noKvHeads.addUint32("llama.embedding_length", 4096);
+        noKvHeads.addUint32("llama.attention.head_count", 32);
+        noKvHeads.addUint32("llama.attention.key_length", 64);
+        bytes = noKvHeads.header();
+        GgufInfo plain;
+        CHECK(GgufReader::parse(bytes.data(), bytes.size(), plain, error));
+        shape = MemoryEstimator::shapeFromGguf(plain, 0);
+        CHECK(shape.kvHeads == 32); // no grouped-query attention
+        CHECK(shape.keyLength == 64 && shape.valueLength == 128);
+        CHECK(shape.trainedContext == 0);
+
+        GgufWriter empty;
+        empty.addString("general.architecture", "llama");
+        bytes = empty.header();
+        GgufInfo none;
+        CHECK(GgufReader::parse(bytes.data(), bytes.size(), none, error));
+        CHECK(!MemoryEstimator::shapeFromGguf(none, 0).valid());
+    }
+
+    // recommendContext(): the largest multiple of step that fits, 0 when one step does not, never past the trained context
+    {
+        ModelShape shape = llama3();
+        uint64_t oneStep = MemoryEstimator::estimate(shape, 1024, 512, 1).total();
+        CHECK(MemoryEstimator::recommendContext(shape, oneStep - 1, 512, 1) == 0);
+        CHECK(MemoryEstimator::recommendContext(shape, oneStep, 512, 1) == 1024);
+        CHECK(MemoryEstimator::recommendContext(shape, 0, 512, 1) == 0);
+        CHECK(MemoryEstimator::recommendContext(ModelShape(), ~0ull, 512, 1) == 0); // no metadata, no guess
+
+        uint64_t fourSteps = MemoryEstimator::estimate(shape, 4096, 512, 1).total();
+        CHECK(MemoryEstimator::recommendContext(shape, fourSteps, 512, 1) == 4096);
+        CHECK(MemoryEstimator::recommendContext(shape, fourSteps - 1, 512, 1) == 3072);
+        CHECK(MemoryEstimator::recommendContext(shape, fourSteps, 512, 2) < 4096); // a second slot needs its own cache
+        CHECK(MemoryEstimator::recommendContext(shape, fourSteps, 512, 1, MemoryEstimator::Q4_0) > 4096);
+
+        CHECK(MemoryEstimator::recommendContext(shape, ~0ull / 4, 512, 1) == 8192); // capped at the trained context
+        shape.trainedContext = 10000;
+        CHECK(MemoryEstimator::recommendContext(shape, ~0ull / 4, 512, 1) == 9216); // a multiple of step below it
+        shape.trainedContext = 512;
+        CHECK(MemoryEstimator::recommendContext(shape, ~0ull / 4, 512, 1) == 512); // shorter than one step
+        shape.trainedContext = 0;
+        CHECK(MemoryEstimator::recommendContext(shape, ~0ull / 4, 512, 1) == 131072); // unknown, 128K at most
+        CHECK(MemoryEstimator::recommendContext(shape, ~0ull / 4, 512, 1, MemoryEstimator::F16, 4096) == 131072);
+    }
+
+    return CheckResult();
+}
@@ -0,0 +1,77 @@
+﻿// NdjsonParserBench - tokens/s parsing a streamed /api/generate answer, in socket sized reads and one line per read
+#include "NdjsonParser.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+
+// stream() - count token lines as ollama sends them, a few with escapes, then the final object
+static std::string stream(size_t count, std::vector<size_t>& lineEnds) {
+    static const char* tokens[] = { " the", " model", "\\n", " \\\"quoted\\\"", " caf\\u00e9", " of", " tokens", "," };
+    std::string bytes;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += "{\"model\":\"llama3:8b\",\"created_at\":\"2024-05-01T10:00:00.123456789Z\",\"response\":\"";
+        bytes += tokens[i % (sizeof(tokens) / sizeof(tokens[0]))];
+        bytes += "\",\"done\":false}\n";
+        lineEnds.push_back(bytes.size());
+    }
+    bytes += "{\"model\":\"llama3:8b\",\"response\":\"\",\"done\":true,\"total_duration\":5043500667,\"eval_count\":" + std::to_string(count) + "}\n";
+    lineEnds.push_back(bytes.size());
+    return bytes;
+}
+
+// run() - best of five passes; the buffer is restored before each pass since the parser decodes in place
+template <typename Feed>
+static double run(const std::string& bytes, Feed feed) {
+    std::vector<char> buffer(bytes.size());
+    double best = 1e9;
+    for (int pass = 0; pass < 5; ++pass) {
+        std::copy(bytes.begin(), bytes.end(), buffer.begin());
+        auto start = std::chrono::steady_clock::now();
+        feed(buffer.data());
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? (size_t)std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::vector<size_t> lineEnds;
+    std::string bytes = stream(count, lineEnds);
+    size_t objects = 0;
+    size_t text = 0;
+    NdjsonParser::Handler onObject = [&objects, &text](const NdjsonParser::Object& object) {
+        objects++;
+        text += object.text.length;
+    };
+
+    std::printf("%zu tokens, %.1f MB of NDJSON\n", count, bytes.size() / 1e6);
+    const size_t readSizes[] = { 4096, 65536 };
+    for (size_t readSize : readSizes) {
+        double seconds = run(bytes, [&](char* data) {
+            NdjsonParser parser;
+            for (size_t at = 0; at < bytes.size(); at += readSize) {
+                parser.feed(data + at, std::min(readSize, bytes.size() - at), onObject);
+            }
+            parser.finish(onObject);
+        });
+        std::printf("%6zu byte reads:    %7.1f M tokens/s  %7.1f MB/s  %5.1f ns/token\n", readSize,
+            count / seconds / 1e6, bytes.size() / seconds / 1e6, seconds * 1e9 / count);
+    }
+    double seconds = run(bytes, [&](char* data) {
+        NdjsonParser parser;
+        size_t from = 0;
+        for (size_t end : lineEnds) {
+            parser.feed(data + from, end - from, onObject);
+            from = end;
+        }
+        parser.finish(onObject);
+    });
+    std::printf("one line per read:    %7.1f M tokens/s  %7.1f MB/s  %5.1f ns/token\n",
+        count / seconds / 1e6, bytes.size() / seconds / 1e6, seconds * 1e9 / count);
+    std::printf("(%zu objects, %zu text bytes)\n", objects, text);
+    return 0;
+}
@@ -0,0 +1,180 @@
+﻿// NdjsonParserTest - a generated stream fed split at every kind of offset must decode to the same objects
+#include "Check.h"
+#include "NdjsonParser.h"
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+
+// Seen - what the parser reported for one object
+struct Seen {
+    std::string text;
+    std::string error;
+    bool done = false;
+    uint64_t evalCount = 0;
+
+    bool operator==(const Seen& other) const {
+        return text == other.text && error == other.error && done == other.done && evalCount == other.evalCount;
+    }
+};
+
+// Stream - generated NDJSON and the objects it should decode to
+struct Stream {
+    std::string bytes;
+    std::vector<Seen> objects;
+    uint64_t malformed = 0;
+};
+
+// Fragment - a piece of token text and its JSON escaped form
+struct Fragment {
+    const char* text;
+    const char* json;
+};
+
+static const Fragment fragments[] = {
+    { "Hello", "Hello" },
+    { " world", " world" },
+    { "\n", "\\n" },
+    { "\r\n", "\\r\\n" },
+    { "\t", "\\t" },
+    { "\"", "\\\"" },
+    { "\\", "\\\\" },
+    { "/", "\\/" },
+    { "A", "\\u0041" },
+    { "\xC3\xA9", "\\u00e9" },                       // é as an escape
+    { "\xC3\xA9", "\xC3\xA9" },                      // é as raw UTF-8
+    { "\xE2\x82\xAC", "\\u20AC" },                   // €
+    { "\xF0\x9F\x98\x80", "\\ud83d\\ude00" },        // 😀 as a surrogate pair
+    { "{\"nested\": [1, 2]}", "{\\\"nested\\\": [1, 2]}" },
+    { "a long run of plain text that spans several SSE2 blocks", "a long run of plain text that spans several SSE2 blocks" },
+};
+
+// token() - random text of 0-4 fragments, appended to text and json
+static void token(std::mt19937& random, std::string& text, std::string& json) {
+    int count = (int)(random() % 5);
+    for (int i = 0; i < count; ++i) {
+        const Fragment& fragment = fragments[random() % (sizeof(fragments) / sizeof(fragments[0]))];
+        text += fragment.text;
+        json += fragment.json;
+    }
+}
+
+// generate() - lines shaped like /api/generate and /api/chat, with errors, blank lines, CRLF and malformed lines
+static Stream generate(std::mt19937& random, int lines, bool finalNewline) {
+    Stream stream;
+    for (int i = 0; i < lines; ++i) {
+        Seen seen;
+        std::string json;
+        std::string line;
+        switch (random() % 8) {
+        case 0: {
+            token(random, seen.text, json);
+            line = "{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.1234Z\",\"message\":{\"role\":\"assistant\",\"content\":\"" +
+                json + "\",\"images\":null},\"done\":false}";
+            break;
+        }
+        case 1: {
+            seen.error = "model \"x\" not found";
+            line = "{\"error\":\"model \\\"x\\\" not found\"}";
+            break;
+        }
+        case 2: {
+            seen.done = true;
+            seen.evalCount = random() % 100000;
+            line = "{\"model\":\"llama3\",\"response\":\"\",\"done\":true,\"done_reason\":\"stop\",\"context\":[128006,882,128007],"
+                "\"total_duration\":5043500667,\"load_duration\":5025959,\"prompt_eval_count\":26,\"eval_count\":" +
+                std::to_string(seen.evalCount) + ",\"eval_duration\":4.5e3,\"negative\":-1}";
+            break;
+        }
+        case 3: {
+            stream.bytes += random() % 2 ? "\n" : "\r\n"; // blank line, no object
+            line = random() % 2 ? "not json" : "{\"response\":\"cut\",";
+            stream.malformed++;
+            stream.bytes += line + "\n";
+            continue;
+        }
+        default: {
+            token(random, seen.text, json);
+            line = "{\"model\":\"llama3\",\"created_at\":\"2024-05-01T10:00:00.1234Z\",\"response\":\"" + json + "\",\"done\":false}";
+            break;
+        }
+        }
+        stream.objects.push_back(seen);
+        bool last = i + 1 == lines;
+        stream.bytes += line;
+        if (!last || finalNewline) {
+            stream.bytes += random() % 4 == 0 ? "\r\n" : "\n";
+        }
+    }
+    return stream;
+}
+
+// parse() - feeds the stream cut at the given offsets, each read in a buffer of its own as a socket would fill it
+static std::vector<Seen> parse(const std::string& bytes, const std::vector<size_t>& cuts, uint64_t* malformed = nullptr) {
+    NdjsonParser parser;
+    std::vector<Seen> seen;
+    NdjsonParser::Handler onObject = [&seen](const NdjsonParser::Object& object) {
+        Seen current;
+        current.text = object.text.str();
+        current.error = object.error.str();
+        current.done = object.done;
+        current.evalCount = object.evalCount;
+        seen.push_back(current);
+    };
+    size_t from = 0;
+    for (size_t i = 0; i <= cuts.size(); ++i) {
+        size_t to = i < cuts.size() ? cuts[i] : bytes.size();
+        std::vector<char> read(bytes.begin() + from, bytes.begin() + to);
+        parser.feed(read.data(), read.size(), onObject);
+        from = to;
+    }
+    parser.finish(onObject);
+    if (malformed != nullptr) *malformed = parser.malformedLines();
+    return seen;
+}
+
+int main() {
+    // random cuts, including empty reads
+    for (unsigned seed = 1; seed <= 300; ++seed) {
+        std::mt19937 random(seed);
+        Stream stream = generate(random, 40, seed % 2 == 0);
+        std::vector<size_t> cuts;
+        size_t pieces = random() % 24;
+        for (size_t i = 0; i < pieces; ++i) cuts.push_back(random() % (stream.bytes.size() + 1));
+        std::sort(cuts.begin(), cuts.end());
+        uint64_t malformed = 0;
+        CHECK(parse(stream.bytes, cuts, &malformed) == stream.objects);
+        CHECK(malformed == stream.malformed);
+    }
+
+    // reads of 1-64 bytes, like a socket under load
+    for (unsigned seed = 1000; seed < 1100; ++seed) {
+        std::mt19937 random(seed);
+        Stream stream = generate(random, 60, true);
+        std::vector<size_t> cuts;
+        for (size_t at = 1 + random() % 64; at < stream.bytes.size(); at += 1 + random() % 64) cuts.push_back(at);
+        CHECK(parse(stream.bytes, cuts) == stream.objects);
+    }
+
+    // every two-piece split of a short stream, and one byte per read
+    for (unsigned seed = 2000; seed < 2010; ++seed) {
+        std::mt19937 random(seed);
+        Stream stream = generate(random, 12, seed % 2 == 0);
+        for (size_t at = 0; at <= stream.bytes.size(); ++at) {
+            CHECK(parse(stream.bytes, std::vector<size_t>(1, at)) == stream.objects);
+        }
+        std::vector<size_t> bytewise;
+        for (size_t at = 1; at < stream.bytes.size(); ++at) bytewise.push_back(at);
+        CHECK(parse(stream.bytes, bytewise) == stream.objects);
+    }
+
+    // a string or escape cut off by the end of the body is a malformed line, not a crash or a partial object
+    const char* truncated[] = { "{\"response\":\"abc", "{\"response\":\"abc\\", "{\"response\":\"\\u00", "{\"response\":\"x\",\"done\":tr" };
+    for (const char* line : truncated) {
+        uint64_t malformed = 0;
+        CHECK(parse(line, std::vector<size_t>(), &malformed).empty());
+        CHECK(malformed == 1);
+    }
+    return CheckResult();
+}
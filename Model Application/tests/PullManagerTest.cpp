@@ -0,0 +1,169 @@
+﻿// PullManagerTest - pulls from a stub daemon serving fake layers: progress, resume after a dropped connection, errors
+// The stub keeps each blob's progress across connections like the daemon keeps partial downloads, so a retried
+// pull continues where the dropped one stopped instead of starting over.
+#include "Check.h"
+#include "PullManager.h"
+#include "StubDaemon.h"
+#include <cstdlib>
+
+
+// FakeLayer - a blob the stub "downloads"
+struct FakeLayer {
+    std::string digest;
+    uint64_t size;
+};
+
+// PullStub - what the stub serves and what it saw
+struct PullStub {
+    std::vector<FakeLayer> layers;
+    uint64_t step = 256 * 1024;   // bytes per progress line
+    uint64_t dropAfter = 0;       // the first connection is cut once this many bytes were downloaded on it, 0 = never
+    std::mutex mutex;             // guards the fields below, connections are served on their own threads
+    std::map<std::string, uint64_t> downloaded; // per digest, kept across connections
+    std::vector<uint64_t> resumedAt;            // bytes already downloaded when each connection started
+    int connections = 0;
+};
+
+// line() - one response line of /api/pull
+static std::string line(const std::string& json) {
+    return json + "\n";
+}
+
+// servePull() - answers /api/pull like the daemon: manifest, a progress line per step of each layer, success
+static void servePull(PullStub& stub, SocketHandle connection, const std::string& body) {
+    int number;
+    uint64_t already = 0;
+    {
+        std::lock_guard<std::mutex> lock(stub.mutex);
+        number = ++stub.connections;
+        for (const auto& entry : stub.downloaded) already += entry.second;
+        stub.resumedAt.push_back(already);
+    }
+    if (body.find("\"model\":\"missing\"") != std::string::npos) {
+        ThreadedStub::sendText(connection, "HTTP/1.0 200 OK\r\nContent-Type: application/x-ndjson\r\n\r\n" +
+                               line("{\"status\":\"pulling manifest\"}") + line("{\"error\":\"pull model manifest: file does not exist\"}"));
+        return;
+    }
+    if (!ThreadedStub::sendText(connection, "HTTP/1.0 200 OK\r\nContent-Type: application/x-ndjson\r\n\r\n" + line("{\"status\":\"pulling manifest\"}"))) {
+        return;
+    }
+    uint64_t sent = 0;
+    for (const FakeLayer& layer : stub.layers) {
+        for (;;) {
+            uint64_t completed;
+            {
+                std::lock_guard<std::mutex> lock(stub.mutex);
+                uint64_t& done = stub.downloaded[layer.digest];
+                if (number == 1 && stub.dropAfter > 0 && sent >= stub.dropAfter) {
+                    return; // connection dropped mid-blob
+                }
+                uint64_t chunk = std::min(stub.step, layer.size - done);
+                done += chunk;
+                sent += chunk;
+                completed = done;
+            }
+            std::string progress = "{\"status\":\"pulling " + layer.digest.substr(7, 12) + "\",\"digest\":\"" + layer.digest +
+                                   "\",\"total\":" + std::to_string(layer.size) + ",\"completed\":" + std::to_string(completed) + "}";
+            if (!ThreadedStub::sendText(connection, line(progress))) {
+                return;
+            }
+            if (completed == layer.size) {
+                break;
+            }
+        }
+    }
+    ThreadedStub::sendText(connection, line("{\"status\":\"verifying sha256 digest\"}") + line("{\"status\":\"writing manifest\"}") +
+                           line("{\"status\":\"success\"}"));
+}
+
+// waitFor() - polls until the pull of model left the queued/running states, false after seconds
+static bool waitFor(const std::string& model, int seconds) {
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < until) {
+        if (!PullManager::pulling(model)) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return false;
+}
+
+// rowOf() - the Pulls window row of model
+static PullManager::Row rowOf(const std::string& model) {
+    for (const PullManager::Row& row : PullManager::snapshot()) {
+        if (row.model == model) {
+            return row;
+        }
+    }
+    return PullManager::Row();
+}
+
+int main() {
+    PullStub stub;
+    stub.layers.push_back(FakeLayer{ "sha256:6a0746a1ec1aef3e7ec53868f220ff6e389f6f8ef87a01d77c96807de94ca2aa", 4u << 20 });
+    stub.layers.push_back(FakeLayer{ "sha256:4fa551d4f938f68b8c1e6afa9d28befb70e3f33f75d0753248d530364aeea40f", 1u << 20 });
+    stub.dropAfter = 3u << 19; // 1.5 MiB into the first layer
+    ThreadedStub server([&stub](SocketHandle connection, const std::string& head, const std::string& body) {
+        if (head.compare(0, 15, "POST /api/pull ") == 0) {
+            servePull(stub, connection, body);
+        }
+        else {
+            ThreadedStub::sendText(connection, "HTTP/1.0 404 Not Found\r\n\r\n");
+        }
+    });
+    int port = server.start();
+    CHECK(port != 0);
+    setenv("OLLAMA_HOST", ("127.0.0.1:" + std::to_string(port)).c_str(), 1);
+
+    // the first attempt is cut off, the retry resumes the blobs where they were and finishes
+    {
+        PullManager::pull("stub-model");
+        CHECK(PullManager::pulling("stub-model"));
+        CHECK(waitFor("stub-model", 20));
+        PullManager::Row row = rowOf("stub-model");
+        CHECK(row.state == PullManager::Done);
+        CHECK(row.attempts == 2);
+        CHECK(row.layers.size() == 2);
+        CHECK(row.total == (5u << 20));
+        CHECK(row.completed == row.total);
+        CHECK(PullManager::completedPulls() == 1);
+        std::lock_guard<std::mutex> lock(stub.mutex);
+        CHECK(stub.connections == 2);
+        CHECK(stub.resumedAt.size() == 2 && stub.resumedAt[0] == 0);
+        CHECK(stub.resumedAt.size() == 2 && stub.resumedAt[1] == stub.dropAfter); // resumed, nothing downloaded twice
+        CHECK(stub.downloaded[stub.layers[0].digest] == stub.layers[0].size);
+    }
+
+    // a daemon error fails the pull at once, retrying would not help
+    {
+        PullManager::pull("missing");
+        CHECK(waitFor("missing", 10));
+        PullManager::Row row = rowOf("missing");
+        CHECK(row.state == PullManager::Failed);
+        CHECK(row.attempts == 1);
+        CHECK(row.error.find("file does not exist") != std::string::npos);
+        CHECK(PullManager::completedPulls() == 1);
+    }
+
+    // pulling again after success downloads nothing new, the blobs are complete
+    {
+        int connections;
+        {
+            std::lock_guard<std::mutex> lock(stub.mutex);
+            connections = stub.connections;
+        }
+        PullManager::pull("stub-model");
+        CHECK(waitFor("stub-model", 10));
+        CHECK(rowOf("stub-model").state == PullManager::Done);
+        CHECK(PullManager::completedPulls() == 2);
+        std::lock_guard<std::mutex> lock(stub.mutex);
+        CHECK(stub.connections == connections + 1);
+        CHECK(stub.resumedAt.back() == (5u << 20));
+    }
+
+    PullManager::shutdown();
+    ThreadPool::shutdown();
+    server.stop();
+    std::remove("pulls.txt");
+    return CheckResult();
+}
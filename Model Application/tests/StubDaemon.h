@@ -0,0 +1,280 @@
+﻿#pragma once
+// StubDaemon.h - a stand-in for the ollama daemon in the benchmarks and tests, and what they measure of a client process; Linux only
+#include "Net.h"
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+
+// Scenario - what the stub sends on every stream
+struct Scenario {
+    const char* name;
+    int tokens;
+    int intervalMs; // between tokens, 0 = unpaced
+};
+
+// tokenChunk() - one streamed object as a chunk
+static std::string tokenChunk(int index) {
+    std::string line = "{\"model\":\"llama3:8b\",\"created_at\":\"2024-05-01T10:00:00.123456789Z\",\"response\":\" tok" +
+        std::to_string(index) + "\",\"done\":false}\n";
+    char size[16];
+    std::snprintf(size, sizeof(size), "%zx\r\n", line.size());
+    return size + line + "\r\n";
+}
+
+static std::string finalChunk(int tokens) {
+    std::string line = "{\"model\":\"llama3:8b\",\"response\":\"\",\"done\":true,\"eval_count\":" + std::to_string(tokens) + "}\n";
+    char size[16];
+    std::snprintf(size, sizeof(size), "%zx\r\n", line.size());
+    return size + line + "\r\n0\r\n\r\n";
+}
+
+// serveStub() - the stub daemon, one epoll thread; runs in a forked process until killed
+static void serveStub(SocketHandle listener, const Scenario& scenario) {
+    struct Connection {
+        std::string in;
+        std::string out;
+        size_t sent = 0;
+        bool answering = false;
+        int tokens = 0; // sent so far
+    };
+    std::map<int, Connection> connections;
+    int poller = epoll_create1(0);
+    epoll_event added = {};
+    added.events = EPOLLIN;
+    added.data.fd = listener;
+    epoll_ctl(poller, EPOLL_CTL_ADD, listener, &added);
+    std::string unpaced = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\nTransfer-Encoding: chunked\r\n\r\n";
+    for (int i = 0; i < scenario.tokens; ++i) unpaced += tokenChunk(i);
+    unpaced += finalChunk(scenario.tokens);
+
+    // flush() - writes what the socket takes, closes once the stream is complete
+    auto flush = [&](int fd, Connection& connection) {
+        while (connection.sent < connection.out.size()) {
+            ssize_t written = send(fd, connection.out.data() + connection.sent, connection.out.size() - connection.sent, MSG_NOSIGNAL);
+            if (written <= 0) break;
+            connection.sent += written;
+        }
+        if (connection.sent == connection.out.size()) {
+            connection.out.clear();
+            connection.sent = 0;
+            if (connection.tokens > scenario.tokens) {
+                close(fd);
+                connections.erase(fd);
+                return;
+            }
+        }
+        epoll_event changed = {};
+        changed.events = EPOLLIN | (connection.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+        changed.data.fd = fd;
+        epoll_ctl(poller, EPOLL_CTL_MOD, fd, &changed);
+    };
+
+    auto nextTick = std::chrono::steady_clock::now();
+    std::vector<epoll_event> events(1024);
+    for (;;) {
+        int timeout = -1;
+        if (scenario.intervalMs > 0) {
+            timeout = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(nextTick - std::chrono::steady_clock::now()).count());
+        }
+        int count = epoll_wait(poller, events.data(), (int)events.size(), timeout);
+        for (int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == listener) {
+                for (int client; (client = accept(listener, nullptr, nullptr)) >= 0; ) {
+                    fcntl(client, F_SETFL, fcntl(client, F_GETFL, 0) | O_NONBLOCK);
+                    connections[client] = Connection();
+                    epoll_event watched = {};
+                    watched.events = EPOLLIN;
+                    watched.data.fd = client;
+                    epoll_ctl(poller, EPOLL_CTL_ADD, client, &watched);
+                }
+                continue;
+            }
+            auto found = connections.find(fd);
+            if (found == connections.end()) continue;
+            Connection& connection = found->second;
+            if (events[i].events & EPOLLIN) {
+                char buffer[4096];
+                ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+                if (received <= 0) {
+                    close(fd);
+                    connections.erase(found);
+                    continue;
+                }
+                connection.in.append(buffer, received);
+                size_t head = connection.in.find("\r\n\r\n");
+                size_t length = connection.in.find("Content-Length: ");
+                if (!connection.answering && head != std::string::npos && length != std::string::npos &&
+                    connection.in.size() >= head + 4 + std::strtoul(connection.in.c_str() + length + 16, nullptr, 10)) {
+                    connection.answering = true;
+                    if (scenario.intervalMs == 0) {
+                        connection.out = unpaced;
+                        connection.tokens = scenario.tokens + 1;
+                    }
+                    else {
+                        connection.out = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\nTransfer-Encoding: chunked\r\n\r\n";
+                    }
+                }
+            }
+            if (!connection.out.empty()) flush(fd, connection);
+        }
+        if (scenario.intervalMs > 0 && std::chrono::steady_clock::now() >= nextTick) {
+            nextTick += std::chrono::milliseconds(scenario.intervalMs);
+            std::vector<int> streaming;
+            for (auto& entry : connections) {
+                if (entry.second.answering) streaming.push_back(entry.first);
+            }
+            for (int fd : streaming) {
+                Connection& connection = connections[fd];
+                connection.out += connection.tokens < scenario.tokens ? tokenChunk(connection.tokens) : finalChunk(scenario.tokens);
+                connection.tokens++;
+                flush(fd, connection);
+            }
+        }
+    }
+}
+
+// startStub() - forks the stub on a free loopback port, 0 if it could not listen
+static pid_t startStub(const Scenario& scenario, int& port) {
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    socklen_t addressLength = sizeof(address);
+    if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 4096) != 0 ||
+        getsockname(listener, (sockaddr*)&address, &addressLength) != 0) {
+        Net::Close(listener);
+        return 0;
+    }
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+    pid_t stub = fork();
+    if (stub == 0) {
+        serveStub(listener, scenario);
+        _exit(0);
+    }
+    Net::Close(listener);
+    port = ntohs(address.sin_port);
+    return stub;
+}
+
+// stopStub() - ends the forked stub
+static void stopStub(pid_t stub) {
+    kill(stub, SIGKILL);
+    waitpid(stub, nullptr, 0);
+}
+
+// ThreadedStub - a daemon stand-in on threads of the test process, so a test can check what the daemon saw
+// A thread per connection reads one request and hands it to the handler, which writes the whole response
+// (sendText()) and may return early to cut it off; the connection is closed after.
+class ThreadedStub {
+public:
+    typedef std::function<void(SocketHandle connection, const std::string& head, const std::string& body)> Handler;
+
+    explicit ThreadedStub(const Handler& handler) : handler(handler) {}
+    ~ThreadedStub() { stop(); }
+
+    // start() - listens on a free loopback port and returns it, 0 if it could not listen
+    int start() {
+        listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        socklen_t addressLength = sizeof(address);
+        if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0 ||
+            getsockname(listener, (sockaddr*)&address, &addressLength) != 0) {
+            Net::Close(listener);
+            listener = INVALID_SOCKET;
+            return 0;
+        }
+        acceptor = std::thread([this]() {
+            for (int client; (client = accept(listener, nullptr, nullptr)) >= 0; ) {
+                std::lock_guard<std::mutex> lock(mutex);
+                connections.emplace_back([this, client]() { serve(client); });
+            }
+        });
+        return ntohs(address.sin_port);
+    }
+
+    // stop() - stops accepting and waits for the connections being served
+    void stop() {
+        if (listener == INVALID_SOCKET) {
+            return;
+        }
+        shutdown(listener, SHUT_RDWR); // accept() fails, the acceptor ends
+        acceptor.join();
+        Net::Close(listener);
+        listener = INVALID_SOCKET;
+        for (std::thread& connection : connections) {
+            connection.join();
+        }
+        connections.clear();
+    }
+
+    // sendText() - writes text to a connection, false once the client went away
+    static bool sendText(SocketHandle connection, const std::string& text) {
+        return send(connection, text.data(), text.size(), MSG_NOSIGNAL) == (ssize_t)text.size();
+    }
+
+private:
+    Handler handler;
+    SocketHandle listener = INVALID_SOCKET;
+    std::thread acceptor;
+    std::mutex mutex; // guards connections while the acceptor adds to it
+    std::vector<std::thread> connections;
+
+    // serve() - reads the head and a Content-Length body, then answers
+    void serve(SocketHandle client) {
+        std::string in;
+        char buffer[4096];
+        size_t head = std::string::npos;
+        size_t expected = 0;
+        for (;;) {
+            if (head == std::string::npos && (head = in.find("\r\n\r\n")) != std::string::npos) {
+                size_t length = in.find("Content-Length: ");
+                expected = head + 4 + (length != std::string::npos && length < head ? std::strtoul(in.c_str() + length + 16, nullptr, 10) : 0);
+            }
+            if (head != std::string::npos && in.size() >= expected) {
+                break;
+            }
+            ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                Net::Close(client);
+                return;
+            }
+            in.append(buffer, received);
+        }
+        handler(client, in.substr(0, head), in.substr(head + 4));
+        Net::Close(client);
+    }
+};
+
+// statusKb() - a "Vm..." line of /proc/self/status in KiB
+static long statusKb(const char* field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t length = std::strlen(field);
+    while (std::getline(status, line)) {
+        if (line.compare(0, length, field) == 0) return std::strtol(line.c_str() + length + 1, nullptr, 10);
+    }
+    return 0;
+}
+
+static double cpuSeconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
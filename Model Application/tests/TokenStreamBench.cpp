@@ -0,0 +1,124 @@
+﻿// TokenStreamBench - 1000 concurrent generations over the HTTP transport, consumed by coroutines, callbacks or threads
+// Each stream is what ModelClient's HTTP transport builds: an HttpLoop request whose NDJSON text is pushed into a
+// TokenStream. Consumers are coroutines (co_await nextChunk()/finished()), onChunk()/then() callbacks, or a thread
+// per stream blocked in next()/wait(). The forked stub daemon is the one HttpLoopBench uses.
+#include "HttpLoop.h"
+#include "NdjsonParser.h"
+#include "StubDaemon.h"
+#include "TokenStream.h"
+#include <condition_variable>
+#include <cstdio>
+
+
+// Finished - counts streams whose consumer got the result
+struct Finished {
+    std::mutex mutex;
+    std::condition_variable all;
+    int remaining = 0;
+    uint64_t bytes = 0;
+
+    void add(size_t length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        bytes += length;
+        if (--remaining == 0) all.notify_one();
+    }
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        all.wait(lock, [this]() { return remaining == 0; });
+    }
+};
+
+// generate() - one HTTP generation feeding a TokenStream, as ModelClient's HTTP transport does
+static std::shared_ptr<TokenStream> generate(int port) {
+    std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+    std::shared_ptr<NdjsonParser> parser = std::make_shared<NdjsonParser>();
+    OllamaApi::Endpoint endpoint;
+    endpoint.port = port;
+    HttpLoop::RequestId request = HttpLoop::post(endpoint, "/api/generate", "{\"model\":\"llama3:8b\",\"prompt\":\"hello\",\"stream\":true}",
+        [stream, parser](int, char* data, size_t length) {
+            parser->feed(data, length, [&stream](const NdjsonParser::Object& object) {
+                if (!object.text.empty()) stream->push(object.text.str());
+            });
+        },
+        [stream](const OllamaApi::Result& result) {
+            if (!result.error.empty()) std::printf("stream failed: %s\n", result.error.c_str());
+            stream->finish(stream->getText(), !result.error.empty());
+        });
+    stream->onCancel([request]() { HttpLoop::cancel(request); });
+    return stream;
+}
+
+static StreamTask consume(std::shared_ptr<TokenStream> stream, Finished* finished) {
+    size_t length = 0;
+    while (std::optional<std::string> chunk = co_await stream->nextChunk()) {
+        length += chunk->size();
+    }
+    co_await stream->finished();
+    finished->add(length);
+}
+
+int main() {
+    const Scenario scenarios[] = {
+        { "paced, 50 tokens at 10 ms", 50, 10 },
+        { "unpaced, 2000 tokens", 2000, 0 },
+    };
+    const int counts[] = { 100, 1000 };
+    const char* consumers[] = { "coroutines", "callbacks", "threads" };
+    for (const Scenario& scenario : scenarios) {
+        int port = 0;
+        pid_t stub = startStub(scenario, port);
+        if (stub == 0) {
+            std::printf("cannot listen\n");
+            return 1;
+        }
+        std::printf("%s\n%-10s %7s %9s %12s %9s %11s %8s\n", scenario.name, "consumer", "streams", "seconds", "tokens/s", "cpu s",
+            "peak RSS", "threads");
+        for (int streams : counts) {
+            for (int consumer = 0; consumer < 3; ++consumer) {
+                fflush(stdout);
+                pid_t client = fork();
+                if (client == 0) {
+                    long baseline = statusKb("VmRSS:");
+                    double cpu = cpuSeconds();
+                    Finished finished;
+                    finished.remaining = streams;
+                    std::vector<std::thread> threads;
+                    auto start = std::chrono::steady_clock::now();
+                    for (int i = 0; i < streams; ++i) {
+                        std::shared_ptr<TokenStream> stream = generate(port);
+                        if (consumer == 0) {
+                            consume(stream, &finished);
+                        }
+                        else if (consumer == 1) {
+                            std::shared_ptr<size_t> length = std::make_shared<size_t>(0);
+                            stream->onChunk([length](const std::string& chunk) { *length += chunk.size(); });
+                            stream->then([length, &finished](const std::string&) { finished.add(*length); });
+                        }
+                        else {
+                            threads.emplace_back([stream, &finished]() {
+                                size_t length = 0;
+                                std::string chunk;
+                                while (stream->next(chunk)) length += chunk.size();
+                                stream->wait();
+                                finished.add(length);
+                            });
+                        }
+                    }
+                    long peakThreads = statusKb("Threads:"); // every consumer started, none finished yet when paced
+                    finished.wait();
+                    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                    for (std::thread& thread : threads) thread.join();
+                    uint64_t tokens = (uint64_t)streams * scenario.tokens;
+                    bool complete = finished.bytes >= tokens * 4; // every token is " tokN"
+                    std::printf("%-10s %7d %9.2f %12.0f %9.2f %8.1f MB %8ld%s\n", consumers[consumer], streams, seconds, tokens / seconds,
+                        cpuSeconds() - cpu, (statusKb("VmHWM:") - baseline) / 1024.0, peakThreads, complete ? "" : "  (incomplete)");
+                    fflush(stdout);
+                    _exit(0);
+                }
+                waitpid(client, nullptr, 0);
+            }
+        }
+        stopStub(stub);
+    }
+    return 0;
+}
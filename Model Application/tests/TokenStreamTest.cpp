@@ -0,0 +1,126 @@
+﻿// TokenStreamTest - the coroutine interface: chunks in order, completion, cancellation and resumption on the producer
+#include "Check.h"
+#include "TokenStream.h"
+#include <atomic>
+#include <thread>
+
+
+// Consumed - what a consuming coroutine saw
+struct Consumed {
+    std::string text;
+    std::string result;
+    size_t chunks = 0;
+    bool ended = false;
+    std::thread::id resumedOn;
+};
+
+static StreamTask consume(std::shared_ptr<TokenStream> stream, Consumed* consumed) {
+    while (std::optional<std::string> chunk = co_await stream->nextChunk()) {
+        consumed->text += *chunk;
+        consumed->chunks++;
+        consumed->resumedOn = std::this_thread::get_id();
+    }
+    consumed->result = co_await stream->finished();
+    consumed->ended = true;
+}
+
+int main() {
+    // chunks pushed before the coroutine starts are taken at once, later ones resume it
+    {
+        std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+        stream->push("Hello");
+        Consumed consumed;
+        consume(stream, &consumed);
+        CHECK(consumed.text == "Hello" && !consumed.ended);
+        stream->push(", ");
+        stream->push("world");
+        CHECK(consumed.text == "Hello, world" && consumed.chunks == 3);
+        stream->finish("Hello, world!");
+        CHECK(consumed.ended && consumed.result == "Hello, world!");
+        CHECK(stream->status() == TokenStream::Finished);
+    }
+
+    // a stream that already ended hands out its text once and its result without waiting
+    {
+        std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+        stream->push("done");
+        stream->finish("result");
+        Consumed consumed;
+        consume(stream, &consumed);
+        CHECK(consumed.ended && consumed.text == "done" && consumed.result == "result");
+    }
+
+    // the coroutine runs on the producer's thread after its first wait
+    {
+        std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+        Consumed consumed;
+        consume(stream, &consumed);
+        std::thread::id producer;
+        std::thread thread([&]() {
+            producer = std::this_thread::get_id();
+            stream->push("x");
+            stream->finish("x");
+        });
+        thread.join();
+        CHECK(consumed.ended && consumed.resumedOn == producer);
+    }
+
+    // cancel() ends a waiting coroutine: through the request's hook, or right away without one
+    {
+        std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+        bool hooked = false;
+        stream->onCancel([&]() { hooked = true; });
+        Consumed consumed;
+        consume(stream, &consumed);
+        stream->push("partial");
+        stream->cancel();
+        CHECK(hooked && !consumed.ended);
+        stream->finish("partial", true);
+        CHECK(consumed.ended && consumed.result == "partial" && stream->status() == TokenStream::Cancelled);
+
+        std::shared_ptr<TokenStream> unhooked = std::make_shared<TokenStream>();
+        Consumed other;
+        consume(unhooked, &other);
+        unhooked->push("so far");
+        unhooked->cancel();
+        CHECK(other.ended && other.text == "so far" && other.result == "so far");
+    }
+
+    // callbacks and a coroutine on the same stream both see everything
+    {
+        std::shared_ptr<TokenStream> stream = std::make_shared<TokenStream>();
+        std::string seen;
+        stream->onChunk([&seen](const std::string& chunk) { seen += chunk; });
+        Consumed consumed;
+        consume(stream, &consumed);
+        for (int i = 0; i < 100; ++i) stream->push(std::to_string(i));
+        stream->finish(stream->getText());
+        CHECK(consumed.ended && consumed.text == seen && consumed.result == seen);
+    }
+
+    // many producers racing their consumers: no chunk lost, no coroutine left waiting
+    {
+        const int streams = 64;
+        const int chunks = 2000;
+        std::vector<std::shared_ptr<TokenStream>> all;
+        std::vector<Consumed> consumed(streams);
+        for (int i = 0; i < streams; ++i) {
+            all.push_back(std::make_shared<TokenStream>());
+            consume(all.back(), &consumed[i]);
+        }
+        std::vector<std::thread> producers;
+        for (int t = 0; t < 4; ++t) {
+            producers.emplace_back([&, t]() {
+                for (int i = t; i < streams; i += 4) {
+                    for (int c = 0; c < chunks; ++c) all[i]->push("t");
+                    all[i]->finish("end");
+                }
+            });
+        }
+        for (std::thread& producer : producers) producer.join();
+        for (const Consumed& each : consumed) {
+            CHECK(each.ended && each.text.size() == (size_t)chunks && each.result == "end");
+        }
+    }
+    return CheckResult();
+}